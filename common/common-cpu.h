@@ -45,6 +45,7 @@ struct GameModeCPUInfo {
 	int park_or_pin;
 	cpu_set_t *online;
 	cpu_set_t *to_keep;
+	cpu_set_t *siblings; /* SMT siblings of to_keep parked along with core pinning, or NULL */
 };
 
 /* parses a list of cpu cores in the format "a,b-c,d-e,f" */
@@ -34,6 +34,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "common-external.h"
 #include "common-logging.h"
 
+#include <fcntl.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
@@ -113,7 +114,9 @@ int run_external_process(const char *const *exec_args, char buffer[EXTERNAL_BUFF
 	int ret = 0;
 	char internal[EXTERNAL_BUFFER_MAX] = { 0 };
 
-	if (pipe(pipes) == -1) {
+	/* Close on exec, so children forked concurrently from other threads don't hold on to our
+	 * write end and delay the EOF we wait for. dup2 clears the flag on the child's stdout. */
+	if (pipe2(pipes, O_CLOEXEC) == -1) {
 		LOG_ERROR("Could not create pipe: %s!\n", strerror(errno));
 		return -1;
 	}
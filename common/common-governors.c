@@ -95,13 +95,11 @@ int fetch_governors(char governors[MAX_GOVERNORS][MAX_GOVERNOR_LENGTH])
 }
 
 /**
- * Return the current governor state
+ * Return the current governor state, kept in the caller's governor buffer
  */
-const char *get_gov_state(void)
+const char *get_gov_state(char governor[MAX_GOVERNOR_STATE_LENGTH])
 {
-	/* Persistent governor state */
-	static char governor[64] = { 0 };
-	memset(governor, 0, sizeof(governor));
+	memset(governor, 0, MAX_GOVERNOR_STATE_LENGTH);
 
 	/* State for all governors */
 	char governors[MAX_GOVERNORS][MAX_GOVERNOR_LENGTH] = { { 0 } };
@@ -130,7 +128,8 @@ const char *get_gov_state(void)
 			if (fread(contents, 1, (size_t)length, f) > 0) {
 				/* Files have a newline */
 				strtok(contents, "\n");
-				if (strlen(governor) > 0 && strncmp(governor, contents, 64) != 0) {
+				if (strlen(governor) > 0 &&
+				    strncmp(governor, contents, MAX_GOVERNOR_STATE_LENGTH) != 0) {
 					/* Don't handle the mixed case, this shouldn't ever happen
 					 * But it is a clear sign we shouldn't carry on */
 					LOG_ERROR("Governors malformed: got \"%s\", expected \"%s\"",
@@ -140,7 +139,7 @@ const char *get_gov_state(void)
 					return "malformed";
 				}
 
-				strncpy(governor, contents, sizeof(governor) - 1);
+				strncpy(governor, contents, MAX_GOVERNOR_STATE_LENGTH - 1);
 			} else {
 				LOG_ERROR("Failed to read contents of %s\n", gov);
 			}
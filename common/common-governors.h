@@ -35,6 +35,7 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #define MAX_GOVERNORS 128
 #define MAX_GOVERNOR_LENGTH PATH_MAX + 1
+#define MAX_GOVERNOR_STATE_LENGTH 64
 
 /**
  * Grab all of the governors
@@ -42,6 +43,6 @@ POSSIBILITY OF SUCH DAMAGE.
 int fetch_governors(char governors[MAX_GOVERNORS][MAX_GOVERNOR_LENGTH]);
 
 /**
- * Get the current governor state
+ * Get the current governor state, filling in governor
  */
-const char *get_gov_state(void);
+const char *get_gov_state(char governor[MAX_GOVERNOR_STATE_LENGTH]);
@@ -48,13 +48,11 @@ int profile_exists(void)
 }
 
 /**
- * Return the current platform profile state
+ * Return the current platform profile state, kept in the caller's profile buffer
  */
-const char *get_profile_state(void)
+const char *get_profile_state(char profile[MAX_PROFILE_LENGTH])
 {
-	/* Persistent profile state */
-	static char profile[64] = { 0 };
-	memset(profile, 0, sizeof(profile));
+	memset(profile, 0, MAX_PROFILE_LENGTH);
 
 	FILE *f = fopen(profile_path, "r");
 	if (!f) {
@@ -74,7 +72,7 @@ const char *get_profile_state(void)
 
 		if (fread(contents, 1, (size_t)length, f) > 0) {
 			strtok(contents, "\n");
-			strncpy(profile, contents, sizeof(profile) - 1);
+			strncpy(profile, contents, MAX_PROFILE_LENGTH - 1);
 		} else {
 			LOG_ERROR("Failed to read contents of %s\n", profile_path);
 		}
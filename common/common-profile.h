@@ -34,6 +34,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <linux/limits.h>
 #include <unistd.h>
 
+#define MAX_PROFILE_LENGTH 64
+
 /**
  * Path for platform profile
  */
@@ -45,6 +47,6 @@ extern const char *profile_path;
 int profile_exists(void);
 
 /**
- * Get the current platform profile state
+ * Get the current platform profile state, filling in profile
  */
-const char *get_profile_state(void);
+const char *get_profile_state(char profile[MAX_PROFILE_LENGTH]);
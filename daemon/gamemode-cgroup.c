@@ -0,0 +1,753 @@
+/*
+
+Copyright (c) 2017-2025, Feral Interactive and the GameMode contributors
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+ * Neither the name of Feral Interactive nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+#define _GNU_SOURCE
+
+#include "common-helpers.h"
+#include "common-logging.h"
+
+#include "gamemode.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Leaf the daemon's own processes move to, so its cgroup can hand controllers down */
+#define CGROUP_DAEMON_LEAF "gamemoded"
+
+/**
+ * The games moved into cgroups of their own, below the cgroup the daemon was started in
+ *
+ * Every game gets a game-<pid> cgroup with its settings, which the kernel applies to all its
+ * threads and every process it starts from then on. Leaving moves what is left in there back
+ * to the cgroup the game came from.
+ */
+struct GameModeCgroups {
+	char mount[PATH_MAX]; /**<Where the unified hierarchy is mounted */
+	char root[PATH_MAX];  /**<The delegated cgroup of the daemon */
+	unsigned int controllers; /**<GameModeCgroupApplied of the controllers enabled below root */
+	GameModePidTable *games;  /**<Original cgroup path of each game, keyed by pid */
+};
+
+static const struct {
+	const char *name;
+	unsigned int applied;
+} cgroup_controllers[] = {
+	{ "cpu", GAME_MODE_CGROUP_CPU },
+	{ "io", GAME_MODE_CGROUP_IO },
+	{ "memory", GAME_MODE_CGROUP_MEMORY },
+	{ "cpuset", GAME_MODE_CGROUP_CPUSET },
+};
+
+/* Write a value to a cgroup file, one write per value as cgroupfs expects */
+static int cgroup_write(const char *dir, const char *file, const char *value)
+{
+	char buffer[PATH_MAX];
+	const char *path = buffered_snprintf(buffer, "%s/%s", dir, file);
+	if (!path)
+		return -ENAMETOOLONG;
+
+	int fd = open(path, O_WRONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	ssize_t len = (ssize_t)strlen(value);
+	int r = write(fd, value, (size_t)len) == len ? 0 : -errno;
+	close(fd);
+	return r;
+}
+
+static int cgroup_write_pid(const char *dir, pid_t pid)
+{
+	char value[32];
+	snprintf(value, sizeof(value), "%d", pid);
+	return cgroup_write(dir, "cgroup.procs", value);
+}
+
+/* Move every process of one cgroup into another, processes that exited meanwhile are skipped */
+static int cgroup_move_procs(const char *from, const char *to)
+{
+	char buffer[PATH_MAX];
+	const char *path = buffered_snprintf(buffer, "%s/cgroup.procs", from);
+	if (!path)
+		return -ENAMETOOLONG;
+
+	FILE *f = fopen(path, "re");
+	if (!f)
+		return -errno;
+
+	int ret = 0;
+	int pid;
+	while (fscanf(f, "%d", &pid) == 1) {
+		int r = cgroup_write_pid(to, pid);
+		if (r < 0 && r != -ESRCH)
+			ret = r;
+	}
+	fclose(f);
+	return ret;
+}
+
+/* The path of the cgroup a process is in, below the mount point */
+static int cgroup_of_process(pid_t pid, char cgroup[PATH_MAX])
+{
+	char buffer[PATH_MAX];
+	const char *path = buffered_snprintf(buffer, "/proc/%d/cgroup", pid);
+	if (!path)
+		return -ENAMETOOLONG;
+
+	FILE *f = fopen(path, "re");
+	if (!f)
+		return -errno;
+
+	/* Only the unified hierarchy has the 0:: entry */
+	int ret = -ENOENT;
+	char line[PATH_MAX + 4];
+	while (fgets(line, sizeof(line), f)) {
+		if (strncmp(line, "0::", 3) != 0)
+			continue;
+
+		line[strcspn(line, "\n")] = '\0';
+		strncpy(cgroup, line + 3, PATH_MAX - 1);
+		cgroup[PATH_MAX - 1] = '\0';
+		ret = 0;
+		break;
+	}
+	fclose(f);
+	return ret;
+}
+
+/**
+ * Set up the daemon's cgroup for holding the games
+ *
+ * @param mount Where cgroup2 is mounted, NULL for /sys/fs/cgroup
+ * @returns NULL if cgroup v2 is not in use or the daemon may not manage its cgroup
+ */
+GameModeCgroups *game_mode_cgroups_new(const char *mount)
+{
+	GameModeCgroups *cgroups = calloc(1, sizeof(GameModeCgroups));
+	if (!cgroups)
+		return NULL;
+
+	strncpy(cgroups->mount, mount ? mount : "/sys/fs/cgroup", sizeof(cgroups->mount) - 1);
+
+	char own[PATH_MAX];
+	char buffer[PATH_MAX];
+	const char *controllers = buffered_snprintf(buffer, "%s/cgroup.controllers", cgroups->mount);
+	if (!controllers || access(controllers, F_OK) != 0 || cgroup_of_process(getpid(), own) != 0) {
+		LOG_ERROR("cgroup v2 is not available at %s, not using cgroups\n", cgroups->mount);
+		goto error;
+	}
+
+	const char *relative = strcmp(own, "/") == 0 ? "" : own;
+	if (snprintf(cgroups->root, sizeof(cgroups->root), "%s%s", cgroups->mount, relative) >=
+	    (int)sizeof(cgroups->root))
+		goto error;
+
+	/* A cgroup with processes in it can not enable controllers for its children */
+	char leaf_buffer[PATH_MAX];
+	const char *leaf = buffered_snprintf(leaf_buffer, "%s/" CGROUP_DAEMON_LEAF, cgroups->root);
+	if (!leaf)
+		goto error;
+
+	if (mkdir(leaf, 0755) != 0 && errno != EEXIST) {
+		LOG_HINTED(ERROR,
+		           "Failed to create cgroups below %s, not using cgroups: %s\n",
+		           "    -- The daemon has to run in a cgroup delegated to it, as with\n"
+		           "    -- Delegate= in gamemoded.service.\n",
+		           cgroups->root,
+		           strerror(errno));
+		goto error;
+	}
+
+	int r = cgroup_move_procs(cgroups->root, leaf);
+	if (r < 0) {
+		LOG_ERROR("Failed to move the daemon into %s: %s\n", leaf, strerror(-r));
+		goto error;
+	}
+
+	/* Hand down what is available, games still get the rest of their settings without some */
+	char available[256] = { 0 };
+	const char *delegated = buffered_snprintf(buffer, "%s/cgroup.controllers", cgroups->root);
+	FILE *f = delegated ? fopen(delegated, "re") : NULL;
+	if (f) {
+		if (!fgets(available, sizeof(available), f))
+			available[0] = '\0';
+		fclose(f);
+	}
+
+	for (size_t i = 0; i < sizeof(cgroup_controllers) / sizeof(cgroup_controllers[0]); i++) {
+		char enable[16];
+		snprintf(enable, sizeof(enable), "+%s", cgroup_controllers[i].name);
+
+		/* Match whole words, "cpu" is a prefix of "cpuset" */
+		bool found = false;
+		for (char *s = available; (s = strstr(s, cgroup_controllers[i].name)); s++) {
+			size_t len = strlen(cgroup_controllers[i].name);
+			if ((s == available || s[-1] == ' ') &&
+			    (s[len] == ' ' || s[len] == '\n' || s[len] == '\0')) {
+				found = true;
+				break;
+			}
+		}
+
+		if (found && cgroup_write(cgroups->root, "cgroup.subtree_control", enable) == 0)
+			cgroups->controllers |= cgroup_controllers[i].applied;
+		else
+			LOG_MSG("The %s cgroup controller is not available for games\n",
+			        cgroup_controllers[i].name);
+	}
+
+	cgroups->games = game_mode_pidtable_new();
+	if (!cgroups->games)
+		goto error;
+
+	LOG_MSG("Moving games into cgroups below %s\n", cgroups->root);
+	return cgroups;
+
+error:
+	free(cgroups);
+	return NULL;
+}
+
+/**
+ * Free the cgroup state, the games have to be removed first
+ */
+void game_mode_cgroups_free(GameModeCgroups *cgroups)
+{
+	if (!cgroups)
+		return;
+
+	size_t iter = 0;
+	void *original = NULL;
+	while (game_mode_pidtable_next(cgroups->games, &iter, NULL, &original))
+		free(original);
+
+	game_mode_pidtable_free(cgroups->games);
+	free(cgroups);
+}
+
+/**
+ * Move a game into a cgroup of its own with the given settings
+ *
+ * @returns a mask of GameModeCgroupApplied, or a negative errno value if the game could not be
+ *          moved
+ */
+int game_mode_cgroups_add(GameModeCgroups *cgroups, pid_t pid,
+                          const GameModeCgroupSettings *settings)
+{
+	if (game_mode_pidtable_lookup(cgroups->games, pid))
+		return -EEXIST;
+
+	char original[PATH_MAX];
+	int r = cgroup_of_process(pid, original);
+	if (r < 0)
+		return r;
+
+	char buffer[PATH_MAX];
+	const char *dir = buffered_snprintf(buffer, "%s/game-%d", cgroups->root, pid);
+	if (!dir)
+		return -ENAMETOOLONG;
+
+	char *original_path = NULL;
+	if (asprintf(&original_path, "%s%s", cgroups->mount, original) < 0)
+		return -ENOMEM;
+
+	if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+		r = -errno;
+		free(original_path);
+		return r;
+	}
+
+	/* Settings first, so the game never runs in its cgroup without them */
+	unsigned int applied = GAME_MODE_CGROUP_MOVED;
+	char value[64];
+	if (settings->cpu_weight > 0 && (cgroups->controllers & GAME_MODE_CGROUP_CPU)) {
+		snprintf(value, sizeof(value), "%ld", settings->cpu_weight);
+		if (cgroup_write(dir, "cpu.weight", value) == 0)
+			applied |= GAME_MODE_CGROUP_CPU;
+	}
+	if (settings->io_weight > 0 && (cgroups->controllers & GAME_MODE_CGROUP_IO)) {
+		snprintf(value, sizeof(value), "default %ld", settings->io_weight);
+		if (cgroup_write(dir, "io.weight", value) == 0)
+			applied |= GAME_MODE_CGROUP_IO;
+	}
+	if (settings->memory_low && settings->memory_low[0] != '\0' &&
+	    (cgroups->controllers & GAME_MODE_CGROUP_MEMORY)) {
+		if (cgroup_write(dir, "memory.low", settings->memory_low) == 0)
+			applied |= GAME_MODE_CGROUP_MEMORY;
+		else
+			LOG_ONCE(ERROR, "Invalid memory_low '%s', ignoring\n", settings->memory_low);
+	}
+	if (settings->cpus && settings->cpus[0] != '\0' &&
+	    (cgroups->controllers & GAME_MODE_CGROUP_CPUSET)) {
+		if (cgroup_write(dir, "cpuset.cpus", settings->cpus) == 0)
+			applied |= GAME_MODE_CGROUP_CPUSET;
+	}
+
+	r = cgroup_write_pid(dir, pid);
+	if (r == 0)
+		r = game_mode_pidtable_insert(cgroups->games, pid, original_path);
+	if (r < 0) {
+		free(original_path);
+		rmdir(dir);
+		return r;
+	}
+
+	return (int)applied;
+}
+
+/**
+ * Move another process into the cgroup of a game, for processes it started before it was moved
+ */
+int game_mode_cgroups_add_process(GameModeCgroups *cgroups, pid_t game, pid_t pid)
+{
+	if (!game_mode_pidtable_lookup(cgroups->games, game))
+		return -ENOENT;
+
+	char buffer[PATH_MAX];
+	const char *dir = buffered_snprintf(buffer, "%s/game-%d", cgroups->root, game);
+	if (!dir)
+		return -ENAMETOOLONG;
+
+	return cgroup_write_pid(dir, pid);
+}
+
+/**
+ * Move the processes left in the cgroup of a game back to the cgroup the game came from, and
+ * remove its cgroup
+ */
+int game_mode_cgroups_remove(GameModeCgroups *cgroups, pid_t pid)
+{
+	char *original = game_mode_pidtable_remove(cgroups->games, pid);
+	if (!original)
+		return -ENOENT;
+
+	char buffer[PATH_MAX];
+	char procs_buffer[PATH_MAX];
+	const char *dir = buffered_snprintf(buffer, "%s/game-%d", cgroups->root, pid);
+	const char *procs =
+	    buffered_snprintf(procs_buffer, "%s/game-%d/cgroup.procs", cgroups->root, pid);
+	int r = -ENAMETOOLONG;
+	if (dir && procs) {
+		/* The original cgroup may be gone, the game stays where it is then. Nothing is left
+		 * to move when the game's cgroup has no processes file any more */
+		r = cgroup_move_procs(dir, original);
+		if (r == -ENOENT && access(procs, F_OK) != 0)
+			r = 0;
+		if (r == 0 && rmdir(dir) != 0 && errno != ENOENT)
+			r = -errno;
+	}
+
+	free(original);
+	return r;
+}
+
+/**
+ * The cgroups of other work throttled while in game mode, with the values to restore
+ */
+struct GameModeThrottle {
+	size_t count;
+	struct GameModeThrottledFile {
+		char *path;      /**<The cpu.weight, io.weight or cpuset.cpus file */
+		char value[256]; /**<What it held before, with the newline */
+	} *files;
+	GameModeThrottle *previous; /**<The throttle being replaced, only while throttling again */
+};
+
+/* Take a file over from the throttle being replaced, true when it was throttled there */
+static bool throttle_carry(GameModeThrottle *throttle, const char *path)
+{
+	GameModeThrottle *previous = throttle->previous;
+	for (size_t i = 0; previous && i < previous->count; i++) {
+		if (!previous->files[i].path || strcmp(previous->files[i].path, path) != 0)
+			continue;
+
+		struct GameModeThrottledFile *files =
+		    realloc(throttle->files, (throttle->count + 1) * sizeof(*files));
+		if (!files)
+			return false;
+		throttle->files = files;
+		throttle->files[throttle->count++] = previous->files[i];
+		previous->files[i].path = NULL;
+		return true;
+	}
+	return false;
+}
+
+/* Read the value of a cgroup file, false when there is none or it is too long */
+static bool throttle_read(const char *path, char value[256])
+{
+	/* No file when the parent does not hand the controller down */
+	FILE *f = fopen(path, "re");
+	if (!f)
+		return false;
+	bool read = fgets(value, 256, f) != NULL;
+	fclose(f);
+
+	return read && strchr(value, '\n');
+}
+
+/* Write a cgroup file, recording what it held before */
+static void throttle_write(GameModeThrottle *throttle, const char *dir, const char *file,
+                           const char *path, const char *previous, const char *target)
+{
+	struct GameModeThrottledFile *files =
+	    realloc(throttle->files, (throttle->count + 1) * sizeof(*files));
+	if (!files)
+		return;
+	throttle->files = files;
+
+	if (cgroup_write(dir, file, target) != 0)
+		return;
+
+	struct GameModeThrottledFile *entry = &throttle->files[throttle->count];
+	entry->path = strdup(path);
+	if (!entry->path) {
+		cgroup_write(dir, file, previous);
+		return;
+	}
+	strcpy(entry->value, previous);
+	throttle->count++;
+}
+
+/* Lower a weight file of a cgroup, unless it is lower already */
+static void throttle_file(GameModeThrottle *throttle, const char *dir, const char *file,
+                          const char *prefix, long weight)
+{
+	char buffer[PATH_MAX];
+	const char *path = buffered_snprintf(buffer, "%s/%s", dir, file);
+	char value[256];
+	if (!path || throttle_carry(throttle, path) || !throttle_read(path, value))
+		return;
+
+	size_t len = strlen(prefix);
+	if (strncmp(value, prefix, len) != 0 || strtol(value + len, NULL, 10) <= weight)
+		return;
+
+	char target[64];
+	snprintf(target, sizeof(target), "%s%ld", prefix, weight);
+	throttle_write(throttle, dir, file, path, value, target);
+}
+
+/* Keep a cgroup to a list of cores, an empty cpuset.cpus means all of its parent's */
+static void throttle_cpus(GameModeThrottle *throttle, const char *dir, const char *cpus)
+{
+	char buffer[PATH_MAX];
+	const char *path = buffered_snprintf(buffer, "%s/cpuset.cpus", dir);
+	char value[256];
+	if (!path || throttle_carry(throttle, path) || !throttle_read(path, value))
+		return;
+
+	if (strncmp(value, cpus, strlen(cpus)) == 0 && value[strlen(cpus)] == '\n')
+		return;
+
+	throttle_write(throttle, dir, "cpuset.cpus", path, value, cpus);
+}
+
+/* Whether a cgroup is one of the kept ones or contains one of them */
+static bool cgroup_holds_kept(const char *cgroup, char *const *kept, size_t num_kept)
+{
+	size_t len = strlen(cgroup);
+	for (size_t i = 0; i < num_kept; i++) {
+		if (strncmp(kept[i], cgroup, len) == 0 && (kept[i][len] == '\0' || kept[i][len] == '/'))
+			return true;
+	}
+	return false;
+}
+
+static bool cgroup_is_kept(const char *cgroup, char *const *kept, size_t num_kept)
+{
+	for (size_t i = 0; i < num_kept; i++) {
+		if (strcmp(kept[i], cgroup) == 0)
+			return true;
+	}
+	return false;
+}
+
+static void throttle_below(GameModeThrottle *throttle, const char *dir, char *const *kept,
+                           size_t num_kept, const GameModeCgroupSettings *settings);
+
+/* Throttle a cgroup, or the cgroups below it when it holds a kept cgroup */
+static void throttle_cgroup(GameModeThrottle *throttle, const char *cgroup, char *const *kept,
+                            size_t num_kept, const GameModeCgroupSettings *settings)
+{
+	if (cgroup_is_kept(cgroup, kept, num_kept))
+		return;
+
+	if (cgroup_holds_kept(cgroup, kept, num_kept)) {
+		throttle_below(throttle, cgroup, kept, num_kept, settings);
+		return;
+	}
+
+	if (settings->cpu_weight > 0)
+		throttle_file(throttle, cgroup, "cpu.weight", "", settings->cpu_weight);
+	if (settings->io_weight > 0)
+		throttle_file(throttle, cgroup, "io.weight", "default ", settings->io_weight);
+	if (settings->cpus && settings->cpus[0] != '\0')
+		throttle_cpus(throttle, cgroup, settings->cpus);
+}
+
+/* Throttle the child cgroups of dir */
+static void throttle_below(GameModeThrottle *throttle, const char *dir, char *const *kept,
+                           size_t num_kept, const GameModeCgroupSettings *settings)
+{
+	DIR *d = opendir(dir);
+	if (!d)
+		return;
+
+	struct dirent *entry;
+	while ((entry = readdir(d))) {
+		if (entry->d_type != DT_DIR || entry->d_name[0] == '.')
+			continue;
+
+		char buffer[PATH_MAX];
+		const char *child = buffered_snprintf(buffer, "%s/%s", dir, entry->d_name);
+		if (child)
+			throttle_cgroup(throttle, child, kept, num_kept, settings);
+	}
+
+	closedir(d);
+}
+
+/* The cgroups of the games and the daemon, which may hold the games' cgroups */
+static char **kept_cgroups(const char *mount, const pid_t *games, size_t num_games,
+                           size_t *num_kept)
+{
+	char **kept = calloc(num_games + 1, sizeof(char *));
+	if (!kept)
+		return NULL;
+
+	*num_kept = 0;
+	for (size_t i = 0; i <= num_games; i++) {
+		char cgroup[PATH_MAX];
+		if (cgroup_of_process(i < num_games ? games[i] : getpid(), cgroup) == 0 &&
+		    asprintf(&kept[*num_kept], "%s%s", mount, cgroup) >= 0)
+			(*num_kept)++;
+	}
+	return kept;
+}
+
+static void free_kept(char **kept, size_t num_kept)
+{
+	for (size_t i = 0; kept && i < num_kept; i++)
+		free(kept[i]);
+	free(kept);
+}
+
+/* The cgroup of the user manager the daemon runs under, false when there is none */
+static bool user_manager_cgroup(char cgroup[PATH_MAX])
+{
+	char *manager = NULL;
+	if (cgroup_of_process(getpid(), cgroup) != 0 || !(manager = strstr(cgroup, "/user@")))
+		return false;
+
+	char *end = strchr(manager + 1, '/');
+	if (end)
+		*end = '\0';
+	return true;
+}
+
+/**
+ * The slices of the user manager holding applications and background work. session.slice is left
+ * alone, it holds the compositor and the sound server the games depend on
+ */
+static const char *const throttled_slices[] = { "app.slice", "background.slice" };
+
+/**
+ * Lower the weights of the cgroups of the applications and background work running under the
+ * user's systemd manager, and keep them to a list of cores, leaving the games and the daemon as
+ * they are
+ *
+ * @param mount Where cgroup2 is mounted, NULL for /sys/fs/cgroup
+ * @returns the throttle to undo with game_mode_unthrottle_others, or NULL if there is no user
+ *          manager to throttle below
+ */
+GameModeThrottle *game_mode_throttle_others(const char *mount, const pid_t *games,
+                                            size_t num_games,
+                                            const GameModeCgroupSettings *settings)
+{
+	return game_mode_rethrottle_others(NULL, mount, games, num_games, settings);
+}
+
+/**
+ * Throttle other work again after games came or went, or new cgroups appeared. Only the cgroups
+ * to throttle that were not throttled before are written, and the ones that are no longer to be
+ * throttled are restored. The settings have to be the ones throttle was made with
+ *
+ * @param throttle What game_mode_throttle_others returned before, used up, NULL for nothing
+ * @returns the throttle replacing it, as with game_mode_throttle_others
+ */
+GameModeThrottle *game_mode_rethrottle_others(GameModeThrottle *throttle, const char *mount,
+                                              const pid_t *games, size_t num_games,
+                                              const GameModeCgroupSettings *settings)
+{
+	if (!mount)
+		mount = "/sys/fs/cgroup";
+
+	/* The user manager's cgroup holds the slices of the user's session */
+	char own[PATH_MAX];
+	if (!user_manager_cgroup(own)) {
+		LOG_ONCE(ERROR, "Not running below a systemd user manager, not throttling other work\n");
+		game_mode_unthrottle_others(throttle);
+		return NULL;
+	}
+
+	char root_buffer[PATH_MAX];
+	const char *root = buffered_snprintf(root_buffer, "%s%s", mount, own);
+	GameModeThrottle *next = calloc(1, sizeof(GameModeThrottle));
+	size_t num_kept = 0;
+	char **kept = kept_cgroups(mount, games, num_games, &num_kept);
+	if (!root || !next || !kept) {
+		free(next);
+		free_kept(kept, num_kept);
+		game_mode_unthrottle_others(throttle);
+		return NULL;
+	}
+
+	next->previous = throttle;
+	for (size_t i = 0; i < sizeof(throttled_slices) / sizeof(throttled_slices[0]); i++) {
+		char buffer[PATH_MAX];
+		const char *slice = buffered_snprintf(buffer, "%s/%s", root, throttled_slices[i]);
+		if (slice)
+			throttle_cgroup(next, slice, kept, num_kept, settings);
+	}
+	next->previous = NULL;
+	LOG_MSG("Throttled %zu cgroup settings of other work below %s\n", next->count, root);
+
+	/* What is left over holds games now, or went away */
+	game_mode_unthrottle_others(throttle);
+	free_kept(kept, num_kept);
+
+	return next;
+}
+
+/**
+ * List the user's login sessions, the cgroups next to the user manager's in the user's own
+ * user-$UID.slice. Only root may change their settings, the privileged helper takes no cgroups
+ * outside that slice. Sessions holding one of the games are left out
+ *
+ * @param mount Where cgroup2 is mounted, NULL for /sys/fs/cgroup
+ * @returns a NULL terminated list of their directories, to free along with each entry, or NULL if
+ *          there is no user manager in the user's slice
+ */
+char **game_mode_cgroups_login_sessions(const char *mount, const pid_t *games, size_t num_games)
+{
+	if (!mount)
+		mount = "/sys/fs/cgroup";
+
+	char own[PATH_MAX];
+	char slice[PATH_MAX];
+	if (!user_manager_cgroup(own))
+		return NULL;
+
+	/* The user manager runs right below the user's slice */
+	char *manager = strrchr(own, '/');
+	snprintf(slice, sizeof(slice), "/user.slice/user-%u.slice", (unsigned int)getuid());
+	if ((size_t)(manager - own) != strlen(slice) || strncmp(own, slice, strlen(slice)) != 0) {
+		LOG_ONCE(ERROR, "The user manager is not in %s, leaving the login sessions alone\n", slice);
+		return NULL;
+	}
+
+	size_t count = 0;
+	size_t num_kept = 0;
+	char **kept = kept_cgroups(mount, games, num_games, &num_kept);
+	char **cgroups = calloc(1, sizeof(char *));
+	char dir_buffer[PATH_MAX];
+	const char *dir = buffered_snprintf(dir_buffer, "%s%s", mount, slice);
+	DIR *d = dir ? opendir(dir) : NULL;
+	if (!kept || !cgroups || !d) {
+		free_kept(kept, num_kept);
+		free(cgroups);
+		if (d)
+			closedir(d);
+		return NULL;
+	}
+
+	struct dirent *entry;
+	while ((entry = readdir(d))) {
+		if (entry->d_type != DT_DIR || entry->d_name[0] == '.' ||
+		    strcmp(entry->d_name, manager + 1) == 0)
+			continue;
+
+		char **grown = realloc(cgroups, (count + 2) * sizeof(char *));
+		if (!grown)
+			break;
+		cgroups = grown;
+		if (asprintf(&cgroups[count], "%s/%s", dir, entry->d_name) < 0)
+			continue;
+
+		/* A game started from a login session rather than below the user manager */
+		if (cgroup_holds_kept(cgroups[count], kept, num_kept))
+			free(cgroups[count]);
+		else
+			count++;
+		cgroups[count] = NULL;
+	}
+
+	closedir(d);
+	free_kept(kept, num_kept);
+
+	return cgroups;
+}
+
+/**
+ * Restore what game_mode_throttle_others changed, cgroups that went away meanwhile are skipped
+ */
+void game_mode_unthrottle_others(GameModeThrottle *throttle)
+{
+	if (!throttle)
+		return;
+
+	for (size_t i = 0; i < throttle->count; i++) {
+		/* Taken over by the throttle that replaced this one */
+		if (!throttle->files[i].path)
+			continue;
+
+		int fd = open(throttle->files[i].path, O_WRONLY | O_CLOEXEC);
+		if (fd >= 0) {
+			/* The newline is kept, so an empty cpuset.cpus is still written */
+			const char *value = throttle->files[i].value;
+			if (write(fd, value, strlen(value)) < 0)
+				LOG_ERROR("Failed to restore %s: %s\n", throttle->files[i].path, strerror(errno));
+			close(fd);
+		}
+		free(throttle->files[i].path);
+	}
+
+	free(throttle->files);
+	free(throttle);
+}
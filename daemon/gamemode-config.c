@@ -31,6 +31,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #define _GNU_SOURCE
 
 #include "gamemode-config.h"
+#include "gamemode.h"
 
 #include "common-helpers.h"
 #include "common-logging.h"
@@ -45,6 +46,9 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <math.h>
 #include <pthread.h>
 #include <pwd.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stddef.h>
 #include <sys/inotify.h>
 #include <sys/stat.h>
 
@@ -61,67 +65,160 @@ POSSIBILITY OF SUCH DAMAGE.
 	long config_get_##name(GameModeConfig *self)                                                   \
 	{                                                                                              \
 		long value = 0;                                                                            \
-		memcpy_locked_config(self, &value, &self->values.name, sizeof(long));                      \
+		COPY_CONFIG_VALUE(self, &value, name);                                                     \
 		return value;                                                                              \
 	}
 
 /* The number of current locations for config files */
 #define CONFIG_NUM_LOCATIONS 4
 
+/* Sections overriding the settings for matching executables, [game:<pattern>] */
+#define CONFIG_GAME_SECTION "game:"
+
 /**
- * The config holds various details as needed
- * and a rwlock to allow config_reload to be called
+ * A setting from a game section, the section and name point into config_keys
  */
-struct GameModeConfig {
-	pthread_rwlock_t rwlock;
-	int inotfd;
-	int inotwd[CONFIG_NUM_LOCATIONS];
+struct ConfigGameSetting {
+	const char *section;
+	const char *name;
+	char value[CONFIG_VALUE_MAX];
+	bool protected; /**<Read from a protected config location */
+};
+
+/**
+ * The settings of a game section, in the order they were read
+ */
+struct ConfigGameProfile {
+	char pattern[CONFIG_VALUE_MAX];
+	GameModeMatcher *matcher;
+	struct ConfigGameSetting *settings;
+	size_t num_settings;
+};
+
+struct ConfigGameProfiles {
+	struct ConfigGameProfile *list;
+	size_t count;
+};
+
+/* Sections with the settings for client threads of a role, [thread:<role>] */
+#define CONFIG_THREAD_SECTION "thread:"
+
+/**
+ * A thread role, and the patterns matching the names of its threads
+ */
+struct ConfigThreadRoleRule {
+	ConfigThreadRole role;
+	GameModeMatcher *matcher;
+};
+
+struct ConfigThreadRoles {
+	struct ConfigThreadRoleRule *list;
+	size_t count;
+};
+
+/**
+ * The values read from the config files
+ */
+struct GameModeConfigValues {
+	GameModeMatcher *whitelist;
+	GameModeMatcher *blacklist;
+
+	long script_timeout;
+	char startscripts[CONFIG_LIST_MAX][CONFIG_VALUE_MAX];
+	char endscripts[CONFIG_LIST_MAX][CONFIG_VALUE_MAX];
+
+	char defaultgov[CONFIG_VALUE_MAX];
+	char desiredgov[CONFIG_VALUE_MAX];
 
-	struct {
-		char whitelist[CONFIG_LIST_MAX][CONFIG_VALUE_MAX];
-		char blacklist[CONFIG_LIST_MAX][CONFIG_VALUE_MAX];
+	char defaultprof[CONFIG_VALUE_MAX];
+	char desiredprof[CONFIG_VALUE_MAX];
 
-		long script_timeout;
-		char startscripts[CONFIG_LIST_MAX][CONFIG_VALUE_MAX];
-		char endscripts[CONFIG_LIST_MAX][CONFIG_VALUE_MAX];
+	char igpu_desiredgov[CONFIG_VALUE_MAX];
+	float igpu_power_threshold;
 
-		char defaultgov[CONFIG_VALUE_MAX];
-		char desiredgov[CONFIG_VALUE_MAX];
+	char softrealtime[CONFIG_VALUE_MAX];
+	char softrealtime_fallback[CONFIG_VALUE_MAX];
+	long softrealtime_budget;
+	long renice;
 
-		char defaultprof[CONFIG_VALUE_MAX];
-		char desiredprof[CONFIG_VALUE_MAX];
+	char ioprio[CONFIG_VALUE_MAX];
 
-		char igpu_desiredgov[CONFIG_VALUE_MAX];
-		float igpu_power_threshold;
+	long uclamp_min;
+	long uclamp_max;
 
-		char softrealtime[CONFIG_VALUE_MAX];
-		long renice;
+	long track_process_tree;
 
-		char ioprio[CONFIG_VALUE_MAX];
+	long use_cgroup;
+	long cgroup_cpu_weight;
+	long cgroup_io_weight;
+	char cgroup_memory_low[CONFIG_VALUE_MAX];
+	long background_cpu_weight;
+	long background_io_weight;
 
-		long inhibit_screensaver;
+	long inhibit_screensaver;
 
-		long disable_splitlock;
+	long disable_splitlock;
 
-		long reaper_frequency;
+	long resident_helper;
 
-		char apply_gpu_optimisations[CONFIG_VALUE_MAX];
-		long gpu_device;
-		long nv_core_clock_mhz_offset;
-		long nv_mem_clock_mhz_offset;
-		long nv_powermizer_mode;
-		long nv_per_profile_editable;
-		char amd_performance_level[CONFIG_VALUE_MAX];
+	long reaper_frequency;
 
-		char cpu_park_cores[CONFIG_VALUE_MAX];
-		char cpu_pin_cores[CONFIG_VALUE_MAX];
-		char amd_x3d_mode_desired[CONFIG_VALUE_MAX];
-		char amd_x3d_mode_default[CONFIG_VALUE_MAX];
+	char apply_gpu_optimisations[CONFIG_VALUE_MAX];
+	long gpu_device;
+	long nv_core_clock_mhz_offset;
+	long nv_mem_clock_mhz_offset;
+	long nv_powermizer_mode;
+	long nv_per_profile_editable;
+	char amd_performance_level[CONFIG_VALUE_MAX];
 
-		long require_supervisor;
-		char supervisor_whitelist[CONFIG_LIST_MAX][CONFIG_VALUE_MAX];
-		char supervisor_blacklist[CONFIG_LIST_MAX][CONFIG_VALUE_MAX];
-	} values;
+	char cpu_park_cores[CONFIG_VALUE_MAX];
+	char cpu_pin_cores[CONFIG_VALUE_MAX];
+	char cpu_smt_siblings[CONFIG_VALUE_MAX];
+	long cpu_isolate_cores;
+	long core_scheduling;
+	char amd_x3d_mode_desired[CONFIG_VALUE_MAX];
+	char amd_x3d_mode_default[CONFIG_VALUE_MAX];
+
+	long require_supervisor;
+	GameModeMatcher *supervisor_whitelist;
+	GameModeMatcher *supervisor_blacklist;
+
+	struct ConfigGameProfiles games;
+	struct ConfigThreadRoles threads;
+};
+
+/**
+ * An immutable set of values, readers hold a reference while they use it
+ */
+struct GameModeConfigSnapshot {
+	atomic_int refcount;
+	struct GameModeConfigValues values;
+};
+
+/**
+ * The config holds various details as needed
+ * The rwlock guards the inotify watches and loading of the config files, the values are read
+ * through the current snapshot which config_reload swaps for a new one
+ */
+struct GameModeConfig {
+	pthread_rwlock_t rwlock;
+	int inotfd;
+	int inotwd[CONFIG_NUM_LOCATIONS];
+
+	_Atomic(struct GameModeConfigSnapshot *) snapshot;
+	atomic_int readers; /**<Readers between loading the snapshot and referencing it */
+};
+
+/*
+ * Every config key, and the group of settings it belongs to
+ */
+struct ConfigKey {
+	const char *section;
+	const char *name;
+	size_t offset;
+	size_t size;
+	enum ConfigChange group;
+	bool (*equal)(const void *a, const void *b); /* Compares the bytes when NULL */
 };
 
 /*
@@ -157,6 +254,26 @@ static bool append_value_to_list(const char *list_name, const char *value,
 	return true;
 }
 
+/*
+ * Add a pattern to a matcher, these lists have no size limit
+ */
+static bool add_value_to_matcher(const char *list_name, const char *value,
+                                 GameModeMatcher *matcher)
+{
+	int ret = matcher ? game_mode_matcher_add(matcher, value) : -ENOMEM;
+	if (ret == -EINVAL) {
+		LOG_ERROR("Config: Could not add [%s] to [%s], invalid regular expression\n",
+		          value,
+		          list_name);
+		return false;
+	} else if (ret != 0) {
+		LOG_ERROR("Config: Could not add [%s] to [%s], out of memory\n", value, list_name);
+		return false;
+	}
+
+	return true;
+}
+
 /*
  * Get a long value from a string
  */
@@ -177,6 +294,29 @@ static bool get_long_value(const char *value_name, const char *value, long *outp
 
 	return true;
 }
+
+/*
+ * Get and validate a long value within a range
+ */
+static bool get_ranged_value(const char *name, const char *value, long min, long max, long *output)
+{
+	long ranged = 0;
+	if (!get_long_value(name, value, &ranged))
+		return false;
+
+	if (ranged < min || ranged > max) {
+		LOG_ERROR("Config: %s has invalid value '%s'. Valid values are %ld to %ld\n",
+		          name,
+		          value,
+		          min,
+		          max);
+		return false;
+	}
+
+	*output = ranged;
+	return true;
+}
+
 /*
  * Get a long value from a hex string
  */
@@ -220,21 +360,6 @@ static bool get_float_value(const char *value_name, const char *value, float *ou
 	return true;
 }
 
-/**
- * Simple strstr scheck
- * Could be expanded for wildcard or regex
- */
-static bool config_string_list_contains(const char *needle,
-                                        char haystack[CONFIG_LIST_MAX][CONFIG_VALUE_MAX])
-{
-	for (unsigned int i = 0; i < CONFIG_LIST_MAX && haystack[i][0]; i++) {
-		if (strstr(needle, haystack[i])) {
-			return true;
-		}
-	}
-	return false;
-}
-
 /*
  * Get a string value
  */
@@ -262,105 +387,160 @@ static bool get_x3d_mode_value(const char *name, const char *value, char output[
 	return true;
 }
 
-/* Controls whether to read the protected config variables */
-static bool load_protected = false;
+/*
+ * The file being parsed, passed through inih to the callback
+ */
+struct ConfigParseState {
+	struct GameModeConfigValues *values;
+	bool protected; /**<Whether to read the protected config variables */
+};
+
+static const struct ConfigKey *find_config_key(const char *name);
 
 /*
- * Handler for the inih callback
+ * Parse a single value into values
  */
-static int inih_handler(void *user, const char *section, const char *name, const char *value)
+static void parse_config_value(struct GameModeConfigValues *values, bool protected,
+                               const char *section, const char *name, const char *value)
 {
-	GameModeConfig *self = (GameModeConfig *)user;
 	bool valid = false;
 
 	if (strcmp(section, "filter") == 0) {
 		/* Filter subsection */
 		if (strcmp(name, "whitelist") == 0) {
-			valid = append_value_to_list(name, value, self->values.whitelist);
+			valid = add_value_to_matcher(name, value, values->whitelist);
 		} else if (strcmp(name, "blacklist") == 0) {
-			valid = append_value_to_list(name, value, self->values.blacklist);
+			valid = add_value_to_matcher(name, value, values->blacklist);
 		}
 	} else if (strcmp(section, "general") == 0) {
 		/* General subsection */
 		if (strcmp(name, "reaper_freq") == 0) {
-			valid = get_long_value(name, value, &self->values.reaper_frequency);
+			valid = get_long_value(name, value, &values->reaper_frequency);
 		} else if (strcmp(name, "defaultgov") == 0) {
-			valid = get_string_value(value, self->values.defaultgov);
+			valid = get_string_value(value, values->defaultgov);
 		} else if (strcmp(name, "desiredgov") == 0) {
-			valid = get_string_value(value, self->values.desiredgov);
+			valid = get_string_value(value, values->desiredgov);
 		} else if (strcmp(name, "defaultprof") == 0) {
-			valid = get_string_value(value, self->values.defaultprof);
+			valid = get_string_value(value, values->defaultprof);
 		} else if (strcmp(name, "desiredprof") == 0) {
-			valid = get_string_value(value, self->values.desiredprof);
+			valid = get_string_value(value, values->desiredprof);
 		} else if (strcmp(name, "igpu_desiredgov") == 0) {
-			valid = get_string_value(value, self->values.igpu_desiredgov);
+			valid = get_string_value(value, values->igpu_desiredgov);
 		} else if (strcmp(name, "igpu_power_threshold") == 0) {
-			valid = get_float_value(name, value, &self->values.igpu_power_threshold);
+			valid = get_float_value(name, value, &values->igpu_power_threshold);
 		} else if (strcmp(name, "softrealtime") == 0) {
-			valid = get_string_value(value, self->values.softrealtime);
+			valid = get_string_value(value, values->softrealtime);
+		} else if (strcmp(name, "softrealtime_fallback") == 0) {
+			if (strcmp(value, "rr") == 0 || strcmp(value, "fifo") == 0 ||
+			    strcmp(value, "off") == 0) {
+				valid = get_string_value(value, values->softrealtime_fallback);
+			} else {
+				LOG_ERROR("Config: %s has invalid value '%s'. Valid values are 'rr', 'fifo' "
+				          "or 'off'\n",
+				          name,
+				          value);
+			}
+		} else if (strcmp(name, "softrealtime_budget") == 0) {
+			valid = get_ranged_value(name, value, 1, 100, &values->softrealtime_budget);
 		} else if (strcmp(name, "renice") == 0) {
-			valid = get_long_value(name, value, &self->values.renice);
+			valid = get_long_value(name, value, &values->renice);
 		} else if (strcmp(name, "ioprio") == 0) {
-			valid = get_string_value(value, self->values.ioprio);
+			valid = get_string_value(value, values->ioprio);
+		} else if (strcmp(name, "uclamp_min") == 0) {
+			valid = get_ranged_value(name, value, -1, 1024, &values->uclamp_min);
+		} else if (strcmp(name, "uclamp_max") == 0) {
+			valid = get_ranged_value(name, value, -1, 1024, &values->uclamp_max);
+		} else if (strcmp(name, "track_process_tree") == 0) {
+			valid = get_long_value(name, value, &values->track_process_tree);
 		} else if (strcmp(name, "inhibit_screensaver") == 0) {
-			valid = get_long_value(name, value, &self->values.inhibit_screensaver);
+			valid = get_long_value(name, value, &values->inhibit_screensaver);
 		} else if (strcmp(name, "disable_splitlock") == 0) {
-			valid = get_long_value(name, value, &self->values.disable_splitlock);
+			valid = get_long_value(name, value, &values->disable_splitlock);
+		} else if (strcmp(name, "resident_helper") == 0) {
+			valid = get_long_value(name, value, &values->resident_helper);
 		}
 	} else if (strcmp(section, "gpu") == 0) {
 		/* Protect the user - don't allow these config options from unsafe config locations */
-		if (!load_protected) {
+		if (!protected) {
 			LOG_ERROR(
 			    "The [gpu] config section is not configurable from unsafe config files! Option %s "
 			    "will be ignored!\n",
 			    name);
 			LOG_ERROR("Consider moving this option to /etc/gamemode.ini\n");
-			return 1;
+			return;
 		}
 
 		/* GPU subsection */
 		if (strcmp(name, "apply_gpu_optimisations") == 0) {
-			valid = get_string_value(value, self->values.apply_gpu_optimisations);
+			valid = get_string_value(value, values->apply_gpu_optimisations);
 		} else if (strcmp(name, "gpu_device") == 0) {
-			valid = get_long_value(name, value, &self->values.gpu_device);
+			valid = get_long_value(name, value, &values->gpu_device);
 		} else if (strcmp(name, "nv_core_clock_mhz_offset") == 0) {
-			valid = get_long_value(name, value, &self->values.nv_core_clock_mhz_offset);
+			valid = get_long_value(name, value, &values->nv_core_clock_mhz_offset);
 		} else if (strcmp(name, "nv_mem_clock_mhz_offset") == 0) {
-			valid = get_long_value(name, value, &self->values.nv_mem_clock_mhz_offset);
+			valid = get_long_value(name, value, &values->nv_mem_clock_mhz_offset);
 		} else if (strcmp(name, "nv_powermizer_mode") == 0) {
-			valid = get_long_value(name, value, &self->values.nv_powermizer_mode);
+			valid = get_long_value(name, value, &values->nv_powermizer_mode);
 		} else if (strcmp(name, "nv_per_profile_editable") == 0) {
-			valid = get_long_value(name, value, &self->values.nv_per_profile_editable);
+			valid = get_long_value(name, value, &values->nv_per_profile_editable);
 		} else if (strcmp(name, "amd_performance_level") == 0) {
-			valid = get_string_value(value, self->values.amd_performance_level);
+			valid = get_string_value(value, values->amd_performance_level);
 		}
 	} else if (strcmp(section, "cpu") == 0) {
 		if (strcmp(name, "park_cores") == 0) {
-			valid = get_string_value(value, self->values.cpu_park_cores);
+			valid = get_string_value(value, values->cpu_park_cores);
 		} else if (strcmp(name, "pin_cores") == 0) {
-			valid = get_string_value(value, self->values.cpu_pin_cores);
+			valid = get_string_value(value, values->cpu_pin_cores);
+		} else if (strcmp(name, "smt_siblings") == 0) {
+			if (strcmp(value, "use") == 0 || strcmp(value, "avoid") == 0 ||
+			    strcmp(value, "park") == 0) {
+				valid = get_string_value(value, values->cpu_smt_siblings);
+			} else {
+				LOG_ERROR("Config: %s has invalid value '%s'. Valid values are 'use', 'avoid' "
+				          "or 'park'\n",
+				          name,
+				          value);
+			}
+		} else if (strcmp(name, "isolate_cores") == 0) {
+			valid = get_long_value(name, value, &values->cpu_isolate_cores);
+		} else if (strcmp(name, "core_scheduling") == 0) {
+			valid = get_long_value(name, value, &values->core_scheduling);
 		} else if (strcmp(name, "amd_x3d_mode_desired") == 0) {
-			valid = get_x3d_mode_value(name, value, self->values.amd_x3d_mode_desired);
+			valid = get_x3d_mode_value(name, value, values->amd_x3d_mode_desired);
 		} else if (strcmp(name, "amd_x3d_mode_default") == 0) {
-			valid = get_x3d_mode_value(name, value, self->values.amd_x3d_mode_default);
+			valid = get_x3d_mode_value(name, value, values->amd_x3d_mode_default);
+		}
+	} else if (strcmp(section, "cgroup") == 0) {
+		if (strcmp(name, "use_cgroup") == 0) {
+			valid = get_long_value(name, value, &values->use_cgroup);
+		} else if (strcmp(name, "cpu_weight") == 0) {
+			valid = get_ranged_value(name, value, 0, 10000, &values->cgroup_cpu_weight);
+		} else if (strcmp(name, "io_weight") == 0) {
+			valid = get_ranged_value(name, value, 0, 10000, &values->cgroup_io_weight);
+		} else if (strcmp(name, "memory_low") == 0) {
+			valid = get_string_value(value, values->cgroup_memory_low);
+		} else if (strcmp(name, "background_cpu_weight") == 0) {
+			valid = get_ranged_value(name, value, 0, 10000, &values->background_cpu_weight);
+		} else if (strcmp(name, "background_io_weight") == 0) {
+			valid = get_ranged_value(name, value, 0, 10000, &values->background_io_weight);
 		}
 	} else if (strcmp(section, "supervisor") == 0) {
 		/* Supervisor subsection */
 		if (strcmp(name, "supervisor_whitelist") == 0) {
-			valid = append_value_to_list(name, value, self->values.supervisor_whitelist);
+			valid = add_value_to_matcher(name, value, values->supervisor_whitelist);
 		} else if (strcmp(name, "supervisor_blacklist") == 0) {
-			valid = append_value_to_list(name, value, self->values.supervisor_blacklist);
+			valid = add_value_to_matcher(name, value, values->supervisor_blacklist);
 		} else if (strcmp(name, "require_supervisor") == 0) {
-			valid = get_long_value(name, value, &self->values.require_supervisor);
+			valid = get_long_value(name, value, &values->require_supervisor);
 		}
 	} else if (strcmp(section, "custom") == 0) {
 		/* Custom subsection */
 		if (strcmp(name, "start") == 0) {
-			valid = append_value_to_list(name, value, self->values.startscripts);
+			valid = append_value_to_list(name, value, values->startscripts);
 		} else if (strcmp(name, "end") == 0) {
-			valid = append_value_to_list(name, value, self->values.endscripts);
+			valid = append_value_to_list(name, value, values->endscripts);
 		} else if (strcmp(name, "script_timeout") == 0) {
-			valid = get_long_value(name, value, &self->values.script_timeout);
+			valid = get_long_value(name, value, &values->script_timeout);
 		}
 	}
 
@@ -368,14 +548,201 @@ static int inih_handler(void *user, const char *section, const char *name, const
 		/* Simply ignore the value, but with a log */
 		LOG_MSG("Config: Value ignored [%s] %s=%s\n", section, name, value);
 	}
+}
+
+/*
+ * Find the profile for a game section, adding it on first use
+ */
+static struct ConfigGameProfile *get_game_profile(struct ConfigGameProfiles *games,
+                                                  const char *pattern)
+{
+	for (size_t i = 0; i < games->count; i++) {
+		if (strcmp(games->list[i].pattern, pattern) == 0)
+			return &games->list[i];
+	}
+
+	if (pattern[0] == '\0' || strlen(pattern) >= CONFIG_VALUE_MAX) {
+		LOG_ERROR("Config: Invalid game section [" CONFIG_GAME_SECTION "%s]\n", pattern);
+		return NULL;
+	}
+
+	struct ConfigGameProfile *list = realloc(games->list, (games->count + 1) * sizeof(*list));
+	if (!list)
+		return NULL;
+	games->list = list;
+
+	struct ConfigGameProfile *profile = &list[games->count];
+	memset(profile, 0, sizeof(*profile));
+	strcpy(profile->pattern, pattern);
+	profile->matcher = game_mode_matcher_new();
+	if (!add_value_to_matcher(CONFIG_GAME_SECTION, pattern, profile->matcher)) {
+		game_mode_matcher_free(profile->matcher);
+		return NULL;
+	}
+
+	games->count++;
+	return profile;
+}
+
+/*
+ * Store a setting of a game section, it is parsed when a matching client registers
+ */
+static void add_game_setting(const struct ConfigParseState *state, const char *pattern,
+                             const char *name, const char *value)
+{
+	const struct ConfigKey *key = find_config_key(name);
+	if (!key) {
+		LOG_MSG("Config: Value ignored [" CONFIG_GAME_SECTION "%s] %s=%s\n", pattern, name, value);
+		return;
+	}
+
+	if (!((unsigned int)key->group & CONFIG_CHANGE_GAME)) {
+		LOG_ERROR("Config: [%s] %s can not be set per game and will be ignored\n",
+		          key->section,
+		          key->name);
+		return;
+	}
+
+	struct ConfigGameProfile *profile = get_game_profile(&state->values->games, pattern);
+	if (!profile)
+		return;
+
+	struct ConfigGameSetting *settings =
+	    realloc(profile->settings, (profile->num_settings + 1) * sizeof(*settings));
+	if (!settings) {
+		LOG_ERROR("Config: Could not add [%s] to [" CONFIG_GAME_SECTION "%s], out of memory\n",
+		          name,
+		          pattern);
+		return;
+	}
+	profile->settings = settings;
+
+	struct ConfigGameSetting *setting = &settings[profile->num_settings++];
+	setting->section = key->section;
+	setting->name = key->name;
+	get_string_value(value, setting->value);
+	setting->protected = state->protected;
+}
+
+static void free_game_profiles(struct ConfigGameProfiles *games)
+{
+	for (size_t i = 0; i < games->count; i++) {
+		game_mode_matcher_free(games->list[i].matcher);
+		free(games->list[i].settings);
+	}
+	free(games->list);
+}
+
+/*
+ * Find the rule for a thread section, adding it on first use
+ */
+static struct ConfigThreadRoleRule *get_thread_role(struct ConfigThreadRoles *threads,
+                                                   const char *name)
+{
+	for (size_t i = 0; i < threads->count; i++) {
+		if (strcmp(threads->list[i].role.name, name) == 0)
+			return &threads->list[i];
+	}
+
+	if (name[0] == '\0' || strlen(name) >= CONFIG_VALUE_MAX) {
+		LOG_ERROR("Config: Invalid thread section [" CONFIG_THREAD_SECTION "%s]\n", name);
+		return NULL;
+	}
+
+	struct ConfigThreadRoleRule *list =
+	    realloc(threads->list, (threads->count + 1) * sizeof(*list));
+	if (!list)
+		return NULL;
+	threads->list = list;
+
+	struct ConfigThreadRoleRule *rule = &list[threads->count];
+	memset(rule, 0, sizeof(*rule));
+	strcpy(rule->role.name, name);
+	rule->role.nice = CONFIG_ROLE_UNSET;
+	rule->role.ioprio = CONFIG_ROLE_UNSET;
+	rule->role.uclamp_min = CONFIG_ROLE_UNSET;
+	rule->role.uclamp_max = CONFIG_ROLE_UNSET;
+	rule->role.softrealtime = CONFIG_ROLE_UNSET;
+	rule->matcher = game_mode_matcher_new();
+	if (!rule->matcher)
+		return NULL;
+
+	threads->count++;
+	return rule;
+}
+
+/*
+ * Parse a setting of a thread section
+ */
+static void add_thread_setting(const struct ConfigParseState *state, const char *role,
+                               const char *name, const char *value)
+{
+	struct ConfigThreadRoleRule *rule = get_thread_role(&state->values->threads, role);
+	if (!rule)
+		return;
+
+	bool valid = false;
+	if (strcmp(name, "match") == 0) {
+		valid = add_value_to_matcher(name, value, rule->matcher);
+	} else if (strcmp(name, "cores") == 0) {
+		valid = get_string_value(value, rule->role.cores);
+	} else if (strcmp(name, "nice") == 0) {
+		valid = get_ranged_value(name, value, -20, 19, &rule->role.nice);
+	} else if (strcmp(name, "ioprio") == 0) {
+		valid = get_ranged_value(name, value, 0, 7, &rule->role.ioprio);
+	} else if (strcmp(name, "uclamp_min") == 0) {
+		valid = get_ranged_value(name, value, 0, 1024, &rule->role.uclamp_min);
+	} else if (strcmp(name, "uclamp_max") == 0) {
+		valid = get_ranged_value(name, value, 0, 1024, &rule->role.uclamp_max);
+	} else if (strcmp(name, "softrealtime") == 0) {
+		valid = get_ranged_value(name, value, 0, 1, &rule->role.softrealtime);
+	} else if (strcmp(name, "policy") == 0) {
+		if (strcmp(value, "normal") == 0 || strcmp(value, "batch") == 0 ||
+		    strcmp(value, "idle") == 0) {
+			valid = get_string_value(value, rule->role.policy);
+		} else {
+			LOG_ERROR("Config: %s has invalid value '%s'. Valid values are 'normal', 'batch' "
+			          "or 'idle'\n",
+			          name,
+			          value);
+		}
+	}
+
+	if (!valid)
+		LOG_MSG("Config: Value ignored [" CONFIG_THREAD_SECTION "%s] %s=%s\n", role, name, value);
+}
+
+static void free_thread_roles(struct ConfigThreadRoles *threads)
+{
+	for (size_t i = 0; i < threads->count; i++)
+		game_mode_matcher_free(threads->list[i].matcher);
+	free(threads->list);
+}
+
+/*
+ * Handler for the inih callback
+ */
+static int inih_handler(void *user, const char *section, const char *name, const char *value)
+{
+	const struct ConfigParseState *state = (const struct ConfigParseState *)user;
+	const size_t prefix = strlen(CONFIG_GAME_SECTION);
+	const size_t thread_prefix = strlen(CONFIG_THREAD_SECTION);
+
+	if (strncmp(section, CONFIG_GAME_SECTION, prefix) == 0)
+		add_game_setting(state, section + prefix, name, value);
+	else if (strncmp(section, CONFIG_THREAD_SECTION, thread_prefix) == 0)
+		add_thread_setting(state, section + thread_prefix, name, value);
+	else
+		parse_config_value(state->values, state->protected, section, name, value);
 
 	return 1;
 }
 
 /*
- * Load the config file
+ * Load the config files into values, watching them for edits if requested
  */
-static void load_config_files(GameModeConfig *self)
+static void load_config_files(GameModeConfig *self, struct GameModeConfigValues *values,
+                              bool watch)
 {
 	/* grab the current dir */
 	char *config_location_local = get_current_dir_name();
@@ -405,19 +772,29 @@ static void load_config_files(GameModeConfig *self)
 	pthread_rwlock_wrlock(&self->rwlock);
 
 	/* Clear our config values */
-	memset(&self->values, 0, sizeof(self->values));
+	memset(values, 0, sizeof(*values));
+
+	/* A missing matcher is treated as an empty list, add_value_to_matcher reports it */
+	values->whitelist = game_mode_matcher_new();
+	values->blacklist = game_mode_matcher_new();
+	values->supervisor_whitelist = game_mode_matcher_new();
+	values->supervisor_blacklist = game_mode_matcher_new();
 
 	/* Set some non-zero defaults */
-	self->values.igpu_power_threshold = DEFAULT_IGPU_POWER_THRESHOLD;
-	self->values.inhibit_screensaver = 1; /* Defaults to on */
-	self->values.disable_splitlock = 1;   /* Defaults to on */
-	self->values.reaper_frequency = DEFAULT_REAPER_FREQ;
-	self->values.gpu_device = 0;
-	self->values.nv_powermizer_mode = -1;
-	self->values.nv_per_profile_editable = 1; /* Defaults to editable profiles */
-	self->values.nv_core_clock_mhz_offset = -1;
-	self->values.nv_mem_clock_mhz_offset = -1;
-	self->values.script_timeout = 10; /* Default to 10 seconds for scripts */
+	values->igpu_power_threshold = DEFAULT_IGPU_POWER_THRESHOLD;
+	values->inhibit_screensaver = 1; /* Defaults to on */
+	values->disable_splitlock = 1;   /* Defaults to on */
+	values->resident_helper = 1;     /* Defaults to on */
+	values->uclamp_min = -1;         /* Defaults to leaving the clamps alone */
+	values->uclamp_max = -1;
+	values->softrealtime_budget = 70; /* The default of SCHED_ISO's iso_cpu */
+	values->reaper_frequency = DEFAULT_REAPER_FREQ;
+	values->gpu_device = 0;
+	values->nv_powermizer_mode = -1;
+	values->nv_per_profile_editable = 1; /* Defaults to editable profiles */
+	values->nv_core_clock_mhz_offset = -1;
+	values->nv_mem_clock_mhz_offset = -1;
+	values->script_timeout = 10; /* Default to 10 seconds for scripts */
 
 	/*
 	 * Locations to load, in order
@@ -441,9 +818,10 @@ static void load_config_files(GameModeConfig *self)
 			FILE *f = NULL;
 			DIR *d = NULL;
 			if ((f = fopen(path, "r"))) {
-				LOG_MSG("Loading config file [%s]\n", path);
-				load_protected = locations[i].protected;
-				int error = ini_parse_file(f, inih_handler, (void *)self);
+				if (watch)
+					LOG_MSG("Loading config file [%s]\n", path);
+				struct ConfigParseState state = { values, locations[i].protected };
+				int error = ini_parse_file(f, inih_handler, (void *)&state);
 
 				/* Failure here isn't fatal */
 				if (error) {
@@ -454,11 +832,12 @@ static void load_config_files(GameModeConfig *self)
 				/* Register for inotify */
 				/* Watch for modification, deletion, moves, or attribute changes */
 				uint32_t fileflags = IN_MODIFY | IN_DELETE_SELF | IN_MOVE_SELF;
-				if ((self->inotwd[i] = inotify_add_watch(self->inotfd, path, fileflags)) == -1) {
+				if (watch &&
+				    (self->inotwd[i] = inotify_add_watch(self->inotfd, path, fileflags)) == -1) {
 					LOG_ERROR("Failed to watch %s, error: %s", path, strerror(errno));
 				}
 
-			} else if ((d = opendir(locations[i].path))) {
+			} else if (watch && (d = opendir(locations[i].path))) {
 				/* We didn't find a file, so we'll wait on the directory */
 				/* Notify if a file is created, or move to the directory, or if the directory itself
 				 * is removed or moved away */
@@ -473,6 +852,34 @@ static void load_config_files(GameModeConfig *self)
 		}
 	}
 
+	/* Build the matchers now that all the patterns are known */
+	GameModeMatcher *matchers[] = {
+		values->whitelist,
+		values->blacklist,
+		values->supervisor_whitelist,
+		values->supervisor_blacklist,
+	};
+	for (size_t i = 0; i < sizeof(matchers) / sizeof(matchers[0]); i++) {
+		if (matchers[i] && game_mode_matcher_compile(matchers[i]) != 0)
+			LOG_ERROR("Config: Failed to compile the client and supervisor lists\n");
+	}
+	for (size_t i = 0; i < values->games.count; i++) {
+		if (game_mode_matcher_compile(values->games.list[i].matcher) != 0)
+			LOG_ERROR("Config: Failed to compile [" CONFIG_GAME_SECTION "%s]\n",
+			          values->games.list[i].pattern);
+	}
+	for (size_t i = 0; i < values->threads.count; i++) {
+		struct ConfigThreadRoleRule *rule = &values->threads.list[i];
+
+		/* Without a match the role is for the threads named after it */
+		if (game_mode_matcher_empty(rule->matcher))
+			add_value_to_matcher(CONFIG_THREAD_SECTION, rule->role.name, rule->matcher);
+
+		if (game_mode_matcher_compile(rule->matcher) != 0)
+			LOG_ERROR("Config: Failed to compile [" CONFIG_THREAD_SECTION "%s]\n",
+			          rule->role.name);
+	}
+
 	/* clean up memory */
 	free(config_location_home);
 	free(config_location_local);
@@ -482,20 +889,78 @@ static void load_config_files(GameModeConfig *self)
 }
 
 /*
- * Copy a config parameter with a lock
+ * Take a reference to the current snapshot, without ever blocking on a reload
  */
-static void memcpy_locked_config(GameModeConfig *self, void *dst, void *src, size_t n)
+static struct GameModeConfigSnapshot *snapshot_acquire(GameModeConfig *self)
 {
-	/* Take the read lock */
-	pthread_rwlock_rdlock(&self->rwlock);
+	atomic_fetch_add(&self->readers, 1);
+	struct GameModeConfigSnapshot *snapshot = atomic_load(&self->snapshot);
+	atomic_fetch_add(&snapshot->refcount, 1);
+	atomic_fetch_sub(&self->readers, 1);
 
-	/* copy the data */
-	memcpy(dst, src, n);
+	return snapshot;
+}
 
-	/* release the lock */
-	pthread_rwlock_unlock(&self->rwlock);
+static void snapshot_release(struct GameModeConfigSnapshot *snapshot)
+{
+	if (atomic_fetch_sub(&snapshot->refcount, 1) != 1)
+		return;
+
+	game_mode_matcher_free(snapshot->values.whitelist);
+	game_mode_matcher_free(snapshot->values.blacklist);
+	game_mode_matcher_free(snapshot->values.supervisor_whitelist);
+	game_mode_matcher_free(snapshot->values.supervisor_blacklist);
+	free_game_profiles(&snapshot->values.games);
+	free_thread_roles(&snapshot->values.threads);
+	free(snapshot);
+}
+
+/*
+ * Load the config files into a new snapshot, NULL when out of memory
+ */
+static struct GameModeConfigSnapshot *snapshot_load(GameModeConfig *self, bool watch)
+{
+	struct GameModeConfigSnapshot *snapshot = malloc(sizeof(*snapshot));
+	if (!snapshot)
+		return NULL;
+
+	atomic_init(&snapshot->refcount, 1);
+	load_config_files(self, &snapshot->values, watch);
+
+	return snapshot;
+}
+
+/*
+ * Make snapshot the current one and give back the reference to the previous one
+ */
+static struct GameModeConfigSnapshot *snapshot_publish(GameModeConfig *self,
+                                                       struct GameModeConfigSnapshot *snapshot)
+{
+	struct GameModeConfigSnapshot *old = atomic_exchange(&self->snapshot, snapshot);
+
+	/* Readers that loaded the old pointer may not have referenced it yet */
+	while (atomic_load(&self->readers) != 0)
+		sched_yield();
+
+	return old;
+}
+
+/*
+ * Copy a config value out of the current snapshot
+ */
+static void copy_config_value(GameModeConfig *self, void *dst, size_t offset, size_t n)
+{
+	struct GameModeConfigSnapshot *snapshot = snapshot_acquire(self);
+	memcpy(dst, (const char *)&snapshot->values + offset, n);
+	snapshot_release(snapshot);
 }
 
+#define COPY_CONFIG_VALUE(self, dst, field)                                                        \
+	copy_config_value(self,                                                                        \
+	                  dst,                                                                         \
+	                  offsetof(struct GameModeConfigValues, field),                                \
+	                  sizeof(((struct GameModeConfigValues *)NULL)->field))
+
 /*
  * Create a context object
  */
@@ -507,12 +972,10 @@ GameModeConfig *config_create(void)
 }
 
 /*
- * Initialize the config
+ * Set up the inotify fd, the watches are added while loading the files
  */
-void config_init(GameModeConfig *self)
+static void watch_init(GameModeConfig *self)
 {
-	pthread_rwlock_init(&self->rwlock, NULL);
-
 	self->inotfd = inotify_init1(IN_NONBLOCK);
 	if (self->inotfd == -1)
 		LOG_ERROR(
@@ -522,18 +985,10 @@ void config_init(GameModeConfig *self)
 	for (unsigned int i = 0; i < CONFIG_NUM_LOCATIONS; i++) {
 		self->inotwd[i] = -1;
 	}
-
-	/* load the initial config */
-	load_config_files(self);
 }
 
-/*
- * Destroy internal parts of config
- */
-static void internal_destroy(GameModeConfig *self)
+static void watch_destroy(GameModeConfig *self)
 {
-	pthread_rwlock_destroy(&self->rwlock);
-
 	for (unsigned int i = 0; i < CONFIG_NUM_LOCATIONS; i++) {
 		if (self->inotwd[i] != -1) {
 			/* TODO: Error handle */
@@ -545,14 +1000,320 @@ static void internal_destroy(GameModeConfig *self)
 		close(self->inotfd);
 }
 
+/*
+ * Initialize the config
+ */
+void config_init(GameModeConfig *self)
+{
+	pthread_rwlock_init(&self->rwlock, NULL);
+	atomic_init(&self->readers, 0);
+
+	watch_init(self);
+
+	/* load the initial config */
+	struct GameModeConfigSnapshot *snapshot = snapshot_load(self, true);
+	if (!snapshot)
+		FATAL_ERROR("Failed to allocate memory for the config\n");
+	atomic_init(&self->snapshot, snapshot);
+}
+
+/* Matchers are compared by their patterns */
+static bool matcher_field_equal(const void *a, const void *b)
+{
+	return game_mode_matcher_equal(*(GameModeMatcher *const *)a, *(GameModeMatcher *const *)b);
+}
+
+/* Game sections are compared setting by setting */
+static bool games_field_equal(const void *a, const void *b)
+{
+	const struct ConfigGameProfiles *x = a, *y = b;
+	if (x->count != y->count)
+		return false;
+
+	for (size_t i = 0; i < x->count; i++) {
+		const struct ConfigGameProfile *p = &x->list[i], *q = &y->list[i];
+		if (strcmp(p->pattern, q->pattern) != 0 || p->num_settings != q->num_settings)
+			return false;
+
+		for (size_t j = 0; j < p->num_settings; j++) {
+			const struct ConfigGameSetting *s = &p->settings[j], *t = &q->settings[j];
+			if (s->name != t->name || s->protected != t->protected ||
+			    strcmp(s->value, t->value) != 0)
+				return false;
+		}
+	}
+
+	return true;
+}
+
+/* Thread sections are compared role by role, in file order */
+static bool threads_field_equal(const void *a, const void *b)
+{
+	const struct ConfigThreadRoles *x = a, *y = b;
+	if (x->count != y->count)
+		return false;
+
+	for (size_t i = 0; i < x->count; i++) {
+		const struct ConfigThreadRoleRule *p = &x->list[i], *q = &y->list[i];
+		if (memcmp(&p->role, &q->role, sizeof(p->role)) != 0 ||
+		    !game_mode_matcher_equal(p->matcher, q->matcher))
+			return false;
+	}
+
+	return true;
+}
+
+#define CONFIG_KEY(section, name, field, group)                                                    \
+	{                                                                                              \
+		section, name, offsetof(struct GameModeConfigValues, field),                               \
+		    sizeof(((struct GameModeConfigValues *)NULL)->field), group, NULL                      \
+	}
+
+#define CONFIG_MATCHER_KEY(section, name, field, group)                                            \
+	{                                                                                              \
+		section, name, offsetof(struct GameModeConfigValues, field),                               \
+		    sizeof(GameModeMatcher *), group, matcher_field_equal                                  \
+	}
+
+/* clang-format off */
+static const struct ConfigKey config_keys[] = {
+	CONFIG_MATCHER_KEY("filter", "whitelist", whitelist, CONFIG_CHANGE_CLIENTS),
+	CONFIG_MATCHER_KEY("filter", "blacklist", blacklist, CONFIG_CHANGE_CLIENTS),
+	CONFIG_KEY("general", "reaper_freq", reaper_frequency, CONFIG_CHANGE_REAPER),
+	CONFIG_KEY("general", "defaultgov", defaultgov, CONFIG_CHANGE_DEFAULTS),
+	CONFIG_KEY("general", "desiredgov", desiredgov, CONFIG_CHANGE_GOVERNOR),
+	CONFIG_KEY("general", "defaultprof", defaultprof, CONFIG_CHANGE_DEFAULTS),
+	CONFIG_KEY("general", "desiredprof", desiredprof, CONFIG_CHANGE_PROFILE),
+	CONFIG_KEY("general", "igpu_desiredgov", igpu_desiredgov, CONFIG_CHANGE_GOVERNOR),
+	CONFIG_KEY("general", "igpu_power_threshold", igpu_power_threshold, CONFIG_CHANGE_GOVERNOR),
+	CONFIG_KEY("general", "softrealtime", softrealtime, CONFIG_CHANGE_CLIENT_OPTS),
+	CONFIG_KEY("general", "softrealtime_fallback", softrealtime_fallback,
+	           CONFIG_CHANGE_CLIENT_OPTS),
+	CONFIG_KEY("general", "softrealtime_budget", softrealtime_budget, CONFIG_CHANGE_CLIENT_OPTS),
+	CONFIG_KEY("general", "renice", renice, CONFIG_CHANGE_CLIENT_OPTS),
+	CONFIG_KEY("general", "ioprio", ioprio, CONFIG_CHANGE_CLIENT_OPTS),
+	CONFIG_KEY("general", "uclamp_min", uclamp_min, CONFIG_CHANGE_CLIENT_OPTS),
+	CONFIG_KEY("general", "uclamp_max", uclamp_max, CONFIG_CHANGE_CLIENT_OPTS),
+	CONFIG_KEY("general", "track_process_tree", track_process_tree, CONFIG_CHANGE_CLIENT_OPTS),
+	CONFIG_KEY("general", "inhibit_screensaver", inhibit_screensaver, CONFIG_CHANGE_SCREENSAVER),
+	CONFIG_KEY("general", "disable_splitlock", disable_splitlock, CONFIG_CHANGE_SPLITLOCK),
+	CONFIG_KEY("general", "resident_helper", resident_helper, CONFIG_CHANGE_HELPER),
+	CONFIG_KEY("gpu", "apply_gpu_optimisations", apply_gpu_optimisations, CONFIG_CHANGE_GPU),
+	CONFIG_KEY("gpu", "gpu_device", gpu_device, CONFIG_CHANGE_GPU),
+	CONFIG_KEY("gpu", "nv_core_clock_mhz_offset", nv_core_clock_mhz_offset, CONFIG_CHANGE_GPU),
+	CONFIG_KEY("gpu", "nv_mem_clock_mhz_offset", nv_mem_clock_mhz_offset, CONFIG_CHANGE_GPU),
+	CONFIG_KEY("gpu", "nv_powermizer_mode", nv_powermizer_mode, CONFIG_CHANGE_GPU),
+	CONFIG_KEY("gpu", "nv_per_profile_editable", nv_per_profile_editable, CONFIG_CHANGE_GPU),
+	CONFIG_KEY("gpu", "amd_performance_level", amd_performance_level, CONFIG_CHANGE_GPU),
+	CONFIG_KEY("cpu", "park_cores", cpu_park_cores, CONFIG_CHANGE_CPU),
+	CONFIG_KEY("cpu", "pin_cores", cpu_pin_cores, CONFIG_CHANGE_CPU),
+	CONFIG_KEY("cpu", "smt_siblings", cpu_smt_siblings, CONFIG_CHANGE_CPU),
+	CONFIG_KEY("cpu", "isolate_cores", cpu_isolate_cores, CONFIG_CHANGE_CPU),
+	CONFIG_KEY("cpu", "core_scheduling", core_scheduling, CONFIG_CHANGE_CLIENT_OPTS),
+	CONFIG_KEY("cpu", "amd_x3d_mode_desired", amd_x3d_mode_desired, CONFIG_CHANGE_X3D_MODE),
+	CONFIG_KEY("cpu", "amd_x3d_mode_default", amd_x3d_mode_default, CONFIG_CHANGE_DEFAULTS),
+	CONFIG_KEY("cgroup", "use_cgroup", use_cgroup, CONFIG_CHANGE_CLIENT_OPTS),
+	CONFIG_KEY("cgroup", "cpu_weight", cgroup_cpu_weight, CONFIG_CHANGE_CLIENT_OPTS),
+	CONFIG_KEY("cgroup", "io_weight", cgroup_io_weight, CONFIG_CHANGE_CLIENT_OPTS),
+	CONFIG_KEY("cgroup", "memory_low", cgroup_memory_low, CONFIG_CHANGE_CLIENT_OPTS),
+	CONFIG_KEY("cgroup", "background_cpu_weight", background_cpu_weight, CONFIG_CHANGE_THROTTLE),
+	CONFIG_KEY("cgroup", "background_io_weight", background_io_weight, CONFIG_CHANGE_THROTTLE),
+	CONFIG_MATCHER_KEY("supervisor", "supervisor_whitelist", supervisor_whitelist,
+	                   CONFIG_CHANGE_CLIENTS),
+	CONFIG_MATCHER_KEY("supervisor", "supervisor_blacklist", supervisor_blacklist,
+	                   CONFIG_CHANGE_CLIENTS),
+	CONFIG_KEY("supervisor", "require_supervisor", require_supervisor, CONFIG_CHANGE_CLIENTS),
+	CONFIG_KEY("custom", "start", startscripts, CONFIG_CHANGE_SCRIPTS),
+	CONFIG_KEY("custom", "end", endscripts, CONFIG_CHANGE_SCRIPTS),
+	CONFIG_KEY("custom", "script_timeout", script_timeout, CONFIG_CHANGE_SCRIPTS),
+	{ "game", "profiles", offsetof(struct GameModeConfigValues, games),
+	  sizeof(struct ConfigGameProfiles), CONFIG_CHANGE_GAMES, games_field_equal },
+	{ "thread", "roles", offsetof(struct GameModeConfigValues, threads),
+	  sizeof(struct ConfigThreadRoles), CONFIG_CHANGE_THREADS, threads_field_equal },
+};
+/* clang-format on */
+
+/*
+ * Look up a key by name, the names are unique across the sections
+ */
+static const struct ConfigKey *find_config_key(const char *name)
+{
+	const unsigned int sections = CONFIG_CHANGE_GAMES | CONFIG_CHANGE_THREADS;
+
+	for (size_t i = 0; i < sizeof(config_keys) / sizeof(config_keys[0]); i++) {
+		if (!((unsigned int)config_keys[i].group & sections) &&
+		    strcmp(config_keys[i].name, name) == 0)
+			return &config_keys[i];
+	}
+
+	return NULL;
+}
+
+/*
+ * Compare two sets of values key by key
+ */
+static unsigned int diff_config_values(const struct GameModeConfigValues *old,
+                                       const struct GameModeConfigValues *new, bool log)
+{
+	unsigned int changes = 0;
+
+	for (size_t i = 0; i < sizeof(config_keys) / sizeof(config_keys[0]); i++) {
+		const struct ConfigKey *key = &config_keys[i];
+		const void *a = (const char *)old + key->offset;
+		const void *b = (const char *)new + key->offset;
+		if (key->equal ? key->equal(a, b) : memcmp(a, b, key->size) == 0)
+			continue;
+
+		if (log)
+			LOG_MSG("Config: [%s] %s changed\n", key->section, key->name);
+		changes |= (unsigned int)key->group;
+	}
+
+	return changes;
+}
+
 /*
  * Re-load the config file
  */
-void config_reload(GameModeConfig *self)
+unsigned int config_reload(GameModeConfig *self)
+{
+	/* Start over with fresh watches, the files may have been replaced */
+	pthread_rwlock_wrlock(&self->rwlock);
+	watch_destroy(self);
+	watch_init(self);
+	pthread_rwlock_unlock(&self->rwlock);
+
+	struct GameModeConfigSnapshot *snapshot = snapshot_load(self, true);
+	if (!snapshot) {
+		LOG_ERROR("Failed to allocate memory, keeping the current config\n");
+		return 0;
+	}
+
+	struct GameModeConfigSnapshot *old = snapshot_publish(self, snapshot);
+	unsigned int changes = diff_config_values(&old->values, &snapshot->values, false);
+	snapshot_release(old);
+
+	return changes;
+}
+
+/*
+ * Compare the config files with the loaded config
+ */
+unsigned int config_pending_changes(GameModeConfig *self)
+{
+	struct GameModeConfigSnapshot *pending = snapshot_load(self, false);
+	if (!pending)
+		return ~0u;
+
+	struct GameModeConfigSnapshot *current = snapshot_acquire(self);
+	unsigned int changes = diff_config_values(&current->values, &pending->values, true);
+	snapshot_release(current);
+
+	snapshot_release(pending);
+	return changes;
+}
+
+/*
+ * A config holding a copy of values, without files to watch, lists, game or thread sections
+ */
+static GameModeConfig *config_from_values(const struct GameModeConfigValues *values)
+{
+	GameModeConfig *config = config_create();
+	struct GameModeConfigSnapshot *snapshot = malloc(sizeof(*snapshot));
+	if (!config || !snapshot) {
+		free(config);
+		free(snapshot);
+		return NULL;
+	}
+
+	atomic_init(&snapshot->refcount, 1);
+	snapshot->values = *values;
+	snapshot->values.whitelist = NULL;
+	snapshot->values.blacklist = NULL;
+	snapshot->values.supervisor_whitelist = NULL;
+	snapshot->values.supervisor_blacklist = NULL;
+	memset(&snapshot->values.games, 0, sizeof(snapshot->values.games));
+	memset(&snapshot->values.threads, 0, sizeof(snapshot->values.threads));
+
+	pthread_rwlock_init(&config->rwlock, NULL);
+	config->inotfd = -1;
+	for (unsigned int i = 0; i < CONFIG_NUM_LOCATIONS; i++)
+		config->inotwd[i] = -1;
+	atomic_init(&config->readers, 0);
+	atomic_init(&config->snapshot, snapshot);
+
+	return config;
+}
+
+/*
+ * Resolve the config for an executable, applying every matching game section in file order
+ */
+GameModeConfig *config_for_executable(GameModeConfig *self, const char *executable)
+{
+	struct GameModeConfigSnapshot *base = snapshot_acquire(self);
+	const struct ConfigGameProfiles *games = &base->values.games;
+	GameModeConfig *config = NULL;
+
+	for (size_t i = 0; i < games->count; i++) {
+		const struct ConfigGameProfile *profile = &games->list[i];
+		if (!game_mode_matcher_match(profile->matcher, executable))
+			continue;
+
+		if (!config && !(config = config_from_values(&base->values))) {
+			LOG_ERROR("Failed to allocate memory for the game profile of [%s]\n", executable);
+			break;
+		}
+
+		LOG_MSG("Applying [" CONFIG_GAME_SECTION "%s] to [%s]\n", profile->pattern, executable);
+
+		/* Nobody else has seen the new config yet */
+		struct GameModeConfigValues *values = &atomic_load(&config->snapshot)->values;
+		for (size_t j = 0; j < profile->num_settings; j++) {
+			const struct ConfigGameSetting *setting = &profile->settings[j];
+			parse_config_value(values,
+			                   setting->protected,
+			                   setting->section,
+			                   setting->name,
+			                   setting->value);
+		}
+	}
+
+	snapshot_release(base);
+	return config;
+}
+
+/*
+ * Resolve the system wide settings, the last game in registration order with a profile wins
+ */
+GameModeConfig *config_for_games(GameModeConfig *self, const char *const *executables,
+                                 size_t count)
+{
+	for (size_t i = count; i-- > 0;) {
+		GameModeConfig *config = config_for_executable(self, executables[i]);
+		if (config) {
+			LOG_MSG("System wide settings follow the profile of [%s]\n", executables[i]);
+			return config;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Compare the settings a game section can override
+ */
+unsigned int config_compare(GameModeConfig *a, GameModeConfig *b)
 {
-	internal_destroy(self);
+	if (a == b)
+		return 0;
 
-	config_init(self);
+	struct GameModeConfigSnapshot *x = snapshot_acquire(a);
+	struct GameModeConfigSnapshot *y = snapshot_acquire(b);
+	unsigned int changes = diff_config_values(&x->values, &y->values, false);
+	snapshot_release(y);
+	snapshot_release(x);
+
+	return changes & CONFIG_CHANGE_GAME;
 }
 
 /*
@@ -613,12 +1374,25 @@ bool config_needs_reload(GameModeConfig *self)
 	return need;
 }
 
+/*
+ * Get the inotify fd for the config files
+ */
+int config_get_inotify_fd(GameModeConfig *self)
+{
+	pthread_rwlock_rdlock(&self->rwlock);
+	int fd = self->inotfd;
+	pthread_rwlock_unlock(&self->rwlock);
+	return fd;
+}
+
 /*
  * Destroy the config
  */
 void config_destroy(GameModeConfig *self)
 {
-	internal_destroy(self);
+	watch_destroy(self);
+	pthread_rwlock_destroy(&self->rwlock);
+	snapshot_release(atomic_load(&self->snapshot));
 
 	/* Finally, free the memory */
 	free(self);
@@ -629,21 +1403,13 @@ void config_destroy(GameModeConfig *self)
  */
 bool config_get_client_whitelisted(GameModeConfig *self, const char *client)
 {
-	/* Take the read lock for the internal data */
-	pthread_rwlock_rdlock(&self->rwlock);
+	struct GameModeConfigSnapshot *snapshot = snapshot_acquire(self);
 
 	/* If the whitelist is empty then everything passes */
-	bool found = true;
-	if (self->values.whitelist[0][0]) {
-		/*
-		 * Check if the value is found in our whitelist
-		 * Currently is a simple strstr check, but could be modified for wildcards etc.
-		 */
-		found = config_string_list_contains(client, self->values.whitelist);
-	}
+	bool found = game_mode_matcher_empty(snapshot->values.whitelist) ||
+	             game_mode_matcher_match(snapshot->values.whitelist, client);
 
-	/* release the lock */
-	pthread_rwlock_unlock(&self->rwlock);
+	snapshot_release(snapshot);
 	return found;
 }
 
@@ -652,17 +1418,11 @@ bool config_get_client_whitelisted(GameModeConfig *self, const char *client)
  */
 bool config_get_client_blacklisted(GameModeConfig *self, const char *client)
 {
-	/* Take the read lock for the internal data */
-	pthread_rwlock_rdlock(&self->rwlock);
+	struct GameModeConfigSnapshot *snapshot = snapshot_acquire(self);
 
-	/*
-	 * Check if the value is found in our whitelist
-	 * Currently is a simple strstr check, but could be modified for wildcards etc.
-	 */
-	bool found = config_string_list_contains(client, self->values.blacklist);
+	bool found = game_mode_matcher_match(snapshot->values.blacklist, client);
 
-	/* release the lock */
-	pthread_rwlock_unlock(&self->rwlock);
+	snapshot_release(snapshot);
 	return found;
 }
 
@@ -677,17 +1437,66 @@ DEFINE_CONFIG_GET(reaper_frequency)
 bool config_get_inhibit_screensaver(GameModeConfig *self)
 {
 	long val;
-	memcpy_locked_config(self, &val, &self->values.inhibit_screensaver, sizeof(long));
+	COPY_CONFIG_VALUE(self, &val, inhibit_screensaver);
 	return val == 1;
 }
 
+/*
+ * Gets the utilisation clamps of game threads, 0..1024 or -1 to leave them alone
+ */
+DEFINE_CONFIG_GET(uclamp_min)
+DEFINE_CONFIG_GET(uclamp_max)
+
+/*
+ * Gets whether the processes a client starts are optimised along with it
+ */
+bool config_get_track_process_tree(GameModeConfig *self)
+{
+	long val;
+	COPY_CONFIG_VALUE(self, &val, track_process_tree);
+	return val == 1;
+}
+
+/*
+ * Gets whether games are moved into cgroups of their own
+ */
+bool config_get_use_cgroup(GameModeConfig *self)
+{
+	long val;
+	COPY_CONFIG_VALUE(self, &val, use_cgroup);
+	return val == 1;
+}
+
+/*
+ * Gets the settings for the cgroups of games, and for the other cgroups while in game mode
+ */
+DEFINE_CONFIG_GET(cgroup_cpu_weight)
+DEFINE_CONFIG_GET(cgroup_io_weight)
+DEFINE_CONFIG_GET(background_cpu_weight)
+DEFINE_CONFIG_GET(background_io_weight)
+
+void config_get_cgroup_memory_low(GameModeConfig *self, char value[CONFIG_VALUE_MAX])
+{
+	COPY_CONFIG_VALUE(self, value, cgroup_memory_low);
+}
+
 /*
  * Gets the disable splitlock setting
  */
 bool config_get_disable_splitlock(GameModeConfig *self)
 {
 	long val;
-	memcpy_locked_config(self, &val, &self->values.disable_splitlock, sizeof(long));
+	COPY_CONFIG_VALUE(self, &val, disable_splitlock);
+	return val == 1;
+}
+
+/*
+ * Gets whether privileged changes go through the resident helper rather than pkexec each time
+ */
+bool config_get_resident_helper(GameModeConfig *self)
+{
+	long val;
+	COPY_CONFIG_VALUE(self, &val, resident_helper);
 	return val == 1;
 }
 
@@ -697,10 +1506,7 @@ bool config_get_disable_splitlock(GameModeConfig *self)
 void config_get_gamemode_start_scripts(GameModeConfig *self,
                                        char scripts[CONFIG_LIST_MAX][CONFIG_VALUE_MAX])
 {
-	memcpy_locked_config(self,
-	                     scripts,
-	                     self->values.startscripts,
-	                     sizeof(self->values.startscripts));
+	COPY_CONFIG_VALUE(self, scripts, startscripts);
 }
 
 /*
@@ -709,7 +1515,7 @@ void config_get_gamemode_start_scripts(GameModeConfig *self,
 void config_get_gamemode_end_scripts(GameModeConfig *self,
                                      char scripts[CONFIG_LIST_MAX][CONFIG_VALUE_MAX])
 {
-	memcpy_locked_config(self, scripts, self->values.endscripts, sizeof(self->values.startscripts));
+	COPY_CONFIG_VALUE(self, scripts, endscripts);
 }
 
 /*
@@ -722,7 +1528,7 @@ DEFINE_CONFIG_GET(script_timeout)
  */
 void config_get_default_governor(GameModeConfig *self, char governor[CONFIG_VALUE_MAX])
 {
-	memcpy_locked_config(self, governor, self->values.defaultgov, sizeof(self->values.defaultgov));
+	COPY_CONFIG_VALUE(self, governor, defaultgov);
 }
 
 /*
@@ -730,7 +1536,7 @@ void config_get_default_governor(GameModeConfig *self, char governor[CONFIG_VALU
  */
 void config_get_desired_governor(GameModeConfig *self, char governor[CONFIG_VALUE_MAX])
 {
-	memcpy_locked_config(self, governor, self->values.desiredgov, sizeof(self->values.desiredgov));
+	COPY_CONFIG_VALUE(self, governor, desiredgov);
 }
 
 /*
@@ -738,7 +1544,7 @@ void config_get_desired_governor(GameModeConfig *self, char governor[CONFIG_VALU
  */
 void config_get_default_profile(GameModeConfig *self, char profile[CONFIG_VALUE_MAX])
 {
-	memcpy_locked_config(self, profile, self->values.defaultprof, sizeof(self->values.defaultprof));
+	COPY_CONFIG_VALUE(self, profile, defaultprof);
 }
 
 /*
@@ -746,7 +1552,7 @@ void config_get_default_profile(GameModeConfig *self, char profile[CONFIG_VALUE_
  */
 void config_get_desired_profile(GameModeConfig *self, char profile[CONFIG_VALUE_MAX])
 {
-	memcpy_locked_config(self, profile, self->values.desiredprof, sizeof(self->values.desiredprof));
+	COPY_CONFIG_VALUE(self, profile, desiredprof);
 }
 
 /*
@@ -754,10 +1560,7 @@ void config_get_desired_profile(GameModeConfig *self, char profile[CONFIG_VALUE_
  */
 void config_get_igpu_desired_governor(GameModeConfig *self, char governor[CONFIG_VALUE_MAX])
 {
-	memcpy_locked_config(self,
-	                     governor,
-	                     self->values.igpu_desiredgov,
-	                     sizeof(self->values.igpu_desiredgov));
+	COPY_CONFIG_VALUE(self, governor, igpu_desiredgov);
 }
 
 /*
@@ -766,7 +1569,7 @@ void config_get_igpu_desired_governor(GameModeConfig *self, char governor[CONFIG
 float config_get_igpu_power_threshold(GameModeConfig *self)
 {
 	float value = 0;
-	memcpy_locked_config(self, &value, &self->values.igpu_power_threshold, sizeof(float));
+	COPY_CONFIG_VALUE(self, &value, igpu_power_threshold);
 	/* Validate the threshold value */
 	if (isnan(value) || value < 0) {
 		LOG_ONCE(ERROR,
@@ -783,19 +1586,29 @@ float config_get_igpu_power_threshold(GameModeConfig *self)
  */
 void config_get_soft_realtime(GameModeConfig *self, char softrealtime[CONFIG_VALUE_MAX])
 {
-	memcpy_locked_config(self,
-	                     softrealtime,
-	                     self->values.softrealtime,
-	                     sizeof(self->values.softrealtime));
+	COPY_CONFIG_VALUE(self, softrealtime, softrealtime);
 }
 
+/*
+ * Get the realtime policy used on kernels without SCHED_ISO, empty for the default
+ */
+void config_get_soft_realtime_fallback(GameModeConfig *self, char value[CONFIG_VALUE_MAX])
+{
+	COPY_CONFIG_VALUE(self, value, softrealtime_fallback);
+}
+
+/*
+ * Get the share of a core a realtime thread may use before it is demoted, in percent
+ */
+DEFINE_CONFIG_GET(softrealtime_budget)
+
 /*
  * Get the renice value
  */
 long config_get_renice_value(GameModeConfig *self)
 {
 	long value = 0;
-	memcpy_locked_config(self, &value, &self->values.renice, sizeof(long));
+	COPY_CONFIG_VALUE(self, &value, renice);
 	/* Validate the renice value */
 	if ((value < 1 || value > 20) && value != 0) {
 		LOG_ONCE(ERROR, "Configured renice value '%ld' is invalid, will not renice.\n", value);
@@ -811,12 +1624,12 @@ long config_get_ioprio_value(GameModeConfig *self)
 {
 	long value = 0;
 	char ioprio_value[CONFIG_VALUE_MAX] = { 0 };
-	memcpy_locked_config(self, ioprio_value, &self->values.ioprio, sizeof(self->values.ioprio));
+	COPY_CONFIG_VALUE(self, ioprio_value, ioprio);
 
 	/* account for special string values */
-	if (0 == strncmp(ioprio_value, "off", sizeof(self->values.ioprio)))
+	if (0 == strncmp(ioprio_value, "off", sizeof(ioprio_value)))
 		value = IOPRIO_DONT_SET;
-	else if (0 == strncmp(ioprio_value, "default", sizeof(self->values.ioprio)))
+	else if (0 == strncmp(ioprio_value, "default", sizeof(ioprio_value)))
 		value = IOPRIO_RESET_DEFAULT;
 	else
 		value = atoi(ioprio_value);
@@ -844,10 +1657,7 @@ long config_get_ioprio_value(GameModeConfig *self)
  */
 void config_get_apply_gpu_optimisations(GameModeConfig *self, char value[CONFIG_VALUE_MAX])
 {
-	memcpy_locked_config(self,
-	                     value,
-	                     &self->values.apply_gpu_optimisations,
-	                     sizeof(self->values.apply_gpu_optimisations));
+	COPY_CONFIG_VALUE(self, value, apply_gpu_optimisations);
 }
 
 /* Define the getters for GPU values */
@@ -859,16 +1669,9 @@ DEFINE_CONFIG_GET(nv_per_profile_editable)
 
 void config_get_amd_performance_level(GameModeConfig *self, char value[CONFIG_VALUE_MAX])
 {
-	memcpy_locked_config(self,
-	                     value,
-	                     &self->values.amd_performance_level,
-	                     sizeof(self->values.amd_performance_level));
+	COPY_CONFIG_VALUE(self, value, amd_performance_level);
 }
 
-/*
-        char supervisor_whitelist[CONFIG_LIST_MAX][CONFIG_VALUE_MAX];
-        char supervisor_blacklist[CONFIG_LIST_MAX][CONFIG_VALUE_MAX];
-*/
 DEFINE_CONFIG_GET(require_supervisor)
 
 /*
@@ -876,34 +1679,100 @@ DEFINE_CONFIG_GET(require_supervisor)
  */
 void config_get_cpu_park_cores(GameModeConfig *self, char value[CONFIG_VALUE_MAX])
 {
-	memcpy_locked_config(self,
-	                     value,
-	                     &self->values.cpu_park_cores,
-	                     sizeof(self->values.cpu_park_cores));
+	COPY_CONFIG_VALUE(self, value, cpu_park_cores);
 }
 
 void config_get_cpu_pin_cores(GameModeConfig *self, char value[CONFIG_VALUE_MAX])
 {
-	memcpy_locked_config(self,
-	                     value,
-	                     &self->values.cpu_pin_cores,
-	                     sizeof(self->values.cpu_pin_cores));
+	COPY_CONFIG_VALUE(self, value, cpu_pin_cores);
+}
+
+void config_get_cpu_smt_siblings(GameModeConfig *self, char value[CONFIG_VALUE_MAX])
+{
+	COPY_CONFIG_VALUE(self, value, cpu_smt_siblings);
+}
+
+/*
+ * Gets whether other work is kept off the pinned cores
+ */
+bool config_get_cpu_isolate_cores(GameModeConfig *self)
+{
+	long val;
+	COPY_CONFIG_VALUE(self, &val, cpu_isolate_cores);
+	return val == 1;
+}
+
+/*
+ * Gets whether games get a core scheduling cookie of their own
+ */
+bool config_get_core_scheduling(GameModeConfig *self)
+{
+	long val;
+	COPY_CONFIG_VALUE(self, &val, core_scheduling);
+	return val == 1;
 }
 
 void config_get_amd_x3d_mode_desired(GameModeConfig *self, char value[CONFIG_VALUE_MAX])
 {
-	memcpy_locked_config(self,
-	                     value,
-	                     &self->values.amd_x3d_mode_desired,
-	                     sizeof(self->values.amd_x3d_mode_desired));
+	COPY_CONFIG_VALUE(self, value, amd_x3d_mode_desired);
 }
 
 void config_get_amd_x3d_mode_default(GameModeConfig *self, char value[CONFIG_VALUE_MAX])
 {
-	memcpy_locked_config(self,
-	                     value,
-	                     &self->values.amd_x3d_mode_default,
-	                     sizeof(self->values.amd_x3d_mode_default));
+	COPY_CONFIG_VALUE(self, value, amd_x3d_mode_default);
+}
+
+/*
+ * Get the number of thread roles
+ */
+long config_get_thread_role_count(GameModeConfig *self)
+{
+	struct GameModeConfigSnapshot *snapshot = snapshot_acquire(self);
+	long count = (long)snapshot->values.threads.count;
+	snapshot_release(snapshot);
+	return count;
+}
+
+/*
+ * Find a thread role by the name of its section
+ */
+int config_get_thread_role_by_name(GameModeConfig *self, const char *name, ConfigThreadRole *role)
+{
+	struct GameModeConfigSnapshot *snapshot = snapshot_acquire(self);
+	const struct ConfigThreadRoles *threads = &snapshot->values.threads;
+	int index = -1;
+
+	for (size_t i = 0; i < threads->count; i++) {
+		if (strcmp(threads->list[i].role.name, name) == 0) {
+			*role = threads->list[i].role;
+			index = (int)i;
+			break;
+		}
+	}
+
+	snapshot_release(snapshot);
+	return index;
+}
+
+/*
+ * Find the role of a thread, the first section with a pattern matching its name wins
+ */
+int config_get_thread_role(GameModeConfig *self, const char *comm, ConfigThreadRole *role)
+{
+	struct GameModeConfigSnapshot *snapshot = snapshot_acquire(self);
+	const struct ConfigThreadRoles *threads = &snapshot->values.threads;
+	int index = -1;
+
+	for (size_t i = 0; i < threads->count; i++) {
+		if (game_mode_matcher_match(threads->list[i].matcher, comm)) {
+			*role = threads->list[i].role;
+			index = (int)i;
+			break;
+		}
+	}
+
+	snapshot_release(snapshot);
+	return index;
 }
 
 /*
@@ -911,21 +1780,13 @@ void config_get_amd_x3d_mode_default(GameModeConfig *self, char value[CONFIG_VAL
  */
 bool config_get_supervisor_whitelisted(GameModeConfig *self, const char *supervisor)
 {
-	/* Take the read lock for the internal data */
-	pthread_rwlock_rdlock(&self->rwlock);
+	struct GameModeConfigSnapshot *snapshot = snapshot_acquire(self);
 
 	/* If the whitelist is empty then everything passes */
-	bool found = true;
-	if (self->values.supervisor_whitelist[0][0]) {
-		/*
-		 * Check if the value is found in our whitelist
-		 * Currently is a simple strstr check, but could be modified for wildcards etc.
-		 */
-		found = config_string_list_contains(supervisor, self->values.supervisor_whitelist);
-	}
+	bool found = game_mode_matcher_empty(snapshot->values.supervisor_whitelist) ||
+	             game_mode_matcher_match(snapshot->values.supervisor_whitelist, supervisor);
 
-	/* release the lock */
-	pthread_rwlock_unlock(&self->rwlock);
+	snapshot_release(snapshot);
 	return found;
 }
 
@@ -934,16 +1795,10 @@ bool config_get_supervisor_whitelisted(GameModeConfig *self, const char *supervi
  */
 bool config_get_supervisor_blacklisted(GameModeConfig *self, const char *supervisor)
 {
-	/* Take the read lock for the internal data */
-	pthread_rwlock_rdlock(&self->rwlock);
+	struct GameModeConfigSnapshot *snapshot = snapshot_acquire(self);
 
-	/*
-	 * Check if the value is found in our whitelist
-	 * Currently is a simple strstr check, but could be modified for wildcards etc.
-	 */
-	bool found = config_string_list_contains(supervisor, self->values.supervisor_blacklist);
+	bool found = game_mode_matcher_match(snapshot->values.supervisor_blacklist, supervisor);
 
-	/* release the lock */
-	pthread_rwlock_unlock(&self->rwlock);
+	snapshot_release(snapshot);
 	return found;
 }
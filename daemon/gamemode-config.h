@@ -31,6 +31,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
 
 /*
  * Maximum sizes values in a config list
@@ -46,6 +47,55 @@ POSSIBILITY OF SUCH DAMAGE.
 #define IOPRIO_DONT_SET -2
 #define IOPRIO_DEFAULT 4
 
+/*
+ * Groups of config values, telling which parts of gamemode a config reload affects
+ */
+enum ConfigChange {
+	CONFIG_CHANGE_CLIENTS = 1 << 0,     /* Which clients and supervisors are accepted */
+	CONFIG_CHANGE_SCRIPTS = 1 << 1,     /* Custom scripts, only run on the next enter or leave */
+	CONFIG_CHANGE_DEFAULTS = 1 << 2,    /* Values restored when leaving */
+	CONFIG_CHANGE_REAPER = 1 << 3,      /* Reaper frequency */
+	CONFIG_CHANGE_GOVERNOR = 1 << 4,    /* Desired governors and the igpu heuristic */
+	CONFIG_CHANGE_PROFILE = 1 << 5,     /* Desired platform profile */
+	CONFIG_CHANGE_SCREENSAVER = 1 << 6, /* Screensaver inhibition */
+	CONFIG_CHANGE_SPLITLOCK = 1 << 7,   /* Split lock mitigation */
+	CONFIG_CHANGE_X3D_MODE = 1 << 8,    /* Desired AMD X3D mode */
+	CONFIG_CHANGE_GPU = 1 << 9,         /* GPU optimisations */
+	CONFIG_CHANGE_CPU = 1 << 10,        /* Core parking and pinning */
+	CONFIG_CHANGE_CLIENT_OPTS = 1 << 11, /* Per client scheduling, renice and ioprio */
+	CONFIG_CHANGE_GAMES = 1 << 12,       /* The [game:<pattern>] sections */
+	CONFIG_CHANGE_THREADS = 1 << 13,     /* The [thread:<role>] sections */
+	CONFIG_CHANGE_THROTTLE = 1 << 14,    /* Throttling of other work while in game mode */
+	CONFIG_CHANGE_HELPER = 1 << 15       /* Use of the resident privileged helper */
+};
+
+/*
+ * The groups a [game:<pattern>] section can override
+ */
+#define CONFIG_CHANGE_GAME                                                                         \
+	(CONFIG_CHANGE_GOVERNOR | CONFIG_CHANGE_PROFILE | CONFIG_CHANGE_SCREENSAVER |                  \
+	 CONFIG_CHANGE_SPLITLOCK | CONFIG_CHANGE_X3D_MODE | CONFIG_CHANGE_GPU | CONFIG_CHANGE_CPU |    \
+	 CONFIG_CHANGE_CLIENT_OPTS | CONFIG_CHANGE_THROTTLE)
+
+/*
+ * Special value for the thread role settings that keep the client's setting
+ */
+#define CONFIG_ROLE_UNSET -128
+
+/*
+ * The settings of a [thread:<role>] section, for the client threads with a matching name
+ */
+typedef struct ConfigThreadRole {
+	char name[CONFIG_VALUE_MAX];
+	char cores[CONFIG_VALUE_MAX];  /* pinned, unpinned, all or a cpu list, empty for pin_cores */
+	long nice;                     /* -20..19, or CONFIG_ROLE_UNSET for renice */
+	long ioprio;                   /* 0..7, or CONFIG_ROLE_UNSET for ioprio */
+	long uclamp_min;               /* 0..1024, or CONFIG_ROLE_UNSET for uclamp_min */
+	long uclamp_max;               /* 0..1024, or CONFIG_ROLE_UNSET for uclamp_max */
+	long softrealtime;             /* 0 or 1, or CONFIG_ROLE_UNSET for the default */
+	char policy[CONFIG_VALUE_MAX]; /* normal, batch or idle, empty to keep the policy */
+} ConfigThreadRole;
+
 /*
  * Opaque config context type
  */
@@ -64,15 +114,47 @@ void config_init(GameModeConfig *self);
 
 /*
  * Reload a config from disk
- * Thread safe to call
+ * Thread safe to call, returns a mask of the ConfigChange groups that changed
+ */
+unsigned int config_reload(GameModeConfig *self);
+
+/*
+ * Read the config files without reloading them
+ * Returns a mask of the ConfigChange groups a reload would change, and logs the changed keys
  */
-void config_reload(GameModeConfig *self);
+unsigned int config_pending_changes(GameModeConfig *self);
+
+/*
+ * Resolve the config for an executable from the [game:<pattern>] sections matching it
+ * Returns NULL when no section matches, otherwise a config that has to be destroyed
+ */
+GameModeConfig *config_for_executable(GameModeConfig *self, const char *executable);
+
+/*
+ * Resolve the system wide settings for games running at once, listed in the order they registered
+ * The most recently registered game with a matching section decides them
+ * Returns NULL when none has one and the global settings apply, otherwise a config to destroy
+ */
+GameModeConfig *config_for_games(GameModeConfig *self, const char *const *executables,
+                                 size_t count);
+
+/*
+ * Compare the settings of two configs
+ * Returns a mask of the ConfigChange groups that differ, out of CONFIG_CHANGE_GAME
+ */
+unsigned int config_compare(GameModeConfig *a, GameModeConfig *b);
 
 /*
  * Check if the config has changed and will need a reload
  */
 bool config_needs_reload(GameModeConfig *self);
 
+/*
+ * Get the inotify fd used to watch the config files, or -1 if unavailable
+ * The fd is replaced by config_reload
+ */
+int config_get_inotify_fd(GameModeConfig *self);
+
 /*
  * Destroy a config
  * Invalidates the config
@@ -107,9 +189,21 @@ void config_get_desired_profile(GameModeConfig *self, char profile[CONFIG_VALUE_
 void config_get_igpu_desired_governor(GameModeConfig *self, char governor[CONFIG_VALUE_MAX]);
 float config_get_igpu_power_threshold(GameModeConfig *self);
 void config_get_soft_realtime(GameModeConfig *self, char softrealtime[CONFIG_VALUE_MAX]);
+void config_get_soft_realtime_fallback(GameModeConfig *self, char value[CONFIG_VALUE_MAX]);
+long config_get_softrealtime_budget(GameModeConfig *self);
 long config_get_renice_value(GameModeConfig *self);
 long config_get_ioprio_value(GameModeConfig *self);
+long config_get_uclamp_min(GameModeConfig *self);
+long config_get_uclamp_max(GameModeConfig *self);
+bool config_get_track_process_tree(GameModeConfig *self);
+bool config_get_use_cgroup(GameModeConfig *self);
+long config_get_cgroup_cpu_weight(GameModeConfig *self);
+long config_get_cgroup_io_weight(GameModeConfig *self);
+void config_get_cgroup_memory_low(GameModeConfig *self, char value[CONFIG_VALUE_MAX]);
+long config_get_background_cpu_weight(GameModeConfig *self);
+long config_get_background_io_weight(GameModeConfig *self);
 bool config_get_disable_splitlock(GameModeConfig *self);
+bool config_get_resident_helper(GameModeConfig *self);
 
 /*
  * Get various config info for gpu optimisations
@@ -127,6 +221,9 @@ void config_get_amd_performance_level(GameModeConfig *self, char value[CONFIG_VA
  */
 void config_get_cpu_park_cores(GameModeConfig *self, char value[CONFIG_VALUE_MAX]);
 void config_get_cpu_pin_cores(GameModeConfig *self, char value[CONFIG_VALUE_MAX]);
+void config_get_cpu_smt_siblings(GameModeConfig *self, char value[CONFIG_VALUE_MAX]);
+bool config_get_cpu_isolate_cores(GameModeConfig *self);
+bool config_get_core_scheduling(GameModeConfig *self);
 void config_get_amd_x3d_mode_desired(GameModeConfig *self, char value[CONFIG_VALUE_MAX]);
 void config_get_amd_x3d_mode_default(GameModeConfig *self, char value[CONFIG_VALUE_MAX]);
 
@@ -136,3 +233,12 @@ void config_get_amd_x3d_mode_default(GameModeConfig *self, char value[CONFIG_VAL
 long config_get_require_supervisor(GameModeConfig *self);
 bool config_get_supervisor_whitelisted(GameModeConfig *self, const char *supervisor);
 bool config_get_supervisor_blacklisted(GameModeConfig *self, const char *supervisor);
+
+/*
+ * Functions to get the thread roles
+ * config_get_thread_role returns the index of the first role matching a thread name and fills
+ * in role, or -1 when none does. config_get_thread_role_by_name does the same for a section name
+ */
+long config_get_thread_role_count(GameModeConfig *self);
+int config_get_thread_role(GameModeConfig *self, const char *comm, ConfigThreadRole *role);
+int config_get_thread_role_by_name(GameModeConfig *self, const char *name, ConfigThreadRole *role);
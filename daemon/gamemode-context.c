@@ -35,6 +35,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "common-governors.h"
 #include "common-helpers.h"
 #include "common-logging.h"
+#include "common-pidfds.h"
 #include "common-power.h"
 #include "common-profile.h"
 #include "common-splitlock.h"
@@ -50,21 +51,39 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <signal.h>
 #include <stdatomic.h>
 #include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/time.h>
 #include <systemd/sd-daemon.h> /* TODO: Move usage to gamemode-dbus.c */
 #include <unistd.h>
 
+#ifdef USE_ELOGIND
+#include <elogind/sd-event.h>
+#else
+#include <systemd/sd-event.h>
+#endif
+
+/* How often the threads in the fallback realtime policies are checked on */
+#define RT_WATCHDOG_PERIOD_USEC (250 * 1000ULL)
+
 /**
- * The GameModeClient encapsulates the remote connection, providing a list
- * form to contain the pid and credentials.
+ * The GameModeClient encapsulates the remote connection, containing the pid
+ * and credentials. Clients are indexed by pid in the context's client table.
  */
 struct GameModeClient {
-	_Atomic int refcount;        /**<Allow outside usage */
-	pid_t pid;                   /**< Process ID */
-	pid_t requester;             /**< Process ID that requested it */
-	struct GameModeClient *next; /**<Next client in the list */
-	char executable[PATH_MAX];   /**<Process executable */
-	time_t timestamp;            /**<When was the client registered */
+	_Atomic int refcount;          /**<Allow outside usage */
+	pid_t pid;                     /**< Process ID */
+	pid_t requester;               /**< Process ID that requested it */
+	int pidfd;                     /**<Process file descriptor, or -1 if unsupported */
+	sd_event_source *exit_source;  /**<Fires when the pidfd reports the process exited */
+	char *executable;              /**<Process executable */
+	time_t timestamp;              /**<When was the client registered */
+	GameModeConfig *config;        /**<Config from the matching game sections, or NULL */
+	GameModeCPUInfo *cpu;          /**<Core pinning for config, or NULL */
+	GameModeThreads *threads;      /**<What was applied to each thread, needs the write lock */
+	GameModePidTable *descendants; /**<Threads of the processes tracked with it, keyed by pid */
+	unsigned int cgroup;           /**<GameModeCgroupApplied, 0 while not in a cgroup of its own */
+	bool sched_core;               /**<Has a core scheduling cookie of its own */
 };
 
 enum GameModeGovernor {
@@ -79,12 +98,17 @@ enum GameModeProfile {
 };
 
 struct GameModeContext {
-	pthread_rwlock_t rwlock; /**<Guard access to the client list */
-	_Atomic int refcount;    /**<Allow cycling the game mode */
-	GameModeClient *client;  /**<Pointer to first client */
+	pthread_rwlock_t rwlock;       /**<Guard access to the client table */
+	_Atomic int refcount;          /**<Allow cycling the game mode */
+	GameModePidTable *clients;     /**<Registered clients, keyed by pid */
+	GameModePidTable *descendants; /**<Client of each tracked descendant process, keyed by pid */
 
 	GameModeConfig *config; /**<Pointer to config object */
 
+	/* Config of the game deciding the system wide settings, NULL while that is the global one.
+	 * Guarded by state_lock */
+	GameModeConfig *system_config;
+
 	char initial_cpu_mode[64]; /**<Only updates when we can */
 
 	enum GameModeGovernor current_govenor;
@@ -96,6 +120,14 @@ struct GameModeContext {
 	struct GameModeGPUInfo *target_gpu; /**<Target GPU info for the current GPU */
 
 	struct GameModeCPUInfo *cpu; /**<Stored CPU info for the current CPU */
+	GameModeTopology *topology;  /**<Replaced under the write lock when cores are hotplugged */
+
+	/* Cgroups of the games, set up for the first game using them. Guarded by the write lock */
+	GameModeCgroups *cgroups;
+	bool cgroups_unavailable;
+
+	GameModeThrottle *throttle;   /**<Other work throttled while in game mode */
+	GameModeIsolation *isolation; /**<Other work kept off the pinned cores while in game mode */
 
 	GameModeIdleInhibitor *idle_inhibitor;
 
@@ -107,13 +139,35 @@ struct GameModeContext {
 
 	char initial_x3d_mode[64]; /**<Initial x3d mode to restore */
 
-	/* Reaper control */
+	/* Held while the system wide optimisations are being entered or left */
+	pthread_mutex_t state_lock;
+
+	/* Asynchronous transitions in and out of game mode */
 	struct {
 		pthread_t thread;
-		bool running;
-		pthread_mutex_t mutex;
+		pthread_mutex_t mutex; /**<Guards the fields below */
 		pthread_cond_t condition;
-	} reaper;
+		bool running;
+		bool target;    /**<Whether game mode should be active */
+		bool applied;   /**<Whether game mode is currently applied */
+		bool restart;   /**<Re-apply what drifted while in game mode */
+		bool reload;    /**<Reload the config, re-applying what changed */
+		bool reprofile; /**<A client with a game profile registered or unregistered */
+		bool reloaded;  /**<A reload finished, the main loop has to catch up */
+		enum GameModeState state;
+		int notify_fd; /**<eventfd telling the main loop about state changes */
+		sd_event_source *notify_source;
+	} transition;
+
+	/* Event sources on the daemon's main loop */
+	sd_event *event;
+	sd_event_source *reaper;       /**<Periodic work, only armed while clients are registered */
+	sd_event_source *rt_watchdog;  /**<Demotes realtime threads and promotes them again */
+	uint64_t rt_watchdog_last;     /**<When the watchdog last ran, in usec */
+	atomic_bool rt_watched;        /**<Threads hold or were demoted from a fallback policy */
+	sd_event_source *config_watch; /**<Config inotify, replaced on every config reload */
+	sd_event_source *proc_events;  /**<Process events, subscribed while clients are registered */
+	bool proc_events_unavailable;  /**<Subscribing failed, poll the clients' threads instead */
 };
 
 static GameModeContext instance = { 0 };
@@ -125,24 +179,263 @@ static volatile bool had_context_init = false;
 
 static GameModeClient *game_mode_client_new(pid_t pid, char *exe, pid_t req);
 static const GameModeClient *game_mode_context_has_client(GameModeContext *self, pid_t client);
-static void *game_mode_context_reaper(void *userdata);
+static int game_mode_context_reaper(sd_event_source *source, uint64_t usec, void *userdata);
+static int game_mode_context_rt_watchdog(sd_event_source *source, uint64_t usec, void *userdata);
+static int game_mode_context_config_changed(sd_event_source *source, int fd, uint32_t revents,
+                                            void *userdata);
+static int game_mode_context_client_exited(sd_event_source *source, int fd, uint32_t revents,
+                                           void *userdata);
+static int game_mode_context_transition_notified(sd_event_source *source, int fd,
+                                                 uint32_t revents, void *userdata);
+static int game_mode_context_proc_events(sd_event_source *source, int fd, uint32_t revents,
+                                         void *userdata);
+static void *game_mode_context_transition_worker(void *userdata);
+static int game_mode_apply_client_optimisations(GameModeContext *self, GameModeClient *cl);
+static int game_mode_remove_client_optimisations(GameModeContext *self, GameModeClient *cl);
+static void game_mode_client_leave_cgroup(GameModeContext *self, GameModeClient *cl);
+static void game_mode_client_leave_sched_core(GameModeClient *cl);
 static void game_mode_context_enter(GameModeContext *self);
 static void game_mode_context_leave(GameModeContext *self);
 static char *game_mode_context_find_exe(pid_t pid);
 static void game_mode_execute_scripts(char scripts[CONFIG_LIST_MAX][CONFIG_VALUE_MAX], int timeout);
 static int game_mode_disable_splitlock(GameModeContext *self, bool disable);
 
-static void start_reaper_thread(GameModeContext *self)
+/**
+ * Watch the pidfd of a newly registered client so it is expired as soon as it exits
+ * Caller must hold the write lock
+ */
+static void game_mode_context_watch_client(GameModeContext *self, GameModeClient *cl)
+{
+	if (cl->pidfd == -1)
+		return;
+
+	int r = sd_event_add_io(self->event,
+	                        &cl->exit_source,
+	                        cl->pidfd,
+	                        EPOLLIN,
+	                        game_mode_context_client_exited,
+	                        cl);
+	if (r < 0) {
+		LOG_ERROR("Failed to watch pidfd for %d, falling back to polling: %s\n",
+		          cl->pid,
+		          strerror(-r));
+		close(cl->pidfd);
+		cl->pidfd = -1;
+	}
+}
+
+/**
+ * Stop watching the pidfd of a client, this has to be explicit as outside
+ * references may keep the client alive
+ * Caller must hold the write lock
+ */
+static void game_mode_context_unwatch_client(GameModeClient *cl)
+{
+	cl->exit_source = sd_event_source_disable_unref(cl->exit_source);
+}
+
+/**
+ * Watch the config files for edits, the inotify fd changes with every reload
+ */
+static void game_mode_context_watch_config(GameModeContext *self)
+{
+	self->config_watch = sd_event_source_disable_unref(self->config_watch);
+
+	int fd = config_get_inotify_fd(self->config);
+	if (fd == -1)
+		return;
+
+	int r = sd_event_add_io(self->event,
+	                        &self->config_watch,
+	                        fd,
+	                        EPOLLIN,
+	                        game_mode_context_config_changed,
+	                        self);
+	if (r < 0)
+		LOG_ERROR("Failed to watch config files for edits: %s\n", strerror(-r));
+}
+
+/**
+ * Arm the realtime watchdog once threads got the fallback realtime policy, it keeps its own pace
+ * and stops by itself when there are none left
+ */
+static void game_mode_context_update_rt_watchdog(GameModeContext *self)
+{
+	if (!atomic_load(&self->rt_watched) || sd_event_source_get_enabled(self->rt_watchdog, NULL) > 0)
+		return;
+
+	uint64_t now = 0;
+	sd_event_now(self->event, CLOCK_MONOTONIC, &now);
+	self->rt_watchdog_last = now;
+	sd_event_source_set_time(self->rt_watchdog, now + RT_WATCHDOG_PERIOD_USEC);
+	sd_event_source_set_enabled(self->rt_watchdog, SD_EVENT_ONESHOT);
+}
+
+/**
+ * Arm the reaper timer while there are registered clients, so the daemon does
+ * not wake up at all while idle
+ *
+ * @param restart Reschedule the timer even if it is already pending
+ */
+static void game_mode_context_update_reaper(GameModeContext *self, bool restart)
+{
+	if (game_mode_context_num_clients(self) == 0) {
+		sd_event_source_set_enabled(self->reaper, SD_EVENT_OFF);
+		sd_event_source_set_enabled(self->rt_watchdog, SD_EVENT_OFF);
+		return;
+	}
+
+	uint64_t now = 0;
+	sd_event_now(self->event, CLOCK_MONOTONIC, &now);
+
+	game_mode_context_update_rt_watchdog(self);
+
+	if (!restart && sd_event_source_get_enabled(self->reaper, NULL) > 0)
+		return;
+
+	long interval = config_get_reaper_frequency(self->config);
+	sd_event_source_set_time(self->reaper, now + (uint64_t)interval * 1000000ULL);
+	sd_event_source_set_enabled(self->reaper, SD_EVENT_ONESHOT);
+}
+
+/* Unsubscribe from the process events */
+static void game_mode_context_unwatch_proc_events(GameModeContext *self)
+{
+	if (!self->proc_events)
+		return;
+
+	int fd = sd_event_source_get_io_fd(self->proc_events);
+	self->proc_events = sd_event_source_disable_unref(self->proc_events);
+	game_mode_proc_events_close(fd);
+}
+
+/**
+ * Subscribe to the process events while there are registered clients, so threads they create
+ * get the per client optimisations right away. Without clients the daemon would otherwise wake
+ * up for every fork on the system.
+ * Called from the main loop before the optimisations of a new client are applied, so none of
+ * its threads are missed
+ */
+static void game_mode_context_update_proc_events(GameModeContext *self)
+{
+	if (game_mode_context_num_clients(self) == 0) {
+		game_mode_context_unwatch_proc_events(self);
+		return;
+	}
+
+	if (self->proc_events || self->proc_events_unavailable)
+		return;
+
+	int fd = game_mode_proc_events_open();
+	if (fd < 0) {
+		LOG_MSG("Process events unavailable (%s), new threads are picked up every reaper_freq\n",
+		        strerror(-fd));
+		self->proc_events_unavailable = true;
+		return;
+	}
+
+	int r = sd_event_add_io(self->event,
+	                        &self->proc_events,
+	                        fd,
+	                        EPOLLIN,
+	                        game_mode_context_proc_events,
+	                        self);
+	if (r < 0) {
+		LOG_ERROR("Failed to watch process events: %s\n", strerror(-r));
+		game_mode_proc_events_close(fd);
+		self->proc_events_unavailable = true;
+	}
+}
+
+/* Whether the transition worker has something to do, caller must hold the transition mutex */
+static inline bool game_mode_transition_pending(const GameModeContext *self)
+{
+	return self->transition.target != self->transition.applied || self->transition.restart ||
+	       self->transition.reload || self->transition.reprofile;
+}
+
+/**
+ * Ask the transition worker to bring game mode in line with the registered
+ * clients, optionally restarting it, reloading the config or picking the game
+ * profile for the system wide settings on the way.
+ * Requests made while the worker is busy are coalesced into its next run.
+ */
+static void game_mode_context_queue_transition(GameModeContext *self, bool restart, bool reload,
+                                               bool reprofile)
+{
+	pthread_mutex_lock(&self->transition.mutex);
+
+	self->transition.target = atomic_load_explicit(&self->refcount, memory_order_seq_cst) > 0;
+	self->transition.restart |= restart && self->transition.target;
+	self->transition.reload |= reload;
+	self->transition.reprofile |= reprofile;
+
+	enum GameModeState previous = self->transition.state;
+	if (game_mode_transition_pending(self)) {
+		self->transition.state = self->transition.target ? GAME_MODE_STATE_ACTIVATING
+		                                                 : GAME_MODE_STATE_DEACTIVATING;
+		pthread_cond_signal(&self->transition.condition);
+	}
+	bool changed = previous != self->transition.state;
+
+	pthread_mutex_unlock(&self->transition.mutex);
+
+	if (changed)
+		game_mode_state_changed();
+}
+
+/* Wake up the main loop from the transition worker */
+static void game_mode_context_notify_transition(GameModeContext *self)
 {
-	pthread_mutex_init(&self->reaper.mutex, NULL);
-	pthread_cond_init(&self->reaper.condition, NULL);
+	uint64_t one = 1;
+	if (write(self->transition.notify_fd, &one, sizeof(one)) == -1)
+		LOG_ERROR("Failed to notify the main loop of a transition: %s\n", strerror(errno));
+}
 
-	self->reaper.running = true;
-	if (pthread_create(&self->reaper.thread, NULL, game_mode_context_reaper, self) != 0) {
+static void start_transition_worker(GameModeContext *self)
+{
+	pthread_mutex_init(&self->state_lock, NULL);
+	pthread_mutex_init(&self->transition.mutex, NULL);
+	pthread_cond_init(&self->transition.condition, NULL);
+
+	self->transition.state = GAME_MODE_STATE_INACTIVE;
+	self->transition.notify_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (self->transition.notify_fd == -1)
+		FATAL_ERROR("Couldn't create the transition eventfd: %s\n", strerror(errno));
+
+	int r = sd_event_add_io(self->event,
+	                        &self->transition.notify_source,
+	                        self->transition.notify_fd,
+	                        EPOLLIN,
+	                        game_mode_context_transition_notified,
+	                        self);
+	if (r < 0)
+		FATAL_ERROR("Couldn't watch the transition eventfd: %s\n", strerror(-r));
+
+	self->transition.running = true;
+	if (pthread_create(&self->transition.thread, NULL, game_mode_context_transition_worker, self) !=
+	    0) {
 		FATAL_ERROR("Couldn't construct a new thread");
 	}
 }
 
+static void end_transition_worker(GameModeContext *self)
+{
+	/* Any transition in progress is finished first */
+	pthread_mutex_lock(&self->transition.mutex);
+	self->transition.running = false;
+	pthread_cond_signal(&self->transition.condition);
+	pthread_mutex_unlock(&self->transition.mutex);
+
+	pthread_join(self->transition.thread, NULL);
+
+	self->transition.notify_source = sd_event_source_disable_unref(self->transition.notify_source);
+	close(self->transition.notify_fd);
+
+	pthread_cond_destroy(&self->transition.condition);
+	pthread_mutex_destroy(&self->transition.mutex);
+}
+
 void game_mode_context_init(GameModeContext *self)
 {
 	if (had_context_init) {
@@ -155,9 +448,15 @@ void game_mode_context_init(GameModeContext *self)
 	/* clear the initial string */
 	memset(self->initial_cpu_mode, 0, sizeof(self->initial_cpu_mode));
 
+	self->clients = game_mode_pidtable_new();
+	self->descendants = game_mode_pidtable_new();
+	if (!self->clients || !self->descendants)
+		FATAL_ERROR("Couldn't allocate the client table\n");
+
 	/* Initialise the config */
 	self->config = config_create();
 	config_init(self->config);
+	game_mode_use_resident_helper(config_get_resident_helper(self->config));
 
 	self->current_govenor = GAME_MODE_GOVERNOR_DEFAULT;
 
@@ -165,8 +464,9 @@ void game_mode_context_init(GameModeContext *self)
 	game_mode_initialise_gpu(self->config, &self->stored_gpu);
 	game_mode_initialise_gpu(self->config, &self->target_gpu);
 
-	/* Initialise the current CPU info */
-	game_mode_initialise_cpu(self->config, &self->cpu);
+	/* Initialise the current CPU info, from the layout of the cores read once here */
+	self->topology = game_mode_topology_new();
+	game_mode_initialise_cpu(self->config, self->topology, &self->cpu);
 
 	self->initial_split_lock_mitigate = -1;
 
@@ -175,24 +475,38 @@ void game_mode_context_init(GameModeContext *self)
 
 	pthread_rwlock_init(&self->rwlock, NULL);
 
-	/* Get the reaper thread going */
-	start_reaper_thread(self);
-}
-
-static void end_reaper_thread(GameModeContext *self)
-{
-	self->reaper.running = false;
-
-	/* We might be stuck waiting, so wake it up again */
-	pthread_mutex_lock(&self->reaper.mutex);
-	pthread_cond_signal(&self->reaper.condition);
-	pthread_mutex_unlock(&self->reaper.mutex);
-
-	/* Join the thread as soon as possible */
-	pthread_join(self->reaper.thread, NULL);
-
-	pthread_cond_destroy(&self->reaper.condition);
-	pthread_mutex_destroy(&self->reaper.mutex);
+	/* Everything runs on the thread's default loop, which the D-Bus loop shares */
+	int r = sd_event_default(&self->event);
+	if (r < 0)
+		FATAL_ERROR("Couldn't create the event loop: %s\n", strerror(-r));
+
+	/* The reaper stays off until the first client registers */
+	r = sd_event_add_time(self->event,
+	                      &self->reaper,
+	                      CLOCK_MONOTONIC,
+	                      0,
+	                      0,
+	                      game_mode_context_reaper,
+	                      self);
+	if (r < 0)
+		FATAL_ERROR("Couldn't create the reaper timer: %s\n", strerror(-r));
+	sd_event_source_set_enabled(self->reaper, SD_EVENT_OFF);
+
+	r = sd_event_add_time(self->event,
+	                      &self->rt_watchdog,
+	                      CLOCK_MONOTONIC,
+	                      0,
+	                      0,
+	                      game_mode_context_rt_watchdog,
+	                      self);
+	if (r < 0)
+		FATAL_ERROR("Couldn't create the realtime watchdog timer: %s\n", strerror(-r));
+	sd_event_source_set_enabled(self->rt_watchdog, SD_EVENT_OFF);
+
+	game_mode_context_watch_config(self);
+
+	/* Entering and leaving game mode happens off the main loop */
+	start_transition_worker(self);
 }
 
 void game_mode_context_destroy(GameModeContext *self)
@@ -201,15 +515,38 @@ void game_mode_context_destroy(GameModeContext *self)
 		return;
 	}
 
-	/* Leave game mode now */
-	if (game_mode_context_num_clients(self) > 0) {
+	/* Let any transition in progress finish, then leave game mode now */
+	end_transition_worker(self);
+	if (self->transition.applied) {
 		game_mode_context_leave(self);
+		self->transition.applied = false;
 	}
+	pthread_mutex_destroy(&self->state_lock);
 
 	had_context_init = false;
-	game_mode_client_unref(self->client);
 
-	end_reaper_thread(self);
+	size_t iter = 0;
+	void *cl = NULL;
+	while (game_mode_pidtable_next(self->clients, &iter, NULL, &cl)) {
+		/* Games in our cgroups would go down with the daemon's cgroup */
+		game_mode_client_leave_cgroup(self, cl);
+		game_mode_client_leave_sched_core(cl);
+		game_mode_context_unwatch_client(cl);
+		game_mode_client_unref(cl);
+	}
+	game_mode_pidtable_free(self->clients);
+	self->clients = NULL;
+	game_mode_pidtable_free(self->descendants);
+	self->descendants = NULL;
+	game_mode_cgroups_free(self->cgroups);
+	self->cgroups = NULL;
+
+	/* Drop our event sources, the loop itself is released by its last user */
+	game_mode_context_unwatch_proc_events(self);
+	self->reaper = sd_event_source_disable_unref(self->reaper);
+	self->rt_watchdog = sd_event_source_disable_unref(self->rt_watchdog);
+	self->config_watch = sd_event_source_disable_unref(self->config_watch);
+	self->event = sd_event_unref(self->event);
 
 	/* Destroy the gpu object */
 	game_mode_free_gpu(&self->stored_gpu);
@@ -217,13 +554,27 @@ void game_mode_context_destroy(GameModeContext *self)
 
 	/* Destroy the cpu object */
 	game_mode_free_cpu(&self->cpu);
+	game_mode_topology_free(self->topology);
+	self->topology = NULL;
 
-	/* Destroy the config object */
+	/* Nothing privileged is left to do */
+	game_mode_stop_privileged_helper();
+
+	/* Destroy the config objects */
+	if (self->system_config)
+		config_destroy(self->system_config);
+	self->system_config = NULL;
 	config_destroy(self->config);
 
 	pthread_rwlock_destroy(&self->rwlock);
 }
 
+/* The config for the system wide settings, caller must hold state_lock */
+static GameModeConfig *game_mode_system_config(GameModeContext *self)
+{
+	return self->system_config ? self->system_config : self->config;
+}
+
 static void game_mode_store_splitlock(GameModeContext *self)
 {
 	long initial_state = get_splitlock_state();
@@ -233,26 +584,25 @@ static void game_mode_store_splitlock(GameModeContext *self)
 
 static int game_mode_disable_splitlock(GameModeContext *self, bool disable)
 {
-	if (!config_get_disable_splitlock(self->config))
+	if (!config_get_disable_splitlock(game_mode_system_config(self)))
 		return 0;
 
-	long value_num = self->initial_split_lock_mitigate;
-	char value_str[40];
-
-	if (disable && value_num == 0)
+	/* Nothing to disable or restore when the mitigation was off or could not be read */
+	long initial = self->initial_split_lock_mitigate;
+	if (initial == 0 || initial == -1)
 		return 0;
 
-	if (value_num == -1)
-		return 0;
+	long value_num = disable ? 0 : initial;
+	char value_str[40];
 
 	sprintf(value_str, "%ld", value_num);
 
 	const char *const exec_args[] = {
-		"pkexec", LIBEXECDIR "/procsysctl", "split_lock_mitigate", value_str, NULL,
+		"procsysctl", "split_lock_mitigate", value_str, NULL,
 	};
 
 	LOG_MSG("Requesting update of split_lock_mitigate to %s\n", value_str);
-	int ret = run_external_process(exec_args, NULL, -1);
+	int ret = game_mode_run_privileged(exec_args, NULL);
 	if (ret != 0) {
 		LOG_ERROR("Failed to update split_lock_mitigate\n");
 		return ret;
@@ -261,17 +611,12 @@ static int game_mode_disable_splitlock(GameModeContext *self, bool disable)
 	return 0;
 }
 
-static void game_mode_store_x3d_mode(GameModeContext *self)
+/* Read the current X3D mode into mode, which holds CONFIG_VALUE_MAX bytes */
+static int game_mode_get_x3d_mode(char *mode)
 {
-	char x3d_mode_desired[CONFIG_VALUE_MAX] = { 0 };
-	config_get_amd_x3d_mode_desired(self->config, x3d_mode_desired);
-	if (x3d_mode_desired[0] == '\0') {
-		return;
-	}
-
 	if (access(LIBEXECDIR "/x3dmodectl", X_OK) != 0) {
 		LOG_MSG("x3dmodectl utility not found, X3D mode control disabled\n");
-		return;
+		return -1;
 	}
 
 	const char *const exec_args[] = {
@@ -284,16 +629,34 @@ static void game_mode_store_x3d_mode(GameModeContext *self)
 	int ret = run_external_process(exec_args, output, -1);
 	if (ret != 0) {
 		LOG_MSG("X3D mode hardware not available or failed to get current mode\n");
-		return;
+		return ret;
 	}
 
-	strncpy(self->initial_x3d_mode, output, sizeof(self->initial_x3d_mode) - 1);
-	self->initial_x3d_mode[sizeof(self->initial_x3d_mode) - 1] = '\0';
-	char *newline = strchr(self->initial_x3d_mode, '\n');
+	strncpy(mode, output, CONFIG_VALUE_MAX - 1);
+	mode[CONFIG_VALUE_MAX - 1] = '\0';
+	char *newline = strchr(mode, '\n');
 	if (newline) {
 		*newline = '\0';
 	}
 
+	return 0;
+}
+
+static void game_mode_store_x3d_mode(GameModeContext *self)
+{
+	char x3d_mode_desired[CONFIG_VALUE_MAX] = { 0 };
+	config_get_amd_x3d_mode_desired(game_mode_system_config(self), x3d_mode_desired);
+	if (x3d_mode_desired[0] == '\0') {
+		return;
+	}
+
+	char mode[CONFIG_VALUE_MAX] = { 0 };
+	if (game_mode_get_x3d_mode(mode) != 0)
+		return;
+
+	strncpy(self->initial_x3d_mode, mode, sizeof(self->initial_x3d_mode) - 1);
+	self->initial_x3d_mode[sizeof(self->initial_x3d_mode) - 1] = '\0';
+
 	LOG_MSG("x3d mode was initially set to [%s]\n", self->initial_x3d_mode);
 }
 
@@ -302,9 +665,9 @@ static int game_mode_set_x3d_mode(GameModeContext *self, bool desired)
 	char x3d_mode_config[CONFIG_VALUE_MAX] = { 0 };
 
 	if (desired) {
-		config_get_amd_x3d_mode_desired(self->config, x3d_mode_config);
+		config_get_amd_x3d_mode_desired(game_mode_system_config(self), x3d_mode_config);
 	} else {
-		config_get_amd_x3d_mode_default(self->config, x3d_mode_config);
+		config_get_amd_x3d_mode_default(game_mode_system_config(self), x3d_mode_config);
 		if (x3d_mode_config[0] == '\0') {
 			if (self->initial_x3d_mode[0] != '\0') {
 				strncpy(x3d_mode_config, self->initial_x3d_mode, CONFIG_VALUE_MAX - 1);
@@ -331,11 +694,11 @@ static int game_mode_set_x3d_mode(GameModeContext *self, bool desired)
 	}
 
 	const char *const exec_args[] = {
-		"pkexec", LIBEXECDIR "/x3dmodectl", "set", x3d_mode_config, NULL,
+		"x3dmodectl", "set", x3d_mode_config, NULL,
 	};
 
 	LOG_MSG("Requesting update of X3D mode to %s\n", x3d_mode_config);
-	int ret = run_external_process(exec_args, NULL, -1);
+	int ret = game_mode_run_privileged(exec_args, NULL);
 	if (ret != 0) {
 		LOG_ERROR("Failed to update X3D mode\n");
 		return ret;
@@ -349,7 +712,8 @@ static void game_mode_store_governor(GameModeContext *self)
 	if (self->current_govenor != GAME_MODE_GOVERNOR_DEFAULT)
 		return;
 
-	const char *initial_state = get_gov_state();
+	char governor[MAX_GOVERNOR_STATE_LENGTH];
+	const char *initial_state = get_gov_state(governor);
 	if (initial_state == NULL)
 		return;
 
@@ -358,27 +722,24 @@ static void game_mode_store_governor(GameModeContext *self)
 	LOG_MSG("governor was initially set to [%s]\n", initial_state);
 }
 
-static int game_mode_set_governor(GameModeContext *self, enum GameModeGovernor gov)
+/* The governor string gov stands for, gov_config_str holds CONFIG_VALUE_MAX bytes */
+static const char *game_mode_governor_value(GameModeContext *self, enum GameModeGovernor gov,
+                                            char *gov_config_str)
 {
-	if (self->current_govenor == gov) {
-		return 0;
-	}
-
-	char *gov_str = NULL;
-	char gov_config_str[CONFIG_VALUE_MAX] = { 0 };
+	const char *gov_str = NULL;
 	switch (gov) {
 	case GAME_MODE_GOVERNOR_DEFAULT:
-		config_get_default_governor(self->config, gov_config_str);
+		config_get_default_governor(game_mode_system_config(self), gov_config_str);
 		gov_str = gov_config_str[0] != '\0' ? gov_config_str : self->initial_cpu_mode;
 		break;
 
 	case GAME_MODE_GOVERNOR_DESIRED:
-		config_get_desired_governor(self->config, gov_config_str);
+		config_get_desired_governor(game_mode_system_config(self), gov_config_str);
 		gov_str = gov_config_str[0] != '\0' ? gov_config_str : "performance";
 		break;
 
 	case GAME_MODE_GOVERNOR_IGPU_DESIRED:
-		config_get_igpu_desired_governor(self->config, gov_config_str);
+		config_get_igpu_desired_governor(game_mode_system_config(self), gov_config_str);
 		gov_str = gov_config_str[0] != '\0' ? gov_config_str : "powersave";
 		break;
 
@@ -386,12 +747,25 @@ static int game_mode_set_governor(GameModeContext *self, enum GameModeGovernor g
 		assert(!"Invalid governor requested");
 	}
 
-	const char *const exec_args[] = {
-		"pkexec", LIBEXECDIR "/cpugovctl", "set", gov_str, NULL,
+	return gov_str;
+}
+
+static int game_mode_set_governor(GameModeContext *self, enum GameModeGovernor gov)
+{
+	if (self->current_govenor == gov) {
+		return 0;
+	}
+
+	char gov_config_str[CONFIG_VALUE_MAX] = { 0 };
+	const char *gov_str = game_mode_governor_value(self, gov, gov_config_str);
+
+	/* Either every cpu gets the new governor or none does */
+	const char *const writes[] = {
+		"/sys/devices/system/cpu/cpu[0-9]*/cpufreq/scaling_governor", gov_str, NULL,
 	};
 
 	LOG_MSG("Requesting update of governor policy to %s\n", gov_str);
-	int ret = run_external_process(exec_args, NULL, -1);
+	int ret = game_mode_apply_privileged_writes(writes);
 	if (ret != 0) {
 		LOG_ERROR("Failed to update cpu governor policy\n");
 		return ret;
@@ -408,7 +782,8 @@ static void game_mode_store_profile(GameModeContext *self)
 	if (!profile_exists() || self->current_profile != GAME_MODE_PROFILE_DEFAULT)
 		return;
 
-	const char *initial_state = get_profile_state();
+	char profile[MAX_PROFILE_LENGTH];
+	const char *initial_state = get_profile_state(profile);
 	if (initial_state == NULL)
 		return;
 
@@ -417,27 +792,19 @@ static void game_mode_store_profile(GameModeContext *self)
 	LOG_MSG("platform profile was initially set to [%s]\n", initial_state);
 }
 
-static int game_mode_set_profile(GameModeContext *self, enum GameModeProfile prof)
+/* The profile string prof stands for, prof_config_str holds CONFIG_VALUE_MAX bytes */
+static const char *game_mode_profile_value(GameModeContext *self, enum GameModeProfile prof,
+                                           char *prof_config_str)
 {
-	if (self->current_profile == prof) {
-		return 0;
-	}
-
-	if (!profile_exists()) {
-		LOG_MSG("Setting platform profile unsupported; skipping\n");
-		return 0;
-	}
-
 	const char *prof_str = NULL;
-	char prof_config_str[CONFIG_VALUE_MAX] = { 0 };
 	switch (prof) {
 	case GAME_MODE_PROFILE_DEFAULT:
-		config_get_default_profile(self->config, prof_config_str);
+		config_get_default_profile(game_mode_system_config(self), prof_config_str);
 		prof_str = prof_config_str[0] != '\0' ? prof_config_str : self->initial_profile;
 		break;
 
 	case GAME_MODE_PROFILE_DESIRED:
-		config_get_desired_profile(self->config, prof_config_str);
+		config_get_desired_profile(game_mode_system_config(self), prof_config_str);
 		prof_str = prof_config_str[0] != '\0' ? prof_config_str : "performance";
 		break;
 
@@ -445,12 +812,29 @@ static int game_mode_set_profile(GameModeContext *self, enum GameModeProfile pro
 		assert(!"Invalid platform profile requested");
 	}
 
+	return prof_str;
+}
+
+static int game_mode_set_profile(GameModeContext *self, enum GameModeProfile prof)
+{
+	if (self->current_profile == prof) {
+		return 0;
+	}
+
+	if (!profile_exists()) {
+		LOG_MSG("Setting platform profile unsupported; skipping\n");
+		return 0;
+	}
+
+	char prof_config_str[CONFIG_VALUE_MAX] = { 0 };
+	const char *prof_str = game_mode_profile_value(self, prof, prof_config_str);
+
 	const char *const exec_args[] = {
-		"pkexec", LIBEXECDIR "/platprofctl", "set", prof_str, NULL,
+		"platprofctl", "set", prof_str, NULL,
 	};
 
 	LOG_MSG("Requesting update of platform profile to %s\n", prof_str);
-	int ret = run_external_process(exec_args, NULL, -1);
+	int ret = game_mode_run_privileged(exec_args, NULL);
 	if (ret != 0) {
 		LOG_ERROR("Failed to update platform profile\n");
 		return ret;
@@ -464,7 +848,7 @@ static int game_mode_set_profile(GameModeContext *self, enum GameModeProfile pro
 
 static void game_mode_enable_igpu_optimization(GameModeContext *self)
 {
-	float threshold = config_get_igpu_power_threshold(self->config);
+	float threshold = config_get_igpu_power_threshold(game_mode_system_config(self));
 
 	/* There's no way the GPU is using 10000x the power.  This lets us
 	 * short-circuit if the config file specifies an invalid threshold
@@ -484,9 +868,39 @@ static void game_mode_disable_igpu_optimization(GameModeContext *self)
 	self->igpu_optimization_enabled = false;
 }
 
+/*
+ * Apply the current governor again, after its config changed or it was changed behind our back.
+ * game_mode_set_governor skips requests for the governor that is already current
+ */
+static void game_mode_reapply_governor(GameModeContext *self)
+{
+	enum GameModeGovernor gov = self->current_govenor;
+	if (gov == GAME_MODE_GOVERNOR_DEFAULT)
+		return;
+
+	game_mode_disable_igpu_optimization(self);
+	self->current_govenor = GAME_MODE_GOVERNOR_DEFAULT;
+	if (game_mode_set_governor(self, gov) != 0)
+		self->current_govenor = gov;
+	game_mode_enable_igpu_optimization(self);
+}
+
+static void game_mode_reapply_profile(GameModeContext *self)
+{
+	enum GameModeProfile prof = self->current_profile;
+	if (prof == GAME_MODE_PROFILE_DEFAULT)
+		return;
+
+	self->current_profile = GAME_MODE_PROFILE_DEFAULT;
+	if (game_mode_set_profile(self, prof) != 0)
+		self->current_profile = prof;
+}
+
 static void game_mode_check_igpu_energy(GameModeContext *self)
 {
-	pthread_rwlock_wrlock(&self->rwlock);
+	/* Don't hold up the main loop, the governor is in flux during a transition anyway */
+	if (pthread_mutex_trylock(&self->state_lock) != 0)
+		return;
 
 	/* We only care if we're not in the default governor */
 	if (self->current_govenor == GAME_MODE_GOVERNOR_DEFAULT)
@@ -537,7 +951,7 @@ static void game_mode_check_igpu_energy(GameModeContext *self)
 		goto unlock;
 	}
 
-	float threshold = config_get_igpu_power_threshold(self->config);
+	float threshold = config_get_igpu_power_threshold(game_mode_system_config(self));
 	double ratio = (double)igpu_energy_delta_uj / (double)cpu_energy_delta_uj;
 	if (ratio > threshold) {
 		game_mode_set_governor(self, GAME_MODE_GOVERNOR_IGPU_DESIRED);
@@ -546,64 +960,111 @@ static void game_mode_check_igpu_energy(GameModeContext *self)
 	}
 
 unlock:
-	pthread_rwlock_unlock(&self->rwlock);
+	pthread_mutex_unlock(&self->state_lock);
 }
 
-static void game_mode_context_store_defaults(GameModeContext *self)
+/*
+ * The steps of entering game mode, each one stores the value it is about to
+ * change so leaving can restore it.
+ */
+enum {
+	ENTER_PROFILE,
+	ENTER_GOVERNOR,
+	ENTER_INHIBIT_SCREENSAVER,
+	ENTER_SPLITLOCK,
+	ENTER_X3D_MODE,
+	ENTER_GPU,
+	ENTER_PARK_CPU,
+	ENTER_ISOLATE_CPU,
+	ENTER_THROTTLE,
+	ENTER_SCRIPTS,
+	ENTER_NUM_STEPS,
+};
+
+static void enter_profile(GameModeContext *self)
 {
+	/* The profile can change the governor, so store that first too */
 	game_mode_store_profile(self);
-
 	game_mode_store_governor(self);
 
-	game_mode_store_splitlock(self);
-
-	game_mode_store_x3d_mode(self);
+	game_mode_set_profile(self, GAME_MODE_PROFILE_DESIRED);
 }
 
-/**
- * Pivot into game mode.
- *
- * This is only possible after game_mode_context_init has made a GameModeContext
- * usable, and should always be followed by a game_mode_context_leave.
- */
-static void game_mode_context_enter(GameModeContext *self)
+static void enter_governor(GameModeContext *self)
 {
-	LOG_MSG("Entering Game Mode...\n");
-	sd_notifyf(0, "STATUS=%sGameMode is now active.%s\n", "\x1B[1;32m", "\x1B[0m");
-
-	/* Store the default value for everything before anything changes. */
-	game_mode_context_store_defaults(self);
-
-	/* Set the profile before anything else since it can restrict things
-	 * like the governor.
-	 */
-	game_mode_set_profile(self, GAME_MODE_PROFILE_DESIRED);
-
 	if (game_mode_set_governor(self, GAME_MODE_GOVERNOR_DESIRED) == 0) {
 		/* We just switched to a non-default governor.  Enable the iGPU
 		 * optimization.
 		 */
 		game_mode_enable_igpu_optimization(self);
 	}
+}
 
-	/* Inhibit the screensaver */
-	if (config_get_inhibit_screensaver(self->config)) {
+static void enter_inhibit_screensaver(GameModeContext *self)
+{
+	if (config_get_inhibit_screensaver(game_mode_system_config(self))) {
 		game_mode_destroy_idle_inhibitor(self->idle_inhibitor);
 		self->idle_inhibitor = game_mode_create_idle_inhibitor();
 	}
+}
 
+static void enter_splitlock(GameModeContext *self)
+{
+	game_mode_store_splitlock(self);
 	game_mode_disable_splitlock(self, true);
+}
 
+static void enter_x3d_mode(GameModeContext *self)
+{
+	game_mode_store_x3d_mode(self);
 	game_mode_set_x3d_mode(self, true);
+}
 
+static void enter_gpu(GameModeContext *self)
+{
 	/* Apply GPU optimisations by first getting the current values, and then setting the target */
 	game_mode_get_gpu(self->stored_gpu);
 	game_mode_apply_gpu(self->target_gpu);
+}
 
+static void enter_park_cpu(GameModeContext *self)
+{
 	game_mode_park_cpu(self->cpu);
+}
+
+static void enter_isolate_cpu(GameModeContext *self)
+{
+	if (!config_get_cpu_isolate_cores(game_mode_system_config(self)))
+		return;
+
+	/* Everything but the games that are registered right now, a refresh leaves what is still
+	 * isolated as it is */
+	unsigned int count = 0;
+	pid_t *games = game_mode_context_list_clients(self, &count);
+	self->isolation = game_mode_isolate_cpu(self->isolation, self->cpu, games, count);
+	free(games);
+}
+
+static void enter_throttle(GameModeContext *self)
+{
+	GameModeConfig *config = game_mode_system_config(self);
+	GameModeCgroupSettings settings = {
+		.cpu_weight = config_get_background_cpu_weight(config),
+		.io_weight = config_get_background_io_weight(config),
+	};
+	if (settings.cpu_weight == 0 && settings.io_weight == 0)
+		return;
+
+	/* Everything but the games that are registered right now, a refresh leaves what is still
+	 * to be throttled as it is */
+	unsigned int count = 0;
+	pid_t *games = game_mode_context_list_clients(self, &count);
+	self->throttle = game_mode_rethrottle_others(self->throttle, NULL, games, count, &settings);
+	free(games);
+}
 
-	/* Run custom scripts last - ensures the above are applied first and these scripts can react to
-	 * them if needed */
+static void enter_scripts(GameModeContext *self)
+{
 	char scripts[CONFIG_LIST_MAX][CONFIG_VALUE_MAX];
 	memset(scripts, 0, sizeof(scripts));
 	config_get_gamemode_start_scripts(self->config, scripts);
@@ -611,41 +1072,112 @@ static void game_mode_context_enter(GameModeContext *self)
 	game_mode_execute_scripts(scripts, (int)timeout);
 }
 
+#define STEP(n) (1u << (n))
+
+/* clang-format off */
+static const GameModeStep enter_steps[ENTER_NUM_STEPS] = {
+	/* Set the profile before the governor since it can restrict it */
+	[ENTER_PROFILE] = { "profile", enter_profile, 0 },
+	[ENTER_GOVERNOR] = { "governor", enter_governor, STEP(ENTER_PROFILE) },
+	[ENTER_INHIBIT_SCREENSAVER] = { "screensaver", enter_inhibit_screensaver, 0 },
+	[ENTER_SPLITLOCK] = { "splitlock", enter_splitlock, 0 },
+	[ENTER_X3D_MODE] = { "x3d", enter_x3d_mode, 0 },
+	[ENTER_GPU] = { "gpu", enter_gpu, 0 },
+	/* Park once the governor is set, so the parked cores come back with it */
+	[ENTER_PARK_CPU] = { "park", enter_park_cpu, STEP(ENTER_GOVERNOR) },
+	/* Other work goes to the cores that are left online */
+	[ENTER_ISOLATE_CPU] = { "isolate", enter_isolate_cpu, STEP(ENTER_PARK_CPU) },
+	[ENTER_THROTTLE] = { "throttle", enter_throttle, 0 },
+	/* Run custom scripts last - ensures the above are applied first and these scripts can react
+	 * to them if needed */
+	[ENTER_SCRIPTS] = { "scripts", enter_scripts, STEP(ENTER_SCRIPTS) - 1 },
+};
+/* clang-format on */
+
 /**
- * Pivot out of game mode.
+ * Pivot into game mode.
  *
- * Should only be called after both init and game_mode_context_enter have
- * been performed.
+ * This is only possible after game_mode_context_init has made a GameModeContext
+ * usable, and should always be followed by a game_mode_context_leave.
  */
-static void game_mode_context_leave(GameModeContext *self)
+static void game_mode_context_enter(GameModeContext *self)
 {
-	LOG_MSG("Leaving Game Mode...\n");
-	sd_notifyf(0, "STATUS=%sGameMode is currently deactivated.%s\n", "\x1B[1;36m", "\x1B[0m");
-
-	/* Restore profile before anything else since it can restrict things
-	 * like the governor.
-	 */
-	game_mode_set_profile(self, GAME_MODE_PROFILE_DEFAULT);
+	LOG_MSG("Entering Game Mode...\n");
+	sd_notifyf(0, "STATUS=%sGameMode is now active.%s\n", "\x1B[1;32m", "\x1B[0m");
 
-	/* Remove GPU optimisations */
-	game_mode_apply_gpu(self->stored_gpu);
+	game_mode_run_steps(self, "Entered Game Mode", enter_steps, ENTER_NUM_STEPS);
+}
 
+/*
+ * The steps of leaving game mode, restoring what the enter steps stored
+ */
+enum {
+	LEAVE_PROFILE,
+	LEAVE_GPU,
+	LEAVE_UNPARK_CPU,
+	LEAVE_UNISOLATE_CPU,
+	LEAVE_INHIBIT_SCREENSAVER,
+	LEAVE_SPLITLOCK,
+	LEAVE_X3D_MODE,
+	LEAVE_GOVERNOR,
+	LEAVE_THROTTLE,
+	LEAVE_SCRIPTS,
+	LEAVE_NUM_STEPS,
+};
+
+static void leave_profile(GameModeContext *self)
+{
+	game_mode_set_profile(self, GAME_MODE_PROFILE_DEFAULT);
+}
+
+static void leave_gpu(GameModeContext *self)
+{
+	game_mode_apply_gpu(self->stored_gpu);
+}
+
+static void leave_unpark_cpu(GameModeContext *self)
+{
 	game_mode_unpark_cpu(self->cpu);
+}
 
-	/* UnInhibit the screensaver */
-	if (config_get_inhibit_screensaver(self->config)) {
+static void leave_unisolate_cpu(GameModeContext *self)
+{
+	game_mode_unisolate_cpu(self->isolation);
+	self->isolation = NULL;
+}
+
+static void leave_inhibit_screensaver(GameModeContext *self)
+{
+	if (config_get_inhibit_screensaver(game_mode_system_config(self))) {
 		game_mode_destroy_idle_inhibitor(self->idle_inhibitor);
 		self->idle_inhibitor = NULL;
 	}
+}
 
+static void leave_splitlock(GameModeContext *self)
+{
 	game_mode_disable_splitlock(self, false);
+}
 
+static void leave_x3d_mode(GameModeContext *self)
+{
 	game_mode_set_x3d_mode(self, false);
+}
 
+static void leave_governor(GameModeContext *self)
+{
 	game_mode_set_governor(self, GAME_MODE_GOVERNOR_DEFAULT);
-
 	game_mode_disable_igpu_optimization(self);
+}
+
+static void leave_throttle(GameModeContext *self)
+{
+	game_mode_unthrottle_others(self->throttle);
+	self->throttle = NULL;
+}
 
+static void leave_scripts(GameModeContext *self)
+{
 	char scripts[CONFIG_LIST_MAX][CONFIG_VALUE_MAX];
 	memset(scripts, 0, sizeof(scripts));
 	config_get_gamemode_end_scripts(self->config, scripts);
@@ -653,39 +1185,196 @@ static void game_mode_context_leave(GameModeContext *self)
 	game_mode_execute_scripts(scripts, (int)timeout);
 }
 
+/* clang-format off */
+static const GameModeStep leave_steps[LEAVE_NUM_STEPS] = {
+	/* Restore profile before the governor since it can restrict it */
+	[LEAVE_PROFILE] = { "profile", leave_profile, 0 },
+	[LEAVE_GPU] = { "gpu", leave_gpu, 0 },
+	[LEAVE_UNPARK_CPU] = { "unpark", leave_unpark_cpu, 0 },
+	[LEAVE_UNISOLATE_CPU] = { "unisolate", leave_unisolate_cpu, 0 },
+	[LEAVE_INHIBIT_SCREENSAVER] = { "screensaver", leave_inhibit_screensaver, 0 },
+	[LEAVE_SPLITLOCK] = { "splitlock", leave_splitlock, 0 },
+	[LEAVE_X3D_MODE] = { "x3d", leave_x3d_mode, 0 },
+	/* Restore the governor once the parked cores are back, so they get it too */
+	[LEAVE_GOVERNOR] = { "governor", leave_governor, STEP(LEAVE_PROFILE) | STEP(LEAVE_UNPARK_CPU) },
+	[LEAVE_THROTTLE] = { "throttle", leave_throttle, 0 },
+	[LEAVE_SCRIPTS] = { "scripts", leave_scripts, STEP(LEAVE_SCRIPTS) - 1 },
+};
+/* clang-format on */
+
+/**
+ * Pivot out of game mode.
+ *
+ * Should only be called after both init and game_mode_context_enter have
+ * been performed.
+ */
+static void game_mode_context_leave(GameModeContext *self)
+{
+	LOG_MSG("Leaving Game Mode...\n");
+	sd_notifyf(0, "STATUS=%sGameMode is currently deactivated.%s\n", "\x1B[1;36m", "\x1B[0m");
+
+	game_mode_run_steps(self, "Left Game Mode", leave_steps, LEAVE_NUM_STEPS);
+}
+
+/*
+ * The steps of restarting game mode, re-applying only what drifted away from the desired state
+ */
+enum {
+	REFRESH_PROFILE,
+	REFRESH_GOVERNOR,
+	REFRESH_INHIBIT_SCREENSAVER,
+	REFRESH_SPLITLOCK,
+	REFRESH_X3D_MODE,
+	REFRESH_GPU,
+	REFRESH_PARK_CPU,
+	REFRESH_ISOLATE_CPU,
+	REFRESH_THROTTLE,
+	REFRESH_NUM_STEPS,
+};
+
+static void refresh_profile(GameModeContext *self)
+{
+	if (self->current_profile == GAME_MODE_PROFILE_DEFAULT || !profile_exists())
+		return;
+
+	char prof_config_str[CONFIG_VALUE_MAX] = { 0 };
+	const char *desired = game_mode_profile_value(self, self->current_profile, prof_config_str);
+	char profile[MAX_PROFILE_LENGTH];
+	const char *live = get_profile_state(profile);
+	if (strcmp(live, desired) == 0)
+		return;
+
+	LOG_MSG("platform profile drifted to [%s]\n", live);
+	game_mode_reapply_profile(self);
+}
+
+static void refresh_governor(GameModeContext *self)
+{
+	if (self->current_govenor == GAME_MODE_GOVERNOR_DEFAULT)
+		return;
+
+	char gov_config_str[CONFIG_VALUE_MAX] = { 0 };
+	const char *desired = game_mode_governor_value(self, self->current_govenor, gov_config_str);
+	char governor[MAX_GOVERNOR_STATE_LENGTH];
+	const char *live = get_gov_state(governor);
+	if (strcmp(live, desired) == 0)
+		return;
+
+	LOG_MSG("governor drifted to [%s]\n", live);
+	game_mode_reapply_governor(self);
+}
+
+static void refresh_inhibit_screensaver(GameModeContext *self)
+{
+	if (config_get_inhibit_screensaver(game_mode_system_config(self)) && !self->idle_inhibitor)
+		self->idle_inhibitor = game_mode_create_idle_inhibitor();
+}
+
+static void refresh_splitlock(GameModeContext *self)
+{
+	if (!config_get_disable_splitlock(game_mode_system_config(self)))
+		return;
+
+	long live = get_splitlock_state();
+	if (live == 0 || live == -1)
+		return;
+
+	LOG_MSG("split lock mitigation drifted to [%ld]\n", live);
+	game_mode_disable_splitlock(self, true);
+}
+
+static void refresh_x3d_mode(GameModeContext *self)
+{
+	char desired[CONFIG_VALUE_MAX] = { 0 };
+	config_get_amd_x3d_mode_desired(game_mode_system_config(self), desired);
+	if (desired[0] == '\0')
+		return;
+
+	char live[CONFIG_VALUE_MAX] = { 0 };
+	if (game_mode_get_x3d_mode(live) != 0 || strcmp(live, desired) == 0)
+		return;
+
+	LOG_MSG("x3d mode drifted to [%s]\n", live);
+	game_mode_set_x3d_mode(self, true);
+}
+
+static void refresh_gpu(GameModeContext *self)
+{
+	if (!game_mode_gpu_matches(self->target_gpu))
+		game_mode_apply_gpu(self->target_gpu);
+}
+
+/* clang-format off */
+static const GameModeStep refresh_steps[REFRESH_NUM_STEPS] = {
+	[REFRESH_PROFILE] = { "profile", refresh_profile, 0 },
+	[REFRESH_GOVERNOR] = { "governor", refresh_governor, STEP(REFRESH_PROFILE) },
+	[REFRESH_INHIBIT_SCREENSAVER] = { "screensaver", refresh_inhibit_screensaver, 0 },
+	[REFRESH_SPLITLOCK] = { "splitlock", refresh_splitlock, 0 },
+	[REFRESH_X3D_MODE] = { "x3d", refresh_x3d_mode, 0 },
+	[REFRESH_GPU] = { "gpu", refresh_gpu, 0 },
+	/* Parking skips the cores that are already offline */
+	[REFRESH_PARK_CPU] = { "park", enter_park_cpu, STEP(REFRESH_GOVERNOR) },
+	/* Games may have come or gone since, and new login sessions appeared */
+	[REFRESH_ISOLATE_CPU] = { "isolate", enter_isolate_cpu, STEP(REFRESH_PARK_CPU) },
+	/* Games may have come or gone since, and new cgroups appeared */
+	[REFRESH_THROTTLE] = { "throttle", enter_throttle, 0 },
+};
+/* clang-format on */
+
+/**
+ * Restart game mode in place.
+ *
+ * Compares the live system state with what game mode applied and only writes
+ * the settings that diverged, the custom scripts are not run.
+ */
+static void game_mode_context_refresh(GameModeContext *self)
+{
+	LOG_MSG("Restarting Game Mode...\n");
+
+	game_mode_run_steps(self, "Restarted Game Mode", refresh_steps, REFRESH_NUM_STEPS);
+}
+
 /**
  * Automatically expire all dead processes
  *
- * This has to take special care to ensure thread safety and ensuring that our
- * pointer is never cached incorrectly.
+ * Clients with a pidfd are expired from the event loop as soon as they exit, this
+ * only polls the ones where pidfd_open was not available. The dead clients are
+ * collected in a single pass under the read lock, and only then unregistered,
+ * as unregistering needs the write lock.
  */
 static void game_mode_context_auto_expire(GameModeContext *self)
 {
-	bool removing = true;
+	pid_t *expired = NULL;
+	size_t num_expired = 0;
 
-	while (removing) {
-		pthread_rwlock_rdlock(&self->rwlock);
-		removing = false;
-
-		/* Each time we hit an expired game, start the loop back */
-		for (GameModeClient *client = self->client; client; client = client->next) {
-			if (kill(client->pid, 0) != 0) {
-				LOG_MSG("Removing expired game [%i]...\n", client->pid);
-				pthread_rwlock_unlock(&self->rwlock);
-				game_mode_context_unregister(self, client->pid, client->pid);
-				removing = true;
+	pthread_rwlock_rdlock(&self->rwlock);
+
+	size_t iter = 0;
+	pid_t pid = 0;
+	void *cl = NULL;
+	while (game_mode_pidtable_next(self->clients, &iter, &pid, &cl)) {
+		if (((GameModeClient *)cl)->pidfd != -1 || kill(pid, 0) == 0)
+			continue;
+
+		if (!expired) {
+			expired = malloc(game_mode_pidtable_count(self->clients) * sizeof(pid_t));
+			if (!expired)
 				break;
-			}
 		}
+		expired[num_expired++] = pid;
+	}
 
-		if (!removing) {
-			pthread_rwlock_unlock(&self->rwlock);
-			break;
-		}
+	pthread_rwlock_unlock(&self->rwlock);
 
-		if (game_mode_context_num_clients(self) == 0)
-			LOG_MSG("Properly cleaned up all expired games.\n");
+	for (size_t i = 0; i < num_expired; i++) {
+		LOG_MSG("Removing expired game [%i]...\n", expired[i]);
+		game_mode_context_unregister(self, expired[i], expired[i]);
 	}
+
+	if (num_expired > 0 && game_mode_context_num_clients(self) == 0)
+		LOG_MSG("Properly cleaned up all expired games.\n");
+
+	free(expired);
 }
 
 /**
@@ -693,17 +1382,8 @@ static void game_mode_context_auto_expire(GameModeContext *self)
  */
 static const GameModeClient *game_mode_context_has_client(GameModeContext *self, pid_t client)
 {
-	const GameModeClient *found = NULL;
 	pthread_rwlock_rdlock(&self->rwlock);
-
-	/* Walk all clients and find a matching pid */
-	for (GameModeClient *cl = self->client; cl; cl = cl->next) {
-		if (cl->pid == client) {
-			found = cl;
-			break;
-		}
-	}
-
+	const GameModeClient *found = game_mode_pidtable_lookup(self->clients, client);
 	pthread_rwlock_unlock(&self->rwlock);
 	return found;
 }
@@ -725,55 +1405,545 @@ pid_t *game_mode_context_list_clients(GameModeContext *self, unsigned int *count
 	if (n > 0)
 		res = (pid_t *)malloc(n * sizeof(pid_t));
 
-	for (GameModeClient *cl = self->client; cl; cl = cl->next) {
+	size_t iter = 0;
+	pid_t pid = 0;
+	while (res && game_mode_pidtable_next(self->clients, &iter, &pid, NULL)) {
 		assert(n > i);
 
-		res[i] = cl->pid;
+		res[i] = pid;
 		i++;
 	}
 
 	*count = i;
 
-	pthread_rwlock_unlock(&self->rwlock);
-	return res;
+	pthread_rwlock_unlock(&self->rwlock);
+	return res;
+}
+
+GameModeClient *game_mode_context_lookup_client(GameModeContext *self, pid_t client)
+{
+	pthread_rwlock_rdlock(&self->rwlock);
+
+	GameModeClient *found = game_mode_pidtable_lookup(self->clients, client);
+	if (found) {
+		game_mode_client_ref(found);
+	}
+
+	pthread_rwlock_unlock(&self->rwlock);
+
+	return found;
+}
+
+/* The config sections of the GAMEMODE_THREAD_ROLE_* values from gamemode_client.h */
+static const char *const game_mode_thread_role_names[] = {
+	NULL, "render", "audio", "worker", "shader", "io",
+};
+
+/* Clients with a game profile use their own config and core pinning */
+static GameModeConfig *game_mode_client_config(GameModeContext *self, const GameModeClient *cl)
+{
+	return cl->config ? cl->config : self->config;
+}
+
+static const GameModeCPUInfo *game_mode_client_cpu(GameModeContext *self, const GameModeClient *cl)
+{
+	return cl->cpu ? cl->cpu : self->cpu;
+}
+
+/*
+ * Whether other work is throttled or kept off the pinned cores, by the global config or the
+ * client's game profile
+ */
+static bool game_mode_config_throttles(GameModeContext *self, const GameModeClient *cl)
+{
+	GameModeConfig *config = game_mode_client_config(self, cl);
+	return config_get_cpu_isolate_cores(self->config) || config_get_cpu_isolate_cores(config) ||
+	       config_get_background_cpu_weight(self->config) > 0 ||
+	       config_get_background_io_weight(self->config) > 0 ||
+	       config_get_background_cpu_weight(config) > 0 ||
+	       config_get_background_io_weight(config) > 0;
+}
+
+/*
+ * Resolve the game profile of a client, for a new client or after a config reload
+ * Caller must hold the write lock once the client is in the table
+ */
+static void game_mode_client_resolve_config(GameModeContext *self, GameModeClient *cl)
+{
+	if (cl->config)
+		config_destroy(cl->config);
+	game_mode_free_cpu(&cl->cpu);
+
+	cl->config = config_for_executable(self->config, cl->executable);
+	if (cl->config)
+		game_mode_initialise_cpu(cl->config, self->topology, &cl->cpu);
+}
+
+/*
+ * Apply the per thread optimisations to a thread that does not have them yet, the thread role
+ * matching its name decides over the client's settings
+ * Caller must hold the write lock
+ */
+static void game_mode_apply_thread_optimisations(GameModeContext *self, GameModeClient *cl,
+                                                 GameModeThreads *threads, GameModeThread *thread,
+                                                 bool be_silent)
+{
+	if (thread->applied & GAME_MODE_THREAD_SEEN)
+		return;
+
+	GameModeConfig *config = game_mode_client_config(self, cl);
+	pid_t pid = game_mode_threads_get_pid(threads);
+	thread->applied = GAME_MODE_THREAD_SEEN;
+
+	/* The roles are global, game profiles only change the client's settings. A role the client
+	 * registered the thread with goes before its name */
+	ConfigThreadRole role = { .nice = CONFIG_ROLE_UNSET,
+	                          .ioprio = CONFIG_ROLE_UNSET,
+	                          .uclamp_min = CONFIG_ROLE_UNSET,
+	                          .uclamp_max = CONFIG_ROLE_UNSET,
+	                          .softrealtime = CONFIG_ROLE_UNSET };
+	thread->role = -1;
+	if (thread->registered_role != 0) {
+		const char *name = game_mode_thread_role_names[thread->registered_role];
+		thread->role = config_get_thread_role_by_name(self->config, name, &role);
+	} else if (config_get_thread_role_count(self->config) > 0 &&
+	           game_mode_threads_get_comm(threads, thread->tid, thread->comm) == 0) {
+		thread->role = config_get_thread_role(self->config, thread->comm, &role);
+	}
+	if (thread->role >= 0)
+		LOG_MSG("Applying [thread:%s] to [%d,%d]\n", role.name, pid, thread->tid);
+
+	/* Renice, expecting a zero value to start with. The cgroup's cpu.weight replaces it */
+	int nice = role.nice != CONFIG_ROLE_UNSET        ? (int)role.nice
+	           : (cl->cgroup & GAME_MODE_CGROUP_CPU) ? 0
+	                                                 : -(int)config_get_renice_value(config);
+	if (nice != 0 && game_mode_apply_thread_renice(pid, thread->tid, 0, nice)) {
+		thread->applied |= GAME_MODE_THREAD_RENICED;
+		thread->nice = nice;
+	}
+
+	/* Apply the ioprio, expecting the default value to start with, or leave it to io.weight */
+	int ioprio = role.ioprio != CONFIG_ROLE_UNSET      ? (int)role.ioprio
+	             : (cl->cgroup & GAME_MODE_CGROUP_IO) ? IOPRIO_DONT_SET
+	                                                  : (int)config_get_ioprio_value(config);
+	if (ioprio != IOPRIO_DONT_SET &&
+	    game_mode_apply_thread_ioprio(pid, thread->tid, IOPRIO_DEFAULT, ioprio)) {
+		thread->applied |= GAME_MODE_THREAD_IOPRIO;
+		thread->ioprio = ioprio;
+	}
+
+	/* Apply the scheduler policy of the role, threads start out as normal ones */
+	int policy = game_mode_sched_policy_from_name(role.policy);
+	if (policy != -1 && game_mode_apply_thread_policy(pid, thread->tid, SCHED_OTHER, policy)) {
+		thread->applied |= GAME_MODE_THREAD_SCHEDULED;
+		thread->policy = policy;
+	}
+
+	/* Otherwise soft realtime, SCHED_ISO goes to every thread as it keeps them in check itself.
+	 * Without it the main thread of each process, or the threads of roles that ask for it, get
+	 * the fallback realtime policy and the watchdog keeps them in check */
+	if (policy == -1 && role.softrealtime != 0 && game_mode_softrealtime_enabled(config)) {
+		int fallback = role.softrealtime == 1 || thread->tid == pid
+		                   ? game_mode_softrealtime_fallback(config)
+		                   : -1;
+		int realtime = game_mode_apply_thread_softrealtime(pid, thread->tid, fallback);
+		if (realtime != -1) {
+			thread->applied |= GAME_MODE_THREAD_SCHEDULED;
+			thread->policy = realtime;
+			game_mode_threads_get_runtime(threads, thread->tid, &thread->runtime);
+			if (realtime != SCHED_ISO)
+				atomic_store(&self->rt_watched, true);
+		}
+	}
+
+	/* Clamp the utilisation, each bound of the role goes before the client's */
+	int uclamp_min = role.uclamp_min != CONFIG_ROLE_UNSET ? (int)role.uclamp_min
+	                                                      : (int)config_get_uclamp_min(config);
+	int uclamp_max = role.uclamp_max != CONFIG_ROLE_UNSET ? (int)role.uclamp_max
+	                                                      : (int)config_get_uclamp_max(config);
+
+	/* The bounds may come from the role and the client each, the kernel rejects a minimum above
+	 * the maximum */
+	if (uclamp_max >= 0 && uclamp_min > uclamp_max) {
+		LOG_ONCE(MSG, "uclamp_min %d is above uclamp_max %d, using %d for both\n", uclamp_min,
+		         uclamp_max, uclamp_max);
+		uclamp_min = uclamp_max;
+	}
+	if ((uclamp_min >= 0 || uclamp_max >= 0) &&
+	    game_mode_apply_thread_uclamp(pid, thread->tid, uclamp_min, uclamp_max)) {
+		thread->applied |= GAME_MODE_THREAD_UCLAMP;
+		thread->uclamp_min = uclamp_min;
+		thread->uclamp_max = uclamp_max;
+	}
+
+	/* Apply the cores of the role, or core pinning unless cpuset.cpus does that */
+	const GameModeCPUInfo *cpu = game_mode_client_cpu(self, cl);
+	bool pinned = false;
+	if (role.cores[0] != '\0')
+		pinned = game_mode_apply_thread_affinity(self->topology,
+		                                         cpu,
+		                                         thread->tid,
+		                                         role.cores,
+		                                         be_silent);
+	else if (!(cl->cgroup & GAME_MODE_CGROUP_CPUSET))
+		pinned = game_mode_apply_thread_core_pinning(cpu, thread->tid, be_silent);
+	if (pinned)
+		thread->applied |= GAME_MODE_THREAD_PINNED;
+}
+
+/*
+ * Restore what was applied to a thread, expecting it to still have our values
+ * Caller must hold the write lock
+ */
+static void game_mode_remove_thread_optimisations(GameModeContext *self, GameModeClient *cl,
+                                                  GameModeThreads *threads, GameModeThread *thread)
+{
+	pid_t pid = game_mode_threads_get_pid(threads);
+
+	if (thread->applied & GAME_MODE_THREAD_IOPRIO)
+		game_mode_apply_thread_ioprio(pid, thread->tid, thread->ioprio, IOPRIO_DEFAULT);
+
+	if (thread->applied & GAME_MODE_THREAD_RENICED)
+		game_mode_apply_thread_renice(pid, thread->tid, thread->nice, 0);
+
+	if (thread->applied & GAME_MODE_THREAD_SCHEDULED)
+		game_mode_apply_thread_policy(pid, thread->tid, thread->policy, SCHED_OTHER);
+
+	if (thread->applied & GAME_MODE_THREAD_UCLAMP)
+		game_mode_undo_thread_uclamp(thread->tid, thread->uclamp_min >= 0, thread->uclamp_max >= 0);
+
+	/* Restore the affinity to all online cores */
+	if (thread->applied & GAME_MODE_THREAD_PINNED)
+		game_mode_undo_thread_core_pinning(game_mode_client_cpu(self, cl), thread->tid);
+
+	thread->applied = 0;
+}
+
+/*
+ * Threads are usually named after they start, so look up the role of a thread again when its
+ * name changed and swap the optimisations over if the role did
+ * Caller must hold the write lock
+ */
+static void game_mode_reclassify_thread(GameModeContext *self, GameModeClient *cl,
+                                        GameModeThreads *threads, GameModeThread *thread,
+                                        bool be_silent)
+{
+	char comm[GAME_MODE_THREAD_COMM_MAX];
+	if (!(thread->applied & GAME_MODE_THREAD_SEEN) || thread->registered_role != 0 ||
+	    game_mode_threads_get_comm(threads, thread->tid, comm) != 0 ||
+	    strcmp(comm, thread->comm) == 0)
+		return;
+
+	ConfigThreadRole role;
+	strcpy(thread->comm, comm);
+	if (config_get_thread_role(self->config, comm, &role) == thread->role)
+		return;
+
+	game_mode_remove_thread_optimisations(self, cl, threads, thread);
+	game_mode_apply_thread_optimisations(self, cl, threads, thread, be_silent);
+}
+
+/* The threads of one of the processes of a client, the client itself or a descendant */
+static GameModeThreads *game_mode_client_process(const GameModeClient *cl, pid_t pid)
+{
+	return pid == cl->pid ? cl->threads : game_mode_pidtable_lookup(cl->descendants, pid);
+}
+
+/* Iterate over the processes of a client, starting with the client itself */
+static bool game_mode_client_next_process(const GameModeClient *cl, size_t *iter,
+                                          GameModeThreads **threads)
+{
+	if (*iter == 0) {
+		*iter = 1;
+		*threads = cl->threads;
+		return true;
+	}
+
+	size_t table_iter = *iter - 1;
+	void *value = NULL;
+	bool found = game_mode_pidtable_next(cl->descendants, &table_iter, NULL, &value);
+	*iter = table_iter + 1;
+	*threads = value;
+	return found;
+}
+
+/*
+ * The client a process is part of, as the client itself or as a descendant it tracks
+ * Caller must hold the lock
+ */
+static GameModeClient *game_mode_context_process_client(GameModeContext *self, pid_t pid)
+{
+	GameModeClient *cl = game_mode_pidtable_lookup(self->clients, pid);
+	return cl ? cl : game_mode_pidtable_lookup(self->descendants, pid);
+}
+
+/*
+ * Pick up the threads a process created since the last scan and apply the optimisations to them
+ * Caller must hold the write lock
+ */
+static int game_mode_client_update_process(GameModeContext *self, GameModeClient *cl,
+                                           GameModeThreads *threads, bool be_silent)
+{
+	int r = game_mode_threads_scan(threads);
+
+	size_t iter = 0;
+	GameModeThread *thread = NULL;
+	while (game_mode_threads_next(threads, &iter, &thread))
+		game_mode_apply_thread_optimisations(self, cl, threads, thread, be_silent);
+
+	return r;
+}
+
+/*
+ * Restore what was applied to the threads of a process
+ * Caller must hold the write lock
+ */
+static void game_mode_remove_process_optimisations(GameModeContext *self, GameModeClient *cl,
+                                                   GameModeThreads *threads)
+{
+	/* Only the threads that got an optimisation need it removed */
+	size_t iter = 0;
+	GameModeThread *thread = NULL;
+	while (game_mode_threads_next(threads, &iter, &thread))
+		game_mode_remove_thread_optimisations(self, cl, threads, thread);
+}
+
+/*
+ * Stop tracking a descendant process, leaving its threads as they are
+ * Caller must hold the write lock
+ */
+static void game_mode_client_forget_descendant(GameModeContext *self, GameModeClient *cl,
+                                               pid_t pid)
+{
+	game_mode_pidtable_remove(self->descendants, pid);
+	game_mode_threads_free(game_mode_pidtable_remove(cl->descendants, pid));
+}
+
+static void game_mode_client_forget_descendants(GameModeContext *self, GameModeClient *cl)
+{
+	size_t iter = 0;
+	pid_t pid = 0;
+	while (game_mode_pidtable_next(cl->descendants, &iter, &pid, NULL))
+		game_mode_client_forget_descendant(self, cl, pid);
+}
+
+/*
+ * Track a process the client started as part of the same game and apply the per process
+ * optimisations to it. Processes that are a client themselves or already tracked are left alone
+ * Caller must hold the write lock
+ */
+static GameModeThreads *game_mode_client_add_descendant(GameModeContext *self, GameModeClient *cl,
+                                                        pid_t pid, bool be_silent)
+{
+	if (game_mode_context_process_client(self, pid))
+		return NULL;
+
+	GameModeThreads *threads = game_mode_threads_new(pid);
+	if (!threads)
+		return NULL;
+
+	if (game_mode_pidtable_insert(cl->descendants, pid, threads) != 0) {
+		game_mode_threads_free(threads);
+		return NULL;
+	}
+	if (game_mode_pidtable_insert(self->descendants, pid, cl) != 0) {
+		game_mode_client_forget_descendant(self, cl, pid);
+		return NULL;
+	}
+
+	/* It may have exited already */
+	if (game_mode_client_update_process(self, cl, threads, be_silent) < 0) {
+		game_mode_client_forget_descendant(self, cl, pid);
+		return NULL;
+	}
+
+	LOG_MSG("Adding process [%d] to game %d [%s]\n", pid, cl->pid, cl->executable);
+
+	/* Started before the client moved into its cgroup */
+	if (cl->cgroup)
+		game_mode_cgroups_add_process(self->cgroups, cl->pid, pid);
+	if (cl->sched_core)
+		game_mode_share_sched_core(cl->pid, pid);
+
+	return threads;
+}
+
+/*
+ * Walk the process tree below the client for processes that were started without a process
+ * event telling us, breadth first
+ * Caller must hold the write lock
+ */
+static void game_mode_client_find_descendants(GameModeContext *self, GameModeClient *cl,
+                                              bool be_silent)
+{
+	size_t max = game_mode_pidtable_count(cl->descendants) + 1;
+	pid_t *queue = malloc(max * sizeof(pid_t));
+	if (!queue)
+		return;
+
+	size_t head = 0, tail = 0;
+	queue[tail++] = cl->pid;
+	while (head < tail) {
+		GameModeThreads *threads = game_mode_client_process(cl, queue[head++]);
+		pid_t *children = NULL;
+		size_t count = 0;
+		if (!threads || game_mode_threads_get_children(threads, &children, &count) != 0)
+			continue;
+
+		for (size_t i = 0; i < count; i++) {
+			/* The processes we know about may have started new ones too */
+			if (!game_mode_client_process(cl, children[i]) &&
+			    !game_mode_client_add_descendant(self, cl, children[i], be_silent))
+				continue;
+
+			if (tail == max) {
+				pid_t *grown = realloc(queue, max * 2 * sizeof(pid_t));
+				if (!grown)
+					break;
+				queue = grown;
+				max *= 2;
+			}
+			queue[tail++] = children[i];
+		}
+		free(children);
+	}
+
+	free(queue);
+}
+
+/*
+ * Pick up the threads the client created since the last scan and apply the optimisations to them,
+ * along with the processes it started when it tracks its process tree
+ * Caller must hold the write lock
+ */
+static void game_mode_client_update_threads(GameModeContext *self, GameModeClient *cl,
+                                            bool be_silent)
+{
+	int r = game_mode_client_update_process(self, cl, cl->threads, be_silent);
+	if (r < 0 && !be_silent)
+		LOG_ERROR("Could not inspect tasks for client [%d]: %s\n", cl->pid, strerror(-r));
+
+	if (!config_get_track_process_tree(game_mode_client_config(self, cl))) {
+		/* Only left from before a config reload, which removed their optimisations */
+		game_mode_client_forget_descendants(self, cl);
+		return;
+	}
+
+	/* Drop the processes that exited, then look for new ones */
+	size_t iter = 0;
+	pid_t pid = 0;
+	void *threads = NULL;
+	while (game_mode_pidtable_next(cl->descendants, &iter, &pid, &threads)) {
+		if (game_mode_client_update_process(self, cl, threads, be_silent) < 0)
+			game_mode_client_forget_descendant(self, cl, pid);
+	}
+
+	game_mode_client_find_descendants(self, cl, be_silent);
+}
+
+/*
+ * Move a client into a cgroup of its own when its config asks for it
+ * Caller must hold the write lock
+ */
+static void game_mode_client_enter_cgroup(GameModeContext *self, GameModeClient *cl)
+{
+	GameModeConfig *config = game_mode_client_config(self, cl);
+	if (cl->cgroup || !config_get_use_cgroup(config))
+		return;
+
+	/* Only tried once, what stops it does not go away while the daemon runs */
+	if (!self->cgroups && !self->cgroups_unavailable) {
+		self->cgroups = game_mode_cgroups_new(NULL);
+		self->cgroups_unavailable = !self->cgroups;
+	}
+	if (!self->cgroups)
+		return;
+
+	char memory_low[CONFIG_VALUE_MAX];
+	char cpus[CONFIG_VALUE_MAX];
+	config_get_cgroup_memory_low(config, memory_low);
+	bool pinned = game_mode_get_pinned_cpus(game_mode_client_cpu(self, cl), cpus, sizeof(cpus));
+
+	GameModeCgroupSettings settings = {
+		.cpu_weight = config_get_cgroup_cpu_weight(config),
+		.io_weight = config_get_cgroup_io_weight(config),
+		.memory_low = memory_low,
+		.cpus = pinned ? cpus : NULL,
+	};
+
+	int r = game_mode_cgroups_add(self->cgroups, cl->pid, &settings);
+	if (r < 0) {
+		LOG_ERROR("Failed to move client [%d] into a cgroup: %s\n", cl->pid, strerror(-r));
+		return;
+	}
+
+	LOG_MSG("Moved client [%d] into a cgroup of its own\n", cl->pid);
+	cl->cgroup = (unsigned int)r;
+}
+
+/*
+ * Move a client back to the cgroup it came from
+ * Caller must hold the write lock
+ */
+static void game_mode_client_leave_cgroup(GameModeContext *self, GameModeClient *cl)
+{
+	if (!cl->cgroup)
+		return;
+
+	int r = game_mode_cgroups_remove(self->cgroups, cl->pid);
+	if (r < 0)
+		LOG_ERROR("Failed to move client [%d] out of its cgroup: %s\n", cl->pid, strerror(-r));
+	cl->cgroup = 0;
 }
 
-GameModeClient *game_mode_context_lookup_client(GameModeContext *self, pid_t client)
+/*
+ * Give a client and the processes tracked with it a core scheduling cookie of their own
+ * Caller must hold the write lock
+ */
+static void game_mode_client_enter_sched_core(GameModeContext *self, GameModeClient *cl)
 {
-	GameModeClient *found = NULL;
+	if (cl->sched_core || !config_get_core_scheduling(game_mode_client_config(self, cl)))
+		return;
 
-	pthread_rwlock_rdlock(&self->rwlock);
+	if (!game_mode_apply_sched_core(cl->pid))
+		return;
 
-	/* Walk all clients and find a matching pid */
-	for (GameModeClient *cl = self->client; cl; cl = cl->next) {
-		if (cl->pid == client) {
-			found = cl;
-			break;
-		}
-	}
+	LOG_MSG("Client [%d] only shares cores with its own threads\n", cl->pid);
+	cl->sched_core = true;
 
-	if (found) {
-		game_mode_client_ref(found);
+	/* Processes found later get it when they are added */
+	size_t iter = 0;
+	GameModeThreads *threads = NULL;
+	while (game_mode_client_next_process(cl, &iter, &threads)) {
+		if (threads != cl->threads)
+			game_mode_share_sched_core(cl->pid, game_mode_threads_get_pid(threads));
 	}
-
-	pthread_rwlock_unlock(&self->rwlock);
-
-	return found;
 }
 
-static int game_mode_apply_client_optimisations(GameModeContext *self, pid_t client)
+/*
+ * Drop the core scheduling cookie of a client and the processes tracked with it
+ * Caller must hold the write lock
+ */
+static void game_mode_client_leave_sched_core(GameModeClient *cl)
 {
-	/* Store current renice and apply */
-	game_mode_apply_renice(self, client, 0 /* expect zero value to start with */);
+	if (!cl->sched_core)
+		return;
 
-	/* Store current ioprio value and apply  */
-	game_mode_apply_ioprio(self, client, IOPRIO_DEFAULT);
+	size_t iter = 0;
+	GameModeThreads *threads = NULL;
+	while (game_mode_client_next_process(cl, &iter, &threads))
+		game_mode_remove_sched_core(game_mode_threads_get_pid(threads));
+	cl->sched_core = false;
+}
 
-	/* Apply scheduler policies */
-	game_mode_apply_scheduling(self, client);
+static int game_mode_apply_client_optimisations(GameModeContext *self, GameModeClient *cl)
+{
+	/* The cgroup's settings go first, they replace some of the per thread ones */
+	game_mode_client_enter_cgroup(self, cl);
+	game_mode_client_enter_sched_core(self, cl);
 
-	/* Apply core pinning */
-	game_mode_apply_core_pinning(self->cpu, client, false);
+	/* Apply renice, ioprio, scheduler policies and core pinning to every thread */
+	game_mode_client_update_threads(self, cl, false);
 
 	return 0;
 }
@@ -848,26 +2018,57 @@ int game_mode_context_register(GameModeContext *self, pid_t client, pid_t reques
 	if (!cl)
 		goto error_cleanup;
 	free(executable); /* we're now done with memory */
+	executable = NULL;
+
+	/* Settings from matching game sections are resolved once, here. The read lock keeps the
+	 * topology from being replaced meanwhile */
+	pthread_rwlock_rdlock(&self->rwlock);
+	game_mode_client_resolve_config(self, cl);
+	pthread_rwlock_unlock(&self->rwlock);
+	bool profiled = cl->config != NULL;
 
-	/* Begin a write lock now to insert our new client at list start */
+	/* Begin a write lock now to insert our new client into the table */
 	pthread_rwlock_wrlock(&self->rwlock);
 
+	/* A process tracked along with another game registering itself becomes a game of its own */
+	GameModeClient *parent = game_mode_pidtable_lookup(self->descendants, client);
+	if (parent) {
+		game_mode_remove_process_optimisations(self,
+		                                       parent,
+		                                       game_mode_client_process(parent, client));
+		game_mode_client_forget_descendant(self, parent, client);
+	}
+
+	int r = game_mode_pidtable_insert(self->clients, client, cl);
+	if (r != 0) {
+		pthread_rwlock_unlock(&self->rwlock);
+		game_mode_client_unref(cl);
+		errno = -r;
+		goto error_cleanup;
+	}
+
 	LOG_MSG("Adding game: %d [%s]\n", client, cl->executable);
 
-	/* Update the list */
-	cl->next = self->client;
-	self->client = cl;
+	game_mode_context_watch_client(self, cl);
 
-	/* First add, init */
-	if (atomic_fetch_add_explicit(&self->refcount, 1, memory_order_seq_cst) == 0) {
-		game_mode_context_enter(self);
-	}
+	/* First add, start entering game mode in the background */
+	bool first = atomic_fetch_add_explicit(&self->refcount, 1, memory_order_seq_cst) == 0;
+
+	/* Threads the client creates from here on are handled as they appear */
+	game_mode_context_update_proc_events(self);
 
-	game_mode_apply_client_optimisations(self, client);
+	game_mode_apply_client_optimisations(self, cl);
 
 	/* Unlock now we're done applying optimisations */
 	pthread_rwlock_unlock(&self->rwlock);
 
+	/* The newest game with a profile decides the system wide settings, and other work that is
+	 * throttled has to let go of the new game */
+	bool rethrottle = !first && game_mode_config_throttles(self, cl);
+	if (first || profiled || rethrottle)
+		game_mode_context_queue_transition(self, rethrottle, false, profiled);
+
+	game_mode_context_update_reaper(self, false);
 	game_mode_client_registered(client);
 
 	return 0;
@@ -879,24 +2080,22 @@ error_cleanup:
 	return err;
 }
 
-static int game_mode_remove_client_optimisations(GameModeContext *self, pid_t client)
+static int game_mode_remove_client_optimisations(GameModeContext *self, GameModeClient *cl)
 {
-	/* Restore the ioprio value for the process, expecting it to be the config value  */
-	game_mode_apply_ioprio(self, client, (int)config_get_ioprio_value(self->config));
+	size_t iter = 0;
+	GameModeThreads *threads = NULL;
+	while (game_mode_client_next_process(cl, &iter, &threads))
+		game_mode_remove_process_optimisations(self, cl, threads);
 
-	/* Restore the renice value for the process, expecting it to be our config value */
-	game_mode_apply_renice(self, client, (int)config_get_renice_value(self->config));
+	game_mode_client_leave_cgroup(self, cl);
+	game_mode_client_leave_sched_core(cl);
 
-	/* Restore the process affinity to all online cores */
-	game_mode_undo_core_pinning(self->cpu, client);
 	return 0;
 }
 
 int game_mode_context_unregister(GameModeContext *self, pid_t client, pid_t requester)
 {
 	GameModeClient *cl = NULL;
-	GameModeClient *prev = NULL;
-	bool found = false;
 
 	/* Check our requester config first */
 	if (requester != client) {
@@ -926,26 +2125,11 @@ int game_mode_context_unregister(GameModeContext *self, pid_t client, pid_t requ
 	/* Requires locking. */
 	pthread_rwlock_wrlock(&self->rwlock);
 
-	for (prev = cl = self->client; cl; cl = cl->next) {
-		if (cl->pid != client) {
-			prev = cl;
-			continue;
-		}
-
+	cl = game_mode_pidtable_remove(self->clients, client);
+	if (cl) {
 		LOG_MSG("Removing game: %d [%s]\n", client, cl->executable);
-
-		/* Found it */
-		found = true;
-		prev->next = cl->next;
-		if (cl == self->client) {
-			self->client = cl->next;
-		}
-		cl->next = NULL;
-		game_mode_client_unref(cl);
-		break;
-	}
-
-	if (!found) {
+		game_mode_context_unwatch_client(cl);
+	} else {
 		LOG_HINTED(
 		    ERROR,
 		    "Removal requested for unknown process [%d].\n",
@@ -959,23 +2143,100 @@ int game_mode_context_unregister(GameModeContext *self, pid_t client, pid_t requ
 	}
 
 	/* When we hit bottom then end the game mode */
-	if (atomic_fetch_sub_explicit(&self->refcount, 1, memory_order_seq_cst) == 1) {
-		game_mode_context_leave(self);
-	}
+	bool last = atomic_fetch_sub_explicit(&self->refcount, 1, memory_order_seq_cst) == 1;
 
-	game_mode_remove_client_optimisations(self, client);
+	game_mode_remove_client_optimisations(self, cl);
+	game_mode_client_forget_descendants(self, cl);
+	bool profiled = cl->config != NULL;
+	bool rethrottle = !last && game_mode_config_throttles(self, cl);
+	game_mode_client_unref(cl);
 
 	/* Unlock now we're done applying optimisations */
 	pthread_rwlock_unlock(&self->rwlock);
 
+	/* The system wide settings go to the previous game with a profile, and what is left of the
+	 * exited game gets throttled */
+	if (last || profiled || rethrottle)
+		game_mode_context_queue_transition(self, rethrottle, false, profiled);
+
+	game_mode_context_update_reaper(self, false);
+	game_mode_context_update_proc_events(self);
 	game_mode_client_unregistered(client);
 
 	return 0;
 }
 
+int game_mode_context_register_thread(GameModeContext *self, pid_t pid, pid_t tid, int role)
+{
+	const int num_roles =
+	    (int)(sizeof(game_mode_thread_role_names) / sizeof(game_mode_thread_role_names[0]));
+	if (role <= 0 || role >= num_roles) {
+		LOG_ERROR("Rejecting unknown role %d for thread [%d,%d]\n", role, pid, tid);
+		return -2;
+	}
+
+	pthread_rwlock_wrlock(&self->rwlock);
+
+	/* Reading the name checks the thread belongs to the process */
+	char comm[GAME_MODE_THREAD_COMM_MAX];
+	GameModeClient *cl = game_mode_context_process_client(self, pid);
+	GameModeThreads *threads = cl ? game_mode_client_process(cl, pid) : NULL;
+	GameModeThread *thread = NULL;
+	if (threads && game_mode_threads_get_comm(threads, tid, comm) == 0)
+		thread = game_mode_threads_add(threads, tid);
+
+	if (!thread) {
+		pthread_rwlock_unlock(&self->rwlock);
+		LOG_ERROR("Failed to register thread [%d,%d]: not a thread of a registered game\n",
+		          pid,
+		          tid);
+		return -1;
+	}
+
+	LOG_MSG("Registering thread [%d,%d] %s as %s\n",
+	        pid,
+	        tid,
+	        comm,
+	        game_mode_thread_role_names[role]);
+
+	/* Swap whatever the thread had for the settings of the role */
+	game_mode_remove_thread_optimisations(self, cl, threads, thread);
+	thread->registered_role = role;
+	strcpy(thread->comm, comm);
+	game_mode_apply_thread_optimisations(self, cl, threads, thread, false);
+
+	pthread_rwlock_unlock(&self->rwlock);
+	game_mode_context_update_rt_watchdog(self);
+	return 0;
+}
+
+int game_mode_context_unregister_thread(GameModeContext *self, pid_t pid, pid_t tid)
+{
+	pthread_rwlock_wrlock(&self->rwlock);
+
+	GameModeClient *cl = game_mode_context_process_client(self, pid);
+	GameModeThreads *threads = cl ? game_mode_client_process(cl, pid) : NULL;
+	GameModeThread *thread = threads ? game_mode_threads_lookup(threads, tid) : NULL;
+
+	if (!thread || thread->registered_role == 0) {
+		pthread_rwlock_unlock(&self->rwlock);
+		LOG_ERROR("Failed to unregister thread [%d,%d]: it has no role\n", pid, tid);
+		return -1;
+	}
+
+	LOG_MSG("Unregistering thread [%d,%d]\n", pid, tid);
+
+	/* Back to the settings for its name */
+	game_mode_remove_thread_optimisations(self, cl, threads, thread);
+	thread->registered_role = 0;
+	game_mode_apply_thread_optimisations(self, cl, threads, thread, false);
+
+	pthread_rwlock_unlock(&self->rwlock);
+	return 0;
+}
+
 int game_mode_context_query_status(GameModeContext *self, pid_t client, pid_t requester)
 {
-	GameModeClient *cl = NULL;
 	int ret = 0;
 
 	/* First check the requester settings if appropriate */
@@ -1011,15 +2272,8 @@ int game_mode_context_query_status(GameModeContext *self, pid_t client, pid_t re
 		/* Requires locking. */
 		pthread_rwlock_rdlock(&self->rwlock);
 
-		for (cl = self->client; cl; cl = cl->next) {
-			if (cl->pid != client) {
-				continue;
-			}
-
-			/* Found it */
+		if (game_mode_pidtable_lookup(self->clients, client))
 			ret++;
-			break;
-		}
 
 		/* Unlock here, potentially yielding */
 		pthread_rwlock_unlock(&self->rwlock);
@@ -1059,14 +2313,8 @@ int game_mode_context_restart(GameModeContext *self, pid_t client, pid_t request
 		return 1;
 	}
 
-	/* Requires locking. */
-	pthread_rwlock_rdlock(&self->rwlock);
-
-	game_mode_context_leave(self);
-	game_mode_context_enter(self);
-
-	/* Unlock here, potentially yielding */
-	pthread_rwlock_unlock(&self->rwlock);
+	/* The worker re-applies whatever drifted since game mode was entered */
+	game_mode_context_queue_transition(self, true, false, false);
 
 	return 0;
 }
@@ -1081,7 +2329,6 @@ static GameModeClient *game_mode_client_new(pid_t pid, char *executable, pid_t r
 	/* This bit seems to be formatted differently by different clang-format versions */
 	/* clang-format off */
 	GameModeClient c = {
-		.next = NULL,
 		.pid = pid,
 		.requester = requester,
 		.timestamp = 0,
@@ -1103,13 +2350,30 @@ static GameModeClient *game_mode_client_new(pid_t pid, char *executable, pid_t r
 	}
 	*ret = c;
 	ret->refcount = ATOMIC_VAR_INIT(1);
-	strncpy(ret->executable, executable, PATH_MAX - 1);
+	ret->executable = strdup(executable);
+	ret->threads = game_mode_threads_new(pid);
+	ret->descendants = game_mode_pidtable_new();
+	if (!ret->executable || !ret->threads || !ret->descendants) {
+		game_mode_pidtable_free(ret->descendants);
+		game_mode_threads_free(ret->threads);
+		free(ret->executable);
+		free(ret);
+		return NULL;
+	}
+
+	/* Pin the process down, a pidfd never refers to a recycled pid */
+	if (open_pidfds(&ret->pid, &ret->pidfd, 1) != 1) {
+		LOG_ERROR("Could not open pidfd for %d, falling back to polling: %s\n",
+		          pid,
+		          strerror(errno));
+		ret->pidfd = -1;
+	}
 
 	return ret;
 }
 
 /**
- * Unref a client and the next element in the list, if non-null.
+ * Unref a client, freeing it once the last reference is gone.
  */
 void game_mode_client_unref(GameModeClient *client)
 {
@@ -1119,9 +2383,20 @@ void game_mode_client_unref(GameModeClient *client)
 	if (atomic_fetch_sub_explicit(&client->refcount, 1, memory_order_seq_cst) > 1) {
 		return; /* object is still alive */
 	}
-	if (client->next) {
-		game_mode_client_unref(client->next);
-	}
+	if (client->pidfd != -1)
+		close(client->pidfd);
+	if (client->config)
+		config_destroy(client->config);
+	game_mode_free_cpu(&client->cpu);
+	game_mode_threads_free(client->threads);
+
+	size_t iter = 0;
+	void *threads = NULL;
+	while (game_mode_pidtable_next(client->descendants, &iter, NULL, &threads))
+		game_mode_threads_free(threads);
+	game_mode_pidtable_free(client->descendants);
+
+	free(client->executable);
 	free(client);
 }
 
@@ -1169,95 +2444,576 @@ uint64_t game_mode_client_get_timestamp(GameModeClient *client)
 	return (uint64_t)client->timestamp;
 }
 
-static void game_mode_reapply_core_pinning_internal(GameModeContext *self)
+/* Catch up on the threads created or renamed without a process event */
+static void game_mode_context_update_threads(GameModeContext *self)
 {
+	bool roles = config_get_thread_role_count(self->config) > 0;
+
 	pthread_rwlock_wrlock(&self->rwlock);
-	if (game_mode_context_num_clients(self)) {
-		for (GameModeClient *cl = self->client; cl; cl = cl->next)
-			game_mode_apply_core_pinning(self->cpu, cl->pid, true);
+	size_t iter = 0;
+	void *value = NULL;
+	while (game_mode_pidtable_next(self->clients, &iter, NULL, &value)) {
+		GameModeClient *cl = value;
+		game_mode_client_update_threads(self, cl, true);
+
+		size_t process_iter = 0;
+		GameModeThreads *threads = NULL;
+		while (roles && game_mode_client_next_process(cl, &process_iter, &threads)) {
+			size_t thread_iter = 0;
+			GameModeThread *thread = NULL;
+			while (game_mode_threads_next(threads, &thread_iter, &thread))
+				game_mode_reclassify_thread(self, cl, threads, thread, true);
+		}
 	}
 	pthread_rwlock_unlock(&self->rwlock);
 }
 
-/* Internal refresh config function (assumes no contention with reaper thread) */
-static void game_mode_reload_config_internal(GameModeContext *self)
+static void game_mode_context_remove_all_client_optimisations(GameModeContext *self)
 {
-	LOG_MSG("Reloading config...\n");
+	pthread_rwlock_wrlock(&self->rwlock);
+	size_t iter = 0;
+	void *cl = NULL;
+	while (game_mode_pidtable_next(self->clients, &iter, NULL, &cl))
+		game_mode_remove_client_optimisations(self, cl);
+	pthread_rwlock_unlock(&self->rwlock);
+}
 
-	/* Make sure we have a readwrite lock on ourselves */
+static void game_mode_context_apply_all_client_optimisations(GameModeContext *self)
+{
 	pthread_rwlock_wrlock(&self->rwlock);
+	size_t iter = 0;
+	void *cl = NULL;
+	while (game_mode_pidtable_next(self->clients, &iter, NULL, &cl))
+		game_mode_apply_client_optimisations(self, cl);
+	pthread_rwlock_unlock(&self->rwlock);
+}
+
+/* Leave the parts of game mode whose settings are about to change */
+static void game_mode_leave_changes(GameModeContext *self, bool applied, unsigned int changes)
+{
+	if (!applied)
+		return;
+
+	if (changes & CONFIG_CHANGE_SCREENSAVER)
+		leave_inhibit_screensaver(self);
+	if (changes & CONFIG_CHANGE_SPLITLOCK)
+		leave_splitlock(self);
+	if (changes & CONFIG_CHANGE_X3D_MODE)
+		leave_x3d_mode(self);
+	if (changes & CONFIG_CHANGE_GPU)
+		leave_gpu(self);
+	if (changes & CONFIG_CHANGE_CPU) {
+		leave_unisolate_cpu(self);
+		leave_unpark_cpu(self);
+	}
+	if (changes & CONFIG_CHANGE_THROTTLE)
+		leave_throttle(self);
+}
 
-	/* Remove current optimisations when we're already active */
-	if (game_mode_context_num_clients(self)) {
-		for (GameModeClient *cl = self->client; cl; cl = cl->next)
-			game_mode_remove_client_optimisations(self, cl->pid);
+/* Enter the parts of game mode whose settings changed again, with the new settings */
+static void game_mode_enter_changes(GameModeContext *self, bool applied, unsigned int changes)
+{
+	if (changes & CONFIG_CHANGE_GPU) {
+		game_mode_free_gpu(&self->stored_gpu);
+		game_mode_free_gpu(&self->target_gpu);
+		game_mode_initialise_gpu(game_mode_system_config(self), &self->stored_gpu);
+		game_mode_initialise_gpu(game_mode_system_config(self), &self->target_gpu);
+	}
 
-		game_mode_context_leave(self);
+	if (!applied)
+		return;
+
+	if (changes & CONFIG_CHANGE_PROFILE)
+		game_mode_reapply_profile(self);
+	if (changes & (CONFIG_CHANGE_GOVERNOR | CONFIG_CHANGE_PROFILE))
+		game_mode_reapply_governor(self);
+	if (changes & CONFIG_CHANGE_SCREENSAVER)
+		enter_inhibit_screensaver(self);
+	if (changes & CONFIG_CHANGE_SPLITLOCK)
+		enter_splitlock(self);
+	if (changes & CONFIG_CHANGE_X3D_MODE)
+		enter_x3d_mode(self);
+	if (changes & CONFIG_CHANGE_GPU)
+		enter_gpu(self);
+	if (changes & CONFIG_CHANGE_CPU) {
+		enter_park_cpu(self);
+		enter_isolate_cpu(self);
+	}
+	if (changes & CONFIG_CHANGE_THROTTLE)
+		enter_throttle(self);
+}
+
+/* Whether cores were hotplugged since the topology was read, leaving out the ones we parked */
+static bool game_mode_context_hotplugged(GameModeContext *self)
+{
+	size_t num_cpu = game_mode_topology_num_cpu(self->topology);
+	cpu_set_t *parked = num_cpu > 0 ? CPU_ALLOC(num_cpu) : NULL;
+	bool parking = parked && game_mode_get_parked_cpus(self->cpu, parked);
+	bool hotplugged = game_mode_topology_changed(self->topology, parking ? parked : NULL);
+
+	if (parked)
+		CPU_FREE(parked);
+	return hotplugged;
+}
+
+/*
+ * Internal refresh config function, run by the transition worker
+ *
+ * Only the parts of game mode whose settings changed are left with the old config and entered
+ * again with the new one, everything else stays applied. The start and end scripts are not run.
+ * While a game profile decides the system wide settings, game_mode_update_system_config takes
+ * care of those.
+ */
+static void game_mode_reload_config_internal(GameModeContext *self, bool applied)
+{
+	const unsigned int client_changes =
+	    CONFIG_CHANGE_CLIENT_OPTS | CONFIG_CHANGE_CPU | CONFIG_CHANGE_GAMES | CONFIG_CHANGE_THREADS;
+
+	unsigned int changes = config_pending_changes(self->config);
+
+	/* Hotplugged cores change what pinning and parking make of the config */
+	bool hotplugged = game_mode_context_hotplugged(self);
+	if (hotplugged)
+		changes |= CONFIG_CHANGE_CPU;
+	if (changes == 0)
+		LOG_MSG("No config changes to apply\n");
+	unsigned int system_changes = self->system_config ? 0 : changes;
+	if (hotplugged)
+		system_changes |= CONFIG_CHANGE_CPU;
+
+	/* Remove the per client optimisations while the old config is still in place */
+	if (changes & client_changes)
+		game_mode_context_remove_all_client_optimisations(self);
+
+	game_mode_leave_changes(self, applied, system_changes);
+
+	/* Main loop users of the cpu info and the clients hold the read lock */
+	pthread_rwlock_wrlock(&self->rwlock);
+
+	/* The files may have been edited again since, go with what was actually loaded */
+	changes |= config_reload(self->config);
+	if (!self->system_config)
+		system_changes |= changes;
+	if (hotplugged) {
+		/* The parked cores were brought back online by leaving the changes */
+		game_mode_topology_free(self->topology);
+		self->topology = game_mode_topology_new();
+	}
+	if (system_changes & CONFIG_CHANGE_CPU)
+		game_mode_reconfig_cpu(game_mode_system_config(self), self->topology, &self->cpu);
+
+	/* Game profiles inherit the global settings, so resolve them all again */
+	if (changes & client_changes) {
+		size_t iter = 0;
+		void *cl = NULL;
+		while (game_mode_pidtable_next(self->clients, &iter, NULL, &cl))
+			game_mode_client_resolve_config(self, cl);
 	}
 
-	/* Reload the config */
-	config_reload(self->config);
-	game_mode_reconfig_cpu(self->config, &self->cpu);
+	pthread_rwlock_unlock(&self->rwlock);
+
+	if (changes & CONFIG_CHANGE_HELPER)
+		game_mode_use_resident_helper(config_get_resident_helper(self->config));
 
-	/* Re-apply all current optimisations */
-	if (game_mode_context_num_clients(self)) {
-		/* Start the global context back up */
-		game_mode_context_enter(self);
+	game_mode_enter_changes(self, applied, system_changes);
+
+	if (changes & client_changes)
+		game_mode_context_apply_all_client_optimisations(self);
+}
 
-		for (GameModeClient *cl = self->client; cl; cl = cl->next)
-			game_mode_apply_client_optimisations(self, cl->pid);
+/*
+ * Hand the system wide settings to the most recently registered client with a game profile, or
+ * back to the global config once there is none left, run by the transition worker
+ */
+static void game_mode_update_system_config(GameModeContext *self, bool applied)
+{
+	/* The table keeps the registration order, the clients keep their executables while locked */
+	pthread_rwlock_rdlock(&self->rwlock);
+	const char **executables =
+	    calloc(game_mode_pidtable_count(self->clients) + 1, sizeof(*executables));
+	size_t count = 0;
+	size_t iter = 0;
+	void *cl = NULL;
+	while (executables && game_mode_pidtable_next(self->clients, &iter, NULL, &cl)) {
+		if (((GameModeClient *)cl)->config)
+			executables[count++] = ((GameModeClient *)cl)->executable;
 	}
+	GameModeConfig *config = config_for_games(self->config, executables, count);
+	pthread_rwlock_unlock(&self->rwlock);
+	free(executables);
+
+	if (!config && self->system_config)
+		LOG_MSG("System wide settings follow the global config again\n");
+
+	unsigned int changes = config_compare(game_mode_system_config(self),
+	                                      config ? config : self->config);
+
+	if (changes & CONFIG_CHANGE_CPU)
+		game_mode_context_remove_all_client_optimisations(self);
+
+	game_mode_leave_changes(self, applied, changes);
+
+	pthread_rwlock_wrlock(&self->rwlock);
+
+	GameModeConfig *previous = self->system_config;
+	self->system_config = config;
+	if (changes & CONFIG_CHANGE_CPU)
+		game_mode_reconfig_cpu(game_mode_system_config(self), self->topology, &self->cpu);
 
 	pthread_rwlock_unlock(&self->rwlock);
 
-	LOG_MSG("Config reload complete\n");
+	if (previous)
+		config_destroy(previous);
+
+	game_mode_enter_changes(self, applied, changes);
+
+	if (changes & CONFIG_CHANGE_CPU)
+		game_mode_context_apply_all_client_optimisations(self);
+}
+
+/**
+ * Runs the transitions in and out of game mode, so the privileged helpers and
+ * custom scripts never hold up the main loop
+ */
+static void *game_mode_context_transition_worker(void *userdata)
+{
+	GameModeContext *self = userdata;
+
+	pthread_mutex_lock(&self->transition.mutex);
+
+	while (self->transition.running) {
+		if (!game_mode_transition_pending(self)) {
+			pthread_cond_wait(&self->transition.condition, &self->transition.mutex);
+			continue;
+		}
+
+		/* Take the whole request, anything queued from now on waits for the next run */
+		bool target = self->transition.target;
+		bool restart = self->transition.restart;
+		bool reload = self->transition.reload;
+		bool reprofile = self->transition.reprofile;
+		bool applied = self->transition.applied;
+		self->transition.restart = false;
+		self->transition.reload = false;
+		self->transition.reprofile = false;
+		self->transition.state = target ? GAME_MODE_STATE_ACTIVATING : GAME_MODE_STATE_DEACTIVATING;
+
+		pthread_mutex_unlock(&self->transition.mutex);
+		game_mode_context_notify_transition(self);
+
+		pthread_mutex_lock(&self->state_lock);
+
+		if (applied && !target) {
+			game_mode_context_leave(self);
+			applied = false;
+		}
+
+		if (reload)
+			game_mode_reload_config_internal(self, applied);
+
+		if (reload || reprofile)
+			game_mode_update_system_config(self, applied);
+
+		if (target && !applied) {
+			game_mode_context_enter(self);
+			applied = true;
+		} else if (target && restart) {
+			game_mode_context_refresh(self);
+		}
+
+		pthread_mutex_unlock(&self->state_lock);
+
+		pthread_mutex_lock(&self->transition.mutex);
+
+		self->transition.applied = applied;
+		self->transition.reloaded |= reload;
+		if (!game_mode_transition_pending(self))
+			self->transition.state = applied ? GAME_MODE_STATE_ACTIVE : GAME_MODE_STATE_INACTIVE;
+
+		pthread_mutex_unlock(&self->transition.mutex);
+		game_mode_context_notify_transition(self);
+		pthread_mutex_lock(&self->transition.mutex);
+	}
+
+	pthread_mutex_unlock(&self->transition.mutex);
+
+	return NULL;
+}
+
+/**
+ * Catch up with the transition worker from the main loop
+ */
+static int game_mode_context_transition_notified(__attribute__((unused)) sd_event_source *source,
+                                                 int fd, __attribute__((unused)) uint32_t revents,
+                                                 void *userdata)
+{
+	GameModeContext *self = userdata;
+
+	uint64_t count;
+	while (read(fd, &count, sizeof(count)) > 0)
+		;
+
+	pthread_mutex_lock(&self->transition.mutex);
+	bool reloaded = self->transition.reloaded;
+	self->transition.reloaded = false;
+	pthread_mutex_unlock(&self->transition.mutex);
+
+	if (reloaded) {
+		/* The reload replaced the inotify fd, and reaper_freq may have changed */
+		game_mode_context_watch_config(self);
+		game_mode_context_update_reaper(self, true);
+
+		LOG_MSG("Config reload complete\n");
+	}
+
+	/* Reloads and refreshes apply the thread optimisations again */
+	game_mode_context_update_rt_watchdog(self);
+
+	game_mode_state_changed();
+	return 0;
+}
+
+/**
+ * Unregister a client once its pidfd became readable, i.e. it exited
+ */
+static int game_mode_context_client_exited(__attribute__((unused)) sd_event_source *source,
+                                           __attribute__((unused)) int fd,
+                                           __attribute__((unused)) uint32_t revents,
+                                           void *userdata)
+{
+	/* The source goes away with the registration, so the client is still valid here */
+	const GameModeClient *cl = userdata;
+	pid_t pid = cl->pid;
+
+	LOG_MSG("Removing expired game [%i]...\n", pid);
+	game_mode_context_unregister(game_mode_context_instance(), pid, pid);
+	return 0;
+}
+
+/**
+ * Reload the config as soon as inotify reports a change to it
+ */
+static int game_mode_context_config_changed(__attribute__((unused)) sd_event_source *source,
+                                            __attribute__((unused)) int fd,
+                                            __attribute__((unused)) uint32_t revents,
+                                            void *userdata)
+{
+	GameModeContext *self = userdata;
+
+	if (config_needs_reload(self->config)) {
+		LOG_MSG("Detected config file changes\n");
+		game_mode_reload_config(self);
+	}
+	return 0;
 }
 
 /**
- * We continuously run until told otherwise.
+ * Periodic work while clients are registered, every reaper_freq seconds.
+ * Exited clients are normally picked up from their pidfds as they happen.
  */
-static void *game_mode_context_reaper(void *userdata)
+static int game_mode_context_reaper(__attribute__((unused)) sd_event_source *source,
+                                    __attribute__((unused)) uint64_t usec, void *userdata)
 {
-	/* Stack, not allocated, won't disappear. */
 	GameModeContext *self = userdata;
 
-	long reaper_interval = config_get_reaper_frequency(self->config);
+	/* Check on the CPU/iGPU energy balance */
+	game_mode_check_igpu_energy(self);
+
+	/* Pick up cores that were hotplugged, the reload reads the topology again */
+	pthread_rwlock_rdlock(&self->rwlock);
+	bool hotplugged = game_mode_context_hotplugged(self);
+	pthread_rwlock_unlock(&self->rwlock);
+	if (hotplugged) {
+		LOG_MSG("Detected cores being hotplugged\n");
+		game_mode_reload_config(self);
+	}
+
+	/* Expire remaining entries */
+	game_mode_context_auto_expire(self);
+
+	/* Apply the per thread optimisations to new threads, while the process events are
+	 * available they get them as they appear */
+	if (!self->proc_events)
+		game_mode_context_update_threads(self);
+
+	game_mode_context_update_reaper(self, true);
+	return 0;
+}
+
+/*
+ * Demote a thread in the fallback realtime policy to normal scheduling if it ran for more than
+ * softrealtime_budget of the period, and promote it again once it ran for less, the way SCHED_ISO
+ * drops back to normal scheduling and returns
+ * Caller must hold the write lock
+ *
+ * Returns whether the thread is one the watchdog looks after
+ */
+static bool game_mode_check_realtime_thread(GameModeContext *self, GameModeClient *cl,
+                                            GameModeThreads *threads, GameModeThread *thread,
+                                            uint64_t period)
+{
+	bool realtime = (thread->applied & GAME_MODE_THREAD_SCHEDULED) &&
+	                (thread->policy == SCHED_RR || thread->policy == SCHED_FIFO);
+	bool demoted = thread->applied & GAME_MODE_THREAD_DEMOTED;
+	if (!realtime && !demoted)
+		return false;
+
+	uint64_t runtime = 0;
+	if (game_mode_threads_get_runtime(threads, thread->tid, &runtime) != 0)
+		return true;
+
+	uint64_t ran = runtime - thread->runtime;
+	thread->runtime = runtime;
+
+	long budget = config_get_softrealtime_budget(game_mode_client_config(self, cl));
+	bool over = ran * 100 > period * 1000 * (uint64_t)budget;
+	pid_t pid = game_mode_threads_get_pid(threads);
+	if (realtime && over) {
+		LOG_MSG("Demoting [%d,%d] to normal scheduling, it used more than %ld%% of a core\n",
+		        pid,
+		        thread->tid,
+		        budget);
+		thread->applied &= ~(unsigned int)GAME_MODE_THREAD_SCHEDULED;
+		if (game_mode_apply_thread_policy(pid, thread->tid, thread->policy, SCHED_OTHER))
+			thread->applied |= GAME_MODE_THREAD_DEMOTED;
+	} else if (demoted && !over) {
+		LOG_MSG("Promoting [%d,%d] to realtime again, it used less than %ld%% of a core\n",
+		        pid,
+		        thread->tid,
+		        budget);
+		if (game_mode_apply_thread_softrealtime(pid, thread->tid, thread->policy) ==
+		    thread->policy) {
+			thread->applied &= ~(unsigned int)GAME_MODE_THREAD_DEMOTED;
+			thread->applied |= GAME_MODE_THREAD_SCHEDULED;
+		}
+	}
+
+	return true;
+}
 
-	struct timespec ts = { 0, 0 };
-	ts.tv_sec = time(NULL) + reaper_interval;
+/**
+ * Keep the threads in the fallback realtime policies from starving the system. RLIMIT_RTTIME
+ * can not do this for us, it sends the game SIGXCPU and then SIGKILL
+ */
+static int game_mode_context_rt_watchdog(__attribute__((unused)) sd_event_source *source,
+                                         __attribute__((unused)) uint64_t usec, void *userdata)
+{
+	GameModeContext *self = userdata;
 
-	while (self->reaper.running) {
-		/* Wait for condition */
-		pthread_mutex_lock(&self->reaper.mutex);
-		pthread_cond_timedwait(&self->reaper.condition, &self->reaper.mutex, &ts);
-		pthread_mutex_unlock(&self->reaper.mutex);
+	uint64_t now = 0;
+	sd_event_now(self->event, CLOCK_MONOTONIC, &now);
+	uint64_t period = now - self->rt_watchdog_last;
+	self->rt_watchdog_last = now;
 
-		/* Highly possible the main thread woke us up to exit */
-		if (!self->reaper.running) {
-			return NULL;
+	pthread_rwlock_wrlock(&self->rwlock);
+	bool watched = false;
+	size_t iter = 0;
+	void *value = NULL;
+	while (game_mode_pidtable_next(self->clients, &iter, NULL, &value)) {
+		GameModeClient *cl = value;
+		size_t process_iter = 0;
+		GameModeThreads *threads = NULL;
+		while (game_mode_client_next_process(cl, &process_iter, &threads)) {
+			size_t thread_iter = 0;
+			GameModeThread *thread = NULL;
+			while (game_mode_threads_next(threads, &thread_iter, &thread))
+				watched |= game_mode_check_realtime_thread(self, cl, threads, thread, period);
 		}
+	}
 
-		/* Check on the CPU/iGPU energy balance */
-		game_mode_check_igpu_energy(self);
+	/* Threads given the fallback policy from here on arm the watchdog again */
+	atomic_store(&self->rt_watched, watched);
+	pthread_rwlock_unlock(&self->rwlock);
+
+	if (watched) {
+		sd_event_source_set_time(self->rt_watchdog, now + RT_WATCHDOG_PERIOD_USEC);
+		sd_event_source_set_enabled(self->rt_watchdog, SD_EVENT_ONESHOT);
+	}
+	return 0;
+}
 
-		/* Expire remaining entries */
-		game_mode_context_auto_expire(self);
+/**
+ * Apply the per client optimisations to the threads and processes clients create, and expire
+ * the clients without a pidfd as soon as they exit
+ */
+static void game_mode_context_proc_event(const GameModeProcEvent *event, void *userdata)
+{
+	GameModeContext *self = userdata;
 
-		/* Re apply the thread affinity mask (aka core pinning) */
-		game_mode_reapply_core_pinning_internal(self);
+	if (event->type == GAME_MODE_PROC_COMM || event->type == GAME_MODE_PROC_EXEC) {
+		/* Renamed threads may have a different role, the main thread included, and so may
+		 * processes that exec'd */
+		pthread_rwlock_wrlock(&self->rwlock);
+		GameModeClient *cl = game_mode_context_process_client(self, event->tgid);
+		GameModeThreads *threads = cl ? game_mode_client_process(cl, event->tgid) : NULL;
+		GameModeThread *thread = threads ? game_mode_threads_add(threads, event->tid) : NULL;
+		if (thread) {
+			game_mode_apply_thread_optimisations(self, cl, threads, thread, true);
+			if (config_get_thread_role_count(self->config) > 0)
+				game_mode_reclassify_thread(self, cl, threads, thread, true);
+		}
+		pthread_rwlock_unlock(&self->rwlock);
+	} else if (event->tid != event->tgid) {
+		if (event->type != GAME_MODE_PROC_FORK && event->type != GAME_MODE_PROC_EXIT)
+			return;
+
+		pthread_rwlock_wrlock(&self->rwlock);
+		GameModeClient *cl = game_mode_context_process_client(self, event->tgid);
+		GameModeThreads *threads = cl ? game_mode_client_process(cl, event->tgid) : NULL;
+		if (threads && event->type == GAME_MODE_PROC_FORK) {
+			GameModeThread *thread = game_mode_threads_add(threads, event->tid);
+			if (thread)
+				game_mode_apply_thread_optimisations(self, cl, threads, thread, true);
+		} else if (threads) {
+			game_mode_threads_remove(threads, event->tid);
+		}
+		pthread_rwlock_unlock(&self->rwlock);
+	} else if (event->type == GAME_MODE_PROC_FORK) {
+		/* New processes are part of the game of their parent when it tracks its process tree */
+		pthread_rwlock_wrlock(&self->rwlock);
+		GameModeClient *cl = game_mode_context_process_client(self, event->parent_tgid);
+		if (cl && config_get_track_process_tree(game_mode_client_config(self, cl)))
+			game_mode_client_add_descendant(self, cl, event->tgid, true);
+		pthread_rwlock_unlock(&self->rwlock);
+	} else if (event->type == GAME_MODE_PROC_EXIT) {
+		pthread_rwlock_wrlock(&self->rwlock);
+		GameModeClient *parent = game_mode_pidtable_lookup(self->descendants, event->tgid);
+		if (parent)
+			game_mode_client_forget_descendant(self, parent, event->tgid);
+
+		const GameModeClient *cl = game_mode_pidtable_lookup(self->clients, event->tgid);
+		bool expired = cl && cl->pidfd == -1;
+		pthread_rwlock_unlock(&self->rwlock);
 
-		/* Check if we should be reloading the config, and do so if needed */
-		if (config_needs_reload(self->config)) {
-			LOG_MSG("Detected config file changes\n");
-			game_mode_reload_config_internal(self);
-			/* The reaper interval may have changed in the config, reload it */
-			reaper_interval = config_get_reaper_frequency(self->config);
+		if (expired) {
+			LOG_MSG("Removing expired game [%i]...\n", event->tgid);
+			game_mode_context_unregister(self, event->tgid, event->tgid);
 		}
+	}
+}
+
+/**
+ * Dispatch the pending process events
+ */
+static int game_mode_context_proc_events(__attribute__((unused)) sd_event_source *source, int fd,
+                                         __attribute__((unused)) uint32_t revents, void *userdata)
+{
+	GameModeContext *self = userdata;
 
-		ts.tv_sec = time(NULL) + reaper_interval;
+	int r = game_mode_proc_events_read(fd, game_mode_context_proc_event, self);
+	if (r == -ENOBUFS) {
+		/* Some events were dropped, catch up on the threads that may have been missed */
+		LOG_MSG("Process events overflowed, rescanning the clients' threads\n");
+		game_mode_context_update_threads(self);
+	} else if (r < 0) {
+		LOG_ERROR("Failed to read process events, falling back to polling: %s\n", strerror(-r));
+		game_mode_context_unwatch_proc_events(self);
+		self->proc_events_unavailable = true;
 	}
 
-	return NULL;
+	/* New threads may have got the fallback realtime policy */
+	game_mode_context_update_rt_watchdog(self);
+	return 0;
 }
 
 GameModeContext *game_mode_context_instance(void)
@@ -1336,19 +3092,26 @@ static void game_mode_execute_scripts(char scripts[CONFIG_LIST_MAX][CONFIG_VALUE
 /*
  * Reload the current configuration
  *
- * Reloading the configuration completely live would be problematic for various optimisation values,
- * to ensure we have a fully clean state, we tear down the whole gamemode state and regrow it with a
- * new config, remembering the registered games
+ * The transition worker compares the new config against the current one and only re-applies the
+ * optimisations whose settings changed, see game_mode_reload_config_internal
  */
 int game_mode_reload_config(GameModeContext *self)
 {
-	/* Stop the reaper thread first */
-	end_reaper_thread(self);
+	LOG_MSG("Reloading config...\n");
 
-	game_mode_reload_config_internal(self);
+	/* The inotify fd is about to be replaced, watch the new one once the reload is done */
+	self->config_watch = sd_event_source_disable_unref(self->config_watch);
 
-	/* Restart the reaper thread back up again */
-	start_reaper_thread(self);
+	/* The worker re-applies whatever the new config changes */
+	game_mode_context_queue_transition(self, false, true, false);
 
 	return 0;
 }
+
+enum GameModeState game_mode_context_get_state(GameModeContext *self)
+{
+	pthread_mutex_lock(&self->transition.mutex);
+	enum GameModeState state = self->transition.state;
+	pthread_mutex_unlock(&self->transition.mutex);
+	return state;
+}
@@ -33,7 +33,6 @@ POSSIBILITY OF SUCH DAMAGE.
 #define _GNU_SOURCE
 
 #include <linux/limits.h>
-#include <dirent.h>
 #include <sched.h>
 
 #include "common-cpu.h"
@@ -46,185 +45,16 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include "build-config.h"
 
-static int read_small_file(char *path, char **buf, size_t *buflen)
-{
-	FILE *f = fopen(path, "r");
-
-	if (!f) {
-		LOG_ERROR("Couldn't open file at %s : %s\n", path, strerror(errno));
-		return 0;
-	}
-
-	ssize_t nread = getline(buf, buflen, f);
-
-	if (nread == -1) {
-		LOG_ERROR("Couldn't read file at %s : %s\n", path, strerror(errno));
-		fclose(f);
-		return 0;
-	}
-
-	fclose(f);
-
-	while (nread > 0 && ((*buf)[nread - 1] == '\n' || (*buf)[nread - 1] == '\r'))
-		nread--;
-
-	(*buf)[nread] = '\0';
-
-	return 1;
-}
-
-static void set_online_from_list(char *cpulist, GameModeCPUInfo *info)
-{
-	long from, to;
-	while ((cpulist = parse_cpulist(cpulist, &from, &to))) {
-		for (long cpu = from; cpu < to + 1; cpu++) {
-			CPU_SET_S((size_t)cpu, CPU_ALLOC_SIZE(info->num_cpu), info->online);
-		}
-	}
-}
-
-static int check_pe_cores(char **buf, size_t *buflen, GameModeCPUInfo *info)
-{
-	if (!read_small_file("/sys/devices/cpu_core/cpus", buf, buflen))
-		return 0;
-
-	LOG_MSG("found kernel support for checking P/E-cores\n");
-
-	long from, to;
-	char *list = *buf;
-	while ((list = parse_cpulist(list, &from, &to))) {
-		for (long cpu = from; cpu < to + 1; cpu++) {
-			CPU_SET_S((size_t)cpu, CPU_ALLOC_SIZE(info->num_cpu), info->to_keep);
-		}
-	}
-
-	if (CPU_EQUAL_S(CPU_ALLOC_SIZE(info->num_cpu), info->online, info->to_keep) ||
-	    CPU_COUNT_S(CPU_ALLOC_SIZE(info->num_cpu), info->to_keep) == 0)
-		LOG_MSG("kernel did not indicate that this was an P/E-cores system\n");
-
-	return 1;
-}
-
-static int walk_sysfs(char *cpulist, char **buf, size_t *buflen, GameModeCPUInfo *info)
-{
-	char path[PATH_MAX];
-	unsigned long long max_cache = 0, max_freq = 0;
-	long from, to;
-
-	cpu_set_t *freq_cores = CPU_ALLOC(info->num_cpu);
-
-	char *list = cpulist;
-	while ((list = parse_cpulist(list, &from, &to))) {
-		for (long cpu = from; cpu < to + 1; cpu++) {
-			/* check for L3 cache non-uniformity among the cores */
-			int ret =
-			    snprintf(path, PATH_MAX, "/sys/devices/system/cpu/cpu%ld/cache/index3/size", cpu);
-
-			if (ret > 0 && ret < PATH_MAX) {
-				if (read_small_file(path, buf, buflen)) {
-					char *endp;
-					unsigned long long cache_size = strtoull(*buf, &endp, 10);
-
-					if (*endp == 'K') {
-						cache_size *= 1024;
-					} else if (*endp == 'M') {
-						cache_size *= 1024 * 1024;
-					} else if (*endp == 'G') {
-						cache_size *= 1024 * 1024 * 1024;
-					} else if (*endp != '\0') {
-						LOG_MSG("cpu L3 cache size (%s) on core #%ld is silly\n", *buf, cpu);
-						cache_size = 0;
-					}
-
-					if (cache_size > max_cache) {
-						max_cache = cache_size;
-						CPU_ZERO_S(CPU_ALLOC_SIZE(info->num_cpu), info->to_keep);
-					}
-
-					if (cache_size == max_cache)
-						CPU_SET_S((size_t)cpu, CPU_ALLOC_SIZE(info->num_cpu), info->to_keep);
-				}
-			}
-
-			/* check for frequency non-uniformity among the cores */
-			ret = snprintf(path,
-			               PATH_MAX,
-			               "/sys/devices/system/cpu/cpu%ld/cpufreq/cpuinfo_max_freq",
-			               cpu);
-
-			if (ret > 0 && ret < PATH_MAX) {
-				if (read_small_file(path, buf, buflen)) {
-					unsigned long long freq = strtoull(*buf, NULL, 10);
-					unsigned long long cutoff = (freq * 10) / 100;
-
-					if (freq > max_freq) {
-						if (max_freq < freq - cutoff)
-							CPU_ZERO_S(CPU_ALLOC_SIZE(info->num_cpu), freq_cores);
-
-						max_freq = freq;
-					}
-
-					if (freq + cutoff >= max_freq)
-						CPU_SET_S((size_t)cpu, CPU_ALLOC_SIZE(info->num_cpu), freq_cores);
-				}
-			}
-		}
-	}
-
-	if (CPU_EQUAL_S(CPU_ALLOC_SIZE(info->num_cpu), info->online, info->to_keep) ||
-	    CPU_COUNT_S(CPU_ALLOC_SIZE(info->num_cpu), info->to_keep) == 0) {
-		LOG_MSG("cpu L3 cache was uniform, this is not a x3D with multiple chiplets\n");
-
-		CPU_FREE(info->to_keep);
-		info->to_keep = freq_cores;
-
-		if (CPU_EQUAL_S(CPU_ALLOC_SIZE(info->num_cpu), info->online, info->to_keep) ||
-		    CPU_COUNT_S(CPU_ALLOC_SIZE(info->num_cpu), info->to_keep) == 0)
-			LOG_MSG("cpu frequency was uniform, this is not a big.LITTLE type of system\n");
-	} else {
-		CPU_FREE(freq_cores);
-	}
-
-	return 1;
-}
-
-static int walk_string(char *cpulist, char *config_cpulist, GameModeCPUInfo *info)
-{
-	long from, to;
-
-	char *list = cpulist;
-	while ((list = parse_cpulist(list, &from, &to))) {
-		for (long cpu = from; cpu < to + 1; cpu++) {
-			CPU_SET_S((size_t)cpu, CPU_ALLOC_SIZE(info->num_cpu), info->online);
-
-			if (info->park_or_pin == IS_CPU_PARK)
-				CPU_SET_S((size_t)cpu, CPU_ALLOC_SIZE(info->num_cpu), info->to_keep);
-		}
-	}
-
-	list = config_cpulist;
-	while ((list = parse_cpulist(list, &from, &to))) {
-		for (long cpu = from; cpu < to + 1; cpu++) {
-			if (CPU_ISSET_S((size_t)cpu, CPU_ALLOC_SIZE(info->num_cpu), info->online)) {
-				if (info->park_or_pin == IS_CPU_PARK)
-					CPU_CLR_S((size_t)cpu, CPU_ALLOC_SIZE(info->num_cpu), info->to_keep);
-				else
-					CPU_SET_S((size_t)cpu, CPU_ALLOC_SIZE(info->num_cpu), info->to_keep);
-			}
-		}
-	}
-
-	return 1;
-}
-
-void game_mode_reconfig_cpu(GameModeConfig *config, GameModeCPUInfo **info)
+void game_mode_reconfig_cpu(GameModeConfig *config, const GameModeTopology *topology,
+                            GameModeCPUInfo **info)
 {
 	game_mode_unpark_cpu(*info);
 	game_mode_free_cpu(info);
-	game_mode_initialise_cpu(config, info);
+	game_mode_initialise_cpu(config, topology, info);
 }
 
-int game_mode_initialise_cpu(GameModeConfig *config, GameModeCPUInfo **info)
+int game_mode_initialise_cpu(GameModeConfig *config, const GameModeTopology *topology,
+                             GameModeCPUInfo **info)
 {
 	/* Verify input, this is programmer error */
 	if (!info || *info)
@@ -271,49 +101,50 @@ int game_mode_initialise_cpu(GameModeConfig *config, GameModeCPUInfo **info)
 	if (park_or_pin != IS_CPU_PARK)
 		park_or_pin = IS_CPU_PIN;
 
-	char *buf = NULL, *buf2 = NULL;
-	size_t buflen = 0, buf2len = 0;
-
-	/* first we find which cores are online, this also helps us to determine the max
-	 * cpu core number that we need to allocate the cpulist later */
-	if (!read_small_file("/sys/devices/system/cpu/online", &buf, &buflen))
-		goto error_exit;
-
-	long from, to, max = 0;
-	char *s = buf;
-	while ((s = parse_cpulist(s, &from, &to))) {
-		if (to > max)
-			max = to;
-	}
-
-	/* either parsing failed or we have only a single core, in either case
+	/* either the topology could not be read or we have only a single core, in either case
 	 * we cannot optimize anyway */
-	if (max == 0)
-		goto early_exit;
+	const size_t num_cpu = game_mode_topology_num_cpu(topology);
+	if (num_cpu <= 1)
+		return 0;
 
 	GameModeCPUInfo *new_info = malloc(sizeof(GameModeCPUInfo));
 	memset(new_info, 0, sizeof(GameModeCPUInfo));
 
-	new_info->num_cpu = (size_t)(max + 1);
+	new_info->num_cpu = num_cpu;
 	new_info->park_or_pin = park_or_pin;
 	new_info->online = CPU_ALLOC(new_info->num_cpu);
 	new_info->to_keep = CPU_ALLOC(new_info->num_cpu);
 
-	CPU_ZERO_S(CPU_ALLOC_SIZE(new_info->num_cpu), new_info->online);
-	CPU_ZERO_S(CPU_ALLOC_SIZE(new_info->num_cpu), new_info->to_keep);
+	const size_t size = CPU_ALLOC_SIZE(new_info->num_cpu);
+	game_mode_topology_get_cpus(topology, "online", new_info->online);
+
+	/* The cores the config names are the ones to keep for pinning and the ones to park for
+	 * parking, otherwise keep what the topology prefers */
+	const char *cores = park_or_pin == IS_CPU_PARK ? park_cores : pin_cores;
+	if (cores[0] != '\0') {
+		if (game_mode_topology_get_cpus(topology, cores, new_info->to_keep) != 0) {
+			LOG_ERROR("Invalid cores '%s', will not apply cpu core parking/pinning!\n", cores);
+			game_mode_free_cpu(&new_info);
+			return -1;
+		}
 
-	if (park_or_pin == IS_CPU_PARK && park_cores[0] != '\0') {
-		if (!walk_string(buf, park_cores, new_info))
-			goto error_exit;
-	} else if (park_or_pin == IS_CPU_PIN && pin_cores[0] != '\0') {
-		if (!walk_string(buf, pin_cores, new_info))
-			goto error_exit;
+		CPU_AND_S(size, new_info->to_keep, new_info->to_keep, new_info->online);
+		if (park_or_pin == IS_CPU_PARK)
+			CPU_XOR_S(size, new_info->to_keep, new_info->to_keep, new_info->online);
 	} else {
-		set_online_from_list(buf, new_info);
+		game_mode_topology_get_preferred(topology, new_info->to_keep);
+	}
 
-		if (!check_pe_cores(&buf2, &buf2len, new_info)) {
-			if (!walk_sysfs(buf, &buf2, &buf2len, new_info))
-				goto error_exit;
+	/* Keep a single hardware thread of each core, its SMT siblings stay with the rest of the
+	 * system or get parked. Parking takes them offline either way as they are not kept */
+	char smt_siblings[CONFIG_VALUE_MAX];
+	config_get_cpu_smt_siblings(config, smt_siblings);
+	if (strcmp(smt_siblings, "avoid") == 0 || strcmp(smt_siblings, "park") == 0) {
+		game_mode_topology_one_per_core(topology, new_info->to_keep);
+
+		if (park_or_pin == IS_CPU_PIN && strcmp(smt_siblings, "park") == 0) {
+			new_info->siblings = CPU_ALLOC(new_info->num_cpu);
+			game_mode_topology_get_siblings(topology, new_info->to_keep, new_info->siblings);
 		}
 	}
 
@@ -321,13 +152,13 @@ int game_mode_initialise_cpu(GameModeConfig *config, GameModeCPUInfo **info)
 	    CPU_EQUAL_S(CPU_ALLOC_SIZE(new_info->num_cpu), new_info->online, new_info->to_keep)) {
 		game_mode_free_cpu(&new_info);
 		LOG_MSG("I can find no reason to perform core parking on this system!\n");
-		goto error_exit;
+		return -1;
 	}
 
 	if (CPU_COUNT_S(CPU_ALLOC_SIZE(new_info->num_cpu), new_info->to_keep) == 0) {
 		game_mode_free_cpu(&new_info);
 		LOG_MSG("I can find no reason to perform core pinning on this system!\n");
-		goto error_exit;
+		return -1;
 	}
 
 	if (CPU_COUNT_S(CPU_ALLOC_SIZE(new_info->num_cpu), new_info->to_keep) < 4) {
@@ -335,20 +166,11 @@ int game_mode_initialise_cpu(GameModeConfig *config, GameModeCPUInfo **info)
 		LOG_MSG(
 		    "logic or config would result in less than 4 active cores, will not apply cpu core "
 		    "parking/pinning!\n");
-		goto error_exit;
+		return -1;
 	}
 
 	*info = new_info;
-
-early_exit:
-	free(buf);
-	free(buf2);
 	return 0;
-
-error_exit:
-	free(buf);
-	free(buf2);
-	return -1;
 }
 
 static int log_state(char *cpulist, int *pos, const long first, const long last)
@@ -379,9 +201,34 @@ static int log_state(char *cpulist, int *pos, const long first, const long last)
 	return 1;
 }
 
+/* Whether parking takes a core offline, the ones not kept or the SMT siblings of the kept ones */
+static bool cpu_is_parked(const GameModeCPUInfo *info, size_t cpu)
+{
+	const size_t size = CPU_ALLOC_SIZE(info->num_cpu);
+	if (!CPU_ISSET_S(cpu, size, info->online))
+		return false;
+
+	if (info->park_or_pin == IS_CPU_PARK)
+		return !CPU_ISSET_S(cpu, size, info->to_keep);
+
+	return info->siblings && CPU_ISSET_S(cpu, size, info->siblings);
+}
+
+/* Whether the core behind an online file is up right now, unreadable files count as online */
+static bool cpu_is_online(const char *path)
+{
+	FILE *f = fopen(path, "r");
+	if (!f)
+		return true;
+
+	int c = fgetc(f);
+	fclose(f);
+	return c != '0';
+}
+
 int game_mode_park_cpu(const GameModeCPUInfo *info)
 {
-	if (!info || info->park_or_pin == IS_CPU_PIN)
+	if (!info || (info->park_or_pin == IS_CPU_PIN && !info->siblings))
 		return 0;
 
 	long first = -1, last = -1;
@@ -389,9 +236,34 @@ int game_mode_park_cpu(const GameModeCPUInfo *info)
 	char cpulist[ARG_MAX];
 	int pos = 0;
 
+	/* Path, value pairs for every core to park */
+	char (*paths)[64] = calloc(info->num_cpu, sizeof(*paths));
+	const char **writes = calloc(2 * info->num_cpu + 1, sizeof(const char *));
+	size_t num_writes = 0;
+	bool park_cpu0 = false;
+	int ret = 0;
+
+	if (!paths || !writes) {
+		LOG_ERROR("Failed to allocate memory, will not apply cpu core parking!\n");
+		goto out;
+	}
+
 	for (long cpu = 0; cpu < (long)(info->num_cpu); cpu++) {
-		if (CPU_ISSET_S((size_t)cpu, CPU_ALLOC_SIZE(info->num_cpu), info->online) &&
-		    !CPU_ISSET_S((size_t)cpu, CPU_ALLOC_SIZE(info->num_cpu), info->to_keep)) {
+		if (cpu_is_parked(info, (size_t)cpu)) {
+			snprintf(paths[cpu], sizeof(*paths), "/sys/devices/system/cpu/cpu%ld/online", cpu);
+
+			/* Already parked, e.g. when game mode is being restarted */
+			if (!cpu_is_online(paths[cpu]))
+				continue;
+
+			/* on some systems one cannot park core #0, it is tried on its own below */
+			if (cpu == 0) {
+				park_cpu0 = access(paths[cpu], F_OK) == 0;
+			} else {
+				writes[num_writes++] = paths[cpu];
+				writes[num_writes++] = "0";
+			}
+
 			if (first == -1) {
 				first = cpu;
 				last = cpu;
@@ -399,7 +271,7 @@ int game_mode_park_cpu(const GameModeCPUInfo *info)
 				last = cpu;
 			} else {
 				if (!log_state(cpulist, &pos, first, last))
-					return 0;
+					goto out;
 
 				first = cpu;
 				last = cpu;
@@ -410,23 +282,35 @@ int game_mode_park_cpu(const GameModeCPUInfo *info)
 	if (first != -1)
 		log_state(cpulist, &pos, first, last);
 
-	const char *const exec_args[] = {
-		"pkexec", LIBEXECDIR "/cpucorectl", "offline", cpulist, NULL,
-	};
+	if (num_writes == 0 && !park_cpu0)
+		goto out;
 
+	/* Either all the other cores get parked or none of them do */
 	LOG_MSG("Requesting parking of cores %s\n", cpulist);
-	int ret = run_external_process(exec_args, NULL, -1);
-	if (ret != 0) {
-		LOG_ERROR("Failed to park cpu cores\n");
-		return ret;
+	if (num_writes > 0) {
+		ret = game_mode_apply_privileged_writes(writes);
+		if (ret != 0) {
+			LOG_ERROR("Failed to park cpu cores\n");
+			goto out;
+		}
 	}
 
-	return 0;
+	if (park_cpu0) {
+		/* Core #0 just stays online when the kernel refuses */
+		const char *const exec_args[] = { "gamemodehelper", "apply", paths[0], "0", NULL };
+		char report[EXTERNAL_BUFFER_MAX];
+		game_mode_run_privileged(exec_args, report);
+	}
+
+out:
+	free(writes);
+	free(paths);
+	return ret;
 }
 
 int game_mode_unpark_cpu(const GameModeCPUInfo *info)
 {
-	if (!info || info->park_or_pin == IS_CPU_PIN)
+	if (!info || (info->park_or_pin == IS_CPU_PIN && !info->siblings))
 		return 0;
 
 	long first = -1, last = -1;
@@ -435,8 +319,7 @@ int game_mode_unpark_cpu(const GameModeCPUInfo *info)
 	int pos = 0;
 
 	for (long cpu = 0; cpu < (long)(info->num_cpu); cpu++) {
-		if (CPU_ISSET_S((size_t)cpu, CPU_ALLOC_SIZE(info->num_cpu), info->online) &&
-		    !CPU_ISSET_S((size_t)cpu, CPU_ALLOC_SIZE(info->num_cpu), info->to_keep)) {
+		if (cpu_is_parked(info, (size_t)cpu)) {
 			if (first == -1) {
 				first = cpu;
 				last = cpu;
@@ -456,11 +339,11 @@ int game_mode_unpark_cpu(const GameModeCPUInfo *info)
 		log_state(cpulist, &pos, first, last);
 
 	const char *const exec_args[] = {
-		"pkexec", LIBEXECDIR "/cpucorectl", "online", cpulist, NULL,
+		"cpucorectl", "online", cpulist, NULL,
 	};
 
 	LOG_MSG("Requesting unparking of cores %s\n", cpulist);
-	int ret = run_external_process(exec_args, NULL, -1);
+	int ret = game_mode_run_privileged(exec_args, NULL);
 	if (ret != 0) {
 		LOG_ERROR("Failed to unpark cpu cores\n");
 		return ret;
@@ -469,60 +352,371 @@ int game_mode_unpark_cpu(const GameModeCPUInfo *info)
 	return 0;
 }
 
-static void apply_affinity_mask(pid_t pid, size_t cpusetsize, const cpu_set_t *mask,
-                                const bool be_silent)
+/* Pin a thread to the cores to keep, returns whether it is pinned */
+bool game_mode_apply_thread_core_pinning(const GameModeCPUInfo *info, const pid_t tid,
+                                         const bool be_silent)
 {
-	char buffer[PATH_MAX];
-	char *proc_path = NULL;
-	DIR *proc_dir = NULL;
+	if (!info || info->park_or_pin == IS_CPU_PARK)
+		return false;
 
-	if (!(proc_path = buffered_snprintf(buffer, "/proc/%d/task", pid))) {
-		if (!be_silent) {
-			LOG_ERROR("Unable to find executable for PID %d: %s\n", pid, strerror(errno));
-		}
+	if (sched_setaffinity(tid, CPU_ALLOC_SIZE(info->num_cpu), info->to_keep) != 0) {
+		/* Short lived threads may be gone already */
+		if (!be_silent)
+			LOG_ERROR("Failed to pin thread %d: %s\n", tid, strerror(errno));
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Set the affinity of a thread from the cores of a thread role, pinned for the cores core pinning
+ * keeps, unpinned for the other ones, all for every online core or a list of cores. Returns
+ * whether the affinity was set, which needs the cpu info from core pinning or parking
+ */
+bool game_mode_apply_thread_affinity(const GameModeTopology *topology, const GameModeCPUInfo *info,
+                                     const pid_t tid, const char *cores, const bool be_silent)
+{
+	if (!info)
+		return false;
+
+	const size_t size = CPU_ALLOC_SIZE(info->num_cpu);
+	cpu_set_t *mask = CPU_ALLOC(info->num_cpu);
+	if (!mask)
+		return false;
+
+	bool valid = true;
+	if (strcmp(cores, "pinned") == 0) {
+		CPU_AND_S(size, mask, info->online, info->to_keep);
+	} else if (strcmp(cores, "unpinned") == 0) {
+		/* The other cores are offline while they are parked */
+		CPU_XOR_S(size, mask, info->online, info->to_keep);
+		CPU_AND_S(size, mask, mask, info->online);
+		valid = info->park_or_pin == IS_CPU_PIN;
+	} else if (strcmp(cores, "all") == 0) {
+		memcpy(mask, info->online, size);
+	} else {
+		/* A list of cores or sets of the topology, which the info was made for */
+		valid = game_mode_topology_get_cpus(topology, cores, mask) == 0;
+		CPU_AND_S(size, mask, mask, info->online);
+	}
+
+	bool applied = false;
+	if (!valid || CPU_COUNT_S(size, mask) == 0) {
+		LOG_ONCE(ERROR, "Thread role cores '%s' leave no cores to run on, ignoring\n", cores);
+	} else if (sched_setaffinity(tid, size, mask) != 0) {
+		/* Short lived threads may be gone already */
+		if (!be_silent)
+			LOG_ERROR("Failed to set the affinity of thread %d: %s\n", tid, strerror(errno));
+	} else {
+		applied = true;
+	}
+
+	CPU_FREE(mask);
+	return applied;
+}
+
+/* Restore the affinity of a thread to all online cores */
+void game_mode_undo_thread_core_pinning(const GameModeCPUInfo *info, const pid_t tid)
+{
+	if (!info)
 		return;
+
+	if (sched_setaffinity(tid, CPU_ALLOC_SIZE(info->num_cpu), info->online) != 0 && errno != ESRCH)
+		LOG_ERROR("Failed to unpin thread %d: %s\n", tid, strerror(errno));
+}
+
+/* A set of cores as a list of cores, false when it does not fit */
+static bool format_cpulist(const cpu_set_t *mask, const size_t num_cpu, char *cpulist, size_t size)
+{
+	const size_t alloc_size = CPU_ALLOC_SIZE(num_cpu);
+	size_t pos = 0;
+	cpulist[0] = '\0';
+
+	for (long cpu = 0; cpu < (long)num_cpu; cpu++) {
+		if (!CPU_ISSET_S((size_t)cpu, alloc_size, mask))
+			continue;
+
+		long last = cpu;
+		while (last + 1 < (long)num_cpu && CPU_ISSET_S((size_t)(last + 1), alloc_size, mask))
+			last++;
+
+		int ret = last == cpu ? snprintf(cpulist + pos, size - pos, "%s%ld", pos ? "," : "", cpu)
+		                      : snprintf(cpulist + pos,
+		                                 size - pos,
+		                                 "%s%ld-%ld",
+		                                 pos ? "," : "",
+		                                 cpu,
+		                                 last);
+		if (ret < 0 || (size_t)ret >= size - pos)
+			return false;
+
+		pos += (size_t)ret;
+		cpu = last;
+	}
+
+	return pos > 0;
+}
+
+/* The cores core pinning keeps as a list of cores, false without core pinning */
+bool game_mode_get_pinned_cpus(const GameModeCPUInfo *info, char *cpulist, size_t size)
+{
+	if (!info || info->park_or_pin == IS_CPU_PARK || size == 0)
+		return false;
+
+	return format_cpulist(info->to_keep, info->num_cpu, cpulist, size);
+}
+
+/* The cores parking takes offline, in a set covering the cores of the topology. False when it
+ * takes none offline, the set is left alone then */
+bool game_mode_get_parked_cpus(const GameModeCPUInfo *info, cpu_set_t *set)
+{
+	if (!info || (info->park_or_pin == IS_CPU_PIN && !info->siblings))
+		return false;
+
+	CPU_ZERO_S(CPU_ALLOC_SIZE(info->num_cpu), set);
+	for (size_t cpu = 0; cpu < info->num_cpu; cpu++) {
+		if (cpu_is_parked(info, cpu))
+			CPU_SET_S(cpu, CPU_ALLOC_SIZE(info->num_cpu), set);
 	}
+	return true;
+}
 
-	if (!(proc_dir = opendir(proc_path))) {
-		if (!be_silent) {
-			LOG_ERROR("Unable to find executable for PID %d: %s\n", pid, strerror(errno));
+/* A set of cores as the hex mask sysfs cpumask files take, e.g. "ff,ffffffff" */
+static bool format_cpumask(const cpu_set_t *mask, const size_t num_cpu, char *cpumask, size_t size)
+{
+	const size_t alloc_size = CPU_ALLOC_SIZE(num_cpu);
+	size_t pos = 0;
+
+	/* Comma separated 32 bit words, the highest cores first */
+	for (size_t word = (num_cpu + 31) / 32; word-- > 0;) {
+		unsigned int bits = 0;
+		for (size_t bit = 0; bit < 32 && word * 32 + bit < num_cpu; bit++) {
+			if (CPU_ISSET_S(word * 32 + bit, alloc_size, mask))
+				bits |= 1u << bit;
 		}
-		return;
+
+		int ret = snprintf(cpumask + pos, size - pos, pos ? ",%08x" : "%x", bits);
+		if (ret < 0 || (size_t)ret >= size - pos)
+			return false;
+		pos += (size_t)ret;
 	}
 
-	struct dirent *entry;
-	while ((entry = readdir(proc_dir))) {
-		if (entry->d_name[0] == '.')
+	return pos > 0;
+}
+
+/* Where unbound workqueues may run, see Documentation/core-api/workqueue.rst */
+#define WORKQUEUE_CPUMASK "/sys/devices/virtual/workqueue/cpumask"
+
+/* Longest cpumask or cpuset.cpus value restored, the privileged helper takes no longer ones */
+#define ISOLATION_VALUE_MAX 300
+
+/**
+ * Other work kept off the pinned cores, with the values to restore
+ */
+struct GameModeIsolation {
+	GameModeThrottle *session;      /**<The user's applications, written by the daemon */
+	char cpus[ISOLATION_VALUE_MAX]; /**<The cores other work was moved to */
+	size_t count;
+	struct GameModeIsolatedFile {
+		char path[PATH_MAX]; /**<Empty once taken over by the isolation replacing this one */
+		char value[ISOLATION_VALUE_MAX]; /**<What it held before, an empty cpuset.cpus is "" */
+	} *files;
+};
+
+/* Take a file over from the isolation being replaced, true when it was isolated there */
+static bool isolate_carry(GameModeIsolation *isolation, GameModeIsolation *previous,
+                          const char *path)
+{
+	for (size_t i = 0; previous && i < previous->count; i++) {
+		if (strcmp(previous->files[i].path, path) != 0)
 			continue;
 
-		int tid = atoi(entry->d_name);
+		isolation->files[isolation->count++] = previous->files[i];
+		previous->files[i].path[0] = '\0';
+		return true;
+	}
+	return false;
+}
 
-		if (sched_setaffinity(tid, cpusetsize, mask) != 0 && !be_silent)
-			LOG_ERROR("Failed to pin thread %d: %s\n", tid, strerror(errno));
+static bool isolation_has(const GameModeIsolation *isolation, const char *path)
+{
+	for (size_t i = 0; i < isolation->count; i++) {
+		if (strcmp(isolation->files[i].path, path) == 0)
+			return true;
 	}
+	return false;
+}
+
+/* The files to isolate with, the workqueues' cpumask and the cpuset.cpus of each cgroup */
+static const char *isolation_path(char *const *cgroups, size_t i, char buffer[PATH_MAX])
+{
+	if (i == 0)
+		return WORKQUEUE_CPUMASK;
 
-	closedir(proc_dir);
+	/* No cpuset.cpus when the parent does not hand the controller down, isolate_file skips it */
+	if (snprintf(buffer, PATH_MAX, "%s/cpuset.cpus", cgroups[i - 1]) >= PATH_MAX)
+		return NULL;
+	return buffer;
 }
 
-void game_mode_apply_core_pinning(const GameModeCPUInfo *info, const pid_t client,
-                                  const bool be_silent)
+/* Record the value of a file to isolate with, unless it is missing or unreadable */
+static bool isolate_file(GameModeIsolation *isolation, const char *path)
 {
-	if (!info || info->park_or_pin == IS_CPU_PARK)
-		return;
+	struct GameModeIsolatedFile *file = &isolation->files[isolation->count];
+	if (snprintf(file->path, sizeof(file->path), "%s", path) >= (int)sizeof(file->path))
+		return false;
 
-	if (!be_silent)
-		LOG_MSG("Pinning process...\n");
+	FILE *f = fopen(path, "r");
+	if (!f)
+		return false;
+	bool ok = fgets(file->value, sizeof(file->value), f) != NULL && strchr(file->value, '\n');
+	fclose(f);
+	if (!ok)
+		return false;
 
-	apply_affinity_mask(client, CPU_ALLOC_SIZE(info->num_cpu), info->to_keep, be_silent);
+	file->value[strcspn(file->value, "\n")] = '\0';
+	isolation->count++;
+	return true;
 }
 
-void game_mode_undo_core_pinning(const GameModeCPUInfo *info, const pid_t client)
+/*
+ * Keep everything but the games off the cores core pinning keeps while in game mode. Unbound
+ * workqueues and the user's login sessions are changed through the privileged helper, the
+ * applications and background work below the user manager by the daemon. Without core pinning
+ * there is nothing to do, parking takes the other cores offline instead
+ *
+ * When isolating again after games came or went, what stays isolated is taken over from previous
+ * without writing it again, and only what no longer is gets restored
+ *
+ * Returns what game_mode_unisolate_cpu restores, or NULL. previous is used up
+ */
+GameModeIsolation *game_mode_isolate_cpu(GameModeIsolation *previous, const GameModeCPUInfo *info,
+                                         const pid_t *games, const size_t num_games)
 {
-	if (!info || info->park_or_pin == IS_CPU_PARK)
+	if (!info || info->park_or_pin == IS_CPU_PARK) {
+		game_mode_unisolate_cpu(previous);
+		return NULL;
+	}
+
+	char **cgroups = game_mode_cgroups_login_sessions(NULL, games, num_games);
+	size_t num_cgroups = 0;
+	while (cgroups && cgroups[num_cgroups])
+		num_cgroups++;
+
+	const size_t size = CPU_ALLOC_SIZE(info->num_cpu);
+	cpu_set_t *others = CPU_ALLOC(info->num_cpu);
+	GameModeIsolation *isolation = calloc(1, sizeof(GameModeIsolation));
+	const char **writes = calloc(2 * (num_cgroups + 1) + 1, sizeof(const char *));
+	size_t num_writes = 0;
+	if (isolation)
+		isolation->files = calloc(num_cgroups + 1, sizeof(struct GameModeIsolatedFile));
+
+	if (!others || !isolation || !isolation->files || !writes) {
+		LOG_ERROR("Failed to allocate memory, will not isolate the pinned cores!\n");
+		game_mode_unisolate_cpu(isolation);
+		isolation = NULL;
+		goto out;
+	}
+
+	/* The other online cores, except the SMT siblings parked along with pinning */
+	CPU_XOR_S(size, others, info->online, info->to_keep);
+	CPU_AND_S(size, others, others, info->online);
+	for (size_t cpu = 0; info->siblings && cpu < info->num_cpu; cpu++) {
+		if (CPU_ISSET_S(cpu, size, info->siblings))
+			CPU_CLR_S(cpu, size, others);
+	}
+
+	char cpumask[ISOLATION_VALUE_MAX];
+	if (CPU_COUNT_S(size, others) == 0 ||
+	    !format_cpulist(others, info->num_cpu, isolation->cpus, sizeof(isolation->cpus)) ||
+	    !format_cpumask(others, info->num_cpu, cpumask, sizeof(cpumask))) {
+		LOG_ERROR("No cores to move other work to, will not isolate the pinned cores!\n");
+		goto out;
+	}
+
+	/* Everything moves again when the cores to move to changed */
+	if (previous && strcmp(previous->cpus, isolation->cpus) != 0) {
+		game_mode_unisolate_cpu(previous);
+		previous = NULL;
+	}
+
+	/* Take over what stays isolated first, so the new files come after it */
+	for (size_t i = 0; i <= num_cgroups; i++) {
+		char buffer[PATH_MAX];
+		const char *path = isolation_path(cgroups, i, buffer);
+		if (path)
+			isolate_carry(isolation, previous, path);
+	}
+
+	size_t num_carried = isolation->count;
+	for (size_t i = 0; i <= num_cgroups; i++) {
+		char buffer[PATH_MAX];
+		const char *path = isolation_path(cgroups, i, buffer);
+		if (path && !isolation_has(isolation, path) && isolate_file(isolation, path)) {
+			writes[num_writes++] = isolation->files[isolation->count - 1].path;
+			writes[num_writes++] = i == 0 ? cpumask : isolation->cpus;
+		}
+	}
+
+	/* Either all of the new ones move or none of them do */
+	if (num_writes > 0) {
+		LOG_MSG("Requesting other work to move to cores %s\n", isolation->cpus);
+		if (game_mode_apply_privileged_writes(writes) != 0) {
+			LOG_ERROR("Failed to isolate the pinned cores\n");
+			isolation->count = num_carried;
+		}
+	}
+
+	GameModeCgroupSettings settings = { .cpus = isolation->cpus };
+	isolation->session = game_mode_rethrottle_others(previous ? previous->session : NULL,
+	                                                 NULL,
+	                                                 games,
+	                                                 num_games,
+	                                                 &settings);
+	if (previous)
+		previous->session = NULL;
+
+out:
+	/* What is left over holds games now, or went away */
+	game_mode_unisolate_cpu(previous);
+	for (size_t i = 0; i < num_cgroups; i++)
+		free(cgroups[i]);
+	free(cgroups);
+	free(writes);
+	if (others)
+		CPU_FREE(others);
+	return isolation;
+}
+
+/* Let other work back onto the pinned cores, restoring what game_mode_isolate_cpu changed */
+void game_mode_unisolate_cpu(GameModeIsolation *isolation)
+{
+	if (!isolation)
 		return;
 
-	LOG_MSG("Pinning process back to all online cores...\n");
-	apply_affinity_mask(client, CPU_ALLOC_SIZE(info->num_cpu), info->online, false);
+	game_mode_unthrottle_others(isolation->session);
+
+	const char **writes = calloc(2 * isolation->count + 1, sizeof(const char *));
+	size_t num_writes = 0;
+	for (size_t i = 0; writes && i < isolation->count; i++) {
+		/* Cgroups may have gone away meanwhile */
+		if (isolation->files[i].path[0] == '\0' || access(isolation->files[i].path, F_OK) != 0)
+			continue;
+
+		writes[num_writes++] = isolation->files[i].path;
+		writes[num_writes++] = isolation->files[i].value;
+	}
+
+	if (num_writes > 0) {
+		LOG_MSG("Requesting other work to move back to all cores\n");
+		if (game_mode_apply_privileged_writes(writes) != 0)
+			LOG_ERROR("Failed to restore the cores of other work\n");
+	}
+
+	free(writes);
+	free(isolation->files);
+	free(isolation);
 }
 
 void game_mode_free_cpu(GameModeCPUInfo **info)
@@ -534,6 +728,10 @@ void game_mode_free_cpu(GameModeCPUInfo **info)
 		CPU_FREE((*info)->to_keep);
 		(*info)->to_keep = NULL;
 
+		if ((*info)->siblings)
+			CPU_FREE((*info)->siblings);
+		(*info)->siblings = NULL;
+
 		free(*info);
 		*info = NULL;
 	}
@@ -39,13 +39,16 @@ POSSIBILITY OF SUCH DAMAGE.
 #ifdef USE_ELOGIND
 #include <elogind/sd-bus.h>
 #include <elogind/sd-daemon.h>
+#include <elogind/sd-event.h>
 #else
 #include <systemd/sd-bus.h>
 #include <systemd/sd-daemon.h>
+#include <systemd/sd-event.h>
 #endif
 
 #include <assert.h>
 #include <errno.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -58,6 +61,10 @@ POSSIBILITY OF SUCH DAMAGE.
 static sd_bus *bus = NULL;
 static sd_bus_slot *slot = NULL;
 
+/* WaitForTransition calls to reply to once game mode settles */
+static sd_bus_message **pending_waits = NULL;
+static size_t num_pending_waits = 0;
+
 /**
  * Clean up our private dbus state
  */
@@ -67,6 +74,12 @@ static void clean_up(void)
 		sd_bus_slot_unref(slot);
 	}
 	slot = NULL;
+	for (size_t i = 0; i < num_pending_waits; i++) {
+		sd_bus_message_unref(pending_waits[i]);
+	}
+	free(pending_waits);
+	pending_waits = NULL;
+	num_pending_waits = 0;
 	if (bus) {
 		sd_bus_unref(bus);
 	}
@@ -294,6 +307,110 @@ static int method_query_status_by_pidfd(sd_bus_message *m, void *userdata,
 	return sd_bus_reply_method_return(m, "i", reply);
 }
 
+/**
+ * Handles the RegisterThread D-BUS Method
+ */
+static int method_register_thread(sd_bus_message *m, void *userdata,
+                                  __attribute__((unused)) sd_bus_error *ret_error)
+{
+	int pid = 0;
+	int tid = 0;
+	int role = 0;
+	GameModeContext *context = userdata;
+
+	int ret = sd_bus_message_read(m, "iii", &pid, &tid, &role);
+	if (ret < 0) {
+		LOG_ERROR("Failed to parse input parameters: %s\n", strerror(-ret));
+		return ret;
+	}
+
+	int status = game_mode_context_register_thread(context, (pid_t)pid, (pid_t)tid, role);
+
+	return sd_bus_reply_method_return(m, "i", status);
+}
+
+/**
+ * Handles the UnregisterThread D-BUS Method
+ */
+static int method_unregister_thread(sd_bus_message *m, void *userdata,
+                                    __attribute__((unused)) sd_bus_error *ret_error)
+{
+	int pid = 0;
+	int tid = 0;
+	GameModeContext *context = userdata;
+
+	int ret = sd_bus_message_read(m, "ii", &pid, &tid);
+	if (ret < 0) {
+		LOG_ERROR("Failed to parse input parameters: %s\n", strerror(-ret));
+		return ret;
+	}
+
+	int status = game_mode_context_unregister_thread(context, (pid_t)pid, (pid_t)tid);
+
+	return sd_bus_reply_method_return(m, "i", status);
+}
+
+/**
+ * Handles the RegisterThreadByPIDFd D-BUS Method
+ *
+ * Threads can only be registered by the process they belong to.
+ */
+static int method_register_thread_by_pidfd(sd_bus_message *m, void *userdata,
+                                           __attribute__((unused)) sd_bus_error *ret_error)
+{
+	int fds[2] = { -1, -1 };
+	pid_t pids[2] = { 0, 0 };
+	int tid = 0;
+	int role = 0;
+	GameModeContext *context = userdata;
+
+	int ret = sd_bus_message_read(m, "hhii", &fds[0], &fds[1], &tid, &role);
+	if (ret < 0) {
+		LOG_ERROR("Failed to parse input parameters: %s\n", strerror(-ret));
+		return ret;
+	}
+
+	int reply = pidfds_to_pids(fds, pids, 2);
+
+	if (reply != 2)
+		reply = -1;
+	else if (pids[0] != pids[1])
+		reply = -2;
+	else
+		reply = game_mode_context_register_thread(context, pids[0], (pid_t)tid, role);
+
+	return sd_bus_reply_method_return(m, "i", reply);
+}
+
+/**
+ * Handles the UnregisterThreadByPIDFd D-BUS Method
+ */
+static int method_unregister_thread_by_pidfd(sd_bus_message *m, void *userdata,
+                                             __attribute__((unused)) sd_bus_error *ret_error)
+{
+	int fds[2] = { -1, -1 };
+	pid_t pids[2] = { 0, 0 };
+	int tid = 0;
+	GameModeContext *context = userdata;
+
+	int ret = sd_bus_message_read(m, "hhi", &fds[0], &fds[1], &tid);
+	if (ret < 0) {
+		LOG_ERROR("Failed to parse input parameters: %s\n", strerror(-ret));
+		return ret;
+	}
+
+	int reply = pidfds_to_pids(fds, pids, 2);
+
+	if (reply != 2)
+		reply = -1;
+	else if (pids[0] != pids[1])
+		reply = -2;
+	else
+		reply = game_mode_context_unregister_thread(context, pids[0], (pid_t)tid);
+
+	return sd_bus_reply_method_return(m, "i", reply);
+}
+
 /**
  * Handles the ClientCount D-BUS Property
  */
@@ -309,6 +426,66 @@ static int property_get_client_count(sd_bus *local_bus, const char *path, const
 	return sd_bus_message_append_basic(reply, 'i', &count);
 }
 
+static const char *game_mode_state_name(enum GameModeState state)
+{
+	switch (state) {
+	case GAME_MODE_STATE_ACTIVATING:
+		return "Activating";
+	case GAME_MODE_STATE_ACTIVE:
+		return "Active";
+	case GAME_MODE_STATE_DEACTIVATING:
+		return "Deactivating";
+	case GAME_MODE_STATE_INACTIVE:
+	default:
+		return "Inactive";
+	}
+}
+
+/**
+ * Handles the State D-BUS Property
+ */
+static int property_get_state(sd_bus *local_bus, const char *path, const char *interface,
+                              const char *property, sd_bus_message *reply, void *userdata,
+                              __attribute__((unused)) sd_bus_error *ret_error)
+{
+	GameModeContext *context = userdata;
+	const char *state = game_mode_state_name(game_mode_context_get_state(context));
+
+	return sd_bus_message_append_basic(reply, 's', state);
+}
+
+/* Whether the state is one game mode can settle in */
+static inline bool game_mode_state_is_settled(enum GameModeState state)
+{
+	return state == GAME_MODE_STATE_ACTIVE || state == GAME_MODE_STATE_INACTIVE;
+}
+
+/**
+ * Handles the WaitForTransition D-BUS Method
+ *
+ * Replies once any transition in or out of game mode has finished, with 1 if
+ * game mode ended up active and 0 if not.
+ */
+static int method_wait_for_transition(sd_bus_message *m, void *userdata,
+                                      __attribute__((unused)) sd_bus_error *ret_error)
+{
+	GameModeContext *context = userdata;
+	enum GameModeState state = game_mode_context_get_state(context);
+
+	if (game_mode_state_is_settled(state))
+		return sd_bus_reply_method_return(m, "i", state == GAME_MODE_STATE_ACTIVE ? 1 : 0);
+
+	/* Hold on to the call, game_mode_state_changed replies to it */
+	sd_bus_message **waits =
+	    realloc(pending_waits, (num_pending_waits + 1) * sizeof(sd_bus_message *));
+	if (!waits)
+		return -ENOMEM;
+
+	pending_waits = waits;
+	pending_waits[num_pending_waits++] = sd_bus_message_ref(m);
+	return 1;
+}
+
 /**
  * Handles the Refresh Config request
  */
@@ -410,6 +587,33 @@ void game_mode_client_unregistered(pid_t pid)
 	game_mode_client_send_game_signal(pid, false);
 }
 
+/* Emit the State change, and complete any waits once game mode has settled */
+void game_mode_state_changed(void)
+{
+	if (!bus)
+		return;
+
+	(void)sd_bus_emit_properties_changed(bus,
+	                                     "/com/feralinteractive/GameMode",
+	                                     "com.feralinteractive.GameMode",
+	                                     "State",
+	                                     NULL);
+
+	enum GameModeState state = game_mode_context_get_state(game_mode_context_instance());
+	if (!game_mode_state_is_settled(state))
+		return;
+
+	for (size_t i = 0; i < num_pending_waits; i++) {
+		int ret = sd_bus_reply_method_return(pending_waits[i],
+		                                     "i",
+		                                     state == GAME_MODE_STATE_ACTIVE ? 1 : 0);
+		if (ret < 0)
+			LOG_ERROR("Failed to reply to WaitForTransition: %s\n", strerror(-ret));
+		sd_bus_message_unref(pending_waits[i]);
+	}
+	num_pending_waits = 0;
+}
+
 /**
  * D-BUS vtable to dispatch virtual methods
  */
@@ -419,6 +623,8 @@ static const sd_bus_vtable gamemode_vtable[] = {
 	SD_BUS_VTABLE_START(0),
 	SD_BUS_PROPERTY("ClientCount", "i", property_get_client_count, 0,
 	                SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
+	SD_BUS_PROPERTY("State", "s", property_get_state, 0,
+	                SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
 	SD_BUS_METHOD("RegisterGame", "i", "i", method_register_game, SD_BUS_VTABLE_UNPRIVILEGED),
 	SD_BUS_METHOD("UnregisterGame", "i", "i", method_unregister_game, SD_BUS_VTABLE_UNPRIVILEGED),
 	SD_BUS_METHOD("QueryStatus", "i", "i", method_query_status, SD_BUS_VTABLE_UNPRIVILEGED),
@@ -437,6 +643,16 @@ static const sd_bus_vtable gamemode_vtable[] = {
 	              SD_BUS_VTABLE_UNPRIVILEGED),
 	SD_BUS_METHOD("RefreshConfig", "", "i", method_refresh_config, SD_BUS_VTABLE_UNPRIVILEGED),
 	SD_BUS_METHOD("ListGames", "", "a(io)", method_list_games, SD_BUS_VTABLE_UNPRIVILEGED),
+	SD_BUS_METHOD("WaitForTransition", "", "i", method_wait_for_transition,
+	              SD_BUS_VTABLE_UNPRIVILEGED),
+	SD_BUS_METHOD("RegisterThread", "iii", "i", method_register_thread,
+	              SD_BUS_VTABLE_UNPRIVILEGED),
+	SD_BUS_METHOD("UnregisterThread", "ii", "i", method_unregister_thread,
+	              SD_BUS_VTABLE_UNPRIVILEGED),
+	SD_BUS_METHOD("RegisterThreadByPIDFd", "hhii", "i", method_register_thread_by_pidfd,
+	              SD_BUS_VTABLE_UNPRIVILEGED),
+	SD_BUS_METHOD("UnregisterThreadByPIDFd", "hhi", "i", method_unregister_thread_by_pidfd,
+	              SD_BUS_VTABLE_UNPRIVILEGED),
 
 	SD_BUS_SIGNAL("GameRegistered", "io", 0),
 	SD_BUS_SIGNAL("GameUnregistered", "io", 0),
@@ -655,6 +871,19 @@ static const sd_bus_vtable game_vtable[] = {
 };
 /* clang-format on */
 
+/**
+ * Quit the main loop on SIGINT or SIGTERM
+ */
+static int handle_quit_signal(sd_event_source *source,
+                              __attribute__((unused)) const struct signalfd_siginfo *si,
+                              __attribute__((unused)) void *userdata)
+{
+	LOG_MSG("Quitting by request...\n");
+	sd_notify(0, "STATUS=GameMode is quitting by request...\n");
+
+	return sd_event_exit(sd_event_source_get_event(source), 0);
+}
+
 /**
  * Main process loop for the daemon. Run until quitting has been requested.
  */
@@ -664,6 +893,26 @@ __attribute__((noreturn)) void game_mode_context_loop(GameModeContext *context)
 	atexit(clean_up);
 	int ret = 0;
 
+	/* The context already put its reaper, pidfd and inotify sources on the default loop */
+	sd_event *event = NULL;
+	ret = sd_event_default(&event);
+	if (ret < 0) {
+		FATAL_ERROR("Failed to get the event loop: %s\n", strerror(-ret));
+	}
+
+	/* Handle quits from the loop, signal sources need the signals blocked */
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0) {
+		FATAL_ERRORNO("Could not block SIGINT and SIGTERM");
+	}
+	if ((ret = sd_event_add_signal(event, NULL, SIGINT, handle_quit_signal, NULL)) < 0 ||
+	    (ret = sd_event_add_signal(event, NULL, SIGTERM, handle_quit_signal, NULL)) < 0) {
+		FATAL_ERROR("Could not catch quit signals: %s\n", strerror(-ret));
+	}
+
 	/* Connect to the session bus */
 	ret = sd_bus_open_user(&bus);
 
@@ -706,27 +955,25 @@ __attribute__((noreturn)) void game_mode_context_loop(GameModeContext *context)
 		FATAL_ERROR("Failed to acquire service name: %s\n", strerror(-ret));
 	}
 
+	ret = sd_bus_attach_event(bus, event, SD_EVENT_PRIORITY_NORMAL);
+	if (ret < 0) {
+		FATAL_ERROR("Failed to attach the bus to the event loop: %s\n", strerror(-ret));
+	}
+
 	LOG_MSG("Successfully initialised bus with name [%s]...\n", "com.feralinteractive.GameMode");
 	sd_notifyf(0, "STATUS=%sGameMode is ready to be activated.%s\n", "\x1B[1;36m", "\x1B[0m");
 
-	/* Now loop, waiting for callbacks */
-	for (;;) {
-		ret = sd_bus_process(bus, NULL);
-		if (ret < 0) {
-			FATAL_ERROR("Failure when processing the bus: %s\n", strerror(-ret));
-		}
+	/* Now loop, waiting for callbacks from the bus, timers, pidfds and inotify */
+	ret = sd_event_loop(event);
+	if (ret < 0) {
+		FATAL_ERROR("Failure when running the event loop: %s\n", strerror(-ret));
+	}
 
-		/* We're done processing */
-		if (ret > 0) {
-			continue;
-		}
+	/* Clean up nicely */
+	game_mode_context_destroy(context);
+	sd_event_unref(event);
 
-		/* Wait for more */
-		ret = sd_bus_wait(bus, (uint64_t)-1);
-		if (ret < 0 && -ret != EINTR) {
-			FATAL_ERROR("Failure when waiting on bus: %s\n", strerror(-ret));
-		}
-	}
+	exit(EXIT_SUCCESS);
 }
 
 struct GameModeIdleInhibitor {
@@ -170,8 +170,7 @@ int game_mode_apply_gpu(const GameModeGPUInfo *info)
 
 	// Set up our command line to pass to gpuclockctl
 	const char *const exec_args[] = {
-		"pkexec",
-		LIBEXECDIR "/gpuclockctl",
+		"gpuclockctl",
 		device,
 		"set",
 		info->vendor == Vendor_NVIDIA ? nv_core : info->amd_performance_level,
@@ -182,7 +181,7 @@ int game_mode_apply_gpu(const GameModeGPUInfo *info)
 		NULL,
 	};
 
-	if (run_external_process(exec_args, NULL, -1) != 0) {
+	if (game_mode_run_privileged(exec_args, NULL) != 0) {
 		LOG_ERROR("Failed to call gpuclockctl, could not apply optimisations!\n");
 		return -1;
 	}
@@ -232,4 +231,30 @@ int game_mode_get_gpu(GameModeGPUInfo *info)
 	}
 
 	return 0;
-}
\ No newline at end of file
+}
+
+/**
+ * Checks whether the values in info are still the ones the gpu runs with
+ */
+bool game_mode_gpu_matches(const GameModeGPUInfo *info)
+{
+	if (!info)
+		return true;
+
+	GameModeGPUInfo live = *info;
+	if (game_mode_get_gpu(&live) != 0)
+		return false;
+
+	switch (info->vendor) {
+	case Vendor_NVIDIA:
+		/* -1 leaves a value alone */
+		return (info->nv_core == -1 || live.nv_core == info->nv_core) &&
+		       (info->nv_mem == -1 || live.nv_mem == info->nv_mem) &&
+		       (info->nv_powermizer_mode == -1 ||
+		        live.nv_powermizer_mode == info->nv_powermizer_mode);
+	case Vendor_AMD:
+		return strcmp(live.amd_performance_level, info->amd_performance_level) == 0;
+	default:
+		return true;
+	}
+}
@@ -0,0 +1,350 @@
+/*
+
+Copyright (c) 2017-2025, Feral Interactive and the GameMode contributors
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+ * Neither the name of Feral Interactive nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+#define _GNU_SOURCE
+
+#include "common-external.h"
+#include "common-logging.h"
+
+#include "gamemode.h"
+
+#include "build-config.h"
+
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Time allowed for polkit to authorise the helper, which may involve a prompt */
+#define HELPER_START_TIMEOUT_MS 60000
+/* Time before starting it again after that failed, doubled on each failure in a row */
+#define HELPER_RETRY_MIN_SEC 10
+#define HELPER_RETRY_MAX_SEC 600
+/* Time allowed for a reply, the helper gives up on a helper process after 5 seconds */
+#define HELPER_REPLY_TIMEOUT_MS 10000
+#define HELPER_REQUEST_MAX 65536
+#define HELPER_ARGS_MAX 2048
+
+/**
+ * The resident privileged helper, started on first use
+ */
+static struct {
+	pthread_mutex_t lock; /**<Guards the members below */
+	int fd;               /**<Request socket, -1 if not running */
+	pid_t pid;            /**<pkexec, and then the helper itself */
+	bool disabled;        /**<resident_helper is off, use pkexec for every request */
+	bool starting;        /**<A request is waiting for polkit to authorise the helper */
+	time_t retry_delay;   /**<Back-off after the last failed start, 0 if it did not fail */
+	time_t retry_at;      /**<When to try starting it again, in CLOCK_MONOTONIC seconds */
+} helper = { PTHREAD_MUTEX_INITIALIZER, -1, 0, false, false, 0, 0 };
+
+static time_t monotonic_seconds(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec;
+}
+
+/**
+ * Start the helper through pkexec, it sends "ready" once it is authorised and running
+ * Called without helper.lock held, authorising it may take as long as a prompt stays open
+ */
+static bool start_helper(int *helper_fd, pid_t *helper_pid)
+{
+	int fds[2];
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) != 0) {
+		LOG_ERROR("Could not create helper socket: %s\n", strerror(errno));
+		return false;
+	}
+
+	pid_t pid = fork();
+	if (pid < 0) {
+		LOG_ERROR("Failed to fork(): %s\n", strerror(errno));
+		close(fds[0]);
+		close(fds[1]);
+		return false;
+	} else if (pid == 0) {
+		/* pkexec keeps stdin open for the helper, dup2 clears close on exec */
+		dup2(fds[1], STDIN_FILENO);
+		execlp("pkexec", "pkexec", LIBEXECDIR "/gamemodehelper", (char *)NULL);
+		_exit(EXIT_FAILURE);
+	}
+
+	close(fds[1]);
+
+	char ready[8] = { 0 };
+	struct pollfd pfd = { .fd = fds[0], .events = POLLIN };
+	if (poll(&pfd, 1, HELPER_START_TIMEOUT_MS) != 1 || recv(fds[0], ready, sizeof(ready), 0) != 5 ||
+	    strcmp(ready, "ready") != 0) {
+		LOG_ERROR("Could not start the privileged helper, falling back to pkexec\n");
+		close(fds[0]);
+		kill(pid, SIGTERM);
+		waitpid(pid, NULL, 0);
+		return false;
+	}
+
+	*helper_fd = fds[0];
+	*helper_pid = pid;
+	return true;
+}
+
+/**
+ * Start the helper unless it is running, being started or backing off after a failed start
+ * Called with helper.lock held, it is dropped while waiting for polkit
+ */
+static void ensure_helper(void)
+{
+	if (helper.fd >= 0 || helper.disabled || helper.starting ||
+	    monotonic_seconds() < helper.retry_at)
+		return;
+
+	/* Requests in the meantime fall back to pkexec rather than wait behind the lock */
+	helper.starting = true;
+	pthread_mutex_unlock(&helper.lock);
+
+	int fd = -1;
+	pid_t pid = 0;
+	bool started = start_helper(&fd, &pid);
+
+	pthread_mutex_lock(&helper.lock);
+	helper.starting = false;
+	if (started && helper.disabled) {
+		/* resident_helper was turned off in the meantime */
+		close(fd);
+		waitpid(pid, NULL, 0);
+		return;
+	} else if (started) {
+		helper.fd = fd;
+		helper.pid = pid;
+		helper.retry_delay = 0;
+		return;
+	}
+
+	/* A dismissed prompt or a slow agent should not rule out the helper for good */
+	helper.retry_delay = helper.retry_delay == 0 ? HELPER_RETRY_MIN_SEC : helper.retry_delay * 2;
+	if (helper.retry_delay > HELPER_RETRY_MAX_SEC)
+		helper.retry_delay = HELPER_RETRY_MAX_SEC;
+	helper.retry_at = monotonic_seconds() + helper.retry_delay;
+	LOG_MSG("Trying the privileged helper again in %lld seconds\n", (long long)helper.retry_delay);
+}
+
+/**
+ * Stop the helper, called with helper.lock held
+ */
+static void stop_helper(void)
+{
+	if (helper.fd < 0)
+		return;
+
+	/* The helper exits when its socket is closed */
+	close(helper.fd);
+	waitpid(helper.pid, NULL, 0);
+	helper.fd = -1;
+}
+
+/**
+ * Send a request along with the write end of its reply socket
+ *
+ * @returns -2 if there is no helper to send it to
+ */
+static int send_request(const char *const *exec_args, int reply)
+{
+	char request[HELPER_REQUEST_MAX];
+	size_t len = 0;
+
+	for (const char *const *arg = exec_args; *arg; arg++) {
+		size_t arg_len = strlen(*arg) + 1;
+		if (len + arg_len > sizeof(request))
+			return -2;
+		memcpy(request + len, *arg, arg_len);
+		len += arg_len;
+	}
+
+	char control[CMSG_SPACE(sizeof(int))] = { 0 };
+	struct iovec iov = { .iov_base = request, .iov_len = len };
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control,
+		.msg_controllen = sizeof(control),
+	};
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &reply, sizeof(int));
+
+	ssize_t ret = -1;
+	pthread_mutex_lock(&helper.lock);
+	ensure_helper();
+
+	if (helper.fd >= 0) {
+		ret = sendmsg(helper.fd, &msg, MSG_NOSIGNAL);
+		if (ret < 0) {
+			/* The helper went away, start it again for the next request */
+			LOG_ERROR("Lost the privileged helper: %s\n", strerror(errno));
+			stop_helper();
+		}
+	}
+	pthread_mutex_unlock(&helper.lock);
+
+	return ret < 0 ? -2 : 0;
+}
+
+/**
+ * Read "<status>\n<output>" from the reply socket until the helper closes it
+ */
+static int read_reply(int fd, char buffer[EXTERNAL_BUFFER_MAX])
+{
+	char reply[EXTERNAL_BUFFER_MAX + 16];
+	size_t len = 0;
+
+	while (len < sizeof(reply) - 1) {
+		struct pollfd pfd = { .fd = fd, .events = POLLIN };
+		int ready = poll(&pfd, 1, HELPER_REPLY_TIMEOUT_MS);
+		if (ready < 0 && errno == EINTR)
+			continue;
+		if (ready != 1) {
+			LOG_ERROR("Timed out waiting for the privileged helper\n");
+			return -1;
+		}
+
+		ssize_t just_read = read(fd, reply + len, sizeof(reply) - 1 - len);
+		if (just_read < 0 && errno == EINTR)
+			continue;
+		if (just_read <= 0)
+			break;
+		len += (size_t)just_read;
+	}
+	reply[len] = '\0';
+
+	char *output = NULL;
+	long status = strtol(reply, &output, 10);
+	if (output == reply || *output != '\n') {
+		LOG_ERROR("Malformed reply from the privileged helper\n");
+		return -1;
+	}
+
+	if (buffer)
+		snprintf(buffer, EXTERNAL_BUFFER_MAX, "%s", output + 1);
+	else if (status != 0)
+		LOG_ERROR("Output was: %s\n", output + 1);
+
+	return status == 0 ? 0 : -1;
+}
+
+/**
+ * Run one of the privileged helpers in LIBEXECDIR
+ */
+int game_mode_run_privileged(const char *const *exec_args, char *buffer)
+{
+	int fds[2];
+	if (buffer)
+		buffer[0] = '\0';
+
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) == 0) {
+		int ret = send_request(exec_args, fds[1]);
+		close(fds[1]);
+
+		if (ret == 0)
+			ret = read_reply(fds[0], buffer);
+		close(fds[0]);
+
+		if (ret != -2)
+			return ret;
+	}
+
+	/* Fall back to authorising every call */
+	const char *args[HELPER_ARGS_MAX + 2] = { "pkexec" };
+	char path[PATH_MAX];
+	size_t argc = 1;
+
+	snprintf(path, sizeof(path), "%s/%s", LIBEXECDIR, exec_args[0]);
+	args[argc++] = path;
+	for (const char *const *arg = exec_args + 1; *arg && argc < HELPER_ARGS_MAX + 1; arg++)
+		args[argc++] = *arg;
+
+	return run_external_process(args, buffer, -1);
+}
+
+/**
+ * Apply a transaction of path, value pairs, see gamemodehelper apply
+ */
+int game_mode_apply_privileged_writes(const char *const *writes)
+{
+	const char *args[HELPER_ARGS_MAX + 1] = { "gamemodehelper", "apply" };
+	size_t argc = 2;
+
+	for (; *writes; writes++) {
+		if (argc == HELPER_ARGS_MAX) {
+			LOG_ERROR("Too many writes in one transaction\n");
+			return -1;
+		}
+		args[argc++] = *writes;
+	}
+
+	char report[EXTERNAL_BUFFER_MAX];
+	int ret = game_mode_run_privileged(args, report);
+	if (ret != 0)
+		LOG_ERROR("Privileged writes failed, and were rolled back:\n%s", report);
+
+	return ret;
+}
+
+/**
+ * Choose between the resident helper and pkexec for every request, following resident_helper
+ */
+void game_mode_use_resident_helper(bool resident)
+{
+	pthread_mutex_lock(&helper.lock);
+	helper.disabled = !resident;
+	if (helper.disabled) {
+		stop_helper();
+	} else {
+		helper.retry_delay = 0;
+		helper.retry_at = 0;
+	}
+	pthread_mutex_unlock(&helper.lock);
+}
+
+/**
+ * Stop the resident helper, it is started again on the next request
+ */
+void game_mode_stop_privileged_helper(void)
+{
+	pthread_mutex_lock(&helper.lock);
+	stop_helper();
+	pthread_mutex_unlock(&helper.lock);
+}
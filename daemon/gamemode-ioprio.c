@@ -36,7 +36,6 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "common-logging.h"
 #include "gamemode-config.h"
 
-#include <dirent.h>
 #include <sys/syscall.h>
 
 /**
@@ -107,84 +106,51 @@ int game_mode_get_ioprio(const pid_t client)
 /**
  * Apply io priorities
  *
- * This tries to change the io priority of the client to a value specified
- * and can possibly reduce lags or latency when a game has to load assets
- * on demand.
+ * This tries to change the io priority of a thread of the client from the
+ * expected value to the target one, and can possibly reduce lags or latency
+ * when a game has to load assets on demand.
+ *
+ * Returns whether the thread has the target value afterwards. Threads inherit
+ * the io priority of the thread creating them, so one that already has it is
+ * left alone.
  */
-void game_mode_apply_ioprio(const GameModeContext *self, const pid_t client, int expected)
+bool game_mode_apply_thread_ioprio(const pid_t client, const pid_t tid, const int expected,
+                                   const int target)
 {
-	if (expected == IOPRIO_DONT_SET)
-		/* Silently bail if fed a don't set (invalid) */
-		return;
-
-	GameModeConfig *config = game_mode_config_from_context(self);
-
-	/* read configuration "ioprio" (0..7) */
-	int ioprio = (int)config_get_ioprio_value(config);
-
-	/* Special value to simply not set the value */
-	if (ioprio == IOPRIO_DONT_SET)
-		return;
-
-	LOG_MSG("Setting ioprio value...\n");
-
-	/* If fed the default, we'll try and reset the value back */
-	if (expected != IOPRIO_DEFAULT) {
-		expected = (int)ioprio;
-		ioprio = IOPRIO_DEFAULT;
+	int current = ioprio_get(IOPRIO_WHO_PROCESS, tid);
+	if (current == -1) {
+		/* Couldn't get the ioprio value
+		 * This could simply mean that the thread exited before fetching the ioprio
+		 */
+		return false;
 	}
 
-	/* Open the tasks dir for the client */
-	char tasks[128];
-	snprintf(tasks, sizeof(tasks), "/proc/%d/task", client);
-	DIR *client_task_dir = opendir(tasks);
-	if (client_task_dir == NULL) {
-		LOG_ERROR("Could not inspect tasks for client [%d]! Skipping ioprio optimisation.\n",
-		          client);
-		return;
+	current = IOPRIO_PRIO_DATA(current);
+	if (current == target) {
+		return true;
+	} else if (current != expected) {
+		/* Don't try and adjust the ioprio value if the value we got doesn't match default */
+		LOG_ERROR("Skipping ioprio on client [%d,%d]: ioprio was (%d) but we expected (%d)\n",
+		          client,
+		          tid,
+		          current,
+		          expected);
+		return false;
 	}
 
-	/* Iterate for all tasks of client process */
-	struct dirent *tid_entry;
-	while ((tid_entry = readdir(client_task_dir)) != NULL) {
-		/* Skip . and .. */
-		if (tid_entry->d_name[0] == '.')
-			continue;
-
-		/* task name is the name of the file */
-		int tid = atoi(tid_entry->d_name);
-
-		int current = game_mode_get_ioprio(tid);
-		if (current == IOPRIO_DONT_SET) {
-			/* Couldn't get the ioprio value
-			 * This could simply mean that the thread exited before fetching the ioprio
-			 * So we should continue
-			 */
-		} else if (current != expected) {
-			/* Don't try and adjust the ioprio value if the value we got doesn't match default */
-			LOG_ERROR("Skipping ioprio on client [%d,%d]: ioprio was (%d) but we expected (%d)\n",
-			          client,
-			          tid,
-			          current,
-			          expected);
-		} else {
-			/*
-			 * For now we only support IOPRIO_CLASS_BE
-			 * IOPRIO_CLASS_RT requires CAP_SYS_ADMIN but should be possible with a polkit process
-			 */
-			int p = ioprio;
-			ioprio = IOPRIO_PRIO_VALUE(IOPRIO_CLASS_BE, ioprio);
-			if (ioprio_set(IOPRIO_WHO_PROCESS, tid, ioprio) != 0) {
-				/* This could simply mean the thread is gone now, as above */
-				LOG_ERROR(
-				    "Setting client [%d,%d] IO priority to (%d) failed with error %d, ignoring.\n",
-				    client,
-				    tid,
-				    p,
-				    errno);
-			}
-		}
+	/*
+	 * For now we only support IOPRIO_CLASS_BE
+	 * IOPRIO_CLASS_RT requires CAP_SYS_ADMIN but should be possible with a polkit process
+	 */
+	if (ioprio_set(IOPRIO_WHO_PROCESS, tid, IOPRIO_PRIO_VALUE(IOPRIO_CLASS_BE, target)) != 0) {
+		/* This could simply mean the thread is gone now, as above */
+		LOG_ERROR("Setting client [%d,%d] IO priority to (%d) failed with error %d, ignoring.\n",
+		          client,
+		          tid,
+		          target,
+		          errno);
+		return false;
 	}
 
-	closedir(client_task_dir);
+	return true;
 }
@@ -0,0 +1,486 @@
+/*
+
+Copyright (c) 2017-2025, Feral Interactive and the GameMode contributors
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+ * Neither the name of Feral Interactive nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+#define _GNU_SOURCE
+
+#include "gamemode.h"
+
+#include <errno.h>
+#include <fnmatch.h>
+#include <pthread.h>
+#include <regex.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Prefix marking a pattern as an extended regular expression */
+#define MATCHER_REGEX_PREFIX "regex:"
+
+/* Prefix marking a pattern as a glob, plain patterns may well contain glob characters */
+#define MATCHER_GLOB_PREFIX "glob:"
+
+/* Number of verdicts remembered, must be a power of two */
+#define MATCHER_CACHE_SIZE 64
+
+/* The root of the automaton, also used as "none" since it is nobody's child or output */
+#define MATCHER_ROOT 0
+
+/* End of a glob chain */
+#define MATCHER_NO_GLOB UINT32_MAX
+
+/**
+ * A node of the substring automaton, children are kept in a sibling list
+ */
+struct MatcherNode {
+	uint32_t fail;         /**<Longest proper suffix that is also in the trie */
+	uint32_t output;       /**<Nearest node along the fail links with globs */
+	uint32_t first_child;  /**<MATCHER_ROOT if there are no children */
+	uint32_t next_sibling; /**<MATCHER_ROOT for the last child */
+	uint32_t first_glob;   /**<Globs whose literal ends here, or MATCHER_NO_GLOB */
+	unsigned char byte;
+	bool match; /**<A plain pattern ends here, or at a node along the fail links */
+};
+
+/**
+ * A glob, only tried once the longest literal part of it was seen in the subject
+ */
+struct MatcherGlob {
+	const char *pattern;
+	uint32_t next; /**<Next glob with the same literal, or MATCHER_NO_GLOB */
+};
+
+struct MatcherCacheEntry {
+	uint64_t hash;
+	char *subject; /**<NULL for an unused entry */
+	bool verdict;
+};
+
+/**
+ * Matches a subject against a list of patterns at once
+ *
+ * Plain patterns match anywhere in the subject and are compiled into an
+ * Aho-Corasick automaton, so the subject is scanned once however many there
+ * are. Globs match the whole subject, the same scan finds their longest
+ * literal part and only those globs are tried with fnmatch. Regexes are tried
+ * one by one and are the slow path. Recent verdicts are cached by subject.
+ */
+struct GameModeMatcher {
+	char **patterns; /**<As given, in order */
+	size_t num_patterns;
+	size_t max_patterns;
+
+	struct MatcherNode *nodes;
+	size_t num_nodes;
+	size_t max_nodes;
+	uint32_t root_next[256]; /**<Dense transitions out of the root */
+
+	struct MatcherGlob *globs;
+	size_t num_globs;
+	uint32_t unanchored_globs; /**<Globs without any literal part, always tried */
+
+	regex_t *regexes;
+	size_t num_regexes;
+
+	pthread_mutex_t cache_lock;
+	struct MatcherCacheEntry cache[MATCHER_CACHE_SIZE];
+};
+
+static bool matcher_is_regex(const char *pattern)
+{
+	return strncmp(pattern, MATCHER_REGEX_PREFIX, strlen(MATCHER_REGEX_PREFIX)) == 0;
+}
+
+static bool matcher_is_glob(const char *pattern)
+{
+	return strncmp(pattern, MATCHER_GLOB_PREFIX, strlen(MATCHER_GLOB_PREFIX)) == 0;
+}
+
+GameModeMatcher *game_mode_matcher_new(void)
+{
+	GameModeMatcher *matcher = calloc(1, sizeof(GameModeMatcher));
+	if (!matcher)
+		return NULL;
+
+	matcher->unanchored_globs = MATCHER_NO_GLOB;
+	pthread_mutex_init(&matcher->cache_lock, NULL);
+	return matcher;
+}
+
+void game_mode_matcher_free(GameModeMatcher *matcher)
+{
+	if (!matcher)
+		return;
+
+	for (size_t i = 0; i < matcher->num_regexes; i++)
+		regfree(&matcher->regexes[i]);
+	free(matcher->regexes);
+	free(matcher->globs);
+	free(matcher->nodes);
+
+	for (size_t i = 0; i < matcher->num_patterns; i++)
+		free(matcher->patterns[i]);
+	free(matcher->patterns);
+
+	for (size_t i = 0; i < MATCHER_CACHE_SIZE; i++)
+		free(matcher->cache[i].subject);
+	pthread_mutex_destroy(&matcher->cache_lock);
+
+	free(matcher);
+}
+
+int game_mode_matcher_add(GameModeMatcher *matcher, const char *pattern)
+{
+	/* Empty patterns never counted as entries */
+	if (pattern[0] == '\0')
+		return 0;
+
+	if (matcher_is_regex(pattern)) {
+		regex_t regex;
+		if (regcomp(&regex, pattern + strlen(MATCHER_REGEX_PREFIX), REG_EXTENDED | REG_NOSUB) !=
+		    0)
+			return -EINVAL;
+		regfree(&regex);
+	}
+
+	if (matcher->num_patterns == matcher->max_patterns) {
+		size_t max = matcher->max_patterns ? matcher->max_patterns * 2 : 8;
+		char **patterns = realloc(matcher->patterns, max * sizeof(char *));
+		if (!patterns)
+			return -ENOMEM;
+
+		matcher->patterns = patterns;
+		matcher->max_patterns = max;
+	}
+
+	if (!(matcher->patterns[matcher->num_patterns] = strdup(pattern)))
+		return -ENOMEM;
+
+	matcher->num_patterns++;
+	return 0;
+}
+
+static uint32_t matcher_child(const GameModeMatcher *matcher, uint32_t node, unsigned char byte)
+{
+	if (node == MATCHER_ROOT)
+		return matcher->root_next[byte];
+
+	for (uint32_t child = matcher->nodes[node].first_child; child != MATCHER_ROOT;
+	     child = matcher->nodes[child].next_sibling) {
+		if (matcher->nodes[child].byte == byte)
+			return child;
+	}
+
+	return MATCHER_ROOT;
+}
+
+/* Add len bytes of str to the trie, returning the node they end at or MATCHER_ROOT */
+static uint32_t matcher_insert(GameModeMatcher *matcher, const char *str, size_t len)
+{
+	uint32_t node = MATCHER_ROOT;
+
+	for (const unsigned char *p = (const unsigned char *)str; len--; p++) {
+		uint32_t child = matcher_child(matcher, node, *p);
+		if (child == MATCHER_ROOT) {
+			if (matcher->num_nodes == matcher->max_nodes) {
+				size_t max = matcher->max_nodes * 2;
+				struct MatcherNode *nodes = realloc(matcher->nodes, max * sizeof(*nodes));
+				if (!nodes)
+					return MATCHER_ROOT;
+
+				matcher->nodes = nodes;
+				matcher->max_nodes = max;
+			}
+
+			child = (uint32_t)matcher->num_nodes++;
+			matcher->nodes[child] = (struct MatcherNode){
+				.byte = *p,
+				.first_glob = MATCHER_NO_GLOB,
+			};
+
+			if (node == MATCHER_ROOT) {
+				matcher->root_next[*p] = child;
+			} else {
+				matcher->nodes[child].next_sibling = matcher->nodes[node].first_child;
+				matcher->nodes[node].first_child = child;
+			}
+		}
+		node = child;
+	}
+
+	return node;
+}
+
+/* The longest run of the glob without any special characters */
+static const char *matcher_glob_literal(const char *glob, size_t *len)
+{
+	const char *best = glob;
+	*len = 0;
+
+	const char *run = glob;
+	for (const char *p = glob;; p++) {
+		if (*p != '\0' && !strchr("*?[\\", *p))
+			continue;
+
+		if ((size_t)(p - run) > *len) {
+			best = run;
+			*len = (size_t)(p - run);
+		}
+
+		if (*p == '\0')
+			break;
+
+		/* Skip over escaped characters and bracket expressions */
+		if (*p == '\\' && p[1]) {
+			p++;
+		} else if (*p == '[') {
+			const char *close = p + 1;
+			if (*close == '!' || *close == '^')
+				close++;
+			if (*close == ']')
+				close++;
+			if ((close = strchr(close, ']')))
+				p = close;
+		}
+		run = p + 1;
+	}
+
+	return best;
+}
+
+static int matcher_add_glob(GameModeMatcher *matcher, const char *glob)
+{
+	uint32_t index = (uint32_t)matcher->num_globs++;
+	struct MatcherGlob *entry = &matcher->globs[index];
+	entry->pattern = glob;
+
+	size_t len;
+	const char *literal = matcher_glob_literal(glob, &len);
+	if (len == 0) {
+		entry->next = matcher->unanchored_globs;
+		matcher->unanchored_globs = index;
+		return 0;
+	}
+
+	uint32_t node = matcher_insert(matcher, literal, len);
+	if (node == MATCHER_ROOT)
+		return -ENOMEM;
+
+	entry->next = matcher->nodes[node].first_glob;
+	matcher->nodes[node].first_glob = index;
+	return 0;
+}
+
+/* Follow the fail links until there is a transition for byte, ending at the root */
+static uint32_t matcher_step(const GameModeMatcher *matcher, uint32_t node, unsigned char byte)
+{
+	for (;;) {
+		uint32_t next = matcher_child(matcher, node, byte);
+		if (next != MATCHER_ROOT || node == MATCHER_ROOT)
+			return next;
+		node = matcher->nodes[node].fail;
+	}
+}
+
+/* Breadth first, so the fail target of every node is done before the node itself */
+static int matcher_link(GameModeMatcher *matcher)
+{
+	uint32_t *queue = malloc(matcher->num_nodes * sizeof(uint32_t));
+	if (!queue)
+		return -ENOMEM;
+
+	size_t head = 0, tail = 0;
+	for (unsigned int byte = 0; byte < 256; byte++) {
+		if (matcher->root_next[byte] != MATCHER_ROOT)
+			queue[tail++] = matcher->root_next[byte];
+	}
+
+	while (head < tail) {
+		uint32_t node = queue[head++];
+		struct MatcherNode *parent = &matcher->nodes[node];
+
+		for (uint32_t child = parent->first_child; child != MATCHER_ROOT;
+		     child = matcher->nodes[child].next_sibling) {
+			struct MatcherNode *n = &matcher->nodes[child];
+			const struct MatcherNode *fail;
+
+			n->fail = matcher_step(matcher, parent->fail, n->byte);
+			fail = &matcher->nodes[n->fail];
+			n->match |= fail->match;
+			n->output = fail->first_glob != MATCHER_NO_GLOB ? n->fail : fail->output;
+			queue[tail++] = child;
+		}
+	}
+
+	free(queue);
+	return 0;
+}
+
+int game_mode_matcher_compile(GameModeMatcher *matcher)
+{
+	matcher->max_nodes = 64;
+	matcher->num_nodes = 1;
+	matcher->nodes = calloc(matcher->max_nodes, sizeof(struct MatcherNode));
+	matcher->globs = calloc(matcher->num_patterns, sizeof(struct MatcherGlob));
+	matcher->regexes = calloc(matcher->num_patterns, sizeof(regex_t));
+	if (!matcher->nodes || !matcher->globs || !matcher->regexes)
+		return -ENOMEM;
+	matcher->nodes[MATCHER_ROOT].first_glob = MATCHER_NO_GLOB;
+
+	for (size_t i = 0; i < matcher->num_patterns; i++) {
+		const char *pattern = matcher->patterns[i];
+		int ret = 0;
+
+		if (matcher_is_regex(pattern)) {
+			pattern += strlen(MATCHER_REGEX_PREFIX);
+			if (regcomp(&matcher->regexes[matcher->num_regexes],
+			            pattern,
+			            REG_EXTENDED | REG_NOSUB) != 0)
+				return -EINVAL;
+			matcher->num_regexes++;
+		} else if (matcher_is_glob(pattern)) {
+			ret = matcher_add_glob(matcher, pattern + strlen(MATCHER_GLOB_PREFIX));
+		} else {
+			uint32_t node = matcher_insert(matcher, pattern, strlen(pattern));
+			if (node == MATCHER_ROOT)
+				ret = -ENOMEM;
+			else
+				matcher->nodes[node].match = true;
+		}
+
+		if (ret != 0)
+			return ret;
+	}
+
+	return matcher_link(matcher);
+}
+
+bool game_mode_matcher_empty(const GameModeMatcher *matcher)
+{
+	return !matcher || matcher->num_patterns == 0;
+}
+
+bool game_mode_matcher_equal(const GameModeMatcher *a, const GameModeMatcher *b)
+{
+	size_t num_a = a ? a->num_patterns : 0;
+	size_t num_b = b ? b->num_patterns : 0;
+	if (num_a != num_b)
+		return false;
+
+	for (size_t i = 0; i < num_a; i++) {
+		if (strcmp(a->patterns[i], b->patterns[i]) != 0)
+			return false;
+	}
+
+	return true;
+}
+
+static bool matcher_try_globs(const GameModeMatcher *matcher, uint32_t glob, const char *subject)
+{
+	for (; glob != MATCHER_NO_GLOB; glob = matcher->globs[glob].next) {
+		if (fnmatch(matcher->globs[glob].pattern, subject, 0) == 0)
+			return true;
+	}
+
+	return false;
+}
+
+static bool matcher_search(const GameModeMatcher *matcher, const char *subject)
+{
+	if (!matcher->nodes)
+		return false;
+
+	if (matcher_try_globs(matcher, matcher->unanchored_globs, subject))
+		return true;
+
+	uint32_t node = MATCHER_ROOT;
+	for (const unsigned char *p = (const unsigned char *)subject; *p; p++) {
+		node = matcher_step(matcher, node, *p);
+		if (matcher->nodes[node].match)
+			return true;
+
+		/* Try the globs of every literal ending here */
+		uint32_t n = matcher->nodes[node].first_glob != MATCHER_NO_GLOB ?
+		                 node :
+		                 matcher->nodes[node].output;
+		for (; n != MATCHER_ROOT; n = matcher->nodes[n].output) {
+			if (matcher_try_globs(matcher, matcher->nodes[n].first_glob, subject))
+				return true;
+		}
+	}
+
+	for (size_t i = 0; i < matcher->num_regexes; i++) {
+		if (regexec(&matcher->regexes[i], subject, 0, NULL, 0) == 0)
+			return true;
+	}
+
+	return false;
+}
+
+/* FNV-1a */
+static uint64_t matcher_hash(const char *subject)
+{
+	uint64_t hash = 0xcbf29ce484222325ull;
+	for (const unsigned char *p = (const unsigned char *)subject; *p; p++)
+		hash = (hash ^ *p) * 0x100000001b3ull;
+	return hash;
+}
+
+bool game_mode_matcher_match(GameModeMatcher *matcher, const char *subject)
+{
+	if (game_mode_matcher_empty(matcher))
+		return false;
+
+	uint64_t hash = matcher_hash(subject);
+	struct MatcherCacheEntry *entry = &matcher->cache[hash & (MATCHER_CACHE_SIZE - 1)];
+
+	pthread_mutex_lock(&matcher->cache_lock);
+	if (entry->subject && entry->hash == hash && strcmp(entry->subject, subject) == 0) {
+		bool verdict = entry->verdict;
+		pthread_mutex_unlock(&matcher->cache_lock);
+		return verdict;
+	}
+	pthread_mutex_unlock(&matcher->cache_lock);
+
+	bool verdict = matcher_search(matcher, subject);
+
+	/* Without memory for the copy the verdict is simply not cached */
+	char *copy = strdup(subject);
+	if (copy) {
+		pthread_mutex_lock(&matcher->cache_lock);
+		free(entry->subject);
+		entry->hash = hash;
+		entry->subject = copy;
+		entry->verdict = verdict;
+		pthread_mutex_unlock(&matcher->cache_lock);
+	}
+
+	return verdict;
+}
@@ -0,0 +1,256 @@
+/*
+
+Copyright (c) 2017-2025, Feral Interactive and the GameMode contributors
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+ * Neither the name of Feral Interactive nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+#define _GNU_SOURCE
+
+#include "gamemode.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Initial number of entries, grows by doubling */
+#define PIDTABLE_INITIAL_ENTRIES 8
+
+/* Marker for an unused slot in the index, entry positions are stored off by one */
+#define PIDTABLE_SLOT_EMPTY 0
+
+/**
+ * An entry in the table, entries are kept in insertion order. Removed entries
+ * keep their position with a zero pid until the table is compacted.
+ */
+struct GameModePidTableEntry {
+	pid_t pid;
+	void *value;
+};
+
+/**
+ * Open addressing hash table keyed by pid
+ *
+ * The index is a power of two sized array of linear probed slots which refer
+ * into the entries array, this keeps lookups O(1) while iteration still walks
+ * the entries in the order they were inserted.
+ */
+struct GameModePidTable {
+	size_t count; /**<Number of live entries */
+	size_t used;  /**<Number of entries used, including removed ones */
+	size_t capacity;
+	struct GameModePidTableEntry *entries;
+
+	unsigned int index_bits;
+	uint32_t *index; /**<Slots holding entry position + 1, or PIDTABLE_SLOT_EMPTY */
+};
+
+static inline size_t pidtable_index_size(const GameModePidTable *table)
+{
+	return (size_t)1 << table->index_bits;
+}
+
+/* Fibonacci hashing spreads sequential pids over the whole index */
+static inline size_t pidtable_hash(const GameModePidTable *table, pid_t pid)
+{
+	uint32_t h = (uint32_t)pid * 2654435769u;
+	return (size_t)(h >> (32 - table->index_bits));
+}
+
+/* Find the slot for pid, either the one holding it or the empty slot ending the probe */
+static size_t pidtable_find_slot(const GameModePidTable *table, pid_t pid)
+{
+	size_t mask = pidtable_index_size(table) - 1;
+	size_t slot = pidtable_hash(table, pid);
+
+	while (table->index[slot] != PIDTABLE_SLOT_EMPTY &&
+	       table->entries[table->index[slot] - 1].pid != pid)
+		slot = (slot + 1) & mask;
+
+	return slot;
+}
+
+/**
+ * Rebuild the entries and index with room for capacity entries, dropping
+ * removed entries along the way. The index is kept at most half full.
+ */
+static int pidtable_rebuild(GameModePidTable *table, size_t capacity)
+{
+	unsigned int bits = 4;
+	while (((size_t)1 << bits) < capacity * 2)
+		bits++;
+
+	struct GameModePidTableEntry *entries = calloc(capacity, sizeof(*entries));
+	uint32_t *index = calloc((size_t)1 << bits, sizeof(*index));
+	if (!entries || !index) {
+		free(entries);
+		free(index);
+		return -ENOMEM;
+	}
+
+	size_t used = 0;
+	for (size_t i = 0; i < table->used; i++) {
+		if (table->entries[i].pid != 0)
+			entries[used++] = table->entries[i];
+	}
+
+	free(table->entries);
+	free(table->index);
+	table->entries = entries;
+	table->index = index;
+	table->index_bits = bits;
+	table->capacity = capacity;
+	table->used = used;
+
+	for (size_t i = 0; i < used; i++) {
+		size_t slot = pidtable_find_slot(table, entries[i].pid);
+		index[slot] = (uint32_t)(i + 1);
+	}
+
+	return 0;
+}
+
+GameModePidTable *game_mode_pidtable_new(void)
+{
+	GameModePidTable *table = calloc(1, sizeof(GameModePidTable));
+	if (!table)
+		return NULL;
+
+	if (pidtable_rebuild(table, PIDTABLE_INITIAL_ENTRIES) != 0) {
+		free(table);
+		return NULL;
+	}
+
+	return table;
+}
+
+void game_mode_pidtable_free(GameModePidTable *table)
+{
+	if (!table)
+		return;
+
+	free(table->entries);
+	free(table->index);
+	free(table);
+}
+
+size_t game_mode_pidtable_count(const GameModePidTable *table)
+{
+	return table->count;
+}
+
+void *game_mode_pidtable_lookup(const GameModePidTable *table, pid_t pid)
+{
+	if (pid <= 0)
+		return NULL;
+
+	size_t slot = pidtable_find_slot(table, pid);
+	if (table->index[slot] == PIDTABLE_SLOT_EMPTY)
+		return NULL;
+
+	return table->entries[table->index[slot] - 1].value;
+}
+
+int game_mode_pidtable_insert(GameModePidTable *table, pid_t pid, void *value)
+{
+	if (pid <= 0)
+		return -EINVAL;
+
+	if (game_mode_pidtable_lookup(table, pid))
+		return -EEXIST;
+
+	/* Out of entries, either compact away removed ones or grow */
+	if (table->used == table->capacity) {
+		size_t capacity = table->capacity;
+		if (table->count >= capacity / 2)
+			capacity *= 2;
+
+		int r = pidtable_rebuild(table, capacity);
+		if (r != 0)
+			return r;
+	}
+
+	size_t pos = table->used++;
+	table->entries[pos].pid = pid;
+	table->entries[pos].value = value;
+	table->index[pidtable_find_slot(table, pid)] = (uint32_t)(pos + 1);
+	table->count++;
+
+	return 0;
+}
+
+void *game_mode_pidtable_remove(GameModePidTable *table, pid_t pid)
+{
+	if (pid <= 0)
+		return NULL;
+
+	size_t mask = pidtable_index_size(table) - 1;
+	size_t slot = pidtable_find_slot(table, pid);
+	if (table->index[slot] == PIDTABLE_SLOT_EMPTY)
+		return NULL;
+
+	struct GameModePidTableEntry *entry = &table->entries[table->index[slot] - 1];
+	void *value = entry->value;
+	entry->pid = 0;
+	entry->value = NULL;
+	table->count--;
+
+	/* Backward shift deletion, so probes never need tombstones */
+	size_t hole = slot;
+	size_t next = (hole + 1) & mask;
+	while (table->index[next] != PIDTABLE_SLOT_EMPTY) {
+		size_t home = pidtable_hash(table, table->entries[table->index[next] - 1].pid);
+
+		/* Move the slot back if its home position is not between the hole and itself */
+		if (((next - home) & mask) >= ((next - hole) & mask)) {
+			table->index[hole] = table->index[next];
+			hole = next;
+		}
+		next = (next + 1) & mask;
+	}
+	table->index[hole] = PIDTABLE_SLOT_EMPTY;
+
+	return value;
+}
+
+bool game_mode_pidtable_next(const GameModePidTable *table, size_t *iter, pid_t *pid, void **value)
+{
+	while (*iter < table->used) {
+		const struct GameModePidTableEntry *entry = &table->entries[(*iter)++];
+		if (entry->pid == 0)
+			continue;
+
+		if (pid)
+			*pid = entry->pid;
+		if (value)
+			*value = entry->value;
+		return true;
+	}
+
+	return false;
+}
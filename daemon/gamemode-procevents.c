@@ -0,0 +1,217 @@
+/*
+
+Copyright (c) 2017-2025, Feral Interactive and the GameMode contributors
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+ * Neither the name of Feral Interactive nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+#define _GNU_SOURCE
+
+#include "common-logging.h"
+
+#include "gamemode.h"
+
+#include <linux/cn_proc.h>
+#include <linux/connector.h>
+#include <linux/netlink.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/* Room for a batch of events, each one is a little over 100 bytes */
+#define PROC_EVENTS_BUFFER_SIZE 16384
+
+/**
+ * Tell the connector to start or stop sending us process events
+ */
+static int proc_events_subscribe(int fd, enum proc_cn_mcast_op op)
+{
+	/* A netlink message holding a connector message holding the op */
+	char request[NLMSG_SPACE(sizeof(struct cn_msg) + sizeof(op))]
+	    __attribute__((aligned(NLMSG_ALIGNTO)));
+	memset(request, 0, sizeof(request));
+
+	struct nlmsghdr *header = (struct nlmsghdr *)request;
+	header->nlmsg_len = NLMSG_LENGTH(sizeof(struct cn_msg) + sizeof(op));
+	header->nlmsg_type = NLMSG_DONE;
+	header->nlmsg_pid = (uint32_t)getpid();
+
+	struct cn_msg *msg = NLMSG_DATA(header);
+	msg->id.idx = CN_IDX_PROC;
+	msg->id.val = CN_VAL_PROC;
+	msg->len = sizeof(op);
+	memcpy(msg->data, &op, sizeof(op));
+
+	if (send(fd, request, header->nlmsg_len, 0) != (ssize_t)header->nlmsg_len)
+		return -errno;
+
+	return 0;
+}
+
+/**
+ * Open a socket receiving the process events, non-blocking and close on exec
+ *
+ * @returns The socket, or a negative errno value. Joining the connector's
+ *          multicast group needs CAP_NET_ADMIN, so -EPERM is expected for an
+ *          unprivileged daemon.
+ */
+int game_mode_proc_events_open(void)
+{
+	int fd = socket(PF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_CONNECTOR);
+	if (fd == -1)
+		return -errno;
+
+	struct sockaddr_nl addr = {
+		.nl_family = AF_NETLINK,
+		.nl_groups = CN_IDX_PROC,
+		.nl_pid = 0, /* Assigned by the kernel */
+	};
+
+	int r = 0;
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+		r = -errno;
+	else
+		r = proc_events_subscribe(fd, PROC_CN_MCAST_LISTEN);
+
+	if (r != 0) {
+		close(fd);
+		return r;
+	}
+
+	return fd;
+}
+
+/**
+ * Unsubscribe and close a socket from game_mode_proc_events_open
+ */
+void game_mode_proc_events_close(int fd)
+{
+	if (fd < 0)
+		return;
+
+	proc_events_subscribe(fd, PROC_CN_MCAST_IGNORE);
+	close(fd);
+}
+
+/**
+ * Translate a connector message, false for the events nobody is interested in
+ */
+static bool proc_event_from_msg(const struct cn_msg *msg, GameModeProcEvent *event)
+{
+	if (msg->id.idx != CN_IDX_PROC || msg->id.val != CN_VAL_PROC ||
+	    msg->len < sizeof(struct proc_event))
+		return false;
+
+	/* The event is only 4 byte aligned in the message */
+	struct proc_event copy;
+	memcpy(&copy, msg->data, sizeof(copy));
+	const struct proc_event *ev = &copy;
+	memset(event, 0, sizeof(*event));
+
+	switch (ev->what) {
+	case PROC_EVENT_FORK:
+		event->type = GAME_MODE_PROC_FORK;
+		event->tid = ev->event_data.fork.child_pid;
+		event->tgid = ev->event_data.fork.child_tgid;
+		event->parent_tid = ev->event_data.fork.parent_pid;
+		event->parent_tgid = ev->event_data.fork.parent_tgid;
+		return true;
+
+	case PROC_EVENT_EXEC:
+		event->type = GAME_MODE_PROC_EXEC;
+		event->tid = ev->event_data.exec.process_pid;
+		event->tgid = ev->event_data.exec.process_tgid;
+		return true;
+
+	case PROC_EVENT_EXIT:
+		event->type = GAME_MODE_PROC_EXIT;
+		event->tid = ev->event_data.exit.process_pid;
+		event->tgid = ev->event_data.exit.process_tgid;
+		return true;
+
+	case PROC_EVENT_COMM:
+		event->type = GAME_MODE_PROC_COMM;
+		event->tid = ev->event_data.comm.process_pid;
+		event->tgid = ev->event_data.comm.process_tgid;
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+/**
+ * Read every pending event from fd and hand it to handler
+ *
+ * @returns 0 once there is nothing left to read, -ENOBUFS if events were
+ *          dropped because the socket buffer overflowed, in which case the
+ *          caller has to catch up by other means, or another negative errno
+ */
+int game_mode_proc_events_read(int fd, GameModeProcEventHandler handler, void *userdata)
+{
+	char buffer[PROC_EVENTS_BUFFER_SIZE] __attribute__((aligned(NLMSG_ALIGNTO)));
+	int ret = 0;
+
+	for (;;) {
+		struct sockaddr_nl from;
+		socklen_t from_len = sizeof(from);
+		ssize_t len =
+		    recvfrom(fd, buffer, sizeof(buffer), 0, (struct sockaddr *)&from, &from_len);
+		if (len == -1) {
+			if (errno == EINTR)
+				continue;
+			if (errno == ENOBUFS) {
+				/* Keep reading, what is left in the buffer is still valid */
+				ret = -ENOBUFS;
+				continue;
+			}
+			return errno == EAGAIN ? ret : -errno;
+		}
+
+		/* Only the kernel sends these */
+		if (from_len != sizeof(from) || from.nl_pid != 0)
+			continue;
+
+		struct nlmsghdr *header = (struct nlmsghdr *)buffer;
+		size_t remaining = (size_t)len;
+		for (; NLMSG_OK(header, remaining); header = NLMSG_NEXT(header, remaining)) {
+			if (header->nlmsg_type == NLMSG_NOOP || header->nlmsg_type == NLMSG_ERROR)
+				continue;
+
+			if (header->nlmsg_len < NLMSG_LENGTH(sizeof(struct cn_msg)))
+				continue;
+
+			const struct cn_msg *msg = NLMSG_DATA(header);
+			if (NLMSG_LENGTH(sizeof(struct cn_msg) + msg->len) > header->nlmsg_len)
+				continue;
+
+			GameModeProcEvent event;
+			if (proc_event_from_msg(msg, &event))
+				handler(&event, userdata);
+		}
+	}
+}
@@ -35,10 +35,14 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "common-logging.h"
 #include "gamemode-config.h"
 
-#include <dirent.h>
+#include <pthread.h>
 #include <sched.h>
+#include <stdint.h>
+#include <sys/prctl.h>
 #include <sys/resource.h>
+#include <sys/syscall.h>
 #include <sys/sysinfo.h>
+#include <unistd.h>
 
 /* SCHED_ISO may not be defined as it is a reserved value not yet
  * implemented in official kernel sources, see linux/sched.h.
@@ -47,12 +51,56 @@ POSSIBILITY OF SUCH DAMAGE.
 #define SCHED_ISO 4
 #endif
 
+/* Core scheduling (Linux 5.14), see Documentation/admin-guide/hw-vuln/core-scheduling.rst */
+#ifndef PR_SCHED_CORE
+#define PR_SCHED_CORE 62
+#define PR_SCHED_CORE_GET 0
+#define PR_SCHED_CORE_CREATE 1
+#define PR_SCHED_CORE_SHARE_TO 2
+#define PR_SCHED_CORE_SHARE_FROM 3
+#endif
+#ifndef PR_SCHED_CORE_SCOPE_THREAD
+#define PR_SCHED_CORE_SCOPE_THREAD 0
+#define PR_SCHED_CORE_SCOPE_THREAD_GROUP 1
+#endif
+
+/* sched_setattr has no libc wrapper everywhere, see linux/sched/types.h. Version 1 of the
+ * struct added the utilisation clamps (Linux 5.3)
+ */
+struct game_mode_sched_attr {
+	uint32_t size;
+	uint32_t sched_policy;
+	uint64_t sched_flags;
+	int32_t sched_nice;
+	uint32_t sched_priority;
+	uint64_t sched_runtime;
+	uint64_t sched_deadline;
+	uint64_t sched_period;
+	uint32_t sched_util_min;
+	uint32_t sched_util_max;
+};
+
+#ifndef SCHED_FLAG_KEEP_POLICY
+#define SCHED_FLAG_KEEP_POLICY 0x08
+#endif
+#ifndef SCHED_FLAG_KEEP_PARAMS
+#define SCHED_FLAG_KEEP_PARAMS 0x10
+#endif
+#ifndef SCHED_FLAG_UTIL_CLAMP_MIN
+#define SCHED_FLAG_UTIL_CLAMP_MIN 0x20
+#endif
+#ifndef SCHED_FLAG_UTIL_CLAMP_MAX
+#define SCHED_FLAG_UTIL_CLAMP_MAX 0x40
+#endif
+#define UCLAMP_SCALE 1024
+
 /**
  * Apply scheduling policies
  *
- * This tries to change the scheduler of the client to soft realtime mode
- * available in some kernels as SCHED_ISO. It also tries to adjust the nice
- * level. If some of each fail, ignore this and log a warning.
+ * This tries to change the scheduler of the client's threads to soft realtime
+ * mode available in some kernels as SCHED_ISO, or to a realtime policy on
+ * others. It also tries to adjust the nice level. If some of each fail, ignore
+ * this and log a warning.
  */
 
 #define RENICE_INVALID -128 /* Special value to store invalid value */
@@ -68,112 +116,230 @@ int game_mode_get_renice(const pid_t client)
 	return -priority;
 }
 
-/* If expected is 0 then we try to apply our renice, otherwise, we try to remove it */
-void game_mode_apply_renice(const GameModeContext *self, const pid_t client, int expected)
+/*
+ * Renice a thread of the client from the expected nice value to the target one
+ *
+ * Returns whether the thread has the target value afterwards. Threads inherit the nice value of
+ * the thread creating them, so one that already has it is left alone
+ */
+bool game_mode_apply_thread_renice(const pid_t client, const pid_t tid, const int expected,
+                                   const int target)
 {
-	if (expected == RENICE_INVALID)
-		/* Silently bail if fed an invalid value */
-		return;
-
-	GameModeConfig *config = game_mode_config_from_context(self);
+	/* Clear errno as -1 is a regitimate return */
+	errno = 0;
+	int prio = getpriority(PRIO_PROCESS, (id_t)tid);
 
-	/*
-	 * read configuration "renice" (1..20)
-	 */
-	long int renice = config_get_renice_value(config);
-	if (renice == 0) {
-		return;
+	if (prio == -1 && errno) {
+		/* The thread may well have ended */
+		return false;
+	} else if (prio == target) {
+		return true;
+	} else if (prio != expected) {
+		/*
+		 * Don't adjust priority if it does not match the expected value
+		 * ie. Another process has changed it, or it began non-standard
+		 */
+		LOG_ERROR("Refused to renice client [%d,%d]: prio was (%d) but we expected (%d)\n",
+		          client,
+		          tid,
+		          prio,
+		          expected);
+		return false;
+	} else if (setpriority(PRIO_PROCESS, (id_t)tid, target)) {
+		LOG_HINTED(ERROR,
+		           "Failed to renice client [%d,%d], ignoring error condition: %s\n",
+		           "    -- Your user may not have permission to do this. Please read the docs\n"
+		           "    -- to learn how to adjust the pam limits.\n",
+		           client,
+		           tid,
+		           strerror(errno));
+		return false;
 	}
 
-	/* Invert the renice value */
-	renice = -renice;
+	return true;
+}
+
+/*
+ * Translate the policy of a [thread:<role>] section, -1 when there is none
+ */
+int game_mode_sched_policy_from_name(const char *name)
+{
+	if (strcmp(name, "normal") == 0)
+		return SCHED_OTHER;
+	else if (strcmp(name, "batch") == 0)
+		return SCHED_BATCH;
+	else if (strcmp(name, "idle") == 0)
+		return SCHED_IDLE;
+
+	return -1;
+}
 
-	/* When expected is non-zero, we should try and remove the renice only if it doesn't match the
-	 * expected value */
-	if (expected != 0) {
-		expected = (int)renice;
-		renice = 0;
+/*
+ * Move a thread of the client from the expected scheduler policy to the target one
+ *
+ * Returns whether the thread has the target policy afterwards, the same way as renicing
+ */
+bool game_mode_apply_thread_policy(const pid_t client, const pid_t tid, const int expected,
+                                   const int target)
+{
+	int policy = sched_getscheduler(tid);
+	if (policy == -1) {
+		/* The thread may well have ended */
+		return false;
 	}
 
-	/* Open the tasks dir for the client */
-	char tasks[128];
-	snprintf(tasks, sizeof(tasks), "/proc/%d/task", client);
-	DIR *client_task_dir = opendir(tasks);
-	if (client_task_dir == NULL) {
-		LOG_ERROR("Could not inspect tasks for client [%d]! Skipping ioprio optimisation.\n",
-		          client);
-		return;
+	/* Only privileged callers may clear the reset on fork flag, so keep it */
+	int reset_on_fork = policy & SCHED_RESET_ON_FORK;
+	policy &= ~SCHED_RESET_ON_FORK;
+	if (policy == target) {
+		return true;
+	} else if (policy != expected) {
+		LOG_ERROR("Refused to change the policy of client [%d,%d]: was (%d) but we expected (%d)\n",
+		          client,
+		          tid,
+		          policy,
+		          expected);
+		return false;
 	}
 
-	/* Iterate for all tasks of client process */
-	struct dirent *tid_entry;
-	while ((tid_entry = readdir(client_task_dir)) != NULL) {
-		/* Skip . and .. */
-		if (tid_entry->d_name[0] == '.')
-			continue;
-
-		/* task name is the name of the file */
-		int tid = atoi(tid_entry->d_name);
-
-		/* Clear errno as -1 is a regitimate return */
-		errno = 0;
-		int prio = getpriority(PRIO_PROCESS, (id_t)tid);
-
-		if (prio == -1 && errno) {
-			/* Process may well have ended */
-			LOG_ERROR("getpriority failed for client [%d,%d] with error: %s\n",
-			          client,
-			          tid,
-			          strerror(errno));
-		} else if (prio != expected) {
-			/*
-			 * Don't adjust priority if it does not match the expected value
-			 * ie. Another process has changed it, or it began non-standard
-			 */
-			LOG_ERROR("Refused to renice client [%d,%d]: prio was (%d) but we expected (%d)\n",
-			          client,
-			          tid,
-			          prio,
-			          expected);
-		} else if (setpriority(PRIO_PROCESS, (id_t)tid, (int)renice)) {
-			LOG_HINTED(ERROR,
-			           "Failed to renice client [%d,%d], ignoring error condition: %s\n",
-			           "    -- Your user may not have permission to do this. Please read the docs\n"
-			           "    -- to learn how to adjust the pam limits.\n",
-			           client,
-			           tid,
-			           strerror(errno));
-		}
+	const struct sched_param p = { .sched_priority = 0 };
+	if (sched_setscheduler(tid, target | reset_on_fork, &p)) {
+		LOG_ERROR("Failed to change the policy of client [%d,%d], ignoring error condition: %s\n",
+		          client,
+		          tid,
+		          strerror(errno));
+		return false;
 	}
 
-	closedir(client_task_dir);
+	return true;
+}
+
+/*
+ * Set the utilisation clamps of a thread, leaving its policy and priority alone
+ */
+static int set_thread_uclamp(const pid_t tid, const uint64_t flags, const uint32_t min,
+                             const uint32_t max)
+{
+	struct game_mode_sched_attr attr = {
+		.size = sizeof(attr),
+		.sched_flags = SCHED_FLAG_KEEP_POLICY | SCHED_FLAG_KEEP_PARAMS | flags,
+		.sched_util_min = min,
+		.sched_util_max = max,
+	};
+	return (int)syscall(SYS_sched_setattr, tid, &attr, 0);
+}
+
+/*
+ * Clamp the utilisation of a thread of the client, so schedutil keeps its core at a higher
+ * frequency (min) or does not raise it for the thread (max). Negative values leave a bound alone
+ *
+ * Returns whether the thread has the clamps afterwards
+ */
+bool game_mode_apply_thread_uclamp(const pid_t client, const pid_t tid, const int min,
+                                   const int max)
+{
+	uint64_t flags = 0;
+	if (min >= 0)
+		flags |= SCHED_FLAG_UTIL_CLAMP_MIN;
+	if (max >= 0)
+		flags |= SCHED_FLAG_UTIL_CLAMP_MAX;
+	if (!flags)
+		return false;
+
+	if (set_thread_uclamp(tid, flags, (uint32_t)min, (uint32_t)max) == 0)
+		return true;
+
+	if (errno == ESRCH) {
+		/* The thread may well have ended */
+	} else if (errno == EOPNOTSUPP || errno == E2BIG || errno == ENOSYS) {
+		LOG_ONCE(ERROR,
+		         "The kernel does not support utilisation clamping (CONFIG_UCLAMP_TASK), "
+		         "ignoring uclamp_min and uclamp_max\n");
+	} else {
+		LOG_ERROR("Failed to clamp the utilisation of client [%d,%d], ignoring error condition: "
+		          "%s\n",
+		          client,
+		          tid,
+		          strerror(errno));
+	}
+	return false;
 }
 
-void game_mode_apply_scheduling(const GameModeContext *self, const pid_t client)
+/*
+ * Reset the clamped bounds of a thread to the defaults
+ */
+void game_mode_undo_thread_uclamp(const pid_t tid, const bool min, const bool max)
 {
-	GameModeConfig *config = game_mode_config_from_context(self);
+	uint64_t flags = (min ? SCHED_FLAG_UTIL_CLAMP_MIN : 0) | (max ? SCHED_FLAG_UTIL_CLAMP_MAX : 0);
+	if (!flags)
+		return;
+
+	/* -1 resets a bound since Linux 5.11, older kernels only take the default values */
+	if (set_thread_uclamp(tid, flags, (uint32_t)-1, (uint32_t)-1) != 0 && errno == EINVAL)
+		set_thread_uclamp(tid, flags, 0, UCLAMP_SCALE);
+}
 
-	/*
-	 * read configuration "softrealtime" (on, off, auto)
-	 */
+/*
+ * Whether soft realtime is enabled for a client with this config, reading "softrealtime" (on, off,
+ * auto). Auto detection is based on observations where dual-core CPU suffered priority inversion
+ * problems with the graphics driver thus running slower as a result, so enable only with more than
+ * 3 cores.
+ */
+bool game_mode_softrealtime_enabled(GameModeConfig *config)
+{
 	char softrealtime[CONFIG_VALUE_MAX] = { 0 };
 	config_get_soft_realtime(config, softrealtime);
 
-	/*
-	 * Enable unconditionally or auto-detect soft realtime usage,
-	 * auto detection is based on observations where dual-core CPU suffered
-	 * priority inversion problems with the graphics driver thus running
-	 * slower as a result, so enable only with more than 3 cores.
-	 */
-	bool enable_softrealtime = (strcmp(softrealtime, "on") == 0) ||
-	                           ((strcmp(softrealtime, "auto") == 0) && (get_nprocs() > 3));
-
-	/*
-	 * Actually apply the scheduler policy if not explicitly turned off
-	 */
-	if (enable_softrealtime) {
-		const struct sched_param p = { .sched_priority = 0 };
-		if (sched_setscheduler(client, SCHED_ISO | SCHED_RESET_ON_FORK, &p)) {
+	return (strcmp(softrealtime, "on") == 0) ||
+	       ((strcmp(softrealtime, "auto") == 0) && (get_nprocs() > 3));
+}
+
+/*
+ * The realtime policy to use instead of SCHED_ISO, read from "softrealtime_fallback" (rr, fifo,
+ * off), -1 for none. Defaults to SCHED_RR
+ */
+int game_mode_softrealtime_fallback(GameModeConfig *config)
+{
+	char fallback[CONFIG_VALUE_MAX] = { 0 };
+	config_get_soft_realtime_fallback(config, fallback);
+
+	if (strcmp(fallback, "off") == 0)
+		return -1;
+	else if (strcmp(fallback, "fifo") == 0)
+		return SCHED_FIFO;
+
+	return SCHED_RR;
+}
+
+/* Set once the kernel rejected SCHED_ISO, callers hold the context's write lock */
+static bool iso_unsupported = false;
+
+/*
+ * Move a thread of the client into soft realtime mode, SCHED_ISO where the kernel has it or the
+ * fallback policy at its lowest priority. The fallback has no protection against starving the
+ * system of its own, callers have to demote threads that use too much CPU time. -1 as fallback
+ * only tries SCHED_ISO. Threads that are not normal ones to start with are left alone, and new
+ * threads are normal ones again
+ *
+ * Returns the policy the thread has afterwards, or -1 when it did not change
+ */
+int game_mode_apply_thread_softrealtime(const pid_t client, const pid_t tid, const int fallback)
+{
+	int policy = sched_getscheduler(tid);
+	if (policy == -1 || (policy & ~SCHED_RESET_ON_FORK) != SCHED_OTHER) {
+		/* The thread may well have ended, or it is the game's own realtime thread */
+		return -1;
+	}
+
+	const struct sched_param iso = { .sched_priority = 0 };
+	if (!iso_unsupported) {
+		if (sched_setscheduler(tid, SCHED_ISO | SCHED_RESET_ON_FORK, &iso) == 0)
+			return SCHED_ISO;
+
+		if (errno == ESRCH)
+			return -1;
+
+		if (errno != EINVAL) {
 			const char *hint = "";
 			HINT_ONCE_ON(
 			    errno == EPERM,
@@ -184,21 +350,146 @@ void game_mode_apply_scheduling(const GameModeContext *self, const pid_t client)
 			    "    -- and not a bug in GameMode, it should be reported upstream.\n"
 			    "    -- If unsure, please also look here:\n"
 			    "    -- https://github.com/FeralInteractive/gamemode/issues/68\n");
-			HINT_ONCE_ON(
-			    errno == EINVAL,
-			    hint,
-			    "    -- The error indicates that your kernel may not support this. If you\n"
-			    "    -- don't know what SCHED_ISO means, you can safely ignore this. If you\n"
-			    "    -- expected it to work, ensure you're running a kernel with MuQSS or\n"
-			    "    -- PDS scheduler.\n"
-			    "    -- For further technical reading on the topic start here:\n"
-			    "    -- https://lwn.net/Articles/720227/\n");
 			LOG_ERROR(
-			    "Failed setting client [%d] into SCHED_ISO mode, ignoring error condition: %s\n"
+			    "Failed setting client [%d,%d] into SCHED_ISO mode, ignoring error condition: %s\n"
 			    "%s",
 			    client,
+			    tid,
 			    strerror(errno),
 			    hint);
+			return -1;
 		}
+
+		/* Only kernels with MuQSS or PDS had SCHED_ISO, see https://lwn.net/Articles/720227/ */
+		iso_unsupported = true;
+		LOG_MSG("The kernel does not support SCHED_ISO, falling back to %s\n",
+		        fallback == SCHED_RR     ? "SCHED_RR"
+		        : fallback == SCHED_FIFO ? "SCHED_FIFO"
+		                                 : "normal scheduling");
+	}
+
+	if (fallback == -1)
+		return -1;
+
+	const struct sched_param rt = { .sched_priority = sched_get_priority_min(fallback) };
+	if (sched_setscheduler(tid, fallback | SCHED_RESET_ON_FORK, &rt) == 0)
+		return fallback;
+
+	if (errno != ESRCH) {
+		LOG_HINTED(ERROR,
+		           "Failed to move client [%d,%d] to realtime scheduling, ignoring error "
+		           "condition: %s\n",
+		           "    -- Your user may not have permission to do this. The game needs a\n"
+		           "    -- realtime priority limit of at least 1 (rtprio in limits.conf),\n"
+		           "    -- which the gamemode group gets. Please read the docs.\n",
+		           client,
+		           tid,
+		           strerror(errno));
+	}
+	return -1;
+}
+
+static void log_sched_core_error(const char *what, const pid_t pid, const int err)
+{
+	if (err == ESRCH) {
+		/* The process has ended already */
+		return;
+	}
+	if (err == EINVAL || err == ENODEV) {
+		/* EINVAL without CONFIG_SCHED_CORE, ENODEV when SMT is off or missing */
+		LOG_ONCE(MSG,
+		         "Core scheduling is not available (needs a kernel with CONFIG_SCHED_CORE and "
+		         "SMT), games may share cores with other tasks\n");
+		return;
+	}
+
+	LOG_HINTED(ERROR,
+	           "Failed to %s the core scheduling cookie of [%d]: %s\n",
+	           "    -- Changing the cookie of a process needs the same access as ptrace,\n"
+	           "    -- check kernel.yama.ptrace_scope or the process running as another user.\n",
+	           what,
+	           pid,
+	           strerror(err));
+}
+
+/*
+ * Give a client a core scheduling cookie of its own, the kernel then only runs its threads
+ * together on the hardware threads of a core, never next to other tasks. Threads and processes
+ * started by the client later inherit the cookie
+ */
+bool game_mode_apply_sched_core(const pid_t client)
+{
+	if (prctl(PR_SCHED_CORE,
+	          PR_SCHED_CORE_CREATE,
+	          (unsigned long)client,
+	          PR_SCHED_CORE_SCOPE_THREAD_GROUP,
+	          0UL) == 0)
+		return true;
+
+	log_sched_core_error("create", client, errno);
+	return false;
+}
+
+struct sched_core_share {
+	pid_t from;
+	pid_t to;
+	int err;
+};
+
+static void *share_sched_core(void *userdata)
+{
+	struct sched_core_share *share = userdata;
+
+	/* A cookie can only be passed on by a thread holding it */
+	if (prctl(PR_SCHED_CORE,
+	          PR_SCHED_CORE_SHARE_FROM,
+	          (unsigned long)share->from,
+	          PR_SCHED_CORE_SCOPE_THREAD,
+	          0UL) != 0 ||
+	    prctl(PR_SCHED_CORE,
+	          PR_SCHED_CORE_SHARE_TO,
+	          (unsigned long)share->to,
+	          PR_SCHED_CORE_SCOPE_THREAD_GROUP,
+	          0UL) != 0)
+		share->err = errno;
+
+	return NULL;
+}
+
+/*
+ * Give another process the core scheduling cookie of a client. That runs on a thread of its own
+ * which ends straight after, so none of the daemon's threads keep running with the cookie
+ */
+bool game_mode_share_sched_core(const pid_t client, const pid_t pid)
+{
+	struct sched_core_share share = { .from = client, .to = pid, .err = 0 };
+	pthread_t thread;
+
+	int r = pthread_create(&thread, NULL, share_sched_core, &share);
+	if (r != 0) {
+		LOG_ERROR("Failed to start a thread to share the core scheduling cookie: %s\n",
+		          strerror(r));
+		return false;
 	}
+	pthread_join(thread, NULL);
+
+	if (share.err == 0)
+		return true;
+
+	log_sched_core_error("share", pid, share.err);
+	return false;
+}
+
+/*
+ * Drop the core scheduling cookie of a process again. The daemon's threads have none, sharing
+ * theirs clears it
+ */
+void game_mode_remove_sched_core(const pid_t pid)
+{
+	if (prctl(PR_SCHED_CORE,
+	          PR_SCHED_CORE_SHARE_TO,
+	          (unsigned long)pid,
+	          PR_SCHED_CORE_SCOPE_THREAD_GROUP,
+	          0UL) != 0)
+		log_sched_core_error("remove", pid, errno);
 }
@@ -0,0 +1,156 @@
+/*
+
+Copyright (c) 2017-2025, Feral Interactive and the GameMode contributors
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+ * Neither the name of Feral Interactive nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+#define _GNU_SOURCE
+
+#include "common-logging.h"
+
+#include "gamemode.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+
+/**
+ * Shared state of one game_mode_run_steps call
+ */
+struct GameModeStepRunner {
+	GameModeContext *context;
+	const GameModeStep *steps;
+
+	pthread_mutex_t mutex; /**<Guards done */
+	pthread_cond_t condition;
+	uint32_t done; /**<Mask of the steps that have finished */
+
+	double elapsed_ms[GAME_MODE_MAX_STEPS];
+};
+
+struct GameModeStepThread {
+	struct GameModeStepRunner *runner;
+	size_t index;
+	pthread_t thread;
+};
+
+static double elapsed_ms_since(const struct timespec *start)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double)(now.tv_sec - start->tv_sec) * 1e3 +
+	       (double)(now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+/* Wait for the dependencies of a step, run it, and let the steps waiting on it go */
+static void run_step(struct GameModeStepRunner *runner, size_t index)
+{
+	const GameModeStep *step = &runner->steps[index];
+
+	pthread_mutex_lock(&runner->mutex);
+	while ((runner->done & step->depends) != step->depends)
+		pthread_cond_wait(&runner->condition, &runner->mutex);
+	pthread_mutex_unlock(&runner->mutex);
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	step->run(runner->context);
+	runner->elapsed_ms[index] = elapsed_ms_since(&start);
+
+	pthread_mutex_lock(&runner->mutex);
+	runner->done |= 1u << index;
+	pthread_cond_broadcast(&runner->condition);
+	pthread_mutex_unlock(&runner->mutex);
+}
+
+static void *run_step_thread(void *userdata)
+{
+	struct GameModeStepThread *thread = userdata;
+	run_step(thread->runner, thread->index);
+	return NULL;
+}
+
+void game_mode_run_steps(GameModeContext *self, const char *what, const GameModeStep *steps,
+                         size_t count)
+{
+	assert(count <= GAME_MODE_MAX_STEPS);
+
+	struct GameModeStepRunner runner = {
+		.context = self,
+		.steps = steps,
+	};
+	struct GameModeStepThread threads[GAME_MODE_MAX_STEPS];
+	bool started[GAME_MODE_MAX_STEPS] = { false };
+
+	pthread_mutex_init(&runner.mutex, NULL);
+	pthread_cond_init(&runner.condition, NULL);
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	/* Steps may only depend on earlier ones, so running in order is always a valid fallback */
+	for (size_t i = 0; i < count; i++) {
+		assert((steps[i].depends >> i) == 0);
+
+		threads[i].runner = &runner;
+		threads[i].index = i;
+		started[i] = pthread_create(&threads[i].thread, NULL, run_step_thread, &threads[i]) == 0;
+		if (!started[i]) {
+			LOG_ERROR("Couldn't start a thread for %s, running it in order\n", steps[i].name);
+			run_step(&runner, i);
+		}
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		if (started[i])
+			pthread_join(threads[i].thread, NULL);
+	}
+
+	double total_ms = elapsed_ms_since(&start);
+
+	pthread_cond_destroy(&runner.condition);
+	pthread_mutex_destroy(&runner.mutex);
+
+	/* Report where the time went, the slowest chain of steps bounds the total */
+	char timings[512] = { 0 };
+	size_t len = 0;
+	for (size_t i = 0; i < count && len < sizeof(timings); i++) {
+		int n = snprintf(timings + len,
+		                 sizeof(timings) - len,
+		                 "%s%s %.0fms",
+		                 i ? ", " : "",
+		                 steps[i].name,
+		                 runner.elapsed_ms[i]);
+		if (n < 0)
+			break;
+		len += (size_t)n;
+	}
+
+	LOG_MSG("%s in %.0fms (%s)\n", what, total_ms, timings);
+}
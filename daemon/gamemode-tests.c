@@ -44,9 +44,13 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include "build-config.h"
 
+#include <fcntl.h>
+#include <ftw.h>
 #include <pthread.h>
+#include <sys/stat.h>
 #include <sys/syscall.h>
 #include <sys/wait.h>
+#include <time.h>
 
 struct GameModeConfig;
 
@@ -57,7 +61,7 @@ static int verify_gamemode_initial(struct GameModeConfig *config)
 
 	if ((status = gamemode_query_status()) != 0 && status != -1) {
 		long reaper = config_get_reaper_frequency(config);
-		LOG_MSG("GameMode was active, waiting for the reaper thread (%ld seconds)!\n", reaper);
+		LOG_MSG("GameMode was active, waiting for the reaper (%ld seconds)!\n", reaper);
 		sleep(1);
 
 		/* Try again after waiting */
@@ -142,6 +146,253 @@ static int verify_other_client_connected(void)
 	return status;
 }
 
+/* Nanoseconds elapsed since start */
+static double elapsed_ns(const struct timespec *start)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double)(now.tv_sec - start->tv_sec) * 1e9 + (double)(now.tv_nsec - start->tv_nsec);
+}
+
+/* Fill, query and drain a client table with fake pids */
+static int run_client_registry_stress_pass(size_t num)
+{
+	GameModePidTable *table = game_mode_pidtable_new();
+	if (!table) {
+		LOG_ERROR("Failed to allocate client table\n");
+		return -1;
+	}
+
+	int status = 0;
+	struct timespec start;
+
+	/* Spread the pids out a little, as real ones are rarely contiguous */
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (size_t i = 0; i < num; i++) {
+		pid_t pid = (pid_t)(i * 7 + 1);
+		if (game_mode_pidtable_insert(table, pid, (void *)(uintptr_t)pid) != 0) {
+			LOG_ERROR("Failed to insert fake client %d\n", pid);
+			status = -1;
+			goto done;
+		}
+	}
+	double insert_ns = elapsed_ns(&start);
+
+	if (game_mode_pidtable_insert(table, 1, NULL) != -EEXIST) {
+		LOG_ERROR("Duplicate fake client was not rejected\n");
+		status = -1;
+		goto done;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (size_t i = 0; i < num; i++) {
+		pid_t pid = (pid_t)(i * 7 + 1);
+		if (game_mode_pidtable_lookup(table, pid) != (void *)(uintptr_t)pid) {
+			LOG_ERROR("Lookup of fake client %d failed\n", pid);
+			status = -1;
+			goto done;
+		}
+	}
+	double lookup_ns = elapsed_ns(&start);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (size_t i = 0; i < num; i++) {
+		pid_t pid = (pid_t)(i * 7 + 2);
+		if (game_mode_pidtable_lookup(table, pid) != NULL) {
+			LOG_ERROR("Lookup of unknown client %d succeeded\n", pid);
+			status = -1;
+			goto done;
+		}
+	}
+	double miss_ns = elapsed_ns(&start);
+
+	/* Iteration must see every client once, in registration order */
+	size_t iter = 0, seen = 0;
+	pid_t pid = 0;
+	while (game_mode_pidtable_next(table, &iter, &pid, NULL)) {
+		if (pid != (pid_t)(seen * 7 + 1)) {
+			LOG_ERROR("Iteration returned client %d out of order\n", pid);
+			status = -1;
+			goto done;
+		}
+		seen++;
+	}
+	if (seen != num) {
+		LOG_ERROR("Iteration saw %zu of %zu clients\n", seen, num);
+		status = -1;
+		goto done;
+	}
+
+	/* Remove every other client first to exercise removal from a sparse table */
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (size_t pass = 0; pass < 2; pass++) {
+		for (size_t i = pass; i < num; i += 2) {
+			pid = (pid_t)(i * 7 + 1);
+			if (game_mode_pidtable_remove(table, pid) != (void *)(uintptr_t)pid) {
+				LOG_ERROR("Removal of fake client %d failed\n", pid);
+				status = -1;
+				goto done;
+			}
+		}
+	}
+	double remove_ns = elapsed_ns(&start);
+
+	if (game_mode_pidtable_count(table) != 0) {
+		LOG_ERROR("Client table not empty after removing all clients\n");
+		status = -1;
+		goto done;
+	}
+
+	LOG_MSG("::: %zu clients: insert %.1fns, lookup %.1fns, miss %.1fns, remove %.1fns per op\n",
+	        num,
+	        insert_ns / (double)num,
+	        lookup_ns / (double)num,
+	        miss_ns / (double)num,
+	        remove_ns / (double)num);
+
+done:
+	game_mode_pidtable_free(table);
+	return status;
+}
+
+/* Run client registry stress tests
+ * Checks the client table stays correct and fast with many registered clients
+ */
+static int run_client_registry_stress_tests(void)
+{
+	LOG_MSG(":: Client registry stress tests\n");
+
+	const size_t sizes[] = { 16, 1024, 16384, 65536 };
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		if (run_client_registry_stress_pass(sizes[i]) != 0)
+			return -1;
+	}
+
+	LOG_MSG(":: Passed\n\n");
+
+	return 0;
+}
+
+/* Build a client filter with num rules and time matching executables against it */
+static int run_client_filter_benchmark_pass(size_t num)
+{
+	GameModeMatcher *matcher = game_mode_matcher_new();
+	if (!matcher) {
+		LOG_ERROR("Failed to allocate matcher\n");
+		return -1;
+	}
+
+	int status = 0;
+	struct timespec start;
+	char pattern[CONFIG_VALUE_MAX];
+	char subject[PATH_MAX];
+
+	/* Mostly plain names, with some globs and regexes mixed in */
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (size_t i = 0; i < num; i++) {
+		if (i % 20 == 1)
+			snprintf(pattern, sizeof(pattern), "glob:*/opt/studio%zu/*", i);
+		else if (i % 20 == 2)
+			snprintf(pattern, sizeof(pattern), "regex:/srv/[a-z]+/launcher%zu$", i);
+		else
+			snprintf(pattern, sizeof(pattern), "game%zu.x86_64", i);
+
+		if (game_mode_matcher_add(matcher, pattern) != 0) {
+			LOG_ERROR("Failed to add rule [%s]\n", pattern);
+			status = -1;
+			goto done;
+		}
+	}
+	if (game_mode_matcher_compile(matcher) != 0) {
+		LOG_ERROR("Failed to compile %zu rules\n", num);
+		status = -1;
+		goto done;
+	}
+	double compile_ns = elapsed_ns(&start);
+
+	/* One executable hitting each kind of rule, and one hitting none */
+	const struct {
+		const char *prefix;
+		size_t index;
+		const char *suffix;
+		bool expected;
+	} cases[] = {
+		{ "/home/user/games/game", (num - 1) - (num - 1) % 20, ".x86_64", true },
+		{ "/opt/studio", 1, "/bin/run", true },
+		{ "/srv/steam/launcher", 2, "", true },
+		{ "/usr/bin/notagame", 0, "", false },
+	};
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		snprintf(subject,
+		         sizeof(subject),
+		         "%s%zu%s",
+		         cases[i].prefix,
+		         cases[i].index,
+		         cases[i].suffix);
+		if (game_mode_matcher_match(matcher, subject) != cases[i].expected) {
+			LOG_ERROR("Filter of %zu rules gave the wrong verdict for [%s]\n", num, subject);
+			status = -1;
+			goto done;
+		}
+	}
+	double uncached_ns = elapsed_ns(&start) / (double)(sizeof(cases) / sizeof(cases[0]));
+
+	/* The same executables again, now answered from the cache */
+	const size_t repeats = 1000;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (size_t r = 0; r < repeats; r++)
+		game_mode_matcher_match(matcher, subject);
+	double cached_ns = elapsed_ns(&start) / (double)repeats;
+
+	LOG_MSG("::: %zu rules: compile %.1fus, match %.1fns, cached %.1fns\n",
+	        num,
+	        compile_ns / 1e3,
+	        uncached_ns,
+	        cached_ns);
+
+done:
+	game_mode_matcher_free(matcher);
+	return status;
+}
+
+/* Run client filter benchmarks
+ * Checks the whitelist and blacklist matching stays correct with thousands of rules
+ */
+static int run_client_filter_benchmark(void)
+{
+	LOG_MSG(":: Client filter benchmark\n");
+
+	const size_t sizes[] = { 32, 1000, 5000 };
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		if (run_client_filter_benchmark_pass(sizes[i]) != 0)
+			return -1;
+	}
+
+	LOG_MSG(":: Passed\n\n");
+
+	return 0;
+}
+
+/* Request gamemode, and wait for the daemon to finish applying the optimisations */
+static int request_start_and_wait(void)
+{
+	int status = gamemode_request_start();
+	if (status == 0 && gamemode_wait_for_transition() < 0)
+		LOG_ERROR("gamemode_wait_for_transition failed: %s\n", gamemode_error_string());
+	return status;
+}
+
+/* End gamemode, and wait for the daemon to finish removing the optimisations */
+static int request_end_and_wait(void)
+{
+	int status = gamemode_request_end();
+	if (status == 0 && gamemode_wait_for_transition() < 0)
+		LOG_ERROR("gamemode_wait_for_transition failed: %s\n", gamemode_error_string());
+	return status;
+}
+
 /* Run basic client tests
  * Tests a simple request_start and request_end works
  */
@@ -159,6 +410,12 @@ static int run_basic_client_tests(void)
 	if (verify_active_and_registered() != 0)
 		return -1;
 
+	/* Verify that the optimisations finish being applied in the background */
+	if (gamemode_wait_for_transition() != 1) {
+		LOG_ERROR("gamemode did not finish activating: %s\n", gamemode_error_string());
+		return -1;
+	}
+
 	/* Verify that gamemode_request_end corrently de-registers gamemode */
 	if (gamemode_request_end() != 0) {
 		LOG_ERROR("gamemode_request_end failed: %s!\n", gamemode_error_string());
@@ -169,11 +426,60 @@ static int run_basic_client_tests(void)
 	if (verify_deactivated() != 0)
 		return -1;
 
+	/* Verify that the optimisations finish being removed in the background */
+	if (gamemode_wait_for_transition() != 0) {
+		LOG_ERROR("gamemode did not finish deactivating: %s\n", gamemode_error_string());
+		return -1;
+	}
+
 	LOG_MSG(":: Passed\n\n");
 
 	return 0;
 }
 
+/* Run thread registration tests
+ * Tests a thread can only be given a role while its process is registered
+ */
+static int run_thread_registration_tests(void)
+{
+	LOG_MSG(":: Thread registration tests\n");
+
+	/* Verify that threads of unregistered processes are refused */
+	if (gamemode_register_thread(GAMEMODE_THREAD_ROLE_RENDER) != -1) {
+		LOG_ERROR("gamemode_register_thread succeeded without gamemode_request_start\n");
+		return -1;
+	}
+
+	if (request_start_and_wait() != 0) {
+		LOG_ERROR("gamemode_request_start failed: %s\n", gamemode_error_string());
+		return -1;
+	}
+
+	int ret = 0;
+
+	/* Verify that the calling thread can be given a role and have it taken away */
+	if (gamemode_register_thread(GAMEMODE_THREAD_ROLE_RENDER) != 0) {
+		LOG_ERROR("gamemode_register_thread failed: %s\n", gamemode_error_string());
+		ret = -1;
+	} else if (gamemode_unregister_thread() != 0) {
+		LOG_ERROR("gamemode_unregister_thread failed: %s\n", gamemode_error_string());
+		ret = -1;
+	}
+
+	/* Verify that unknown roles are rejected */
+	if (gamemode_register_thread(0) != -2) {
+		LOG_ERROR("gamemode_register_thread did not reject an unknown role\n");
+		ret = -1;
+	}
+
+	request_end_and_wait();
+
+	if (ret == 0)
+		LOG_MSG(":: Passed\n\n");
+
+	return ret;
+}
+
 /* Run some dual client tests
  * This also tests that the "-r" argument works correctly and cleans up correctly
  */
@@ -263,7 +569,7 @@ static int run_gamemoderun_and_reaper_tests(struct GameModeConfig *config)
 {
 	int status = 0;
 
-	LOG_MSG(":: Gamemoderun and reaper thread tests\n");
+	LOG_MSG(":: Gamemoderun and reaper tests\n");
 
 	/* Fork so that the child can request gamemode */
 	int child = fork();
@@ -297,10 +603,16 @@ static int run_gamemoderun_and_reaper_tests(struct GameModeConfig *config)
 		usleep(100000);
 	}
 
-	/* And give gamemode a chance to reap the process */
+	/* And give gamemode a chance to reap the process, with pidfd support this
+	 * should happen right away, otherwise it may take up to reaper_frequency */
 	long freq = config_get_reaper_frequency(config);
-	LOG_MSG("...Waiting for reaper thread (reaper_frequency set to %ld seconds)...\n", freq);
-	sleep((unsigned int)freq);
+	LOG_MSG("...Waiting for reaper (reaper_frequency set to %ld seconds)...\n", freq);
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while (gamemode_query_status() > 0 && elapsed_ns(&start) < (double)(freq + 1) * 1e9)
+		usleep(1000);
+	LOG_MSG("...Expired after %.1fms...\n", elapsed_ns(&start) / 1e6);
 
 	/* Verify that gamemode is now inactive */
 	if (verify_deactivated() != 0)
@@ -323,9 +635,10 @@ static int run_cpu_governor_tests(struct GameModeConfig *config)
 		strcpy(desiredgov, "performance");
 
 	char defaultgov[CONFIG_VALUE_MAX] = { 0 };
+	char governor[MAX_GOVERNOR_STATE_LENGTH];
 
 	if (defaultgov[0] == '\0') {
-		const char *currentgov = get_gov_state();
+		const char *currentgov = get_gov_state(governor);
 		if (currentgov) {
 			strncpy(defaultgov, currentgov, CONFIG_VALUE_MAX - 1);
 		} else {
@@ -337,21 +650,21 @@ static int run_cpu_governor_tests(struct GameModeConfig *config)
 	}
 
 	/* Start gamemode */
-	gamemode_request_start();
+	request_start_and_wait();
 
 	/* Verify the governor is the desired one */
-	const char *currentgov = get_gov_state();
+	const char *currentgov = get_gov_state(governor);
 	if (strncmp(currentgov, desiredgov, CONFIG_VALUE_MAX) != 0) {
 		LOG_ERROR("Governor was not set to %s (was actually %s)!\n", desiredgov, currentgov);
-		gamemode_request_end();
+		request_end_and_wait();
 		return -1;
 	}
 
 	/* End gamemode */
-	gamemode_request_end();
+	request_end_and_wait();
 
 	/* Verify the governor has been set back */
-	currentgov = get_gov_state();
+	currentgov = get_gov_state(governor);
 	if (strncmp(currentgov, defaultgov, CONFIG_VALUE_MAX) != 0) {
 		LOG_ERROR("Governor was not set back to %s (was actually %s)!\n", defaultgov, currentgov);
 		return -1;
@@ -375,9 +688,10 @@ static int run_platform_profile_tests(struct GameModeConfig *config)
 
 	char defaultprof[CONFIG_VALUE_MAX] = { 0 };
 	config_get_default_profile(config, defaultprof);
+	char profile[MAX_PROFILE_LENGTH];
 
 	if (defaultprof[0] == '\0') {
-		const char *currentprof = get_profile_state();
+		const char *currentprof = get_profile_state(profile);
 		if (currentprof) {
 			strncpy(defaultprof, currentprof, CONFIG_VALUE_MAX - 1);
 		} else {
@@ -389,23 +703,23 @@ static int run_platform_profile_tests(struct GameModeConfig *config)
 	}
 
 	/* Start gamemode */
-	gamemode_request_start();
+	request_start_and_wait();
 
 	/* Verify the platform profile is the desired one */
-	const char *currentprof = get_profile_state();
+	const char *currentprof = get_profile_state(profile);
 	if (strncmp(currentprof, desiredprof, CONFIG_VALUE_MAX) != 0) {
 		LOG_ERROR("Platform profile was not set to %s (was actually %s)!\n",
 		          desiredprof,
 		          currentprof);
-		gamemode_request_end();
+		request_end_and_wait();
 		return -1;
 	}
 
 	/* End gamemode */
-	gamemode_request_end();
+	request_end_and_wait();
 
 	/* Verify the platform profile has been set back */
-	currentprof = get_profile_state();
+	currentprof = get_profile_state(profile);
 	if (strncmp(currentprof, defaultprof, CONFIG_VALUE_MAX) != 0) {
 		LOG_ERROR("Platform profile was not set back to %s (was actually %s)!\n",
 		          defaultprof,
@@ -527,11 +841,11 @@ int run_gpu_optimisation_tests(struct GameModeConfig *config)
 		expected_mem = original_nv_mem;
 
 	/* Start gamemode and check the new values */
-	gamemode_request_start();
+	request_start_and_wait();
 
 	if (game_mode_get_gpu(gpuinfo) != 0) {
 		LOG_ERROR("Could not get current GPU info, see above!\n");
-		gamemode_request_end();
+		request_end_and_wait();
 		game_mode_free_gpu(&gpuinfo);
 		return -1;
 	}
@@ -561,7 +875,7 @@ int run_gpu_optimisation_tests(struct GameModeConfig *config)
 	}
 
 	/* End gamemode and check the values have returned */
-	gamemode_request_end();
+	request_end_and_wait();
 
 	if (game_mode_get_gpu(gpuinfo) != 0) {
 		LOG_ERROR("Could not get current GPU info, see above!\n");
@@ -644,7 +958,7 @@ static pid_t run_tests_on_process_tree(int inactive, int active, int (*func)(pid
 		pthread_barrier_init(&barrier, NULL, numthreads + 1);
 
 		/* First, request gamemode for this child process before it created the threads */
-		gamemode_request_start();
+		request_start_and_wait();
 
 		/* Spawn a few child threads */
 		pthread_t threads[numthreads];
@@ -667,12 +981,12 @@ static pid_t run_tests_on_process_tree(int inactive, int active, int (*func)(pid
 
 		if (fail) {
 			LOG_ERROR("Initial values for new threads were incorrect!\n");
-			gamemode_request_end();
+			request_end_and_wait();
 			exit(-1);
 		}
 
 		/* Request gamemode end */
-		gamemode_request_end();
+		request_end_and_wait();
 
 		/* Test each spawned thread */
 		for (unsigned int i = 0; i < numthreads; i++)
@@ -683,19 +997,19 @@ static pid_t run_tests_on_process_tree(int inactive, int active, int (*func)(pid
 		}
 
 		/* Request gamemode again - this time after threads were created */
-		gamemode_request_start();
+		request_start_and_wait();
 
 		/* Test each spawned thread */
 		for (unsigned int i = 0; i < numthreads; i++)
 			fail |= (active != func(info[i].this));
 		if (fail) {
 			LOG_ERROR("values for threads were not set correctly!\n");
-			gamemode_request_end();
+			request_end_and_wait();
 			exit(-1);
 		}
 
 		/* Request gamemode end */
-		gamemode_request_end();
+		request_end_and_wait();
 
 		/* Test each spawned thread */
 		for (unsigned int i = 0; i < numthreads; i++)
@@ -753,7 +1067,7 @@ int run_renice_tests(struct GameModeConfig *config)
 	int ret = 0;
 
 	/* Ask for gamemode for ourselves */
-	gamemode_request_start();
+	request_start_and_wait();
 
 	/* Check renice is now requested value */
 	val = game_mode_get_renice(getpid());
@@ -766,7 +1080,7 @@ int run_renice_tests(struct GameModeConfig *config)
 	}
 
 	/* End gamemode for ourselves */
-	gamemode_request_end();
+	request_end_and_wait();
 
 	/* Check renice is returned to correct value */
 	val = game_mode_get_renice(getpid());
@@ -805,7 +1119,7 @@ int run_ioprio_tests(struct GameModeConfig *config)
 	int ret = 0;
 
 	/* Ask for gamemode for ourselves */
-	gamemode_request_start();
+	request_start_and_wait();
 
 	/* Check renice is now requested value */
 	val = game_mode_get_ioprio(getpid());
@@ -818,7 +1132,7 @@ int run_ioprio_tests(struct GameModeConfig *config)
 	}
 
 	/* End gamemode for ourselves */
-	gamemode_request_end();
+	request_end_and_wait();
 
 	/* Check ioprio is returned to correct value */
 	val = game_mode_get_ioprio(getpid());
@@ -882,7 +1196,7 @@ static int run_x3d_mode_tests(struct GameModeConfig *config)
 	}
 
 	/* Start gamemode */
-	gamemode_request_start();
+	request_start_and_wait();
 
 	/* Give gamemode time to apply settings */
 	usleep(500000);
@@ -891,7 +1205,7 @@ static int run_x3d_mode_tests(struct GameModeConfig *config)
 	ret = run_external_process(get_args, output, -1);
 	if (ret != 0) {
 		LOG_ERROR("Failed to get X3D mode after gamemode start\n");
-		gamemode_request_end();
+		request_end_and_wait();
 		return -1;
 	}
 
@@ -903,12 +1217,12 @@ static int run_x3d_mode_tests(struct GameModeConfig *config)
 
 	if (strcmp(output, desired_mode) != 0) {
 		LOG_ERROR("X3D mode was not set to %s (was actually %s)!\n", desired_mode, output);
-		gamemode_request_end();
+		request_end_and_wait();
 		return -1;
 	}
 
 	/* End gamemode */
-	gamemode_request_end();
+	request_end_and_wait();
 
 	/* Give gamemode time to restore settings */
 	usleep(500000);
@@ -937,6 +1251,610 @@ static int run_x3d_mode_tests(struct GameModeConfig *config)
 	return 0;
 }
 
+/* Time entering and leaving game mode, with the privileged changes going through the resident
+ * helper or through pkexec each time as resident_helper says. Only run when
+ * GAMEMODE_BENCHMARK_HELPER is set, every enter may ask polkit for authorisation
+ */
+static int run_privileged_helper_benchmark(struct GameModeConfig *config)
+{
+	if (!getenv("GAMEMODE_BENCHMARK_HELPER"))
+		return 1;
+
+	const int runs = 5;
+	const bool resident = config_get_resident_helper(config);
+	struct timespec start;
+	double first_ms = 0.0;
+	double enter_ms = 0.0;
+	double leave_ms = 0.0;
+
+	for (int i = 0; i <= runs; i++) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		if (request_start_and_wait() != 0) {
+			LOG_ERROR("Could not enter game mode\n");
+			return -1;
+		}
+		double ms = elapsed_ns(&start) / 1e6;
+
+		/* The first enter may also start and authorise the resident helper */
+		if (i == 0)
+			first_ms = ms;
+		else
+			enter_ms += ms / runs;
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		if (request_end_and_wait() != 0) {
+			LOG_ERROR("Could not leave game mode\n");
+			return -1;
+		}
+		if (i > 0)
+			leave_ms += elapsed_ns(&start) / 1e6 / runs;
+	}
+
+	LOG_MSG("    -- %s: %.1fms per enter, %.1fms per leave (%.1fms for the first enter)\n",
+	        resident ? "resident helper" : "pkexec",
+	        enter_ms,
+	        leave_ms,
+	        first_ms);
+	LOG_MSG("    -- Set resident_helper=%d and run again to compare\n", resident ? 0 : 1);
+
+	return 0;
+}
+
+static int write_fake_cgroup_file(const char *dir, const char *file, const char *value)
+{
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/%s", dir, file);
+	FILE *f = fopen(path, "w");
+	if (!f)
+		return -1;
+	fputs(value, f);
+	return fclose(f);
+}
+
+static bool fake_cgroup_file_is(const char *dir, const char *file, const char *expected)
+{
+	char path[PATH_MAX];
+	char value[64] = { 0 };
+	snprintf(path, sizeof(path), "%s/%s", dir, file);
+	FILE *f = fopen(path, "r");
+	if (!f)
+		return false;
+	if (!fgets(value, sizeof(value), f))
+		value[0] = '\0';
+	fclose(f);
+
+	if (strcmp(value, expected) != 0) {
+		LOG_ERROR("%s was '%s', expected '%s'\n", path, value, expected);
+		return false;
+	}
+	return true;
+}
+
+static int remove_fake_cgroup_entry(const char *path, __attribute__((unused)) const struct stat *sb,
+                                    __attribute__((unused)) int typeflag,
+                                    __attribute__((unused)) struct FTW *ftwbuf)
+{
+	return remove(path);
+}
+
+/* Read the layout of the cores and resolve the sets of cores the config can name */
+static int run_topology_tests(void)
+{
+	GameModeTopology *topology = game_mode_topology_new();
+	if (!topology)
+		return 1;
+
+	int ret = 0;
+	size_t num_cpu = game_mode_topology_num_cpu(topology);
+	cpu_set_t *set = CPU_ALLOC(num_cpu);
+	cpu_set_t *online = CPU_ALLOC(num_cpu);
+	const size_t size = CPU_ALLOC_SIZE(num_cpu);
+
+	if (game_mode_topology_get_cpus(topology, "online", online) != 0 ||
+	    CPU_COUNT_S(size, online) == 0) {
+		LOG_ERROR("No online cores found\n");
+		ret = -1;
+	}
+
+	/* Every core is either the first hardware thread of a core or another one */
+	int smt = 0;
+	if (game_mode_topology_get_cpus(topology, "smt-primary", set) == 0)
+		smt += CPU_COUNT_S(size, set);
+	if (game_mode_topology_get_cpus(topology, "smt-secondary", set) == 0)
+		smt += CPU_COUNT_S(size, set);
+	if (smt != CPU_COUNT_S(size, online)) {
+		LOG_ERROR("SMT siblings cover %d cores instead of %d\n", smt, CPU_COUNT_S(size, online));
+		ret = -1;
+	}
+
+	if (game_mode_topology_get_cpus(topology, "0,ccd0,pcores", set) != 0 ||
+	    game_mode_topology_get_cpus(topology, "ccd", set) == 0 ||
+	    game_mode_topology_get_cpus(topology, "bogus", set) == 0) {
+		LOG_ERROR("Sets of cores were not resolved as expected\n");
+		ret = -1;
+	}
+
+	if (game_mode_topology_changed(topology, NULL) ||
+	    game_mode_topology_changed(topology, online)) {
+		LOG_ERROR("Topology changed without cores being hotplugged\n");
+		ret = -1;
+	}
+
+	CPU_FREE(online);
+	CPU_FREE(set);
+	game_mode_topology_free(topology);
+	return ret;
+}
+
+/* Whether the cgroup dir is the cgroup own or holds it */
+static bool fake_cgroup_holds(const char *dir, const char *own)
+{
+	size_t len = strlen(dir);
+	return strncmp(own, dir, len) == 0 && (own[len] == '\0' || own[len] == '/');
+}
+
+/* A fake cgroup below a slice of the user manager */
+static void make_fake_throttle_cgroup(const char *dir)
+{
+	/* The fake files are not truncated, the values keep their length */
+	mkdir(dir, 0755);
+	write_fake_cgroup_file(dir, "cpu.weight", "5000\n");
+	write_fake_cgroup_file(dir, "io.weight", "default 5000\n");
+	write_fake_cgroup_file(dir, "cpuset.cpus", "0-3\n");
+}
+
+/* Whether the first of the fake cgroups are throttled as expected, or all restored */
+static bool fake_cgroups_throttled(char (*dirs)[PATH_MAX * 2], size_t count, const char *own,
+                                   bool throttled)
+{
+	/* app.slice and background.slice are lowered as a whole, or the cgroups next to ours are
+	 * when we run inside one of them. session.slice is left alone */
+	bool ok = true;
+	for (size_t i = 0; i < count; i++) {
+		const char *slice = dirs[i % 3];
+		bool lowered = throttled && i % 3 != 2 && !fake_cgroup_holds(dirs[i], own) &&
+		               (i < 3 || fake_cgroup_holds(slice, own));
+		if (!fake_cgroup_file_is(dirs[i], "cpu.weight", lowered ? "1000\n" : "5000\n") ||
+		    !fake_cgroup_file_is(dirs[i],
+		                         "io.weight",
+		                         lowered ? "default 1000\n" : "default 5000\n") ||
+		    !fake_cgroup_file_is(dirs[i], "cpuset.cpus", lowered ? "2-3\n" : "0-3\n"))
+			ok = false;
+	}
+	return ok;
+}
+
+/* Throttle the slices below a fake user manager, then check they are all restored */
+static int run_throttle_tests(const char *mount, const char *manager, const char *own)
+{
+	const char *const slices[] = { "app.slice", "background.slice", "session.slice" };
+	const char *const children[] = {
+		"other.scope", "other.service", "pipewire.service", "new.scope",
+	};
+
+	/* The slices, a cgroup in each and one that appears while throttled */
+	char dirs[7][PATH_MAX * 2];
+	for (size_t i = 0; i < 7; i++) {
+		if (i < 3)
+			snprintf(dirs[i], sizeof(dirs[i]), "%s/%s", manager, slices[i]);
+		else
+			snprintf(dirs[i], sizeof(dirs[i]), "%s/%s", dirs[i % 3], children[i - 3]);
+		if (i < 6)
+			make_fake_throttle_cgroup(dirs[i]);
+	}
+
+	GameModeCgroupSettings settings = {
+		.cpu_weight = 1000,
+		.io_weight = 1000,
+		.cpus = "2-3",
+	};
+	GameModeThrottle *throttle = game_mode_throttle_others(mount, NULL, 0, &settings);
+	if (!throttle) {
+		LOG_ERROR("Nothing was throttled below %s\n", manager);
+		return -1;
+	}
+
+	int ret = fake_cgroups_throttled(dirs, 6, own, true) ? 0 : -1;
+
+	/* Throttling again keeps what is throttled and picks up the new cgroup */
+	make_fake_throttle_cgroup(dirs[6]);
+	throttle = game_mode_rethrottle_others(throttle, mount, NULL, 0, &settings);
+	if (!fake_cgroups_throttled(dirs, 7, own, true))
+		ret = -1;
+
+	game_mode_unthrottle_others(throttle);
+	if (!fake_cgroups_throttled(dirs, 7, own, false))
+		ret = -1;
+
+	return ret;
+}
+
+/* List the login sessions next to a fake user manager, in the user's own slice */
+static int run_login_session_tests(const char *mount, const char *manager)
+{
+	/* Login sessions are only isolated when the user manager runs right below the user's slice */
+	char slice[PATH_MAX];
+	snprintf(slice, sizeof(slice), "%s/user.slice/user-%u.slice", mount, (unsigned int)getuid());
+	size_t len = strlen(slice);
+	if (strncmp(manager, slice, len) != 0 || manager[len] != '/' || strchr(manager + len + 1, '/'))
+		return 0;
+
+	char sessions[2][PATH_MAX * 2];
+	for (size_t i = 0; i < 2; i++) {
+		snprintf(sessions[i], sizeof(sessions[i]), "%s/session-%zu.scope", slice, i + 1);
+		mkdir(sessions[i], 0755);
+	}
+
+	/* The sessions and nothing else, not the user manager */
+	int ret = 0;
+	size_t count = 0;
+	char **cgroups = game_mode_cgroups_login_sessions(mount, NULL, 0);
+	while (cgroups && cgroups[count]) {
+		if (strcmp(cgroups[count], sessions[0]) != 0 && strcmp(cgroups[count], sessions[1]) != 0) {
+			LOG_ERROR("%s is not a login session\n", cgroups[count]);
+			ret = -1;
+		}
+		free(cgroups[count++]);
+	}
+	free(cgroups);
+
+	if (count != 2) {
+		LOG_ERROR("Found %zu login sessions, expected 2\n", count);
+		ret = -1;
+	}
+	return ret;
+}
+
+/* Move ourselves into a cgroup and back out again, on a fake cgroupfs in a temporary directory */
+static int run_cgroup_tests(void)
+{
+	/* Recreate our own cgroup below the fake mount point */
+	char own[PATH_MAX] = { 0 };
+	FILE *f = fopen("/proc/self/cgroup", "r");
+	if (!f)
+		return 1;
+	char line[PATH_MAX + 4];
+	while (fgets(line, sizeof(line), f)) {
+		if (strncmp(line, "0::", 3) == 0) {
+			line[strcspn(line, "\n")] = '\0';
+			snprintf(own, sizeof(own), "%s", line + 3);
+		}
+	}
+	fclose(f);
+	if (own[0] != '/')
+		return 1; /* No cgroup v2 */
+
+	char mount[] = "/tmp/gamemode-cgroup-XXXXXX";
+	if (!mkdtemp(mount))
+		return -1;
+
+	char root[PATH_MAX];
+	snprintf(root, sizeof(root), "%s", mount);
+	for (char *s = strtok(own, "/"); s; s = strtok(NULL, "/")) {
+		strncat(root, "/", sizeof(root) - strlen(root) - 1);
+		strncat(root, s, sizeof(root) - strlen(root) - 1);
+		mkdir(root, 0755);
+	}
+
+	/* cgroupfs makes the control files along with a cgroup, here they have to exist first */
+	char pid[32];
+	char leaf[PATH_MAX + 32];
+	char game[PATH_MAX + 32];
+	snprintf(pid, sizeof(pid), "%d", getpid());
+	snprintf(leaf, sizeof(leaf), "%s/gamemoded", root);
+	snprintf(game, sizeof(game), "%s/game-%d", root, getpid());
+	mkdir(leaf, 0755);
+	mkdir(game, 0755);
+
+	int ret = 0;
+	write_fake_cgroup_file(mount, "cgroup.controllers", "cpuset cpu io memory pids\n");
+	write_fake_cgroup_file(root, "cgroup.controllers", "cpuset cpu io memory pids\n");
+	write_fake_cgroup_file(root, "cgroup.subtree_control", "");
+	write_fake_cgroup_file(root, "cgroup.procs", pid);
+	write_fake_cgroup_file(leaf, "cgroup.procs", "");
+	const char *const game_files[] = {
+		"cgroup.procs", "cpu.weight", "io.weight", "memory.low", "cpuset.cpus",
+	};
+	for (size_t i = 0; i < sizeof(game_files) / sizeof(game_files[0]); i++)
+		write_fake_cgroup_file(game, game_files[i], "");
+
+	GameModeCgroups *cgroups = game_mode_cgroups_new(mount);
+	if (!cgroups) {
+		LOG_ERROR("Could not set up cgroups on the fake cgroupfs\n");
+		ret = -1;
+		goto out;
+	}
+
+	if (!fake_cgroup_file_is(leaf, "cgroup.procs", pid)) {
+		LOG_ERROR("The daemon was not moved into its leaf cgroup\n");
+		ret = -1;
+	}
+
+	GameModeCgroupSettings settings = {
+		.cpu_weight = 500,
+		.io_weight = 200,
+		.memory_low = "1G",
+		.cpus = "0",
+	};
+	const int expected = GAME_MODE_CGROUP_MOVED | GAME_MODE_CGROUP_CPU | GAME_MODE_CGROUP_IO |
+	                     GAME_MODE_CGROUP_MEMORY | GAME_MODE_CGROUP_CPUSET;
+	int applied = game_mode_cgroups_add(cgroups, getpid(), &settings);
+	if (applied != expected) {
+		LOG_ERROR("Moving into a cgroup applied %d, expected %d\n", applied, expected);
+		ret = -1;
+	}
+
+	/* Each controller is enabled with a write of its own, cpuset is the last one */
+	if (!fake_cgroup_file_is(root, "cgroup.subtree_control", "+cpuset") ||
+	    !fake_cgroup_file_is(game, "cgroup.procs", pid) ||
+	    !fake_cgroup_file_is(game, "cpu.weight", "500") ||
+	    !fake_cgroup_file_is(game, "io.weight", "default 200") ||
+	    !fake_cgroup_file_is(game, "memory.low", "1G") ||
+	    !fake_cgroup_file_is(game, "cpuset.cpus", "0"))
+		ret = -1;
+
+	/* An emptied cgroup, its control files go away with it on a real cgroupfs */
+	for (size_t i = 0; i < sizeof(game_files) / sizeof(game_files[0]); i++) {
+		char path[PATH_MAX * 2];
+		snprintf(path, sizeof(path), "%s/%s", game, game_files[i]);
+		unlink(path);
+	}
+	int removed = game_mode_cgroups_remove(cgroups, getpid());
+	if (removed != 0 || access(game, F_OK) == 0) {
+		LOG_ERROR("Leaving the cgroup returned %d and left %s behind\n", removed, game);
+		ret = -1;
+	}
+
+	game_mode_cgroups_free(cgroups);
+
+	/* Throttling and isolating other work need a user manager above us */
+	char manager[PATH_MAX];
+	snprintf(manager, sizeof(manager), "%s", root);
+	char *user = strstr(manager, "/user@");
+	char *end = user ? strchr(user + 1, '/') : NULL;
+	if (end) {
+		*end = '\0';
+		if (run_throttle_tests(mount, manager, root) != 0 ||
+		    run_login_session_tests(mount, manager) != 0)
+			ret = -1;
+	}
+
+out:
+	nftw(mount, remove_fake_cgroup_entry, 8, FTW_DEPTH | FTW_PHYS);
+	return ret;
+}
+
+static int write_test_config(const char *path, const char *contents)
+{
+	FILE *f = fopen(path, "w");
+	if (!f)
+		return -1;
+	fputs(contents, f);
+	return fclose(f);
+}
+
+static int write_reload_test_config(const char *path, const char *governor, const char *whitelist)
+{
+	char contents[512];
+	snprintf(contents,
+	         sizeof(contents),
+	         "[general]\ndesiredgov=%s\nrenice=5\n[filter]\nwhitelist=%s\n"
+	         "[cpu]\npark_cores=no\npin_cores=no\n",
+	         governor,
+	         whitelist);
+	return write_test_config(path, contents);
+}
+
+/* Edit the config one setting at a time, and check a reload only touches what depends on it */
+static int run_config_reload_tests(const char *path)
+{
+	const struct {
+		const char *edit;
+		const char *governor;
+		const char *whitelist;
+		unsigned int changes;
+	} edits[] = {
+		{ "a filter line", "performance", "gamemode-test-second", CONFIG_CHANGE_CLIENTS },
+		{ "the governor", "powersave", "gamemode-test-second", CONFIG_CHANGE_GOVERNOR },
+		{ "nothing", "powersave", "gamemode-test-second", 0 },
+	};
+
+	if (write_reload_test_config(path, "performance", "gamemode-test-first") != 0)
+		return -1;
+
+	GameModeConfig *config = config_create();
+	config_init(config);
+
+	int ret = 0;
+	for (size_t i = 0; i < sizeof(edits) / sizeof(edits[0]); i++) {
+		if (write_reload_test_config(path, edits[i].governor, edits[i].whitelist) != 0) {
+			ret = -1;
+			break;
+		}
+
+		/* Parking, pinning and the per client settings are left and applied again on change */
+		unsigned int pending = config_pending_changes(config);
+		unsigned int changes = config_reload(config);
+		if (pending != edits[i].changes || changes != edits[i].changes) {
+			LOG_ERROR("Editing %s changed 0x%x before and 0x%x on reload, expected 0x%x\n",
+			          edits[i].edit,
+			          pending,
+			          changes,
+			          edits[i].changes);
+			ret = -1;
+		}
+	}
+
+	config_destroy(config);
+	return ret;
+}
+
+/* Check a resolved config has the settings of the profile it should have */
+static bool game_profile_is(GameModeConfig *config, const char *name, long renice, long ioprio,
+                            const char *governor)
+{
+	if (!config) {
+		LOG_ERROR("%s has no profile\n", name);
+		return false;
+	}
+
+	char desiredgov[CONFIG_VALUE_MAX] = { 0 };
+	config_get_desired_governor(config, desiredgov);
+	if (config_get_renice_value(config) == renice && config_get_ioprio_value(config) == ioprio &&
+	    strcmp(desiredgov, governor) == 0)
+		return true;
+
+	LOG_ERROR("%s has renice=%ld ioprio=%ld desiredgov=%s, expected %ld, %ld and %s\n",
+	          name,
+	          config_get_renice_value(config),
+	          config_get_ioprio_value(config),
+	          desiredgov,
+	          renice,
+	          ioprio,
+	          governor);
+	return false;
+}
+
+/* Resolve overlapping game sections, and hand the system wide settings from game to game */
+static int run_game_profile_tests(const char *path)
+{
+	const char *const contents = "[general]\n"
+	                             "desiredgov=powersave\n"
+	                             "renice=2\n"
+	                             "ioprio=1\n"
+	                             "reaper_freq=7\n"
+	                             "[game:gamemode-test-game]\n"
+	                             "desiredgov=performance\n"
+	                             "renice=5\n"
+	                             "[game:gamemode-test-game-two]\n"
+	                             "renice=10\n"
+	                             "ioprio=3\n"
+	                             "[game:gamemode-test-game]\n"
+	                             "ioprio=6\n"
+	                             "reaper_freq=1\n";
+	const char *const one = "/opt/gamemode-test-game-one";
+	const char *const two = "/opt/gamemode-test-game-two";
+	const char *const other = "/opt/gamemode-test-other";
+
+	if (write_test_config(path, contents) != 0)
+		return -1;
+
+	GameModeConfig *config = config_create();
+	config_init(config);
+	GameModeConfig *first = config_for_executable(config, one);
+	GameModeConfig *second = config_for_executable(config, two);
+	GameModeConfig *none = config_for_executable(config, other);
+
+	/* The repeated section is merged into the first one, so the second section still wins */
+	int ret = 0;
+	if (!game_profile_is(config, "The global config", 2, 1, "powersave") ||
+	    !game_profile_is(first, one, 5, 6, "performance") ||
+	    !game_profile_is(second, two, 10, 3, "performance"))
+		ret = -1;
+	if (none) {
+		LOG_ERROR("%s matched a game section\n", other);
+		config_destroy(none);
+		ret = -1;
+	}
+	if (first && config_get_reaper_frequency(first) != 7) {
+		LOG_ERROR("A game section changed reaper_freq, which can not be set per game\n");
+		ret = -1;
+	}
+	if (ret != 0)
+		goto out;
+
+	/* Only the groups a game section can override are compared */
+	if (config_compare(config, first) != (CONFIG_CHANGE_GOVERNOR | CONFIG_CHANGE_CLIENT_OPTS) ||
+	    config_compare(first, second) != CONFIG_CHANGE_CLIENT_OPTS) {
+		LOG_ERROR("The game profiles differ from the global config in the wrong groups\n");
+		ret = -1;
+	}
+
+	/* The last registered game with a profile decides, the previous one takes over once it
+	 * exits, and games without a profile never do */
+	const struct {
+		const char *games[2];
+		size_t count;
+		GameModeConfig *decides;
+	} handoffs[] = {
+		{ { one, two }, 2, second }, { { two, one }, 2, first }, { { one, other }, 2, first },
+		{ { one }, 1, first },       { { other }, 1, NULL },
+	};
+	for (size_t i = 0; i < sizeof(handoffs) / sizeof(handoffs[0]); i++) {
+		GameModeConfig *system = config_for_games(config, handoffs[i].games, handoffs[i].count);
+		if ((system == NULL) != (handoffs[i].decides == NULL) ||
+		    (system && config_compare(system, handoffs[i].decides) != 0)) {
+			LOG_ERROR("The system wide settings of hand-off %zu followed the wrong game\n", i);
+			ret = -1;
+		}
+		if (system)
+			config_destroy(system);
+	}
+
+out:
+	if (first)
+		config_destroy(first);
+	if (second)
+		config_destroy(second);
+	config_destroy(config);
+	return ret;
+}
+
+/* Run the config tests against a scratch gamemode.ini in the current directory, with an empty
+ * $XDG_CONFIG_HOME. The shipped and /etc configs still load first, the tests only look at the
+ * settings they set themselves
+ */
+static int run_config_tests(void)
+{
+	LOG_MSG(":: Config tests\n");
+
+	char dir[] = "/tmp/gamemode-config-XXXXXX";
+	if (!mkdtemp(dir))
+		return -1;
+
+	char home[PATH_MAX];
+	char path[PATH_MAX];
+	snprintf(home, sizeof(home), "%s/home", dir);
+	snprintf(path, sizeof(path), "%s/gamemode.ini", dir);
+	mkdir(home, 0755);
+
+	char *xdg_config_home = getenv("XDG_CONFIG_HOME");
+	if (xdg_config_home)
+		xdg_config_home = strdup(xdg_config_home);
+	int cwd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+	int ret = -1;
+	if (cwd >= 0 && chdir(dir) == 0 && setenv("XDG_CONFIG_HOME", home, 1) == 0) {
+		ret = 0;
+		if (run_config_reload_tests(path) != 0)
+			ret = -1;
+		if (run_game_profile_tests(path) != 0)
+			ret = -1;
+	}
+
+	if (xdg_config_home)
+		setenv("XDG_CONFIG_HOME", xdg_config_home, 1);
+	else
+		unsetenv("XDG_CONFIG_HOME");
+	free(xdg_config_home);
+	if (cwd >= 0) {
+		if (fchdir(cwd) != 0)
+			ret = -1;
+		close(cwd);
+	}
+
+	unlink(path);
+	rmdir(home);
+	rmdir(dir);
+
+	if (ret == 0)
+		LOG_MSG(":: Passed\n\n");
+	else
+		LOG_ERROR(":: Failed!\n");
+
+	return ret;
+}
+
 /**
  * game_mode_run_feature_tests runs a set of tests for each current feature (based on the current
  * config) returns 0 for success, -1 for failure
@@ -1062,6 +1980,53 @@ static int game_mode_run_feature_tests(struct GameModeConfig *config)
 		}
 	}
 
+	/* Can we tell the cores apart? */
+	{
+		LOG_MSG("::: Verifying the cpu topology\n");
+		int topologystatus = run_topology_tests();
+
+		if (topologystatus == 1)
+			LOG_MSG("::: Passed (sysfs not available)\n");
+		else if (topologystatus == 0)
+			LOG_MSG("::: Passed\n");
+		else {
+			LOG_MSG("::: Failed!\n");
+			status = -1;
+		}
+	}
+
+	/* Do games get moved into cgroups and back? */
+	{
+		LOG_MSG("::: Verifying cgroups\n");
+		int cgroupstatus = run_cgroup_tests();
+
+		if (cgroupstatus == 1)
+			LOG_MSG("::: Passed (cgroup v2 not in use)\n");
+		else if (cgroupstatus == 0)
+			LOG_MSG("::: Passed\n");
+		else {
+			LOG_MSG("::: Failed!\n");
+			status = -1;
+		}
+	}
+
+	/* How much does the resident helper save? */
+	{
+		LOG_MSG("::: Benchmarking privileged changes\n");
+		int benchstatus = run_privileged_helper_benchmark(config);
+
+		if (benchstatus == 1)
+			LOG_MSG("::: Passed (GAMEMODE_BENCHMARK_HELPER not set)\n");
+		else if (benchstatus == 0)
+			LOG_MSG("::: Passed\n");
+		else {
+			LOG_MSG("::: Failed!\n");
+			// The pkexec fallback keeps working without the helper
+			if (status == 0)
+				status = 1;
+		}
+	}
+
 	/* TODO */
 	/* Was the scheduling applied and removed? Does it get applied to a full process tree? */
 	/* Does the screensaver get inhibited? Unknown if this is testable, org.freedesktop.ScreenSaver
@@ -1198,6 +2163,18 @@ int game_mode_run_client_tests(void)
 
 	/* TODO: Also check blacklist/whitelist values as these may mess up the tests below */
 
+	/* Check the client registry holds up with many clients */
+	if (run_client_registry_stress_tests() != 0)
+		status = -1;
+
+	/* Check the client filters hold up with many rules */
+	if (run_client_filter_benchmark() != 0)
+		status = -1;
+
+	/* Check the config resolves and reloads as documented */
+	if (run_config_tests() != 0)
+		status = -1;
+
 	/* Run the basic tests */
 	if (run_basic_client_tests() != 0)
 		status = -1;
@@ -1206,7 +2183,11 @@ int game_mode_run_client_tests(void)
 	if (run_dual_client_tests() != 0)
 		status = -1;
 
-	/* Check gamemoderun and the reaper thread work */
+	/* Run the thread registration tests */
+	if (run_thread_registration_tests() != 0)
+		status = -1;
+
+	/* Check gamemoderun and the reaper work */
 	if (run_gamemoderun_and_reaper_tests(config) != 0)
 		status = -1;
 
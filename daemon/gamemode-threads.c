@@ -0,0 +1,279 @@
+/*
+
+Copyright (c) 2017-2025, Feral Interactive and the GameMode contributors
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+ * Neither the name of Feral Interactive nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+#define _GNU_SOURCE
+
+#include "common-helpers.h"
+
+#include "gamemode.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * The threads of a process, keyed by thread id
+ *
+ * Every scan bumps the generation, threads the scan did not see have exited
+ * and are dropped along with what was applied to them.
+ */
+struct GameModeThreads {
+	pid_t pid;
+	GameModePidTable *table; /**<GameModeThread entries */
+	unsigned int generation;
+};
+
+GameModeThreads *game_mode_threads_new(pid_t pid)
+{
+	GameModeThreads *threads = calloc(1, sizeof(GameModeThreads));
+	if (!threads)
+		return NULL;
+
+	threads->pid = pid;
+	threads->table = game_mode_pidtable_new();
+	if (!threads->table) {
+		free(threads);
+		return NULL;
+	}
+
+	return threads;
+}
+
+void game_mode_threads_free(GameModeThreads *threads)
+{
+	if (!threads)
+		return;
+
+	size_t iter = 0;
+	void *thread = NULL;
+	while (game_mode_pidtable_next(threads->table, &iter, NULL, &thread))
+		free(thread);
+
+	game_mode_pidtable_free(threads->table);
+	free(threads);
+}
+
+pid_t game_mode_threads_get_pid(const GameModeThreads *threads)
+{
+	return threads->pid;
+}
+
+size_t game_mode_threads_count(const GameModeThreads *threads)
+{
+	return game_mode_pidtable_count(threads->table);
+}
+
+GameModeThread *game_mode_threads_lookup(const GameModeThreads *threads, pid_t tid)
+{
+	return game_mode_pidtable_lookup(threads->table, tid);
+}
+
+/**
+ * Track a thread, returns the existing entry if it is known already or NULL
+ * when out of memory
+ */
+GameModeThread *game_mode_threads_add(GameModeThreads *threads, pid_t tid)
+{
+	GameModeThread *thread = game_mode_pidtable_lookup(threads->table, tid);
+	if (thread)
+		return thread;
+
+	thread = calloc(1, sizeof(GameModeThread));
+	if (!thread)
+		return NULL;
+
+	thread->tid = tid;
+	thread->generation = threads->generation;
+	thread->role = -1;
+	if (game_mode_pidtable_insert(threads->table, tid, thread) != 0) {
+		free(thread);
+		return NULL;
+	}
+
+	return thread;
+}
+
+void game_mode_threads_remove(GameModeThreads *threads, pid_t tid)
+{
+	free(game_mode_pidtable_remove(threads->table, tid));
+}
+
+/**
+ * Bring the table in line with /proc/<pid>/task, new threads are added with
+ * nothing applied and the ones that exited are dropped
+ *
+ * @returns 0 on success, or a negative errno value if the process could not be inspected
+ */
+int game_mode_threads_scan(GameModeThreads *threads)
+{
+	char buffer[PATH_MAX];
+	const char *tasks = buffered_snprintf(buffer, "/proc/%d/task", threads->pid);
+	if (!tasks)
+		return -ENAMETOOLONG;
+
+	DIR *dir = opendir(tasks);
+	if (!dir)
+		return -errno;
+
+	unsigned int generation = ++threads->generation;
+
+	struct dirent *entry;
+	while ((entry = readdir(dir))) {
+		/* Skip . and .. */
+		if (entry->d_name[0] == '.')
+			continue;
+
+		GameModeThread *thread = game_mode_threads_add(threads, atoi(entry->d_name));
+		if (thread)
+			thread->generation = generation;
+	}
+
+	closedir(dir);
+
+	size_t iter = 0;
+	pid_t tid = 0;
+	void *thread = NULL;
+	while (game_mode_pidtable_next(threads->table, &iter, &tid, &thread)) {
+		if (((GameModeThread *)thread)->generation != generation)
+			game_mode_threads_remove(threads, tid);
+	}
+
+	return 0;
+}
+
+/**
+ * Read the name of a thread, as set with pthread_setname_np or prctl
+ *
+ * @returns 0 on success, or a negative errno value if the thread is gone
+ */
+int game_mode_threads_get_comm(const GameModeThreads *threads, pid_t tid,
+                               char comm[GAME_MODE_THREAD_COMM_MAX])
+{
+	char buffer[PATH_MAX];
+	const char *path = buffered_snprintf(buffer, "/proc/%d/task/%d/comm", threads->pid, tid);
+	if (!path)
+		return -ENAMETOOLONG;
+
+	FILE *f = fopen(path, "re");
+	if (!f)
+		return -errno;
+
+	if (!fgets(comm, GAME_MODE_THREAD_COMM_MAX, f)) {
+		fclose(f);
+		return -EIO;
+	}
+	fclose(f);
+
+	comm[strcspn(comm, "\n")] = '\0';
+	return 0;
+}
+
+/**
+ * Read the CPU time a thread ran for, from /proc/<pid>/task/<tid>/schedstat
+ *
+ * @returns 0 on success with the time in ns, or a negative errno value if the thread is gone
+ */
+int game_mode_threads_get_runtime(const GameModeThreads *threads, pid_t tid, uint64_t *runtime)
+{
+	char buffer[PATH_MAX];
+	const char *path = buffered_snprintf(buffer, "/proc/%d/task/%d/schedstat", threads->pid, tid);
+	if (!path)
+		return -ENAMETOOLONG;
+
+	FILE *f = fopen(path, "re");
+	if (!f)
+		return -errno;
+
+	int r = fscanf(f, "%" SCNu64, runtime) == 1 ? 0 : -EIO;
+	fclose(f);
+	return r;
+}
+
+/**
+ * List the child processes of the known threads, from /proc/<pid>/task/<tid>/children
+ *
+ * @returns 0 on success with a malloc'd array in children, or -ENOMEM
+ */
+int game_mode_threads_get_children(const GameModeThreads *threads, pid_t **children,
+                                   size_t *count)
+{
+	pid_t *list = NULL;
+	size_t num = 0, max = 0;
+
+	size_t iter = 0;
+	pid_t tid = 0;
+	while (game_mode_pidtable_next(threads->table, &iter, &tid, NULL)) {
+		char buffer[PATH_MAX];
+		const char *path =
+		    buffered_snprintf(buffer, "/proc/%d/task/%d/children", threads->pid, tid);
+		if (!path)
+			continue;
+
+		FILE *f = fopen(path, "re");
+		/* Threads that exited since the last scan have no list */
+		if (!f)
+			continue;
+
+		int child;
+		while (fscanf(f, "%d", &child) == 1) {
+			if (num == max) {
+				max = max ? max * 2 : 16;
+				pid_t *grown = realloc(list, max * sizeof(pid_t));
+				if (!grown) {
+					fclose(f);
+					free(list);
+					return -ENOMEM;
+				}
+				list = grown;
+			}
+			list[num++] = child;
+		}
+		fclose(f);
+	}
+
+	*children = list;
+	*count = num;
+	return 0;
+}
+
+bool game_mode_threads_next(const GameModeThreads *threads, size_t *iter, GameModeThread **thread)
+{
+	void *value = NULL;
+	if (!game_mode_pidtable_next(threads->table, iter, NULL, &value))
+		return false;
+
+	*thread = value;
+	return true;
+}
@@ -0,0 +1,583 @@
+/*
+
+Copyright (c) 2017-2025, Feral Interactive and the GameMode contributors
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+ * Neither the name of Feral Interactive nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+#define _GNU_SOURCE
+
+#include "common-cpu.h"
+#include "common-helpers.h"
+#include "common-logging.h"
+
+#include "gamemode.h"
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define CPU_SYSFS "/sys/devices/system/cpu"
+
+/* Long enough for the cpu lists of the largest machines */
+#define CPULIST_MAX 4096
+
+enum GameModeCPUType {
+	CPU_TYPE_UNKNOWN,     /**<Not a hybrid system, or the kernel does not tell */
+	CPU_TYPE_PERFORMANCE, /**<P-core */
+	CPU_TYPE_EFFICIENCY,  /**<E-core */
+};
+
+/* What is known about each core, -1 for what the kernel does not tell */
+typedef struct GameModeTopologyCPU {
+	bool online;
+	int package;
+	int die;
+	int cluster;
+	int core;
+	int node;
+	int l3; /**<Index of the L3 domain, numbered by their first core */
+	enum GameModeCPUType type;
+	int smt_group;           /**<The first of its SMT siblings */
+	unsigned long max_freq;  /**<In kHz, 0 when unknown */
+	unsigned long base_freq; /**<In kHz, 0 when unknown */
+} GameModeTopologyCPU;
+
+/**
+ * The layout of the cores, read from sysfs once at startup. Core pinning, core parking and the
+ * thread roles look up sets of cores here rather than reading sysfs again on every config reload.
+ * The files of offline cores are gone, so it needs to be built while no cores are parked.
+ */
+struct GameModeTopology {
+	size_t num_cpu;
+	char present[CPULIST_MAX]; /**<The present cores, to notice cores being added or removed */
+	GameModeTopologyCPU *cpus;
+	unsigned long long *l3_size; /**<Size of each L3 domain in bytes */
+	size_t num_l3;
+	bool hybrid;          /**<The kernel told P-cores and E-cores apart */
+	cpu_set_t *preferred; /**<The cores core pinning and parking keep by default */
+};
+
+/* Read a small sysfs file, without the trailing newline */
+static bool read_file(const char *path, char *buf, size_t size)
+{
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return false;
+
+	ssize_t len = read(fd, buf, size - 1);
+	close(fd);
+	if (len <= 0)
+		return false;
+
+	buf[len] = '\0';
+	buf[strcspn(buf, "\n")] = '\0';
+	return true;
+}
+
+static bool read_cpu_file(long cpu, const char *name, char *buf, size_t size)
+{
+	char path[PATH_MAX];
+	const char *p = buffered_snprintf(path, CPU_SYSFS "/cpu%ld/%s", cpu, name);
+	return p && read_file(p, buf, size);
+}
+
+static long read_cpu_long(long cpu, const char *name)
+{
+	char buf[64];
+	if (!read_cpu_file(cpu, name, buf, sizeof(buf)))
+		return -1;
+
+	char *end = NULL;
+	long value = strtol(buf, &end, 10);
+	return end != buf ? value : -1;
+}
+
+/* The first core of a list, -1 for an empty one */
+static long first_of_list(char *cpulist)
+{
+	long from, to;
+	return parse_cpulist(cpulist, &from, &to) ? from : -1;
+}
+
+/* Add the cores of a list to a set, leaving out the ones past the end of it */
+static void add_list_to_set(char *cpulist, size_t num_cpu, cpu_set_t *set)
+{
+	long from, to;
+	while ((cpulist = parse_cpulist(cpulist, &from, &to))) {
+		for (long cpu = from; cpu < to + 1 && cpu < (long)num_cpu; cpu++)
+			CPU_SET_S((size_t)cpu, CPU_ALLOC_SIZE(num_cpu), set);
+	}
+}
+
+/* Size of the L3 cache of a core in bytes, 0 if unknown */
+static unsigned long long read_l3_size(long cpu)
+{
+	char buf[64];
+	if (!read_cpu_file(cpu, "cache/index3/size", buf, sizeof(buf)))
+		return 0;
+
+	char *endp;
+	unsigned long long cache_size = strtoull(buf, &endp, 10);
+
+	if (*endp == 'K') {
+		cache_size *= 1024;
+	} else if (*endp == 'M') {
+		cache_size *= 1024 * 1024;
+	} else if (*endp == 'G') {
+		cache_size *= 1024 * 1024 * 1024;
+	} else if (*endp != '\0') {
+		LOG_MSG("cpu L3 cache size (%s) on core #%ld is silly\n", buf, cpu);
+		cache_size = 0;
+	}
+
+	return cache_size;
+}
+
+/* The NUMA node of a core, from its node<N> link */
+static int read_node(long cpu)
+{
+	char path[PATH_MAX];
+	const char *p = buffered_snprintf(path, CPU_SYSFS "/cpu%ld", cpu);
+	DIR *dir = p ? opendir(p) : NULL;
+	if (!dir)
+		return -1;
+
+	int node = -1;
+	struct dirent *entry;
+	while ((entry = readdir(dir))) {
+		if (strncmp(entry->d_name, "node", 4) == 0 && isdigit((unsigned char)entry->d_name[4])) {
+			node = atoi(entry->d_name + 4);
+			break;
+		}
+	}
+	closedir(dir);
+	return node;
+}
+
+/* Tell the P-cores from the E-cores of Intel hybrid CPUs, returns whether the kernel could */
+static bool read_core_types(GameModeTopology *topology)
+{
+	char list[CPULIST_MAX];
+	if (!read_file("/sys/devices/cpu_core/cpus", list, sizeof(list)))
+		return false;
+
+	LOG_MSG("found kernel support for checking P/E-cores\n");
+
+	long from, to;
+	char *s = list;
+	while ((s = parse_cpulist(s, &from, &to))) {
+		for (long cpu = from; cpu < to + 1 && cpu < (long)topology->num_cpu; cpu++)
+			topology->cpus[cpu].type = CPU_TYPE_PERFORMANCE;
+	}
+
+	if (read_file("/sys/devices/cpu_atom/cpus", list, sizeof(list))) {
+		s = list;
+		while ((s = parse_cpulist(s, &from, &to))) {
+			for (long cpu = from; cpu < to + 1 && cpu < (long)topology->num_cpu; cpu++)
+				topology->cpus[cpu].type = CPU_TYPE_EFFICIENCY;
+		}
+	}
+
+	return true;
+}
+
+/* Read what sysfs tells about an online core */
+static int read_cpu(GameModeTopology *topology, long cpu, long *l3_first)
+{
+	GameModeTopologyCPU *info = &topology->cpus[cpu];
+	info->package = (int)read_cpu_long(cpu, "topology/physical_package_id");
+	info->die = (int)read_cpu_long(cpu, "topology/die_id");
+	info->cluster = (int)read_cpu_long(cpu, "topology/cluster_id");
+	info->core = (int)read_cpu_long(cpu, "topology/core_id");
+	info->node = read_node(cpu);
+
+	long freq = read_cpu_long(cpu, "cpufreq/cpuinfo_max_freq");
+	info->max_freq = freq > 0 ? (unsigned long)freq : 0;
+	freq = read_cpu_long(cpu, "cpufreq/base_frequency");
+	info->base_freq = freq > 0 ? (unsigned long)freq : 0;
+
+	char list[CPULIST_MAX];
+	if (read_cpu_file(cpu, "topology/thread_siblings_list", list, sizeof(list)))
+		info->smt_group = (int)first_of_list(list);
+
+	/* The cores sharing an L3 cache make up a domain, such as a CCD of AMD CPUs */
+	if (!read_cpu_file(cpu, "cache/index3/shared_cpu_list", list, sizeof(list)))
+		return 0;
+
+	long first = first_of_list(list);
+	size_t domain = 0;
+	while (domain < topology->num_l3 && l3_first[domain] != first)
+		domain++;
+
+	if (domain == topology->num_l3) {
+		unsigned long long *sizes =
+		    realloc(topology->l3_size, (topology->num_l3 + 1) * sizeof(*sizes));
+		if (!sizes)
+			return -ENOMEM;
+		topology->l3_size = sizes;
+		topology->l3_size[domain] = read_l3_size(cpu);
+		l3_first[domain] = first;
+		topology->num_l3++;
+	}
+	info->l3 = (int)domain;
+	return 0;
+}
+
+/* The L3 domains with the largest caches, such as the CCDs with 3D V-Cache */
+static void get_vcache(const GameModeTopology *topology, cpu_set_t *set)
+{
+	unsigned long long min = 0, max = 0;
+	for (size_t i = 0; i < topology->num_l3; i++) {
+		if (i == 0 || topology->l3_size[i] < min)
+			min = topology->l3_size[i];
+		if (topology->l3_size[i] > max)
+			max = topology->l3_size[i];
+	}
+
+	/* Nothing stands out with uniform caches */
+	if (min == max)
+		return;
+
+	for (size_t cpu = 0; cpu < topology->num_cpu; cpu++) {
+		const GameModeTopologyCPU *info = &topology->cpus[cpu];
+		if (info->online && info->l3 >= 0 && topology->l3_size[info->l3] == max)
+			CPU_SET_S(cpu, CPU_ALLOC_SIZE(topology->num_cpu), set);
+	}
+}
+
+/* The cores within 10% of the highest maximum frequency */
+static void get_fastest(const GameModeTopology *topology, cpu_set_t *set)
+{
+	unsigned long max = 0;
+	for (size_t cpu = 0; cpu < topology->num_cpu; cpu++) {
+		if (topology->cpus[cpu].online && topology->cpus[cpu].max_freq > max)
+			max = topology->cpus[cpu].max_freq;
+	}
+
+	for (size_t cpu = 0; cpu < topology->num_cpu; cpu++) {
+		unsigned long freq = topology->cpus[cpu].max_freq;
+		if (topology->cpus[cpu].online && freq > 0 && freq + (freq * 10) / 100 >= max)
+			CPU_SET_S(cpu, CPU_ALLOC_SIZE(topology->num_cpu), set);
+	}
+}
+
+/*
+ * Pick the cores games should run on: the P-cores of hybrid CPUs, otherwise the CCDs with the
+ * larger L3 cache of X3D CPUs with several chiplets, otherwise the cores with the highest
+ * frequency of big.LITTLE systems
+ */
+static void find_preferred(GameModeTopology *topology, const cpu_set_t *online)
+{
+	const size_t size = CPU_ALLOC_SIZE(topology->num_cpu);
+	cpu_set_t *preferred = topology->preferred;
+
+	if (topology->hybrid) {
+		game_mode_topology_get_cpus(topology, "pcores", preferred);
+		if (CPU_EQUAL_S(size, online, preferred) || CPU_COUNT_S(size, preferred) == 0)
+			LOG_MSG("kernel did not indicate that this was an P/E-cores system\n");
+		return;
+	}
+
+	get_vcache(topology, preferred);
+	if (CPU_COUNT_S(size, preferred) > 0 && !CPU_EQUAL_S(size, online, preferred))
+		return;
+
+	LOG_MSG("cpu L3 cache was uniform, this is not a x3D with multiple chiplets\n");
+
+	CPU_ZERO_S(size, preferred);
+	get_fastest(topology, preferred);
+	if (CPU_EQUAL_S(size, online, preferred) || CPU_COUNT_S(size, preferred) == 0)
+		LOG_MSG("cpu frequency was uniform, this is not a big.LITTLE type of system\n");
+}
+
+/**
+ * Read the layout of the cores from sysfs
+ *
+ * @returns The topology, or NULL when the present cores can not be read
+ */
+GameModeTopology *game_mode_topology_new(void)
+{
+	GameModeTopology *topology = calloc(1, sizeof(*topology));
+	if (!topology)
+		return NULL;
+
+	char online_list[CPULIST_MAX];
+	if (!read_file(CPU_SYSFS "/present", topology->present, sizeof(topology->present)) ||
+	    !read_file(CPU_SYSFS "/online", online_list, sizeof(online_list))) {
+		LOG_ERROR("Couldn't read the present and online cores : %s\n", strerror(errno));
+		free(topology);
+		return NULL;
+	}
+
+	long from, to, max = 0;
+	char *s = topology->present;
+	while ((s = parse_cpulist(s, &from, &to))) {
+		if (to > max)
+			max = to;
+	}
+	topology->num_cpu = (size_t)(max + 1);
+
+	const size_t size = CPU_ALLOC_SIZE(topology->num_cpu);
+	topology->cpus = calloc(topology->num_cpu, sizeof(*topology->cpus));
+	topology->preferred = CPU_ALLOC(topology->num_cpu);
+	cpu_set_t *online = CPU_ALLOC(topology->num_cpu);
+	long *l3_first = calloc(topology->num_cpu, sizeof(*l3_first));
+	if (!topology->cpus || !topology->preferred || !online || !l3_first)
+		goto error;
+
+	CPU_ZERO_S(size, topology->preferred);
+	CPU_ZERO_S(size, online);
+	add_list_to_set(online_list, topology->num_cpu, online);
+
+	static const GameModeTopologyCPU unknown = {
+		.package = -1, .die = -1, .cluster = -1, .core = -1, .node = -1, .l3 = -1, .smt_group = -1,
+	};
+	for (size_t cpu = 0; cpu < topology->num_cpu; cpu++) {
+		GameModeTopologyCPU *info = &topology->cpus[cpu];
+		*info = unknown;
+		info->online = CPU_ISSET_S(cpu, size, online);
+		if (info->online && read_cpu(topology, (long)cpu, l3_first) != 0)
+			goto error;
+	}
+
+	topology->hybrid = read_core_types(topology);
+	find_preferred(topology, online);
+
+	LOG_MSG("Found %d online cores with %zu L3 cache domains\n", CPU_COUNT_S(size, online),
+	        topology->num_l3);
+
+	free(l3_first);
+	CPU_FREE(online);
+	return topology;
+
+error:
+	LOG_ERROR("Failed to allocate memory for the cpu topology\n");
+	free(l3_first);
+	if (online)
+		CPU_FREE(online);
+	game_mode_topology_free(topology);
+	return NULL;
+}
+
+void game_mode_topology_free(GameModeTopology *topology)
+{
+	if (!topology)
+		return;
+
+	if (topology->preferred)
+		CPU_FREE(topology->preferred);
+	free(topology->l3_size);
+	free(topology->cpus);
+	free(topology);
+}
+
+/**
+ * Whether cores were added or removed, or taken offline or brought online, since the topology was
+ * read
+ *
+ * @param parked The cores parking takes offline, left out of the comparison, NULL for none
+ */
+bool game_mode_topology_changed(const GameModeTopology *topology, const cpu_set_t *parked)
+{
+	char present[CPULIST_MAX];
+	char online_list[CPULIST_MAX];
+	if (!topology || !read_file(CPU_SYSFS "/present", present, sizeof(present)) ||
+	    !read_file(CPU_SYSFS "/online", online_list, sizeof(online_list)))
+		return false;
+
+	if (strcmp(present, topology->present) != 0)
+		return true;
+
+	const size_t size = CPU_ALLOC_SIZE(topology->num_cpu);
+	cpu_set_t *online = CPU_ALLOC(topology->num_cpu);
+	if (!online)
+		return false;
+	CPU_ZERO_S(size, online);
+	add_list_to_set(online_list, topology->num_cpu, online);
+
+	bool changed = false;
+	for (size_t cpu = 0; cpu < topology->num_cpu && !changed; cpu++) {
+		if (!parked || !CPU_ISSET_S(cpu, size, parked))
+			changed = CPU_ISSET_S(cpu, size, online) != topology->cpus[cpu].online;
+	}
+
+	CPU_FREE(online);
+	return changed;
+}
+
+/* The number of cores a cpu set for this topology needs to cover */
+size_t game_mode_topology_num_cpu(const GameModeTopology *topology)
+{
+	return topology ? topology->num_cpu : 0;
+}
+
+/* The cores core pinning and parking keep when the config does not name any */
+void game_mode_topology_get_preferred(const GameModeTopology *topology, cpu_set_t *set)
+{
+	memcpy(set, topology->preferred, CPU_ALLOC_SIZE(topology->num_cpu));
+}
+
+/* Parse the number after a set name such as ccd1, -1 if there is none */
+static long set_index(const char *name, const char *prefix)
+{
+	size_t len = strlen(prefix);
+	if (strncmp(name, prefix, len) != 0 || !isdigit((unsigned char)name[len]))
+		return -1;
+
+	char *end = NULL;
+	long index = strtol(name + len, &end, 10);
+	return *end == '\0' ? index : -1;
+}
+
+/* Add the online cores matching a named set to a set */
+static bool add_named_set(const GameModeTopology *topology, const char *name, cpu_set_t *set)
+{
+	const size_t size = CPU_ALLOC_SIZE(topology->num_cpu);
+
+	if (strcmp(name, "vcache") == 0) {
+		get_vcache(topology, set);
+		return true;
+	} else if (strcmp(name, "fastest") == 0) {
+		get_fastest(topology, set);
+		return true;
+	}
+
+	long ccd = set_index(name, "ccd");
+	long node = set_index(name, "node");
+	long package = set_index(name, "package");
+
+	for (size_t cpu = 0; cpu < topology->num_cpu; cpu++) {
+		const GameModeTopologyCPU *info = &topology->cpus[cpu];
+		bool match = false;
+
+		if (strcmp(name, "online") == 0)
+			match = true;
+		else if (strcmp(name, "pcores") == 0)
+			match = info->type != CPU_TYPE_EFFICIENCY;
+		else if (strcmp(name, "ecores") == 0)
+			match = info->type == CPU_TYPE_EFFICIENCY;
+		else if (strcmp(name, "smt-primary") == 0)
+			match = info->smt_group == -1 || info->smt_group == (int)cpu;
+		else if (strcmp(name, "smt-secondary") == 0)
+			match = info->smt_group != -1 && info->smt_group != (int)cpu;
+		else if (ccd != -1)
+			match = info->l3 == ccd;
+		else if (node != -1)
+			match = info->node == node;
+		else if (package != -1)
+			match = info->package == package;
+		else
+			return false;
+
+		if (match && info->online)
+			CPU_SET_S(cpu, size, set);
+	}
+
+	return true;
+}
+
+/**
+ * Resolve a list of cores as in pin_cores and park_cores into a set. Besides core numbers and
+ * ranges the list can name the online cores, pcores, ecores, vcache (the CCDs with the larger L3
+ * cache), fastest, smt-primary, smt-secondary, ccd<N> (the L3 domains in order of their first
+ * core), node<N> or package<N>. The set has to be allocated for game_mode_topology_num_cpu
+ *
+ * @returns 0 on success, or -EINVAL for a name that is not known
+ */
+int game_mode_topology_get_cpus(const GameModeTopology *topology, const char *cores,
+                                cpu_set_t *set)
+{
+	const size_t size = CPU_ALLOC_SIZE(topology->num_cpu);
+	CPU_ZERO_S(size, set);
+
+	char list[CPULIST_MAX];
+	strncpy(list, cores, sizeof(list) - 1);
+	list[sizeof(list) - 1] = '\0';
+
+	char *saveptr = NULL;
+	for (char *item = strtok_r(list, ",", &saveptr); item; item = strtok_r(NULL, ",", &saveptr)) {
+		if (isdigit((unsigned char)item[0])) {
+			long from, to;
+			if (!parse_cpulist(item, &from, &to))
+				return -EINVAL;
+			for (long cpu = from; cpu < to + 1 && cpu < (long)topology->num_cpu; cpu++)
+				CPU_SET_S((size_t)cpu, size, set);
+		} else if (!add_named_set(topology, item, set)) {
+			return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+
+/* Whether two cores are hardware threads of the same physical core */
+static bool same_core(const GameModeTopology *topology, size_t a, size_t b)
+{
+	return topology->cpus[a].smt_group != -1 &&
+	       topology->cpus[a].smt_group == topology->cpus[b].smt_group;
+}
+
+/* Leave a single hardware thread of each physical core in a set, the lowest numbered one */
+void game_mode_topology_one_per_core(const GameModeTopology *topology, cpu_set_t *set)
+{
+	const size_t size = CPU_ALLOC_SIZE(topology->num_cpu);
+	for (size_t cpu = 0; cpu < topology->num_cpu; cpu++) {
+		if (!CPU_ISSET_S(cpu, size, set))
+			continue;
+
+		for (size_t other = cpu + 1; other < topology->num_cpu; other++) {
+			if (same_core(topology, cpu, other))
+				CPU_CLR_S(other, size, set);
+		}
+	}
+}
+
+/* The online SMT siblings of the cores in a set, which are not in the set themselves */
+void game_mode_topology_get_siblings(const GameModeTopology *topology, const cpu_set_t *cores,
+                                     cpu_set_t *siblings)
+{
+	const size_t size = CPU_ALLOC_SIZE(topology->num_cpu);
+	CPU_ZERO_S(size, siblings);
+
+	for (size_t cpu = 0; cpu < topology->num_cpu; cpu++) {
+		if (!CPU_ISSET_S(cpu, size, cores))
+			continue;
+
+		for (size_t other = 0; other < topology->num_cpu; other++) {
+			if (other != cpu && topology->cpus[other].online && same_core(topology, cpu, other) &&
+			    !CPU_ISSET_S(other, size, cores))
+				CPU_SET_S(other, size, siblings);
+		}
+	}
+}
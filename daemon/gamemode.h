@@ -31,6 +31,7 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #pragma once
 
+#include <sched.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <sys/types.h>
@@ -46,6 +47,17 @@ typedef struct GameModeContext GameModeContext;
 typedef struct GameModeConfig GameModeConfig;
 typedef struct GameModeClient GameModeClient;
 
+/**
+ * State of the system wide optimisations, entering and leaving game mode
+ * happens asynchronously to clients registering and unregistering.
+ */
+enum GameModeState {
+	GAME_MODE_STATE_INACTIVE,
+	GAME_MODE_STATE_ACTIVATING,
+	GAME_MODE_STATE_ACTIVE,
+	GAME_MODE_STATE_DEACTIVATING,
+};
+
 /**
  * GameModeClient related functions
  */
@@ -125,6 +137,9 @@ GameModeClient *game_mode_context_lookup_client(GameModeContext *self, pid_t cli
 /**
  * Register a new game client with the context
  *
+ * Game mode is entered in the background for the first client, see
+ * game_mode_context_get_state.
+ *
  * @param pid Process ID for the remote client
  * @param requester Process ID for the remote requestor
  * @returns 0 if the request was accepted and the client could be registered
@@ -144,6 +159,27 @@ int game_mode_context_register(GameModeContext *self, pid_t pid, pid_t requester
  */
 int game_mode_context_unregister(GameModeContext *self, pid_t pid, pid_t requester);
 
+/**
+ * Give a thread of a registered client a role, its [thread:<role>] section then applies
+ * regardless of the thread name
+ *
+ * @param pid Process ID of the client the thread belongs to
+ * @param tid Thread ID
+ * @param role One of the GAMEMODE_THREAD_ROLE_* values from gamemode_client.h
+ * @returns 0 if the thread has the role now
+ *          -1 if the client is not registered or the thread is not one of its threads
+ *          -2 if the role is unknown
+ */
+int game_mode_context_register_thread(GameModeContext *self, pid_t pid, pid_t tid, int role);
+
+/**
+ * Take the role of a thread away again, it gets the settings for its thread name
+ *
+ * @returns 0 if the thread had a role
+ *          -1 if the client is not registered or the thread had no role
+ */
+int game_mode_context_unregister_thread(GameModeContext *self, pid_t pid, pid_t tid);
+
 /**
  * Query the current status of gamemode
  *
@@ -159,7 +195,7 @@ int game_mode_context_query_status(GameModeContext *self, pid_t pid, pid_t reque
  * Restart gamemode if it is running
  *
  * @param pid Process ID for the remote client
- * @returns 0 if gamemode was restarted
+ * @returns 0 if gamemode is being restarted in the background
  *          1 if gamemode was already deactivated
  *          -2 if this request was rejected
  */
@@ -178,20 +214,38 @@ GameModeConfig *game_mode_config_from_context(const GameModeContext *context);
  */
 int game_mode_reload_config(GameModeContext *context);
 
+/**
+ * Query whether game mode is active, or on its way in or out
+ */
+enum GameModeState game_mode_context_get_state(GameModeContext *self);
+
 /** gamemode-ioprio.c
  * Provides internal API functions specific to adjusting process
  * IO priorities.
  */
 int game_mode_get_ioprio(const pid_t client);
-void game_mode_apply_ioprio(const GameModeContext *self, const pid_t client, int expected);
+bool game_mode_apply_thread_ioprio(const pid_t client, const pid_t tid, const int expected,
+                                   const int target);
 
 /** gamemode-sched.c
  * Provides internal API functions specific to adjusting process
  * scheduling.
  */
 int game_mode_get_renice(const pid_t client);
-void game_mode_apply_renice(const GameModeContext *self, const pid_t client, int expected);
-void game_mode_apply_scheduling(const GameModeContext *self, const pid_t client);
+bool game_mode_apply_thread_renice(const pid_t client, const pid_t tid, const int expected,
+                                   const int target);
+int game_mode_sched_policy_from_name(const char *name);
+bool game_mode_apply_thread_policy(const pid_t client, const pid_t tid, const int expected,
+                                   const int target);
+bool game_mode_apply_thread_uclamp(const pid_t client, const pid_t tid, const int min,
+                                   const int max);
+void game_mode_undo_thread_uclamp(const pid_t tid, const bool min, const bool max);
+bool game_mode_softrealtime_enabled(GameModeConfig *config);
+int game_mode_softrealtime_fallback(GameModeConfig *config);
+int game_mode_apply_thread_softrealtime(const pid_t client, const pid_t tid, const int fallback);
+bool game_mode_apply_sched_core(const pid_t client);
+bool game_mode_share_sched_core(const pid_t client, const pid_t pid);
+void game_mode_remove_sched_core(const pid_t pid);
 
 /** gamemode-wine.c
  * Provides internal API functions specific to handling wine
@@ -199,6 +253,165 @@ void game_mode_apply_scheduling(const GameModeContext *self, const pid_t client)
  */
 char *game_mode_resolve_wine_preloader(const char *exe, const pid_t pid);
 
+/** gamemode-procevents.c
+ * Provides the fork, exec, exit and rename events of every process from the kernel's process
+ * events connector. Subscribing needs CAP_NET_ADMIN, callers have to poll /proc when it is
+ * unavailable.
+ */
+enum GameModeProcEventType {
+	GAME_MODE_PROC_FORK, /**<New thread when tid != tgid, otherwise a new process */
+	GAME_MODE_PROC_EXEC,
+	GAME_MODE_PROC_EXIT, /**<A thread exited, the whole process when tid == tgid */
+	GAME_MODE_PROC_COMM, /**<A thread was renamed */
+};
+typedef struct GameModeProcEvent {
+	enum GameModeProcEventType type;
+	pid_t tid;
+	pid_t tgid;
+	pid_t parent_tid; /**<Only set for fork events, the parent process for new threads */
+	pid_t parent_tgid;
+} GameModeProcEvent;
+typedef void (*GameModeProcEventHandler)(const GameModeProcEvent *event, void *userdata);
+int game_mode_proc_events_open(void);
+void game_mode_proc_events_close(int fd);
+int game_mode_proc_events_read(int fd, GameModeProcEventHandler handler, void *userdata);
+
+/** gamemode-pidtable.c
+ * Provides an open addressing hash table keyed by process id, used to index the
+ * registered clients. Iteration follows insertion order, entries may be removed
+ * while iterating but not inserted.
+ */
+typedef struct GameModePidTable GameModePidTable;
+GameModePidTable *game_mode_pidtable_new(void);
+void game_mode_pidtable_free(GameModePidTable *table);
+size_t game_mode_pidtable_count(const GameModePidTable *table);
+void *game_mode_pidtable_lookup(const GameModePidTable *table, pid_t pid);
+int game_mode_pidtable_insert(GameModePidTable *table, pid_t pid, void *value);
+void *game_mode_pidtable_remove(GameModePidTable *table, pid_t pid);
+bool game_mode_pidtable_next(const GameModePidTable *table, size_t *iter, pid_t *pid, void **value);
+
+/** gamemode-threads.c
+ * Tracks the threads of a client process and which per thread optimisations each one has, so they
+ * are only applied to new threads. A single scan of /proc/<pid>/task picks up the new threads and
+ * drops the ones that exited.
+ */
+enum GameModeThreadApplied {
+	GAME_MODE_THREAD_SEEN = 1 << 0, /**<The optimisations were applied, or at least attempted */
+	GAME_MODE_THREAD_RENICED = 1 << 1,
+	GAME_MODE_THREAD_IOPRIO = 1 << 2,
+	GAME_MODE_THREAD_PINNED = 1 << 3,
+	GAME_MODE_THREAD_SCHEDULED = 1 << 4, /**<The scheduler policy of a thread role */
+	GAME_MODE_THREAD_UCLAMP = 1 << 5,
+	GAME_MODE_THREAD_DEMOTED = 1 << 6, /**<Out of the fallback realtime policy until it is back
+	                                    * within its budget */
+};
+#define GAME_MODE_THREAD_COMM_MAX 16
+typedef struct GameModeThread {
+	pid_t tid;
+	unsigned int applied;    /**<Mask of GameModeThreadApplied */
+	unsigned int generation; /**<Last scan that saw the thread */
+	int role;                /**<Index of the thread role applied, -1 for none */
+	int registered_role;     /**<Role the client gave the thread, 0 for none */
+	int nice;                /**<The values we set, to restore them from */
+	int ioprio;
+	int policy;
+	int uclamp_min; /**<-1 for a bound left alone */
+	int uclamp_max;
+	uint64_t runtime; /**<CPU time when the realtime watchdog last looked at the thread, in ns */
+	char comm[GAME_MODE_THREAD_COMM_MAX]; /**<Name when the role was looked up */
+} GameModeThread;
+typedef struct GameModeThreads GameModeThreads;
+GameModeThreads *game_mode_threads_new(pid_t pid);
+void game_mode_threads_free(GameModeThreads *threads);
+pid_t game_mode_threads_get_pid(const GameModeThreads *threads);
+size_t game_mode_threads_count(const GameModeThreads *threads);
+GameModeThread *game_mode_threads_lookup(const GameModeThreads *threads, pid_t tid);
+GameModeThread *game_mode_threads_add(GameModeThreads *threads, pid_t tid);
+void game_mode_threads_remove(GameModeThreads *threads, pid_t tid);
+int game_mode_threads_scan(GameModeThreads *threads);
+int game_mode_threads_get_comm(const GameModeThreads *threads, pid_t tid,
+                               char comm[GAME_MODE_THREAD_COMM_MAX]);
+int game_mode_threads_get_runtime(const GameModeThreads *threads, pid_t tid, uint64_t *runtime);
+int game_mode_threads_get_children(const GameModeThreads *threads, pid_t **children,
+                                   size_t *count);
+bool game_mode_threads_next(const GameModeThreads *threads, size_t *iter, GameModeThread **thread);
+
+/** gamemode-cgroup.c
+ * Moves games into cgroups of their own below the daemon's cgroup, so cpu.weight, io.weight,
+ * memory.low and cpuset.cpus cover all their threads and the processes they start. Needs the
+ * unified cgroup v2 hierarchy and a cgroup delegated to the daemon. Also throttles the cgroups of
+ * everything else the user runs, which needs the daemon to run under the systemd user manager.
+ */
+enum GameModeCgroupApplied {
+	GAME_MODE_CGROUP_MOVED = 1 << 0,
+	GAME_MODE_CGROUP_CPU = 1 << 1,    /**<cpu.weight */
+	GAME_MODE_CGROUP_IO = 1 << 2,     /**<io.weight */
+	GAME_MODE_CGROUP_MEMORY = 1 << 3, /**<memory.low */
+	GAME_MODE_CGROUP_CPUSET = 1 << 4, /**<cpuset.cpus */
+};
+typedef struct GameModeCgroupSettings {
+	long cpu_weight;        /**<1 to 10000, 0 to leave it */
+	long io_weight;         /**<1 to 10000, 0 to leave it */
+	const char *memory_low; /**<As memory.low takes it, NULL or empty to leave it */
+	const char *cpus;       /**<List of cores, NULL or empty to leave it */
+} GameModeCgroupSettings;
+typedef struct GameModeCgroups GameModeCgroups;
+GameModeCgroups *game_mode_cgroups_new(const char *mount);
+void game_mode_cgroups_free(GameModeCgroups *cgroups);
+int game_mode_cgroups_add(GameModeCgroups *cgroups, pid_t pid,
+                          const GameModeCgroupSettings *settings);
+int game_mode_cgroups_add_process(GameModeCgroups *cgroups, pid_t game, pid_t pid);
+int game_mode_cgroups_remove(GameModeCgroups *cgroups, pid_t pid);
+typedef struct GameModeThrottle GameModeThrottle;
+GameModeThrottle *game_mode_throttle_others(const char *mount, const pid_t *games,
+                                            size_t num_games,
+                                            const GameModeCgroupSettings *settings);
+GameModeThrottle *game_mode_rethrottle_others(GameModeThrottle *throttle, const char *mount,
+                                              const pid_t *games, size_t num_games,
+                                              const GameModeCgroupSettings *settings);
+void game_mode_unthrottle_others(GameModeThrottle *throttle);
+char **game_mode_cgroups_login_sessions(const char *mount, const pid_t *games, size_t num_games);
+
+/** gamemode-matcher.c
+ * Provides a matcher for lists of patterns, plain patterns match anywhere in the subject, patterns
+ * prefixed with glob: the whole subject and ones prefixed with regex: are extended regular
+ * expressions. The patterns are added first and then compiled, after which the matcher can be
+ * used from any thread.
+ */
+typedef struct GameModeMatcher GameModeMatcher;
+GameModeMatcher *game_mode_matcher_new(void);
+void game_mode_matcher_free(GameModeMatcher *matcher);
+int game_mode_matcher_add(GameModeMatcher *matcher, const char *pattern);
+int game_mode_matcher_compile(GameModeMatcher *matcher);
+bool game_mode_matcher_empty(const GameModeMatcher *matcher);
+bool game_mode_matcher_equal(const GameModeMatcher *a, const GameModeMatcher *b);
+bool game_mode_matcher_match(GameModeMatcher *matcher, const char *subject);
+
+/** gamemode-steps.c
+ * Runs the steps of entering or leaving game mode, concurrently where their
+ * dependencies allow it, and logs how long each of them took.
+ */
+#define GAME_MODE_MAX_STEPS 32
+typedef struct GameModeStep {
+	const char *name;
+	void (*run)(GameModeContext *self);
+	uint32_t depends; /**<Mask of earlier steps that have to finish first */
+} GameModeStep;
+void game_mode_run_steps(GameModeContext *self, const char *what, const GameModeStep *steps,
+                         size_t count);
+
+/** gamemode-helper.c
+ * Runs the privileged helpers in LIBEXECDIR through a resident helper process, so polkit
+ * authorisation and pkexec startup are only paid once. Falls back to pkexec for every call if
+ * the helper cannot be started. exec_args start with the helper name, buffer is NULL or holds
+ * EXTERNAL_BUFFER_MAX bytes.
+ */
+int game_mode_run_privileged(const char *const *exec_args, char *buffer);
+/* Write a NULL terminated list of path, value pairs in order, all or nothing */
+int game_mode_apply_privileged_writes(const char *const *writes);
+void game_mode_use_resident_helper(bool resident);
+void game_mode_stop_privileged_helper(void);
+
 /** gamemode-tests.c
  * Provides a test suite to verify gamemode behaviour
  */
@@ -212,19 +425,46 @@ int game_mode_initialise_gpu(GameModeConfig *config, GameModeGPUInfo **info);
 void game_mode_free_gpu(GameModeGPUInfo **info);
 int game_mode_apply_gpu(const GameModeGPUInfo *info);
 int game_mode_get_gpu(GameModeGPUInfo *info);
+bool game_mode_gpu_matches(const GameModeGPUInfo *info);
+
+/** gamemode-topology.c
+ * Provides the layout of the cores, packages, L3 cache domains, SMT siblings, P/E-cores and NUMA
+ * nodes, read once and looked up by name
+ */
+typedef struct GameModeTopology GameModeTopology;
+GameModeTopology *game_mode_topology_new(void);
+void game_mode_topology_free(GameModeTopology *topology);
+bool game_mode_topology_changed(const GameModeTopology *topology, const cpu_set_t *parked);
+size_t game_mode_topology_num_cpu(const GameModeTopology *topology);
+void game_mode_topology_get_preferred(const GameModeTopology *topology, cpu_set_t *set);
+int game_mode_topology_get_cpus(const GameModeTopology *topology, const char *cores,
+                                cpu_set_t *set);
+void game_mode_topology_one_per_core(const GameModeTopology *topology, cpu_set_t *set);
+void game_mode_topology_get_siblings(const GameModeTopology *topology, const cpu_set_t *cores,
+                                     cpu_set_t *siblings);
 
 /** gamemode-cpu.c
  * Provides internal functions to apply optimisations to cpus
  */
 typedef struct GameModeCPUInfo GameModeCPUInfo;
-int game_mode_initialise_cpu(GameModeConfig *config, GameModeCPUInfo **info);
+int game_mode_initialise_cpu(GameModeConfig *config, const GameModeTopology *topology,
+                             GameModeCPUInfo **info);
 void game_mode_free_cpu(GameModeCPUInfo **info);
-void game_mode_reconfig_cpu(GameModeConfig *config, GameModeCPUInfo **info);
+void game_mode_reconfig_cpu(GameModeConfig *config, const GameModeTopology *topology,
+                            GameModeCPUInfo **info);
 int game_mode_park_cpu(const GameModeCPUInfo *info);
 int game_mode_unpark_cpu(const GameModeCPUInfo *info);
-void game_mode_apply_core_pinning(const GameModeCPUInfo *info, const pid_t client,
-                                  const bool be_silent);
-void game_mode_undo_core_pinning(const GameModeCPUInfo *info, const pid_t client);
+bool game_mode_apply_thread_core_pinning(const GameModeCPUInfo *info, const pid_t tid,
+                                         const bool be_silent);
+bool game_mode_apply_thread_affinity(const GameModeTopology *topology, const GameModeCPUInfo *info,
+                                     const pid_t tid, const char *cores, const bool be_silent);
+void game_mode_undo_thread_core_pinning(const GameModeCPUInfo *info, const pid_t tid);
+bool game_mode_get_pinned_cpus(const GameModeCPUInfo *info, char *cpulist, size_t size);
+bool game_mode_get_parked_cpus(const GameModeCPUInfo *info, cpu_set_t *set);
+typedef struct GameModeIsolation GameModeIsolation;
+GameModeIsolation *game_mode_isolate_cpu(GameModeIsolation *previous, const GameModeCPUInfo *info,
+                                         const pid_t *games, const size_t num_games);
+void game_mode_unisolate_cpu(GameModeIsolation *isolation);
 
 /** gamemode-dbus.c
  * Provides an API interface for using dbus
@@ -235,3 +475,4 @@ GameModeIdleInhibitor *game_mode_create_idle_inhibitor(void);
 void game_mode_destroy_idle_inhibitor(GameModeIdleInhibitor *inhibitor);
 void game_mode_client_registered(pid_t);
 void game_mode_client_unregistered(pid_t);
+void game_mode_state_changed(void);
@@ -61,7 +61,6 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <getopt.h>
 #include <signal.h>
 #include <sys/stat.h>
-#include <systemd/sd-daemon.h> /* TODO: Move usage to gamemode-dbus.c */
 #include <unistd.h>
 
 #define USAGE_TEXT                                                                                 \
@@ -81,17 +80,6 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #define VERSION_TEXT "gamemode version: v" GAMEMODE_VERSION "\n"
 
-static void sigint_handler(__attribute__((unused)) int signo)
-{
-	LOG_MSG("Quitting by request...\n");
-	sd_notify(0, "STATUS=GameMode is quitting by request...\n");
-
-	/* Clean up nicely */
-	game_mode_context_destroy(game_mode_context_instance());
-
-	_Exit(EXIT_SUCCESS);
-}
-
 static void sigint_handler_noexit(__attribute__((unused)) int signo)
 {
 	LOG_MSG("Quitting by request...\n");
@@ -357,15 +345,7 @@ int main(int argc, char *argv[])
 	context = game_mode_context_instance();
 	game_mode_context_init(context);
 
-	/* Handle quits cleanly */
-	if (signal(SIGINT, sigint_handler) == SIG_ERR) {
-		FATAL_ERRORNO("Could not catch SIGINT");
-	}
-	if (signal(SIGTERM, sigint_handler) == SIG_ERR) {
-		FATAL_ERRORNO("Could not catch SIGTERM");
-	}
-
-	/* Run the main dbus message loop */
+	/* Run the main loop, this also handles quitting cleanly on SIGINT and SIGTERM */
 	game_mode_context_loop(context);
 
 	/* The contex loop is noreturn, exit is handled elsewhere */
@@ -40,6 +40,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <unistd.h>
 
@@ -192,7 +193,7 @@ static void cleanup_pending_call(DBusPendingCall **call)
 
 /* internal API */
 static int make_request(DBusConnection *bus, int native, int use_pidfds, const char *method,
-                        pid_t *pids, int npids, DBusError *error)
+                        pid_t *pids, int npids, const int *args, int nargs, DBusError *error)
 {
 	_cleanup_msg_ DBusMessage *msg = NULL;
 	_cleanup_dpc_ DBusPendingCall *call = NULL;
@@ -260,6 +261,12 @@ static int make_request(DBusConnection *bus, int native, int use_pidfds, const c
 		dbus_message_iter_append_basic(&iter, type, &p);
 	}
 
+	// Any other arguments follow the pids
+	for (int i = 0; i < nargs; i++) {
+		dbus_int32_t a = (dbus_int32_t)args[i];
+		dbus_message_iter_append_basic(&iter, DBUS_TYPE_INT32, &a);
+	}
+
 	dbus_connection_send_with_reply(bus, msg, &call, -1);
 	dbus_connection_flush(bus);
 	dbus_message_unref(msg);
@@ -296,7 +303,7 @@ static int make_request(DBusConnection *bus, int native, int use_pidfds, const c
 	return res;
 }
 
-static int gamemode_request(const char *method, pid_t for_pid)
+static int gamemode_request(const char *method, pid_t for_pid, const int *args, int nargs)
 {
 	_cleanup_bus_ DBusConnection *bus = NULL;
 	static int use_pidfs = 1;
@@ -336,7 +343,7 @@ retry:
 	else
 		npids = 1;
 
-	res = make_request(bus, native, use_pidfs, method, pids, npids, &err);
+	res = make_request(bus, native, use_pidfs, method, pids, npids, args, nargs, &err);
 
 	if (res == -1 && use_pidfs && dbus_error_is_set(&err)) {
 		TRACE("GM: Request with pidfds failed (%s). Retrying.\n", err.message);
@@ -365,41 +372,91 @@ extern const char *real_gamemode_error_string(void)
 // Wrapper to call RegisterGame
 extern int real_gamemode_request_start(void)
 {
-	return gamemode_request("RegisterGame", 0);
+	return gamemode_request("RegisterGame", 0, NULL, 0);
 }
 
 // Wrapper to call UnregisterGame
 extern int real_gamemode_request_end(void)
 {
-	return gamemode_request("UnregisterGame", 0);
+	return gamemode_request("UnregisterGame", 0, NULL, 0);
 }
 
 // Wrapper to call QueryStatus
 extern int real_gamemode_query_status(void)
 {
-	return gamemode_request("QueryStatus", 0);
+	return gamemode_request("QueryStatus", 0, NULL, 0);
 }
 //
 // Wrapper to call RestartGamemode
 extern int real_gamemode_request_restart(void)
 {
-	return gamemode_request("RestartGamemode", 0);
+	return gamemode_request("RestartGamemode", 0, NULL, 0);
+}
+
+// Wrapper to call WaitForTransition
+extern int real_gamemode_wait_for_transition(void)
+{
+	_cleanup_bus_ DBusConnection *bus = NULL;
+	DBusError err;
+	int res;
+
+	// The portal does not forward this call
+	if (in_sandbox())
+		return log_error("Waiting for transitions is not supported inside a sandbox");
+
+	bus = hop_on_the_bus();
+
+	if (bus == NULL)
+		return -1;
+
+	dbus_error_init(&err);
+
+	res = make_request(bus, 1, 0, "WaitForTransition", NULL, 0, NULL, 0, &err);
+
+	if (res == -1 && dbus_error_is_set(&err))
+		log_error("D-Bus error: %s", err.message);
+
+	if (dbus_error_is_set(&err))
+		dbus_error_free(&err);
+
+	return res;
 }
 
 // Wrapper to call RegisterGameByPID
 extern int real_gamemode_request_start_for(pid_t pid)
 {
-	return gamemode_request("RegisterGameByPID", pid);
+	return gamemode_request("RegisterGameByPID", pid, NULL, 0);
 }
 
 // Wrapper to call UnregisterGameByPID
 extern int real_gamemode_request_end_for(pid_t pid)
 {
-	return gamemode_request("UnregisterGameByPID", pid);
+	return gamemode_request("UnregisterGameByPID", pid, NULL, 0);
 }
 
 // Wrapper to call QueryStatusByPID
 extern int real_gamemode_query_status_for(pid_t pid)
 {
-	return gamemode_request("QueryStatusByPID", pid);
+	return gamemode_request("QueryStatusByPID", pid, NULL, 0);
+}
+
+// Wrapper to call RegisterThread for the calling thread
+extern int real_gamemode_register_thread(int role)
+{
+	// The portal does not forward this call
+	if (in_sandbox())
+		return log_error("Registering threads is not supported inside a sandbox");
+
+	int args[2] = { (int)syscall(SYS_gettid), role };
+	return gamemode_request("RegisterThread", 0, args, 2);
+}
+
+// Wrapper to call UnregisterThread for the calling thread
+extern int real_gamemode_unregister_thread(void)
+{
+	if (in_sandbox())
+		return log_error("Registering threads is not supported inside a sandbox");
+
+	int args[1] = { (int)syscall(SYS_gettid) };
+	return gamemode_request("UnregisterThread", 0, args, 1);
 }
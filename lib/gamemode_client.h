@@ -67,13 +67,43 @@ POSSIBILITY OF SUCH DAMAGE.
  *   2 if gamemode is active and this client is registered
  *   -1 if the query failed
  *
+ * int gamemode_wait_for_transition() - Wait for gamemode to finish starting or stopping
+ *   0 if gamemode is now inactive
+ *   1 if gamemode is now active
+ *   -1 if the request failed
+ *
+ * int gamemode_register_thread(int role) - Give the calling thread one of the roles below
+ *   0 if the request was sent successfully
+ *   -1 if the request failed, e.g. this process is not registered
+ *   -2 if the request was rejected
+ *
+ * int gamemode_unregister_thread() - Take the role of the calling thread away again
+ *   0 if the request was sent successfully
+ *   -1 if the request failed
+ *   -2 if the request was rejected
+ *
  * const char* gamemode_error_string() - Get an error string
  *   returns a string describing any of the above errors
  *
  * Note: All the above requests can be blocking - dbus requests can and will block while the daemon
  * handles the request. It is not recommended to make these calls in performance critical code
+ *
+ * The daemon applies the system wide optimisations in the background, so gamemode_request_start
+ * and gamemode_request_end return before gamemode has fully started or stopped. Use
+ * gamemode_wait_for_transition when the optimisations need to be in place.
+ *
+ * Registered threads get the settings of the [thread:<name>] config section of their role
+ * instead of the one their thread name matches. The role lasts until the thread exits,
+ * gamemode_unregister_thread is called or the process ends gamemode.
  */
 
+/* Thread roles for gamemode_register_thread, and the name of their config section */
+#define GAMEMODE_THREAD_ROLE_RENDER 1 /* render, e.g. the render and submit threads */
+#define GAMEMODE_THREAD_ROLE_AUDIO 2  /* audio, the audio mixing and output threads */
+#define GAMEMODE_THREAD_ROLE_WORKER 3 /* worker, the job system threads of a frame */
+#define GAMEMODE_THREAD_ROLE_SHADER 4 /* shader, background shader and pipeline compilation */
+#define GAMEMODE_THREAD_ROLE_IO 5     /* io, asset streaming and loading */
+
 #include <stdbool.h>
 #include <stdio.h>
 
@@ -98,6 +128,7 @@ static volatile int internal_libgamemode_loaded = 1;
 typedef int (*api_call_return_int)(void);
 typedef const char *(*api_call_return_cstring)(void);
 typedef int (*api_call_pid_return_int)(pid_t);
+typedef int (*api_call_int_return_int)(int);
 
 /* Storage for functors */
 static api_call_return_int REAL_internal_gamemode_request_start = NULL;
@@ -108,6 +139,9 @@ static api_call_return_cstring REAL_internal_gamemode_error_string = NULL;
 static api_call_pid_return_int REAL_internal_gamemode_request_start_for = NULL;
 static api_call_pid_return_int REAL_internal_gamemode_request_end_for = NULL;
 static api_call_pid_return_int REAL_internal_gamemode_query_status_for = NULL;
+static api_call_return_int REAL_internal_gamemode_wait_for_transition = NULL;
+static api_call_int_return_int REAL_internal_gamemode_register_thread = NULL;
+static api_call_return_int REAL_internal_gamemode_unregister_thread = NULL;
 
 /**
  * Internal helper to perform the symbol binding safely.
@@ -187,6 +221,18 @@ __attribute__((always_inline)) static inline int internal_load_libgamemode(void)
 		  (void **)&REAL_internal_gamemode_query_status_for,
 		  sizeof(REAL_internal_gamemode_query_status_for),
 		  false },
+		{ "real_gamemode_wait_for_transition",
+		  (void **)&REAL_internal_gamemode_wait_for_transition,
+		  sizeof(REAL_internal_gamemode_wait_for_transition),
+		  false },
+		{ "real_gamemode_register_thread",
+		  (void **)&REAL_internal_gamemode_register_thread,
+		  sizeof(REAL_internal_gamemode_register_thread),
+		  false },
+		{ "real_gamemode_unregister_thread",
+		  (void **)&REAL_internal_gamemode_unregister_thread,
+		  sizeof(REAL_internal_gamemode_unregister_thread),
+		  false },
 	};
 
 	void *libgamemode = NULL;
@@ -396,4 +442,58 @@ __attribute__((always_inline)) static inline int gamemode_query_status_for(pid_t
 	return REAL_internal_gamemode_query_status_for(pid);
 }
 
+/* Redirect to the real libgamemode */
+__attribute__((always_inline)) static inline int gamemode_wait_for_transition(void)
+{
+	/* Need to load gamemode */
+	if (internal_load_libgamemode() < 0) {
+		return -1;
+	}
+
+	if (REAL_internal_gamemode_wait_for_transition == NULL) {
+		snprintf(internal_gamemode_client_error_string,
+		         sizeof(internal_gamemode_client_error_string),
+		         "gamemode_wait_for_transition missing (older host?)");
+		return -1;
+	}
+
+	return REAL_internal_gamemode_wait_for_transition();
+}
+
+/* Redirect to the real libgamemode */
+__attribute__((always_inline)) static inline int gamemode_register_thread(int role)
+{
+	/* Need to load gamemode */
+	if (internal_load_libgamemode() < 0) {
+		return -1;
+	}
+
+	if (REAL_internal_gamemode_register_thread == NULL) {
+		snprintf(internal_gamemode_client_error_string,
+		         sizeof(internal_gamemode_client_error_string),
+		         "gamemode_register_thread missing (older host?)");
+		return -1;
+	}
+
+	return REAL_internal_gamemode_register_thread(role);
+}
+
+/* Redirect to the real libgamemode */
+__attribute__((always_inline)) static inline int gamemode_unregister_thread(void)
+{
+	/* Need to load gamemode */
+	if (internal_load_libgamemode() < 0) {
+		return -1;
+	}
+
+	if (REAL_internal_gamemode_unregister_thread == NULL) {
+		snprintf(internal_gamemode_client_error_string,
+		         sizeof(internal_gamemode_client_error_string),
+		         "gamemode_unregister_thread missing (older host?)");
+		return -1;
+	}
+
+	return REAL_internal_gamemode_unregister_thread();
+}
+
 #endif // CLIENT_GAMEMODE_H
@@ -71,7 +71,8 @@ static int set_gov_state(const char *value)
 int main(int argc, char *argv[])
 {
 	if (argc == 2 && strncmp(argv[1], "get", 3) == 0) {
-		printf("%s", get_gov_state());
+		char governor[MAX_GOVERNOR_STATE_LENGTH];
+		printf("%s", get_gov_state(governor));
 	} else if (argc == 3 && strncmp(argv[1], "set", 3) == 0) {
 		const char *value = argv[2];
 
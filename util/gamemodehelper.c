@@ -0,0 +1,436 @@
+/*
+
+Copyright (c) 2017-2025, Feral Interactive and the GameMode contributors
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+ * Neither the name of Feral Interactive nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+#define _GNU_SOURCE
+
+#include "common-external.h"
+#include "common-logging.h"
+
+#include "build-config.h"
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <glob.h>
+#include <limits.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/* Maximum size of a single request, and of the arguments in it */
+#define HELPER_REQUEST_MAX 65536
+#define HELPER_ARGS_MAX 2048
+
+/* Maximum length of a value written by a transaction, long enough for the cpumask of 1024 cores */
+#define HELPER_VALUE_MAX 300
+
+/**
+ * The files a transaction may write to, matched with fnmatch
+ */
+static const char *const allowed_writes[] = {
+	"/sys/devices/system/cpu/cpu[0-9]*/cpufreq/scaling_governor",
+	"/sys/devices/system/cpu/cpufreq/policy[0-9]*/scaling_governor",
+	"/sys/devices/system/cpu/cpu[0-9]*/online",
+	"/sys/devices/virtual/workqueue/cpumask",
+};
+
+/**
+ * The cpuset.cpus of the caller's login sessions, the cgroups in its own user-$UID.slice. Empty
+ * until the caller is known, no cgroup may be written then
+ */
+static char allowed_cgroups[PATH_MAX];
+
+/**
+ * A write that has been applied, and the value to restore if a later one fails
+ */
+struct HelperWrite {
+	char path[PATH_MAX];
+	char previous[HELPER_VALUE_MAX];
+};
+
+/**
+ * The privileged helpers the daemon is allowed to run through us
+ */
+static const char *const allowed_helpers[] = {
+	"cpugovctl", "cpucorectl", "gpuclockctl", "platprofctl", "procsysctl", "x3dmodectl",
+};
+
+static bool helper_allowed(const char *name)
+{
+	for (size_t i = 0; i < sizeof(allowed_helpers) / sizeof(allowed_helpers[0]); i++) {
+		if (strcmp(name, allowed_helpers[i]) == 0)
+			return true;
+	}
+	return false;
+}
+
+static bool write_allowed(const char *path)
+{
+	if (strstr(path, "/../") || strstr(path, "/./"))
+		return false;
+
+	for (size_t i = 0; i < sizeof(allowed_writes) / sizeof(allowed_writes[0]); i++) {
+		if (fnmatch(allowed_writes[i], path, FNM_PATHNAME | FNM_PERIOD) == 0)
+			return true;
+	}
+	return allowed_cgroups[0] != '\0' &&
+	       fnmatch(allowed_cgroups, path, FNM_PATHNAME | FNM_PERIOD) == 0;
+}
+
+/**
+ * The user we act for: the daemon at the other end of the socket we serve, or whoever ran
+ * pkexec for a single transaction
+ */
+static bool caller_uid(bool apply, uid_t *uid)
+{
+	if (!apply) {
+		struct ucred cred;
+		socklen_t len = sizeof(cred);
+		if (getsockopt(STDIN_FILENO, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0)
+			return false;
+		*uid = cred.uid;
+		return true;
+	}
+
+	const char *pkexec_uid = getenv("PKEXEC_UID");
+	if (!pkexec_uid) {
+		*uid = getuid();
+		return true;
+	}
+
+	char *end = NULL;
+	errno = 0;
+	unsigned long value = strtoul(pkexec_uid, &end, 10);
+	if (errno != 0 || end == pkexec_uid || *end != '\0' || value > UINT_MAX)
+		return false;
+	*uid = (uid_t)value;
+	return true;
+}
+
+/**
+ * Check every file a possibly globbed path expands to may be written
+ */
+static bool path_allowed(const char *path)
+{
+	glob_t glo = { 0 };
+	bool ok = glob(path, GLOB_NOSORT, NULL, &glo) == 0 && glo.gl_pathc > 0;
+
+	for (size_t i = 0; ok && i < glo.gl_pathc; i++)
+		ok = write_allowed(glo.gl_pathv[i]);
+
+	globfree(&glo);
+	return ok;
+}
+
+/**
+ * Values are words, lists of cores or cpumasks. Empty ones reset files like cpuset.cpus
+ */
+static bool value_allowed(const char *value)
+{
+	size_t len = strlen(value);
+	if (len >= HELPER_VALUE_MAX)
+		return false;
+
+	for (size_t i = 0; i < len; i++) {
+		if (!isalnum((unsigned char)value[i]) && value[i] != '_' && value[i] != '-' &&
+		    value[i] != ',')
+			return false;
+	}
+	return true;
+}
+
+static bool read_value(const char *path, char value[HELPER_VALUE_MAX])
+{
+	FILE *f = fopen(path, "r");
+	if (!f)
+		return false;
+
+	bool ok = fgets(value, HELPER_VALUE_MAX, f) != NULL;
+	fclose(f);
+
+	if (ok)
+		value[strcspn(value, "\n")] = '\0';
+	return ok;
+}
+
+static bool write_value(const char *path, const char *value)
+{
+	FILE *f = fopen(path, "w");
+	if (!f)
+		return false;
+
+	/* sysfs reports errors from the store on write or on close */
+	bool ok = fprintf(f, "%s\n", value) >= 0;
+	return fclose(f) == 0 && ok;
+}
+
+/**
+ * Apply one write, expanding a glob in its path, and record what it changed
+ */
+static bool apply_write(const char *path, const char *value, struct HelperWrite *applied,
+                        size_t *num_applied, size_t max_applied, FILE *report)
+{
+	glob_t glo = { 0 };
+	if (glob(path, GLOB_NOSORT, NULL, &glo) != 0 || glo.gl_pathc == 0) {
+		fprintf(report, "failed %s: no such file\n", path);
+		globfree(&glo);
+		return false;
+	}
+
+	bool ok = true;
+	for (size_t i = 0; i < glo.gl_pathc && ok; i++) {
+		const char *file = glo.gl_pathv[i];
+		char previous[HELPER_VALUE_MAX] = { 0 };
+
+		if (!write_allowed(file) || *num_applied == max_applied) {
+			fprintf(report, "failed %s: not allowed\n", file);
+			ok = false;
+		} else if (!read_value(file, previous)) {
+			fprintf(report, "failed %s: %s\n", file, strerror(errno));
+			ok = false;
+		} else if (strcmp(previous, value) == 0) {
+			fprintf(report, "unchanged %s\n", file);
+		} else if (!write_value(file, value)) {
+			fprintf(report, "failed %s: %s\n", file, strerror(errno));
+			ok = false;
+		} else {
+			fprintf(report, "ok %s\n", file);
+			struct HelperWrite *write = &applied[(*num_applied)++];
+			snprintf(write->path, sizeof(write->path), "%s", file);
+			snprintf(write->previous, sizeof(write->previous), "%s", previous);
+		}
+	}
+
+	globfree(&glo);
+	return ok;
+}
+
+/**
+ * Apply a transaction of PATH VALUE pairs in order
+ *
+ * Every write is validated before any is applied. If one of them fails, the writes already
+ * applied are restored in reverse order.
+ */
+static int apply_transaction(int argc, const char *const *argv, FILE *report)
+{
+	if (argc % 2 != 0 || argc == 0) {
+		fprintf(report, "failed: expected PATH VALUE pairs\n");
+		return EXIT_FAILURE;
+	}
+
+	for (int i = 0; i < argc; i += 2) {
+		if (!path_allowed(argv[i]) || !value_allowed(argv[i + 1])) {
+			fprintf(report, "failed %s: not allowed to write '%s'\n", argv[i], argv[i + 1]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	size_t max_applied = HELPER_ARGS_MAX * 4;
+	struct HelperWrite *applied = calloc(max_applied, sizeof(struct HelperWrite));
+	size_t num_applied = 0;
+	if (!applied) {
+		fprintf(report, "failed: out of memory\n");
+		return EXIT_FAILURE;
+	}
+
+	int status = EXIT_SUCCESS;
+	for (int i = 0; i < argc; i += 2) {
+		if (!apply_write(argv[i], argv[i + 1], applied, &num_applied, max_applied, report)) {
+			status = EXIT_FAILURE;
+			break;
+		}
+	}
+
+	if (status != EXIT_SUCCESS) {
+		while (num_applied > 0) {
+			const struct HelperWrite *write = &applied[--num_applied];
+			if (write_value(write->path, write->previous))
+				fprintf(report, "restored %s\n", write->path);
+			else
+				fprintf(report, "not restored %s: %s\n", write->path, strerror(errno));
+		}
+	}
+
+	free(applied);
+	return status;
+}
+
+/**
+ * Run a transaction for the daemon, capturing the report for the reply
+ */
+static int run_transaction(int argc, const char *const *argv, char buffer[EXTERNAL_BUFFER_MAX])
+{
+	char *report = NULL;
+	size_t report_len = 0;
+	FILE *f = open_memstream(&report, &report_len);
+	if (!f) {
+		snprintf(buffer, EXTERNAL_BUFFER_MAX, "failed: %s", strerror(errno));
+		return -1;
+	}
+
+	int status = apply_transaction(argc, argv, f);
+	fclose(f);
+
+	snprintf(buffer, EXTERNAL_BUFFER_MAX, "%s", report);
+	free(report);
+	return status == EXIT_SUCCESS ? 0 : -1;
+}
+
+/**
+ * Run a single request and write "<status>\n<output>" to the reply fd
+ */
+static void run_request(char *request, size_t len, int reply)
+{
+	char path[PATH_MAX];
+	const char *args[HELPER_ARGS_MAX + 1] = { 0 };
+	char buffer[EXTERNAL_BUFFER_MAX] = { 0 };
+	size_t argc = 0;
+	size_t pos = 0;
+	int status = -1;
+
+	/* Arguments are sent as consecutive nul terminated strings */
+	if (len > 0 && request[len - 1] == '\0') {
+		for (; pos < len && argc < HELPER_ARGS_MAX; pos += strlen(request + pos) + 1)
+			args[argc++] = request + pos;
+	}
+
+	if (argc == 0 || pos != len) {
+		snprintf(buffer, sizeof(buffer), "rejected malformed request");
+	} else if (argc >= 2 && strcmp(args[0], "gamemodehelper") == 0 &&
+	           strcmp(args[1], "apply") == 0) {
+		/* Transactions are run here rather than by executing ourselves again */
+		status = run_transaction((int)argc - 2, args + 2, buffer);
+	} else if (!helper_allowed(args[0])) {
+		snprintf(buffer, sizeof(buffer), "rejected request for '%s'", args[0]);
+	} else {
+		snprintf(path, sizeof(path), "%s/%s", LIBEXECDIR, args[0]);
+		args[0] = path;
+		status = run_external_process(args, buffer, -1);
+	}
+
+	dprintf(reply, "%d\n%s", status, buffer);
+}
+
+/**
+ * Main entry point
+ *
+ * With "apply PATH VALUE..." a single transaction is applied and reported on stdout.
+ *
+ * Without arguments we serve requests from the daemon until it goes away. The daemon starts us
+ * once through pkexec with a SOCK_SEQPACKET socket as stdin. Each message holds one request and
+ * carries the fd to write its reply to. Requests are run in a child of their own so slow helpers
+ * like gpuclockctl don't hold up the others.
+ */
+int main(int argc, char *argv[])
+{
+	int type = 0;
+	socklen_t type_len = sizeof(type);
+	bool apply = argc >= 2 && strcmp(argv[1], "apply") == 0;
+
+	if (!apply && (argc != 1 ||
+	               getsockopt(STDIN_FILENO, SOL_SOCKET, SO_TYPE, &type, &type_len) != 0 ||
+	               type != SOCK_SEQPACKET)) {
+		fprintf(stderr, "usage: gamemodehelper [apply PATH VALUE [PATH VALUE]...]\n");
+		return EXIT_FAILURE;
+	}
+
+	/* Must be root to do anything useful */
+	if (geteuid() != 0) {
+		LOG_ERROR("This program must be run as root\n");
+		return EXIT_FAILURE;
+	}
+
+	uid_t uid;
+	if (caller_uid(apply, &uid))
+		snprintf(allowed_cgroups,
+		         sizeof(allowed_cgroups),
+		         "/sys/fs/cgroup/user.slice/user-%u.slice/*/cpuset.cpus",
+		         (unsigned int)uid);
+
+	if (apply)
+		return apply_transaction(argc - 2, (const char *const *)argv + 2, stdout);
+
+	/* Children are reaped automatically */
+	signal(SIGCHLD, SIG_IGN);
+
+	/* Let the daemon know we were authorised and are ready */
+	if (send(STDIN_FILENO, "ready", 5, MSG_NOSIGNAL) < 0)
+		return EXIT_FAILURE;
+
+	while (true) {
+		char request[HELPER_REQUEST_MAX];
+		char control[CMSG_SPACE(sizeof(int))];
+		struct iovec iov = { .iov_base = request, .iov_len = sizeof(request) };
+		struct msghdr msg = {
+			.msg_iov = &iov,
+			.msg_iovlen = 1,
+			.msg_control = control,
+			.msg_controllen = sizeof(control),
+		};
+
+		ssize_t len = recvmsg(STDIN_FILENO, &msg, MSG_CMSG_CLOEXEC);
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len <= 0)
+			break;
+
+		struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+		if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ||
+		    (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC))) {
+			LOG_ERROR("Dropping malformed request\n");
+			if (cmsg && cmsg->cmsg_type == SCM_RIGHTS) {
+				int stray;
+				memcpy(&stray, CMSG_DATA(cmsg), sizeof(stray));
+				close(stray);
+			}
+			continue;
+		}
+
+		int reply;
+		memcpy(&reply, CMSG_DATA(cmsg), sizeof(reply));
+
+		pid_t pid = fork();
+		if (pid == 0) {
+			/* Keep the request socket from the helpers we run */
+			int null = open("/dev/null", O_RDONLY | O_CLOEXEC);
+			if (null < 0 || dup2(null, STDIN_FILENO) < 0)
+				close(STDIN_FILENO);
+			signal(SIGCHLD, SIG_DFL);
+			run_request(request, (size_t)len, reply);
+			_exit(EXIT_SUCCESS);
+		} else if (pid < 0) {
+			dprintf(reply, "-1\nfork failed: %s", strerror(errno));
+		}
+		close(reply);
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -64,7 +64,8 @@ static int set_profile_state(const char *value)
 int main(int argc, char *argv[])
 {
 	if (argc == 2 && strncmp(argv[1], "get", 3) == 0) {
-		printf("%s", get_profile_state());
+		char profile[MAX_PROFILE_LENGTH];
+		printf("%s", get_profile_state(profile));
 	} else if (argc == 3 && strncmp(argv[1], "set", 3) == 0) {
 		const char *value = argv[2];
 